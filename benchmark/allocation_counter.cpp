@@ -0,0 +1,96 @@
+#include "allocation_counter.h"
+
+#include <atomic>
+#include <new>
+
+static std::atomic<uint64_t> allocation_count{0};
+static std::atomic<uint64_t> lua_allocation_count{0};
+
+//------------------------------------------------------------------------------
+// allocate
+//------------------------------------------------------------------------------
+static void* allocate(size_t size) {
+  allocation_count.fetch_add(1, std::memory_order_relaxed);
+  auto result = std::malloc(size == 0 ? 1 : size);
+  if (result == nullptr) {
+    throw std::bad_alloc{};
+  }
+  return result;
+}
+
+//------------------------------------------------------------------------------
+// operator new
+//------------------------------------------------------------------------------
+void* operator new(size_t size) { return allocate(size); }
+
+void* operator new[](size_t size) { return allocate(size); }
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept {
+  try {
+    return allocate(size);
+  } catch (const std::bad_alloc&) {
+    return nullptr;
+  }
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) noexcept {
+  try {
+    return allocate(size);
+  } catch (const std::bad_alloc&) {
+    return nullptr;
+  }
+}
+
+//------------------------------------------------------------------------------
+// operator delete
+//------------------------------------------------------------------------------
+void operator delete(void* ptr) noexcept { std::free(ptr); }
+
+void operator delete[](void* ptr) noexcept { std::free(ptr); }
+
+void operator delete(void* ptr, const std::nothrow_t&) noexcept {
+  std::free(ptr);
+}
+
+void operator delete[](void* ptr, const std::nothrow_t&) noexcept {
+  std::free(ptr);
+}
+
+#if __cpp_sized_deallocation
+void operator delete(void* ptr, size_t) noexcept { std::free(ptr); }
+
+void operator delete[](void* ptr, size_t) noexcept { std::free(ptr); }
+#endif
+
+namespace lua_bridge_tracer {
+//------------------------------------------------------------------------------
+// num_allocations
+//------------------------------------------------------------------------------
+uint64_t num_allocations() noexcept {
+  return allocation_count.load(std::memory_order_relaxed);
+}
+
+//------------------------------------------------------------------------------
+// num_lua_allocations
+//------------------------------------------------------------------------------
+uint64_t num_lua_allocations() noexcept {
+  return lua_allocation_count.load(std::memory_order_relaxed);
+}
+
+//------------------------------------------------------------------------------
+// lua_allocate
+//------------------------------------------------------------------------------
+void* lua_allocate(void* /*user_data*/, void* ptr, size_t old_size,
+                   size_t new_size) noexcept {
+  if (new_size == 0) {
+    std::free(ptr);
+    return nullptr;
+  }
+  // Lua passes a type tag rather than a size for new blocks in 5.2+, so
+  // count any call that isn't a shrink or free of an existing block.
+  if (ptr == nullptr || new_size > old_size) {
+    lua_allocation_count.fetch_add(1, std::memory_order_relaxed);
+  }
+  return std::realloc(ptr, new_size);
+}
+}  // namespace lua_bridge_tracer
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdlib>
+
+// Replaces the global operator new and delete with versions that count calls,
+// and provides a lua_Alloc that does the same for the Lua heap.
+namespace lua_bridge_tracer {
+// The number of calls to operator new made so far by any thread.
+uint64_t num_allocations() noexcept;
+
+// The number of allocations made so far through `lua_allocate`.
+uint64_t num_lua_allocations() noexcept;
+
+// A lua_Alloc that counts allocations.
+void* lua_allocate(void* user_data, void* ptr, size_t old_size,
+                   size_t new_size) noexcept;
+}  // namespace lua_bridge_tracer
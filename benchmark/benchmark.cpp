@@ -0,0 +1,287 @@
+// Measures the cost of the bridge's Lua API.
+//
+// Usage: bridge_benchmark [iterations]
+//
+// Each case is run against the C++ global tracer, which is a no-op tracer, so
+// that the bridge's own overhead can be seen, against the module's native
+// tracer with no sinks, and also against the mocktracer if the MOCKTRACER
+// environmental variable points at its plugin.
+#include "allocation_counter.h"
+#include "lua_harness.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <string>
+
+namespace {
+struct BenchmarkCase {
+  const char* name;
+
+  // The body of a function called with the tracer and iteration count, which
+  // should perform the operation `n` times.
+  const char* source;
+};
+}  // namespace
+
+static const BenchmarkCase benchmark_cases[] = {
+    {"start_span+finish", R"(
+      for i = 1, n do
+        tracer:start_span("abc"):finish()
+      end)"},
+    {"start_span(tags)+finish", R"(
+      local options = {["tags"] = {["component"] = "lua", ["i"] = 123}}
+      for i = 1, n do
+        tracer:start_span("abc", options):finish()
+      end)"},
+    // Compare to find the savings of a tag template over building the tags of
+    // each span in Lua.
+    {"start_span(request tags)+finish", R"(
+      for i = 1, n do
+        tracer:start_span("abc", {["tags"] = {["component"] = "lua",
+                                              ["http.method"] = "GET",
+                                              ["http.url"] = "/abc",
+                                              ["http.status_code"] = 200}})
+            :finish()
+      end)"},
+    {"start_span+set_tags_with+finish", R"(
+      local template = tracer:tag_template({"http.method", "http.url",
+                                            "http.status_code",
+                                            ["component"] = "lua"})
+      for i = 1, n do
+        local span = tracer:start_span("abc")
+        span:set_tags_with(template, "GET", "/abc", 200)
+        span:finish()
+      end)"},
+    {"start_span(child_of)+finish", R"(
+      local parent = tracer:start_span("parent")
+      local options = {["references"] = {{"child_of", parent:context()}}}
+      for i = 1, n do
+        tracer:start_span("abc", options):finish()
+      end
+      parent:finish())"},
+    // Counts each span of the batch as an iteration.
+    {"start_spans(child_of)+finish_spans", R"(
+      local parent = tracer:start_span("parent")
+      local options = {["references"] = {{"child_of", parent:context()}},
+                       ["tags"] = {["component"] = "lua"}}
+      local names = {}
+      for i = 1, 10 do
+        names[i] = "abc"
+      end
+      for i = 1, n, 10 do
+        tracer:finish_spans(tracer:start_spans(names, options))
+      end
+      parent:finish())"},
+    // Compare to find the profiler's overhead on Lua-bound code.
+    {"start_span+work+finish", R"(
+      for i = 1, n do
+        local span = tracer:start_span("abc")
+        local x = 0
+        for j = 1, 1000 do
+          x = x + j % 7
+        end
+        span:finish()
+      end)"},
+    {"start_span+work+finish(prof)", R"(
+      tracer:set_profiling(true)
+      for i = 1, n do
+        local span = tracer:start_span("abc")
+        local x = 0
+        for j = 1, 1000 do
+          x = x + j % 7
+        end
+        span:finish()
+      end
+      tracer:set_profiling(false))"},
+    {"set_tag(string)", R"(
+      local span = tracer:start_span("abc")
+      for i = 1, n do
+        span:set_tag("key", "value")
+      end
+      span:finish())"},
+    {"set_tag(number)", R"(
+      local span = tracer:start_span("abc")
+      for i = 1, n do
+        span:set_tag("key", 123)
+      end
+      span:finish())"},
+    {"set_tag_int", R"(
+      local span = tracer:start_span("abc")
+      for i = 1, n do
+        span:set_tag_int("key", 123)
+      end
+      span:finish())"},
+    {"set_tag(boolean)", R"(
+      local span = tracer:start_span("abc")
+      for i = 1, n do
+        span:set_tag("key", true)
+      end
+      span:finish())"},
+    {"set_tag(table)", R"(
+      local span = tracer:start_span("abc")
+      local value = {["x"] = 1, ["y"] = {1, 2, 3}}
+      for i = 1, n do
+        span:set_tag("key", value)
+      end
+      span:finish())"},
+    {"log_kv", R"(
+      local span = tracer:start_span("abc")
+      local fields = {["event"] = "cache miss", ["key"] = "abc"}
+      for i = 1, n do
+        span:log_kv(fields)
+        if i % 50 == 0 then
+          span:finish()
+          span = tracer:start_span("abc")
+        end
+      end
+      span:finish())"},
+    {"text_map_inject", R"(
+      local span = tracer:start_span("abc")
+      local context = span:context()
+      for i = 1, n do
+        tracer:text_map_inject(context, {})
+      end
+      span:finish())"},
+    {"text_map_extract", R"(
+      local span = tracer:start_span("abc")
+      local carrier = {}
+      tracer:text_map_inject(span:context(), carrier)
+      for i = 1, n do
+        tracer:text_map_extract(carrier)
+      end
+      span:finish())"},
+    // Counts each carrier of the batch as an iteration.
+    {"text_map_extract_many", R"(
+      local span = tracer:start_span("abc")
+      local carrier = {}
+      tracer:text_map_inject(span:context(), carrier)
+      local carriers = {}
+      for i = 1, 100 do
+        carriers[i] = carrier
+      end
+      for i = 1, n, 100 do
+        tracer:text_map_extract_many(carriers)
+      end
+      span:finish())"},
+    {"http_headers_inject", R"(
+      local span = tracer:start_span("abc")
+      local context = span:context()
+      for i = 1, n do
+        tracer:http_headers_inject(context, {})
+      end
+      span:finish())"},
+    {"http_headers_extract", R"(
+      local span = tracer:start_span("abc")
+      local carrier = {}
+      tracer:http_headers_inject(span:context(), carrier)
+      for i = 1, n do
+        tracer:http_headers_extract(carrier)
+      end
+      span:finish())"},
+    {"binary_inject", R"(
+      local span = tracer:start_span("abc")
+      local context = span:context()
+      for i = 1, n do
+        tracer:binary_inject(context)
+      end
+      span:finish())"},
+    {"binary_extract", R"(
+      local span = tracer:start_span("abc")
+      local carrier = tracer:binary_inject(span:context())
+      for i = 1, n do
+        tracer:binary_extract(carrier)
+      end
+      span:finish())"},
+};
+
+//------------------------------------------------------------------------------
+// run_benchmark_case
+//------------------------------------------------------------------------------
+static void run_benchmark_case(lua_bridge_tracer::LuaHarness& harness,
+                               const char* tracer_name,
+                               const BenchmarkCase& benchmark_case,
+                               int num_iterations) {
+  auto L = harness.state();
+  harness.load(std::string{"local tracer, n = ...\n"} + benchmark_case.source);
+  auto function_index = lua_gettop(L);
+
+  // warm up
+  lua_pushvalue(L, function_index);
+  lua_pushvalue(L, function_index - 1);
+  lua_pushinteger(L, num_iterations / 10 + 1);
+  harness.call(2, 0);
+  lua_gc(L, LUA_GCCOLLECT, 0);
+
+  lua_pushvalue(L, function_index);
+  lua_pushvalue(L, function_index - 1);
+  lua_pushinteger(L, num_iterations);
+  auto num_allocations = lua_bridge_tracer::num_allocations();
+  auto num_lua_allocations = lua_bridge_tracer::num_lua_allocations();
+  auto start = std::chrono::steady_clock::now();
+  harness.call(2, 0);
+  auto finish = std::chrono::steady_clock::now();
+  num_allocations = lua_bridge_tracer::num_allocations() - num_allocations;
+  num_lua_allocations =
+      lua_bridge_tracer::num_lua_allocations() - num_lua_allocations;
+  lua_pop(L, 1);
+  lua_gc(L, LUA_GCCOLLECT, 0);
+
+  auto elapsed =
+      std::chrono::duration_cast<std::chrono::nanoseconds>(finish - start);
+  std::printf("%-28s %-10s %10.1f ns/op %8.2f allocs/op", benchmark_case.name,
+              tracer_name,
+              static_cast<double>(elapsed.count()) / num_iterations,
+              static_cast<double>(num_allocations) / num_iterations);
+  if (harness.counts_lua_allocations()) {
+    std::printf(" %8.2f lua allocs/op",
+                static_cast<double>(num_lua_allocations) / num_iterations);
+  }
+  std::printf("\n");
+}
+
+//------------------------------------------------------------------------------
+// run_benchmarks
+//------------------------------------------------------------------------------
+// Runs each case against the tracer named by `tracer_name`, or the given
+// plugin if `library` isn't null.
+static void run_benchmarks(const char* tracer_name, const char* library,
+                           int num_iterations) {
+  for (auto& benchmark_case : benchmark_cases) {
+    // Use a new lua_State for each case so that earlier cases don't leave
+    // garbage behind.
+    lua_bridge_tracer::LuaHarness harness;
+    if (library == nullptr && std::strcmp(tracer_name, "native") == 0) {
+      harness.push_native_tracer();
+    } else if (library == nullptr) {
+      harness.push_tracer();
+    } else {
+      harness.push_tracer(library, R"({ "output_file":"/dev/null" })");
+    }
+    run_benchmark_case(harness, tracer_name, benchmark_case, num_iterations);
+  }
+}
+
+int main(int argc, char* argv[]) try {
+  int num_iterations = 100000;
+  if (argc > 1) {
+    num_iterations = std::atoi(argv[1]);
+  }
+  if (num_iterations <= 0) {
+    std::fprintf(stderr, "Usage: %s [iterations]\n", argv[0]);
+    return 1;
+  }
+
+  run_benchmarks("noop", nullptr, num_iterations);
+  run_benchmarks("native", nullptr, num_iterations);
+  auto mocktracer = std::getenv("MOCKTRACER");
+  if (mocktracer != nullptr) {
+    run_benchmarks("mocktracer", mocktracer, num_iterations);
+  }
+  return 0;
+} catch (const std::exception& e) {
+  std::fprintf(stderr, "Error: %s\n", e.what());
+  return 1;
+}
@@ -0,0 +1,238 @@
+#include "json.h"
+
+#include <cstdlib>
+#include <stdexcept>
+
+namespace lua_bridge_tracer {
+//------------------------------------------------------------------------------
+// find
+//------------------------------------------------------------------------------
+const JsonValue* JsonValue::find(const std::string& key) const noexcept {
+  for (auto& member : object) {
+    if (member.first == key) {
+      return &member.second;
+    }
+  }
+  return nullptr;
+}
+
+//------------------------------------------------------------------------------
+// JsonParser
+//------------------------------------------------------------------------------
+namespace {
+class JsonParser {
+ public:
+  explicit JsonParser(const std::string& text) : text_{text} {}
+
+  JsonValue parse() {
+    auto result = parse_value();
+    skip_whitespace();
+    if (position_ != text_.size()) {
+      fail("unexpected trailing characters");
+    }
+    return result;
+  }
+
+ private:
+  const std::string& text_;
+  size_t position_ = 0;
+
+  [[noreturn]] void fail(const std::string& message) const {
+    throw std::runtime_error{"invalid JSON at offset " +
+                             std::to_string(position_) + ": " + message};
+  }
+
+  void skip_whitespace() noexcept {
+    while (position_ < text_.size() &&
+           (text_[position_] == ' ' || text_[position_] == '\t' ||
+            text_[position_] == '\n' || text_[position_] == '\r')) {
+      ++position_;
+    }
+  }
+
+  char peek() {
+    skip_whitespace();
+    if (position_ == text_.size()) {
+      fail("unexpected end of input");
+    }
+    return text_[position_];
+  }
+
+  void expect(char c) {
+    if (peek() != c) {
+      fail(std::string{"expected '"} + c + "'");
+    }
+    ++position_;
+  }
+
+  void expect_literal(const char* literal) {
+    for (auto c = literal; *c != '\0'; ++c) {
+      if (position_ == text_.size() || text_[position_] != *c) {
+        fail(std::string{"expected "} + literal);
+      }
+      ++position_;
+    }
+  }
+
+  JsonValue parse_value() {
+    JsonValue result;
+    switch (peek()) {
+      case '{':
+        result.type = JsonValue::Type::Object;
+        parse_object(result);
+        break;
+      case '[':
+        result.type = JsonValue::Type::Array;
+        parse_array(result);
+        break;
+      case '"':
+        result.type = JsonValue::Type::String;
+        result.text = parse_string();
+        break;
+      case 't':
+        result.type = JsonValue::Type::Boolean;
+        result.boolean = true;
+        expect_literal("true");
+        break;
+      case 'f':
+        result.type = JsonValue::Type::Boolean;
+        expect_literal("false");
+        break;
+      case 'n':
+        expect_literal("null");
+        break;
+      default:
+        result.type = JsonValue::Type::Number;
+        parse_number(result);
+        break;
+    }
+    return result;
+  }
+
+  void parse_object(JsonValue& result) {
+    expect('{');
+    if (peek() == '}') {
+      ++position_;
+      return;
+    }
+    while (true) {
+      if (peek() != '"') {
+        fail("expected a string key");
+      }
+      auto key = parse_string();
+      expect(':');
+      result.object.emplace_back(std::move(key), parse_value());
+      if (peek() == ',') {
+        ++position_;
+        continue;
+      }
+      expect('}');
+      return;
+    }
+  }
+
+  void parse_array(JsonValue& result) {
+    expect('[');
+    if (peek() == ']') {
+      ++position_;
+      return;
+    }
+    while (true) {
+      result.array.push_back(parse_value());
+      if (peek() == ',') {
+        ++position_;
+        continue;
+      }
+      expect(']');
+      return;
+    }
+  }
+
+  void parse_number(JsonValue& result) {
+    auto start = position_;
+    while (position_ < text_.size() &&
+           std::string{"+-0123456789.eE"}.find(text_[position_]) !=
+               std::string::npos) {
+      ++position_;
+    }
+    if (start == position_) {
+      fail("unexpected character");
+    }
+    result.text = text_.substr(start, position_ - start);
+    result.number = std::strtod(result.text.c_str(), nullptr);
+  }
+
+  std::string parse_string() {
+    expect('"');
+    std::string result;
+    while (true) {
+      if (position_ == text_.size()) {
+        fail("unterminated string");
+      }
+      auto c = text_[position_++];
+      if (c == '"') {
+        return result;
+      }
+      if (c != '\\') {
+        result.push_back(c);
+        continue;
+      }
+      if (position_ == text_.size()) {
+        fail("unterminated string");
+      }
+      c = text_[position_++];
+      switch (c) {
+        case 'b':
+          result.push_back('\b');
+          break;
+        case 'f':
+          result.push_back('\f');
+          break;
+        case 'n':
+          result.push_back('\n');
+          break;
+        case 'r':
+          result.push_back('\r');
+          break;
+        case 't':
+          result.push_back('\t');
+          break;
+        case 'u':
+          append_code_point(result);
+          break;
+        default:
+          result.push_back(c);
+          break;
+      }
+    }
+  }
+
+  // Decodes a \uXXXX escape (without surrogate pairs) as UTF-8.
+  void append_code_point(std::string& result) {
+    if (position_ + 4 > text_.size()) {
+      fail("truncated unicode escape");
+    }
+    auto code_point = static_cast<unsigned>(
+        std::strtoul(text_.substr(position_, 4).c_str(), nullptr, 16));
+    position_ += 4;
+    if (code_point < 0x80) {
+      result.push_back(static_cast<char>(code_point));
+    } else if (code_point < 0x800) {
+      result.push_back(static_cast<char>(0xC0 | (code_point >> 6)));
+      result.push_back(static_cast<char>(0x80 | (code_point & 0x3F)));
+    } else {
+      result.push_back(static_cast<char>(0xE0 | (code_point >> 12)));
+      result.push_back(static_cast<char>(0x80 | ((code_point >> 6) & 0x3F)));
+      result.push_back(static_cast<char>(0x80 | (code_point & 0x3F)));
+    }
+  }
+};
+}  // namespace
+
+//------------------------------------------------------------------------------
+// parse_json
+//------------------------------------------------------------------------------
+JsonValue parse_json(const std::string& text) {
+  return JsonParser{text}.parse();
+}
+}  // namespace lua_bridge_tracer
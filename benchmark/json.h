@@ -0,0 +1,29 @@
+#pragma once
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace lua_bridge_tracer {
+// A minimal JSON document model, sufficient for reading recorded workloads.
+struct JsonValue {
+  enum class Type { Null, Boolean, Number, String, Array, Object };
+
+  Type type = Type::Null;
+  bool boolean = false;
+  double number = 0;
+
+  // For strings, the string; for numbers, the number as written.
+  std::string text;
+
+  std::vector<JsonValue> array;
+  std::vector<std::pair<std::string, JsonValue>> object;
+
+  // Returns the member named `key`, or nullptr if there isn't one.
+  const JsonValue* find(const std::string& key) const noexcept;
+};
+
+// Parses a JSON document, throwing std::runtime_error if it's malformed.
+JsonValue parse_json(const std::string& text);
+}  // namespace lua_bridge_tracer
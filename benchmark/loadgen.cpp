@@ -0,0 +1,511 @@
+// Replays a recorded workload through the bridge's Lua API.
+//
+// Usage: bridge_loadgen [options] <workload.json>
+//
+//   --plugin <path>         load the tracer from this plugin instead of using
+//                           the C++ global tracer
+//   --config <json|@file>   the plugin's configuration
+//   --rate <traces/s>       replay traces at this rate instead of as fast as
+//                           possible
+//   --repeat <n>            replay the workload n times
+//   --propagation <format>  pass parent contexts to children by injecting
+//                           them into and extracting them from a carrier;
+//                           one of text_map, http_headers, or binary
+//
+// The workload is the JSON written by the mocktracer: each trace is replayed
+// with the same span tree, tags, and logs, starting and finishing spans in the
+// order they were recorded. To test a plugin against a collector, point its
+// configuration at a local stand-in for the collector.
+//
+// Throughput and RSS are reported every second, then latency percentiles for
+// each API call. Latencies are measured around lua_pcall, so include its
+// overhead, and are counted in fixed buckets so that a long run's memory
+// doesn't grow with it; percentiles are within 1/64 of the true value.
+#include "lua_harness.h"
+#include "workload.h"
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <exception>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+using lua_bridge_tracer::JsonValue;
+using lua_bridge_tracer::LuaHarness;
+using lua_bridge_tracer::WorkloadFields;
+using lua_bridge_tracer::WorkloadTrace;
+
+namespace {
+struct LoadgenOptions {
+  std::string workload;
+  std::string plugin;
+  std::string config = "{}";
+  double rate = 0;
+  int repeat = 1;
+  std::string propagation;
+};
+
+// A histogram of the latencies of each call to one of the bridge's methods.
+// Values below 128ns get a bucket each; above that, each power of two is split
+// into 64 buckets, so a bucket spans less than 1/64 of its values.
+class Latencies {
+ public:
+  Latencies() : counts_(num_buckets, 0) {}
+
+  void add(uint64_t value) noexcept {
+    ++counts_[bucket_index(value)];
+    ++count_;
+    max_ = std::max(max_, value);
+  }
+
+  uint64_t count() const noexcept { return count_; }
+
+  uint64_t max() const noexcept { return max_; }
+
+  // Returns the upper bound of the bucket holding the value at quantile `p`,
+  // capped at the largest value seen.
+  uint64_t percentile(double p) const noexcept {
+    auto rank = static_cast<uint64_t>(p * static_cast<double>(count_ - 1));
+    uint64_t seen = 0;
+    for (size_t i = 0; i < counts_.size(); ++i) {
+      seen += counts_[i];
+      if (seen > rank) {
+        return std::min(bucket_upper_bound(i), max_);
+      }
+    }
+    return max_;
+  }
+
+ private:
+  static const int sub_bucket_bits = 6;
+  static const uint64_t num_linear = uint64_t{2} << sub_bucket_bits;
+  static const size_t num_buckets =
+      num_linear + (64 - sub_bucket_bits - 1) * (num_linear / 2);
+
+  std::vector<uint64_t> counts_;
+  uint64_t count_ = 0;
+  uint64_t max_ = 0;
+
+  static size_t bucket_index(uint64_t value) noexcept {
+    if (value < num_linear) {
+      return static_cast<size_t>(value);
+    }
+    int shift = 0;
+    while ((value >> shift) >= num_linear) {
+      ++shift;
+    }
+    return static_cast<size_t>(num_linear + (shift - 1) * (num_linear / 2) +
+                               ((value >> shift) - num_linear / 2));
+  }
+
+  static uint64_t bucket_upper_bound(size_t index) noexcept {
+    if (index < num_linear) {
+      return index;
+    }
+    auto shift = (index - num_linear) / (num_linear / 2) + 1;
+    auto sub_bucket = (index - num_linear) % (num_linear / 2) + num_linear / 2;
+    return ((sub_bucket + 1) << shift) - 1;
+  }
+};
+
+class Replayer {
+ public:
+  Replayer(LuaHarness& harness, const std::string& propagation)
+      : harness_{harness}, propagation_{propagation} {
+    auto L = harness_.state();
+    tracer_index_ = lua_gettop(L);
+    lua_newtable(L);
+    spans_index_ = lua_gettop(L);
+  }
+
+  void replay(const WorkloadTrace& trace);
+
+  // Closes the tracer so that a plugin can flush what it's buffered.
+  void close();
+
+  size_t num_spans() const noexcept { return num_spans_; }
+
+  const std::map<std::string, Latencies>& latencies() const noexcept {
+    return latencies_;
+  }
+
+ private:
+  LuaHarness& harness_;
+  std::string propagation_;
+  int tracer_index_;
+  int spans_index_;
+  size_t num_spans_ = 0;
+  std::map<std::string, Latencies> latencies_;
+
+  // Calls `method` on the object at the top of the stack with the
+  // `num_arguments` arguments pushed after it, recording how long it took.
+  void call_method(const char* method, int num_arguments, int num_results);
+
+  void push_context(int span);
+
+  void start_span(const WorkloadTrace& trace, int span);
+
+  void finish_span(int span);
+};
+}  // namespace
+
+//------------------------------------------------------------------------------
+// push_json
+//------------------------------------------------------------------------------
+static void push_json(lua_State* L, const JsonValue& value) {
+  switch (value.type) {
+    case JsonValue::Type::Null:
+      lua_pushnil(L);
+      break;
+    case JsonValue::Type::Boolean:
+      lua_pushboolean(L, value.boolean);
+      break;
+    case JsonValue::Type::Number:
+      lua_pushnumber(L, static_cast<lua_Number>(value.number));
+      break;
+    case JsonValue::Type::String:
+      lua_pushlstring(L, value.text.data(), value.text.size());
+      break;
+    case JsonValue::Type::Array:
+      luaL_checkstack(L, 2, "workload value is too deeply nested");
+      lua_createtable(L, static_cast<int>(value.array.size()), 0);
+      for (size_t i = 0; i < value.array.size(); ++i) {
+        push_json(L, value.array[i]);
+        lua_rawseti(L, -2, static_cast<int>(i + 1));
+      }
+      break;
+    case JsonValue::Type::Object:
+      luaL_checkstack(L, 2, "workload value is too deeply nested");
+      lua_createtable(L, 0, static_cast<int>(value.object.size()));
+      for (auto& member : value.object) {
+        push_json(L, member.second);
+        lua_setfield(L, -2, member.first.c_str());
+      }
+      break;
+  }
+}
+
+//------------------------------------------------------------------------------
+// push_fields
+//------------------------------------------------------------------------------
+static void push_fields(lua_State* L, const WorkloadFields& fields) {
+  lua_createtable(L, 0, static_cast<int>(fields.size()));
+  for (auto& field : fields) {
+    push_json(L, field.second);
+    lua_setfield(L, -2, field.first.c_str());
+  }
+}
+
+//------------------------------------------------------------------------------
+// call_method
+//------------------------------------------------------------------------------
+void Replayer::call_method(const char* method, int num_arguments,
+                           int num_results) {
+  auto L = harness_.state();
+  auto self_index = lua_gettop(L) - num_arguments;
+  lua_getfield(L, self_index, method);
+  lua_insert(L, self_index);
+  auto start = std::chrono::steady_clock::now();
+  harness_.call(num_arguments + 1, num_results);
+  auto finish = std::chrono::steady_clock::now();
+  latencies_[method].add(static_cast<uint64_t>(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(finish - start)
+          .count()));
+}
+
+//------------------------------------------------------------------------------
+// push_context
+//------------------------------------------------------------------------------
+// Pushes the context of `span`, passing it through a carrier if propagation is
+// enabled.
+void Replayer::push_context(int span) {
+  auto L = harness_.state();
+  lua_rawgeti(L, spans_index_, span + 1);
+  call_method("context", 0, 1);
+  if (propagation_.empty()) {
+    return;
+  }
+  auto inject = propagation_ + "_inject";
+  auto extract = propagation_ + "_extract";
+  lua_pushvalue(L, tracer_index_);
+  lua_insert(L, -2);
+  if (propagation_ == "binary") {
+    call_method(inject.c_str(), 1, 1);
+  } else {
+    lua_newtable(L);
+    lua_pushvalue(L, -1);
+    lua_insert(L, -4);
+    call_method(inject.c_str(), 2, 0);
+  }
+  lua_pushvalue(L, tracer_index_);
+  lua_insert(L, -2);
+  call_method(extract.c_str(), 1, 1);
+}
+
+//------------------------------------------------------------------------------
+// start_span
+//------------------------------------------------------------------------------
+void Replayer::start_span(const WorkloadTrace& trace, int span) {
+  auto L = harness_.state();
+  auto& workload_span = trace.spans[span];
+  lua_pushvalue(L, tracer_index_);
+  lua_pushlstring(L, workload_span.operation_name.data(),
+                  workload_span.operation_name.size());
+  if (workload_span.parent < 0) {
+    call_method("start_span", 1, 1);
+  } else {
+    // {["references"] = {{<reference type>, <parent context>}}}
+    lua_createtable(L, 0, 1);
+    lua_createtable(L, 1, 0);
+    lua_createtable(L, 2, 0);
+    lua_pushstring(L,
+                   workload_span.follows_from ? "follows_from" : "child_of");
+    lua_rawseti(L, -2, 1);
+    push_context(workload_span.parent);
+    lua_rawseti(L, -2, 2);
+    lua_rawseti(L, -2, 1);
+    lua_setfield(L, -2, "references");
+    call_method("start_span", 2, 1);
+  }
+
+  for (auto& tag : workload_span.tags) {
+    if (tag.second.type == JsonValue::Type::Null) {
+      continue;
+    }
+    lua_pushvalue(L, -1);
+    lua_pushlstring(L, tag.first.data(), tag.first.size());
+    push_json(L, tag.second);
+    call_method("set_tag", 2, 0);
+  }
+  for (auto& log : workload_span.logs) {
+    lua_pushvalue(L, -1);
+    push_fields(L, log);
+    call_method("log_kv", 1, 0);
+  }
+  lua_rawseti(L, spans_index_, span + 1);
+}
+
+//------------------------------------------------------------------------------
+// finish_span
+//------------------------------------------------------------------------------
+void Replayer::finish_span(int span) {
+  auto L = harness_.state();
+  lua_rawgeti(L, spans_index_, span + 1);
+  call_method("finish", 0, 0);
+  ++num_spans_;
+}
+
+//------------------------------------------------------------------------------
+// replay
+//------------------------------------------------------------------------------
+void Replayer::replay(const WorkloadTrace& trace) {
+  auto L = harness_.state();
+  for (auto& event : trace.events) {
+    if (event.finish) {
+      finish_span(event.span);
+    } else {
+      start_span(trace, event.span);
+    }
+  }
+
+  // Release the trace's spans so that they can be collected.
+  for (size_t i = 0; i < trace.spans.size(); ++i) {
+    lua_pushnil(L);
+    lua_rawseti(L, spans_index_, static_cast<int>(i + 1));
+  }
+}
+
+//------------------------------------------------------------------------------
+// close
+//------------------------------------------------------------------------------
+void Replayer::close() {
+  lua_pushvalue(harness_.state(), tracer_index_);
+  call_method("close", 0, 0);
+}
+
+//------------------------------------------------------------------------------
+// get_rss
+//------------------------------------------------------------------------------
+// Returns the resident set size in bytes, or 0 if it can't be read.
+static size_t get_rss() {
+  std::ifstream statm{"/proc/self/statm"};
+  size_t num_pages = 0;
+  size_t num_resident_pages = 0;
+  if (!(statm >> num_pages >> num_resident_pages)) {
+    return 0;
+  }
+  return num_resident_pages * static_cast<size_t>(sysconf(_SC_PAGESIZE));
+}
+
+//------------------------------------------------------------------------------
+// print_latencies
+//------------------------------------------------------------------------------
+static void print_latencies(const std::map<std::string, Latencies>& latencies) {
+  std::printf("%-22s %10s %10s %10s %10s %10s %10s\n", "call", "count",
+              "p50 us", "p90 us", "p99 us", "p99.9 us", "max us");
+  for (auto& method : latencies) {
+    auto& values = method.second;
+    if (values.count() == 0) {
+      continue;
+    }
+    auto percentile = [&](double p) {
+      return static_cast<double>(values.percentile(p)) / 1000.0;
+    };
+    std::printf("%-22s %10llu %10.2f %10.2f %10.2f %10.2f %10.2f\n",
+                method.first.c_str(),
+                static_cast<unsigned long long>(values.count()),
+                percentile(0.5), percentile(0.9), percentile(0.99),
+                percentile(0.999), static_cast<double>(values.max()) / 1000.0);
+  }
+}
+
+//------------------------------------------------------------------------------
+// run_loadgen
+//------------------------------------------------------------------------------
+static void run_loadgen(const LoadgenOptions& options) {
+  auto workload = lua_bridge_tracer::load_workload(options.workload);
+  std::printf("loaded %zu traces with %zu spans from %s\n",
+              workload.traces.size(), workload.num_spans,
+              options.workload.c_str());
+  if (workload.traces.empty()) {
+    return;
+  }
+
+  LuaHarness harness;
+  if (options.plugin.empty()) {
+    harness.push_tracer();
+  } else {
+    harness.push_tracer(options.plugin, options.config);
+  }
+  Replayer replayer{harness, options.propagation};
+
+  std::chrono::steady_clock::duration trace_interval{};
+  if (options.rate > 0) {
+    trace_interval = std::chrono::duration_cast<
+        std::chrono::steady_clock::duration>(
+        std::chrono::duration<double>{1.0 / options.rate});
+  }
+
+  std::printf("%8s %12s %12s %10s\n", "time s", "spans", "spans/s", "rss MB");
+  auto start = std::chrono::steady_clock::now();
+  auto last_report = start;
+  size_t last_num_spans = 0;
+  auto report = [&](std::chrono::steady_clock::time_point now) {
+    auto elapsed = std::chrono::duration<double>{now - start}.count();
+    auto interval = std::chrono::duration<double>{now - last_report}.count();
+    auto num_spans = replayer.num_spans();
+    std::printf("%8.1f %12zu %12.0f %10.1f\n", elapsed, num_spans,
+                interval > 0 ? (num_spans - last_num_spans) / interval : 0.0,
+                static_cast<double>(get_rss()) / (1024.0 * 1024.0));
+    std::fflush(stdout);
+    last_report = now;
+    last_num_spans = num_spans;
+  };
+
+  size_t num_traces = 0;
+  for (int i = 0; i < options.repeat; ++i) {
+    for (auto& trace : workload.traces) {
+      if (options.rate > 0) {
+        std::this_thread::sleep_until(start + trace_interval * num_traces);
+      }
+      replayer.replay(trace);
+      ++num_traces;
+      auto now = std::chrono::steady_clock::now();
+      if (now - last_report >= std::chrono::seconds{1}) {
+        report(now);
+      }
+    }
+  }
+  auto finish = std::chrono::steady_clock::now();
+  report(finish);
+
+  auto elapsed = std::chrono::duration<double>{finish - start}.count();
+  std::printf("\nreplayed %zu traces with %zu spans in %.2f s (%.0f spans/s)\n",
+              num_traces, replayer.num_spans(), elapsed,
+              replayer.num_spans() / elapsed);
+  std::printf("\n");
+  print_latencies(replayer.latencies());
+
+  replayer.close();
+}
+
+//------------------------------------------------------------------------------
+// read_config
+//------------------------------------------------------------------------------
+static std::string read_config(const std::string& argument) {
+  if (argument.empty() || argument[0] != '@') {
+    return argument;
+  }
+  std::ifstream in{argument.substr(1)};
+  if (!in.good()) {
+    throw std::runtime_error{"failed to open " + argument.substr(1)};
+  }
+  std::ostringstream contents;
+  contents << in.rdbuf();
+  return contents.str();
+}
+
+//------------------------------------------------------------------------------
+// parse_options
+//------------------------------------------------------------------------------
+static bool parse_options(int argc, char* argv[], LoadgenOptions& options) {
+  for (int i = 1; i < argc; ++i) {
+    std::string argument = argv[i];
+    if (argument.compare(0, 2, "--") != 0) {
+      if (!options.workload.empty()) {
+        return false;
+      }
+      options.workload = argument;
+      continue;
+    }
+    if (i + 1 == argc) {
+      return false;
+    }
+    std::string value = argv[++i];
+    if (argument == "--plugin") {
+      options.plugin = value;
+    } else if (argument == "--config") {
+      options.config = read_config(value);
+    } else if (argument == "--rate") {
+      options.rate = std::atof(value.c_str());
+    } else if (argument == "--repeat") {
+      options.repeat = std::atoi(value.c_str());
+    } else if (argument == "--propagation") {
+      if (value != "text_map" && value != "http_headers" && value != "binary") {
+        return false;
+      }
+      options.propagation = value;
+    } else {
+      return false;
+    }
+  }
+  return !options.workload.empty() && options.rate >= 0 && options.repeat > 0;
+}
+
+int main(int argc, char* argv[]) try {
+  LoadgenOptions options;
+  if (!parse_options(argc, argv, options)) {
+    std::fprintf(stderr,
+                 "Usage: %s [--plugin <path>] [--config <json|@file>] "
+                 "[--rate <traces/s>] [--repeat <n>] "
+                 "[--propagation text_map|http_headers|binary] "
+                 "<workload.json>\n",
+                 argv[0]);
+    return 1;
+  }
+  run_loadgen(options);
+  return 0;
+} catch (const std::exception& e) {
+  std::fprintf(stderr, "Error: %s\n", e.what());
+  return 1;
+}
@@ -0,0 +1,92 @@
+#include "lua_harness.h"
+
+#include "allocation_counter.h"
+
+#include <stdexcept>
+
+extern "C" {
+#include <lualib.h>
+}  // extern "C"
+
+extern "C" int luaopen_opentracing_bridge_tracer(lua_State* L);
+
+namespace lua_bridge_tracer {
+//------------------------------------------------------------------------------
+// constructor
+//------------------------------------------------------------------------------
+LuaHarness::LuaHarness() {
+  lua_state_ = lua_newstate(lua_allocate, nullptr);
+  counts_lua_allocations_ = lua_state_ != nullptr;
+  if (lua_state_ == nullptr) {
+    lua_state_ = luaL_newstate();
+  }
+  if (lua_state_ == nullptr) {
+    throw std::runtime_error{"failed to create lua_State"};
+  }
+  luaL_openlibs(lua_state_);
+
+  // package.preload.opentracing_bridge_tracer = luaopen_opentracing_bridge_tracer
+  lua_getglobal(lua_state_, "package");
+  lua_getfield(lua_state_, -1, "preload");
+  lua_pushcfunction(lua_state_, luaopen_opentracing_bridge_tracer);
+  lua_setfield(lua_state_, -2, "opentracing_bridge_tracer");
+  lua_pop(lua_state_, 2);
+}
+
+//------------------------------------------------------------------------------
+// destructor
+//------------------------------------------------------------------------------
+LuaHarness::~LuaHarness() { lua_close(lua_state_); }
+
+//------------------------------------------------------------------------------
+// load
+//------------------------------------------------------------------------------
+void LuaHarness::load(const std::string& source) {
+  if (luaL_loadstring(lua_state_, source.c_str()) != 0) {
+    std::string error_message = lua_tostring(lua_state_, -1);
+    lua_pop(lua_state_, 1);
+    throw std::runtime_error{error_message};
+  }
+}
+
+//------------------------------------------------------------------------------
+// call
+//------------------------------------------------------------------------------
+void LuaHarness::call(int num_arguments, int num_results) {
+  if (lua_pcall(lua_state_, num_arguments, num_results, 0) != 0) {
+    std::string error_message = lua_tostring(lua_state_, -1);
+    lua_pop(lua_state_, 1);
+    throw std::runtime_error{error_message};
+  }
+}
+
+//------------------------------------------------------------------------------
+// push_tracer
+//------------------------------------------------------------------------------
+void LuaHarness::push_tracer() {
+  load(
+      "local bridge_tracer = require 'opentracing_bridge_tracer'\n"
+      "return bridge_tracer:new_from_global()");
+  call(0, 1);
+}
+
+void LuaHarness::push_tracer(const std::string& library,
+                             const std::string& config) {
+  load(
+      "local bridge_tracer = require 'opentracing_bridge_tracer'\n"
+      "return bridge_tracer:new(...)");
+  lua_pushlstring(lua_state_, library.data(), library.size());
+  lua_pushlstring(lua_state_, config.data(), config.size());
+  call(2, 1);
+}
+
+//------------------------------------------------------------------------------
+// push_native_tracer
+//------------------------------------------------------------------------------
+void LuaHarness::push_native_tracer() {
+  load(
+      "local bridge_tracer = require 'opentracing_bridge_tracer'\n"
+      "return bridge_tracer:new({})");
+  call(0, 1);
+}
+}  // namespace lua_bridge_tracer
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <string>
+
+extern "C" {
+#include <lauxlib.h>
+#include <lua.h>
+}  // extern "C"
+
+namespace lua_bridge_tracer {
+// Owns a lua_State with the standard libraries loaded and
+// opentracing_bridge_tracer available to `require`.
+class LuaHarness {
+ public:
+  LuaHarness();
+
+  LuaHarness(const LuaHarness&) = delete;
+  LuaHarness& operator=(const LuaHarness&) = delete;
+
+  ~LuaHarness();
+
+  lua_State* state() const noexcept { return lua_state_; }
+
+  // Whether Lua's allocations are counted. LuaJIT on 64-bit platforms doesn't
+  // support a custom allocator, so they aren't there.
+  bool counts_lua_allocations() const noexcept {
+    return counts_lua_allocations_;
+  }
+
+  // Compiles `source` and pushes the resulting function.
+  void load(const std::string& source);
+
+  // Calls the function below `num_arguments` arguments on the top of the
+  // stack, throwing if it errors.
+  void call(int num_arguments, int num_results);
+
+  // Pushes a tracer constructed from the C++ global tracer (a no-op tracer
+  // unless one's been installed), or from the given plugin and configuration.
+  void push_tracer();
+  void push_tracer(const std::string& library, const std::string& config);
+
+  // Pushes the module's native tracer, which discards spans.
+  void push_native_tracer();
+
+ private:
+  lua_State* lua_state_;
+  bool counts_lua_allocations_;
+};
+}  // namespace lua_bridge_tracer
@@ -0,0 +1,186 @@
+// Measures how span throughput scales with threads, each running its own
+// lua_State with a tracer obtained from the same C++ global tracer, as
+// embedders running a lua_State per core do.
+//
+// The global tracer is set to the module's native tracer with no sinks. The
+// C++ no-op tracer isn't used since its spans each take a reference to it,
+// which would make the threads contend.
+//
+// Usage: bridge_scaling_benchmark [spans per thread] [max threads]
+//
+// Throughput should grow close to linearly up to the number of cores; the
+// efficiency column is each thread's throughput relative to a lone thread's.
+//
+// This doesn't use LuaHarness, since counting allocations would itself make
+// the threads contend.
+#include "native_tracer.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <exception>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+extern "C" {
+#include <lauxlib.h>
+#include <lua.h>
+#include <lualib.h>
+}  // extern "C"
+
+extern "C" int luaopen_opentracing_bridge_tracer(lua_State* L);
+
+// Returns a function that starts and finishes `n` spans.
+static const char* const benchmark_source = R"(
+  local bridge_tracer = require 'opentracing_bridge_tracer'
+  local tracer = bridge_tracer:new_from_global()
+  return function(n)
+    local parent = tracer:start_span("parent")
+    local options = {["references"] = {{"child_of", parent:context()}}}
+    for i = 1, n do
+      local span = tracer:start_span("abc", options)
+      span:set_tag("component", "lua")
+      span:finish()
+    end
+    parent:finish()
+  end)";
+
+namespace {
+//------------------------------------------------------------------------------
+// Worker
+//------------------------------------------------------------------------------
+// Runs the benchmark in a lua_State of its own once every worker is ready.
+class Worker {
+ public:
+  Worker() = default;
+
+  Worker(const Worker&) = delete;
+  Worker& operator=(const Worker&) = delete;
+
+  void run(int num_spans, std::atomic<int>& num_ready,
+           const std::atomic<bool>& start) noexcept {
+    auto L = luaL_newstate();
+    if (L == nullptr) {
+      error_ = "failed to create lua_State";
+      ++num_ready;
+      return;
+    }
+    luaL_openlibs(L);
+    lua_getglobal(L, "package");
+    lua_getfield(L, -1, "preload");
+    lua_pushcfunction(L, luaopen_opentracing_bridge_tracer);
+    lua_setfield(L, -2, "opentracing_bridge_tracer");
+    lua_pop(L, 2);
+    auto is_ready = luaL_loadstring(L, benchmark_source) == 0 &&
+                    lua_pcall(L, 0, 1, 0) == 0;
+    ++num_ready;
+    if (is_ready) {
+      while (!start.load(std::memory_order_acquire)) {
+        std::this_thread::yield();
+      }
+      lua_pushnumber(L, num_spans);
+      is_ready = lua_pcall(L, 1, 0, 0) == 0;
+      finish_time_ = std::chrono::steady_clock::now();
+    }
+    if (!is_ready) {
+      error_ = lua_tostring(L, -1);
+    }
+    lua_close(L);
+  }
+
+  const std::string& error() const noexcept { return error_; }
+
+  std::chrono::steady_clock::time_point finish_time() const noexcept {
+    return finish_time_;
+  }
+
+ private:
+  std::string error_;
+  std::chrono::steady_clock::time_point finish_time_;
+};
+}  // namespace
+
+//------------------------------------------------------------------------------
+// run_threads
+//------------------------------------------------------------------------------
+// Returns the spans per second started and finished by `num_threads` threads
+// together.
+static double run_threads(int num_threads, int num_spans) {
+  std::vector<Worker> workers(num_threads);
+  std::vector<std::thread> threads;
+  std::atomic<int> num_ready{0};
+  std::atomic<bool> start{false};
+  for (auto& worker : workers) {
+    threads.emplace_back([&worker, num_spans, &num_ready, &start] {
+      worker.run(num_spans, num_ready, start);
+    });
+  }
+  while (num_ready.load() < num_threads) {
+    std::this_thread::yield();
+  }
+  auto start_time = std::chrono::steady_clock::now();
+  start.store(true, std::memory_order_release);
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  auto finish_time = start_time;
+  for (auto& worker : workers) {
+    if (!worker.error().empty()) {
+      throw std::runtime_error{worker.error()};
+    }
+    finish_time = std::max(finish_time, worker.finish_time());
+  }
+  auto elapsed = std::chrono::duration<double>(finish_time - start_time);
+  return static_cast<double>(num_threads) * num_spans / elapsed.count();
+}
+
+//------------------------------------------------------------------------------
+// main
+//------------------------------------------------------------------------------
+int main(int argc, char* argv[]) try {
+  int num_spans = 1000000;
+  int max_threads = static_cast<int>(std::thread::hardware_concurrency());
+  if (argc > 1) {
+    num_spans = std::atoi(argv[1]);
+  }
+  if (argc > 2) {
+    max_threads = std::atoi(argv[2]);
+  }
+  if (num_spans <= 0 || max_threads <= 0) {
+    std::fprintf(stderr, "Usage: %s [spans per thread] [max threads]\n",
+                 argv[0]);
+    return 1;
+  }
+
+  opentracing::Tracer::InitGlobal(
+      std::make_shared<lua_bridge_tracer::NativeTracer>(
+          std::vector<std::unique_ptr<lua_bridge_tracer::SpanSink>>{}));
+
+  std::printf("%-10s%16s%16s%12s\n", "threads", "spans/s", "per thread",
+              "efficiency");
+  double single_thread_rate = 0;
+  for (int num_threads = 1;; num_threads *= 2) {
+    if (num_threads > max_threads) {
+      num_threads = max_threads;
+    }
+    auto rate = run_threads(num_threads, num_spans);
+    auto per_thread_rate = rate / num_threads;
+    if (num_threads == 1) {
+      single_thread_rate = rate;
+    }
+    std::printf("%-10d%16.0f%16.0f%11.0f%%\n", num_threads, rate,
+                per_thread_rate, 100 * per_thread_rate / single_thread_rate);
+    if (num_threads == max_threads) {
+      break;
+    }
+  }
+  return 0;
+} catch (const std::exception& e) {
+  std::fprintf(stderr, "Error: %s\n", e.what());
+  return 1;
+}
@@ -0,0 +1,228 @@
+#include "workload.h"
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <unordered_map>
+
+namespace lua_bridge_tracer {
+namespace {
+// A span as recorded, before it's been placed in its trace.
+struct RecordedSpan {
+  std::string trace_id;
+  std::string span_id;
+  std::string parent_id;
+  WorkloadSpan span;
+  double start_timestamp = 0;
+  double finish_timestamp = 0;
+};
+}  // namespace
+
+//------------------------------------------------------------------------------
+// get_id
+//------------------------------------------------------------------------------
+// Ids are written either as numbers or as strings depending on the tracer, so
+// compare them by their text.
+static std::string get_id(const JsonValue& value, const char* key) {
+  auto id = value.find(key);
+  if (id == nullptr) {
+    return {};
+  }
+  return id->text;
+}
+
+//------------------------------------------------------------------------------
+// get_number
+//------------------------------------------------------------------------------
+static double get_number(const JsonValue& value, const char* key) {
+  auto number = value.find(key);
+  if (number == nullptr || number->type != JsonValue::Type::Number) {
+    return 0;
+  }
+  return number->number;
+}
+
+//------------------------------------------------------------------------------
+// to_recorded_span
+//------------------------------------------------------------------------------
+static RecordedSpan to_recorded_span(const JsonValue& value) {
+  if (value.type != JsonValue::Type::Object) {
+    throw std::runtime_error{"workload spans must be objects"};
+  }
+  RecordedSpan result;
+  result.trace_id = get_id(value, "trace_id");
+  result.span_id = get_id(value, "span_id");
+  auto operation_name = value.find("operation_name");
+  if (operation_name != nullptr) {
+    result.span.operation_name = operation_name->text;
+  }
+
+  auto references = value.find("references");
+  if (references != nullptr && !references->array.empty()) {
+    auto& reference = references->array.front();
+    result.parent_id = get_id(reference, "span_id");
+    auto reference_type = reference.find("reference_type");
+    result.span.follows_from =
+        reference_type != nullptr && (reference_type->text == "FOLLOWS_FROM" ||
+                                      reference_type->text == "follows_from");
+  }
+
+  auto tags = value.find("tags");
+  if (tags != nullptr) {
+    result.span.tags = tags->object;
+  }
+
+  auto logs = value.find("logs");
+  if (logs != nullptr) {
+    for (auto& log : logs->array) {
+      auto fields = log.find("fields");
+      if (fields == nullptr) {
+        continue;
+      }
+      WorkloadFields log_fields;
+      for (auto& field : fields->array) {
+        auto key = field.find("key");
+        auto field_value = field.find("value");
+        if (key != nullptr && field_value != nullptr) {
+          log_fields.emplace_back(key->text, *field_value);
+        }
+      }
+      result.span.logs.push_back(std::move(log_fields));
+    }
+  }
+
+  result.start_timestamp = get_number(value, "start_timestamp");
+  result.finish_timestamp =
+      result.start_timestamp + get_number(value, "duration");
+  return result;
+}
+
+//------------------------------------------------------------------------------
+// make_trace
+//------------------------------------------------------------------------------
+static WorkloadTrace make_trace(std::vector<RecordedSpan>& recorded_spans) {
+  std::stable_sort(recorded_spans.begin(), recorded_spans.end(),
+                   [](const RecordedSpan& lhs, const RecordedSpan& rhs) {
+                     return lhs.start_timestamp < rhs.start_timestamp;
+                   });
+  std::unordered_map<std::string, size_t> span_indexes;
+  for (size_t i = 0; i < recorded_spans.size(); ++i) {
+    span_indexes.emplace(recorded_spans[i].span_id, i);
+  }
+
+  // Order the spans so that parents come before their children, even if the
+  // recorded clocks disagree.
+  std::vector<int> order;
+  std::vector<int> new_indexes(recorded_spans.size(), -1);
+  std::vector<std::vector<size_t>> children(recorded_spans.size());
+  std::vector<size_t> roots;
+  for (size_t i = 0; i < recorded_spans.size(); ++i) {
+    auto parent = span_indexes.find(recorded_spans[i].parent_id);
+    if (recorded_spans[i].parent_id.empty() || parent == span_indexes.end() ||
+        parent->second == i) {
+      roots.push_back(i);
+    } else {
+      children[parent->second].push_back(i);
+    }
+  }
+  // Spans caught in a cycle of references are visited once any of them is
+  // reached and are otherwise treated as roots.
+  for (size_t i = 0; i < recorded_spans.size(); ++i) {
+    roots.push_back(i);
+  }
+  std::vector<size_t> stack;
+  for (auto root : roots) {
+    stack.push_back(root);
+    while (!stack.empty()) {
+      auto i = stack.back();
+      stack.pop_back();
+      if (new_indexes[i] >= 0) {
+        continue;
+      }
+      new_indexes[i] = static_cast<int>(order.size());
+      order.push_back(static_cast<int>(i));
+      auto start_timestamp = recorded_spans[i].start_timestamp;
+      for (auto child = children[i].rbegin(); child != children[i].rend();
+           ++child) {
+        auto& child_span = recorded_spans[*child];
+        child_span.start_timestamp =
+            std::max(child_span.start_timestamp, start_timestamp);
+        stack.push_back(*child);
+      }
+    }
+  }
+
+  WorkloadTrace result;
+  result.spans.reserve(order.size());
+  std::vector<std::pair<double, WorkloadEvent>> events;
+  events.reserve(2 * order.size());
+  for (auto i : order) {
+    auto& recorded_span = recorded_spans[i];
+    auto index = static_cast<int>(result.spans.size());
+    auto parent = span_indexes.find(recorded_span.parent_id);
+    if (parent != span_indexes.end() && new_indexes[parent->second] < index) {
+      recorded_span.span.parent = new_indexes[parent->second];
+    }
+    result.spans.push_back(std::move(recorded_span.span));
+    events.emplace_back(recorded_span.start_timestamp,
+                        WorkloadEvent{false, index});
+    events.emplace_back(
+        std::max(recorded_span.start_timestamp, recorded_span.finish_timestamp),
+        WorkloadEvent{true, index});
+  }
+
+  // Starts come before finishes that happen at the same time, and both keep
+  // the parent-first order of the spans.
+  std::stable_sort(events.begin(), events.end(),
+                   [](const std::pair<double, WorkloadEvent>& lhs,
+                      const std::pair<double, WorkloadEvent>& rhs) {
+                     if (lhs.first != rhs.first) {
+                       return lhs.first < rhs.first;
+                     }
+                     return !lhs.second.finish && rhs.second.finish;
+                   });
+  result.events.reserve(events.size());
+  for (auto& event : events) {
+    result.events.push_back(event.second);
+  }
+  return result;
+}
+
+//------------------------------------------------------------------------------
+// load_workload
+//------------------------------------------------------------------------------
+Workload load_workload(const std::string& path) {
+  std::ifstream in{path};
+  if (!in.good()) {
+    throw std::runtime_error{"failed to open " + path};
+  }
+  std::ostringstream contents;
+  contents << in.rdbuf();
+  auto document = parse_json(contents.str());
+  if (document.type != JsonValue::Type::Array) {
+    throw std::runtime_error{path + " isn't an array of spans"};
+  }
+
+  // Group the spans by trace, keeping the traces in the order they appear.
+  std::vector<std::vector<RecordedSpan>> traces;
+  std::unordered_map<std::string, size_t> trace_indexes;
+  for (auto& value : document.array) {
+    auto recorded_span = to_recorded_span(value);
+    auto trace_index =
+        trace_indexes.emplace(recorded_span.trace_id, traces.size());
+    if (trace_index.second) {
+      traces.emplace_back();
+    }
+    traces[trace_index.first->second].push_back(std::move(recorded_span));
+  }
+
+  Workload result;
+  result.traces.reserve(traces.size());
+  for (auto& trace : traces) {
+    result.num_spans += trace.size();
+    result.traces.push_back(make_trace(trace));
+  }
+  return result;
+}
+}  // namespace lua_bridge_tracer
@@ -0,0 +1,45 @@
+#pragma once
+
+#include "json.h"
+
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace lua_bridge_tracer {
+using WorkloadFields = std::vector<std::pair<std::string, JsonValue>>;
+
+struct WorkloadSpan {
+  std::string operation_name;
+
+  // The index of the span this one references within its trace, or -1 if it's
+  // a root span.
+  int parent = -1;
+  bool follows_from = false;
+
+  WorkloadFields tags;
+  std::vector<WorkloadFields> logs;
+};
+
+// A step in replaying a trace: either starting or finishing one of its spans.
+struct WorkloadEvent {
+  bool finish;
+  int span;
+};
+
+// The spans of a trace along with the order they were started and finished
+// in. Parents are always started before their children.
+struct WorkloadTrace {
+  std::vector<WorkloadSpan> spans;
+  std::vector<WorkloadEvent> events;
+};
+
+struct Workload {
+  std::vector<WorkloadTrace> traces;
+  size_t num_spans = 0;
+};
+
+// Reads a workload recorded as the mocktracer's JSON output: an array of spans
+// with their trace and span ids, references, tags, logs, and timestamps.
+Workload load_workload(const std::string& path);
+}  // namespace lua_bridge_tracer
@@ -19,9 +19,10 @@ function run_lua_test()
   ./ci/install_rocks.sh
   SRC_DIR=`pwd`
   mkdir /build && cd /build
-  cmake -DCMAKE_BUILD_TYPE=Debug $SRC_DIR
+  cmake -DCMAKE_BUILD_TYPE=Debug -DBUILD_TESTING=ON $SRC_DIR
   make && make install
   ldconfig
+  ctest --output-on-failure
   cd $SRC_DIR
   LD_PRELOAD=/usr/lib/x86_64-linux-gnu/libasan.so.4 busted test/tracer.lua
 }
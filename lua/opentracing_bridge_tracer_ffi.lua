@@ -0,0 +1,500 @@
+-- A drop-in replacement for opentracing_bridge_tracer that, under LuaJIT,
+-- starts, tags, logs, finishes, and propagates spans by calling the module's
+-- C API (src/c_api.h) through the FFI. Calls into lua_CFunctions abort
+-- LuaJIT's trace compiler while FFI calls don't, so code using this wrapper
+-- stays compiled with tracing on.
+--
+-- On other Lua implementations this returns opentracing_bridge_tracer itself.
+local bridge_tracer = require 'opentracing_bridge_tracer'
+
+local has_ffi, ffi = pcall(require, 'ffi')
+if not has_ffi or jit == nil then
+  return bridge_tracer
+end
+
+-- Keep in sync with src/c_api.h.
+ffi.cdef[[
+typedef struct bridge_tracer bridge_tracer_t;
+typedef struct bridge_span bridge_span_t;
+typedef struct bridge_span_context bridge_span_context_t;
+typedef struct bridge_tag_template bridge_tag_template_t;
+
+const char* bridge_last_error(void);
+
+const void* bridge_tracer_id(const bridge_tracer_t* tracer);
+bridge_span_t* bridge_tracer_start_span(bridge_tracer_t* tracer,
+                                        const char* operation_name,
+                                        const bridge_span_context_t* reference,
+                                        int reference_type, double start_time);
+int bridge_tracer_inject(bridge_tracer_t* tracer,
+                         const bridge_span_context_t* span_context, int format,
+                         char* buffer, size_t capacity, size_t* size);
+bridge_span_context_t* bridge_tracer_extract(bridge_tracer_t* tracer,
+                                             int format, const char* carrier,
+                                             size_t carrier_size, int* error);
+
+void bridge_span_free(bridge_span_t* span);
+const void* bridge_span_tracer_id(const bridge_span_t* span);
+int bridge_span_finish(bridge_span_t* span, double finish_time);
+int bridge_span_set_operation_name(bridge_span_t* span,
+                                   const char* operation_name,
+                                   size_t operation_name_size);
+int bridge_span_set_tag_string(bridge_span_t* span, const char* key,
+                               size_t key_size, const char* value,
+                               size_t value_size);
+int bridge_span_set_tag_number(bridge_span_t* span, const char* key,
+                               size_t key_size, double value);
+int bridge_span_set_tag_bool(bridge_span_t* span, const char* key,
+                             size_t key_size, int value);
+int bridge_span_set_tag_int(bridge_span_t* span, const char* key,
+                            size_t key_size, int64_t value);
+int bridge_span_set_tag_uint(bridge_span_t* span, const char* key,
+                             size_t key_size, uint64_t value);
+int bridge_span_set_constant_tags(bridge_span_t* span,
+                                  const bridge_tag_template_t* tag_template);
+size_t bridge_tag_template_num_keys(const bridge_tag_template_t* tag_template);
+const char* bridge_tag_template_key(const bridge_tag_template_t* tag_template,
+                                    size_t index, size_t* key_size);
+int bridge_span_log_begin(bridge_span_t* span);
+void bridge_span_log_string(bridge_span_t* span, const char* key,
+                            size_t key_size, const char* value,
+                            size_t value_size);
+void bridge_span_log_number(bridge_span_t* span, const char* key,
+                            size_t key_size, double value);
+void bridge_span_log_bool(bridge_span_t* span, const char* key,
+                          size_t key_size, int value);
+int bridge_span_log_end(bridge_span_t* span);
+int bridge_span_set_baggage_item(bridge_span_t* span, const char* key,
+                                 size_t key_size, const char* value,
+                                 size_t value_size);
+int bridge_span_baggage_item(bridge_span_t* span, const char* key,
+                             size_t key_size, char* buffer, size_t capacity,
+                             size_t* size);
+bridge_span_context_t* bridge_span_context(bridge_span_t* span);
+void bridge_span_context_free(bridge_span_context_t* span_context);
+]]
+
+local CHILD_OF = 0
+local FOLLOWS_FROM = 1
+
+local TEXT_MAP = 0
+local HTTP_HEADERS = 1
+local BINARY = 2
+
+-- require has already loaded the module, so this returns the same instance
+-- of it rather than a second copy.
+local C = ffi.load(package.searchpath('opentracing_bridge_tracer',
+                                      package.cpath))
+
+local span_context_type = ffi.typeof('bridge_span_context_t*')
+local int64_type = ffi.typeof('int64_t')
+local uint64_type = ffi.typeof('uint64_t')
+local size = ffi.new('size_t[1]')
+local error_flag = ffi.new('int[1]')
+local buffer_capacity = 256
+local buffer = ffi.new('char[?]', buffer_capacity)
+
+local function check(result)
+  if result < 0 then
+    error(ffi.string(C.bridge_last_error()), 3)
+  end
+  return result
+end
+
+-- Addresses fit in a Lua number on the platforms LuaJIT supports.
+local function id_key(pointer)
+  return tonumber(ffi.cast('uintptr_t', pointer))
+end
+
+-- Functions that copy out strings set `size` to the bytes they need and only
+-- write to the buffer if those fit. This makes room for a retry.
+local function grow_buffer()
+  if size[0] <= buffer_capacity then
+    return false
+  end
+  buffer_capacity = tonumber(size[0])
+  buffer = ffi.new('char[?]', buffer_capacity)
+  return true
+end
+
+-- Wrappers by tracer id, so that span:tracer() can find them.
+local tracers = setmetatable({}, {__mode = 'v'})
+
+-- Tag templates' C API handles and keys, by template, so that they're only
+-- looked up through the module once.
+local c_tag_templates = setmetatable({}, {__mode = 'k'})
+
+local function get_c_tag_template(tag_template)
+  local result = c_tag_templates[tag_template]
+  if result ~= nil then
+    return result
+  end
+  local c_tag_template = ffi.cast('const bridge_tag_template_t*',
+                                  tag_template:c_tag_template())
+  local keys = {}
+  for i = 1, tonumber(C.bridge_tag_template_num_keys(c_tag_template)) do
+    local key = C.bridge_tag_template_key(c_tag_template, i - 1, size)
+    keys[i] = ffi.string(key, size[0])
+  end
+  result = {c_tag_template = c_tag_template, keys = keys}
+  c_tag_templates[tag_template] = result
+  return result
+end
+
+--------------------------------------------------------------------------------
+-- SpanContext
+--------------------------------------------------------------------------------
+local SpanContext = {}
+
+ffi.metatype('struct bridge_span_context', {__index = SpanContext})
+
+local function wrap_span_context(span_context)
+  if span_context == nil then
+    return nil
+  end
+  return ffi.gc(span_context, C.bridge_span_context_free)
+end
+
+--------------------------------------------------------------------------------
+-- Span
+--------------------------------------------------------------------------------
+local Span = {}
+
+ffi.metatype('struct bridge_span', {__index = Span})
+
+local function set_tag(span, key, value)
+  local value_type = type(value)
+  if value_type == 'cdata' and ffi.istype(int64_type, value) then
+    check(C.bridge_span_set_tag_int(span, key, #key, value))
+  elseif value_type == 'cdata' and ffi.istype(uint64_type, value) then
+    check(C.bridge_span_set_tag_uint(span, key, #key, value))
+  elseif value_type == 'number' then
+    check(C.bridge_span_set_tag_number(span, key, #key, value))
+  elseif value_type == 'boolean' then
+    check(C.bridge_span_set_tag_bool(span, key, #key, value and 1 or 0))
+  else
+    if value_type ~= 'string' then
+      value = tostring(value)
+    end
+    check(C.bridge_span_set_tag_string(span, key, #key, value, #value))
+  end
+end
+
+function Span:context()
+  return wrap_span_context(C.bridge_span_context(self))
+end
+
+function Span:tracer()
+  return tracers[id_key(C.bridge_span_tracer_id(self))]
+end
+
+function Span:set_operation_name(operation_name)
+  check(C.bridge_span_set_operation_name(self, operation_name,
+                                         #operation_name))
+end
+
+function Span:finish(finish_time)
+  check(C.bridge_span_finish(self, finish_time or 0))
+end
+
+function Span:set_tag(key, value)
+  set_tag(self, key, value)
+end
+
+function Span:set_tag_int(key, value)
+  check(C.bridge_span_set_tag_int(self, key, #key, value))
+end
+
+function Span:set_tag_uint(key, value)
+  check(C.bridge_span_set_tag_uint(self, key, #key, value))
+end
+
+function Span:set_tags_with(tag_template, ...)
+  local c_tag_template = get_c_tag_template(tag_template)
+  local keys = c_tag_template.keys
+  local num_values = select('#', ...)
+  if num_values > #keys then
+    error('more values than tag template keys', 2)
+  end
+  check(C.bridge_span_set_constant_tags(self, c_tag_template.c_tag_template))
+  for i = 1, num_values do
+    local value = select(i, ...)
+    if value ~= nil then
+      set_tag(self, keys[i], value)
+    end
+  end
+end
+
+function Span:log_kv(fields)
+  if check(C.bridge_span_log_begin(self)) == 0 then
+    return
+  end
+  for key, value in pairs(fields) do
+    if type(key) == 'string' then
+      local value_type = type(value)
+      if value_type == 'number' then
+        C.bridge_span_log_number(self, key, #key, value)
+      elseif value_type == 'boolean' then
+        C.bridge_span_log_bool(self, key, #key, value and 1 or 0)
+      else
+        if value_type ~= 'string' then
+          value = tostring(value)
+        end
+        C.bridge_span_log_string(self, key, #key, value, #value)
+      end
+    end
+  end
+  check(C.bridge_span_log_end(self))
+end
+
+function Span:set_baggage_item(key, value)
+  check(C.bridge_span_set_baggage_item(self, key, #key, value, #value))
+end
+
+function Span:get_baggage_item(key)
+  check(C.bridge_span_baggage_item(self, key, #key, buffer, buffer_capacity,
+                                   size))
+  if grow_buffer() then
+    check(C.bridge_span_baggage_item(self, key, #key, buffer, buffer_capacity,
+                                     size))
+  end
+  return ffi.string(buffer, size[0])
+end
+
+--------------------------------------------------------------------------------
+-- Tracer
+--------------------------------------------------------------------------------
+local Tracer = {}
+
+local tracer_metatable = {
+  -- The tracer's other methods are the module's, called on the wrapped tracer.
+  __index = function(tracer, key)
+    local method = Tracer[key]
+    if method ~= nil then
+      return method
+    end
+    method = tracer.lua_tracer[key]
+    if type(method) ~= 'function' then
+      return method
+    end
+    return function(self, ...)
+      return method(self.lua_tracer, ...)
+    end
+  end
+}
+
+local function wrap_tracer(lua_tracer)
+  -- The userdata owns the handle, so the wrapper keeps it alongside.
+  local c_tracer_owner = lua_tracer:c_tracer()
+  local c_tracer = ffi.cast('bridge_tracer_t**', c_tracer_owner)[0]
+  local tracer = setmetatable({lua_tracer = lua_tracer, c_tracer = c_tracer,
+                               c_tracer_owner = c_tracer_owner},
+                              tracer_metatable)
+  tracers[id_key(C.bridge_tracer_id(c_tracer))] = tracer
+  return tracer
+end
+
+-- Converts an FFI span context to one the module's methods accept.
+local function to_lua_span_context(tracer, span_context)
+  if not ffi.istype(span_context_type, span_context) then
+    return span_context
+  end
+  return tracer.lua_tracer:import_c_span_context(id_key(span_context))
+end
+
+-- Returns the context of the running coroutine's active span, to be freed by
+-- the caller, if it was started by `tracer`. The C API doesn't consult active
+-- spans, so the wrapper passes it as the parent of spans with no references.
+local function get_active_parent(tracer)
+  local active_span = tracer.lua_tracer:active_span()
+  if active_span == nil then
+    return nil
+  end
+  -- Span userdata hold a single bridge_span_t*, as c_tracer's does.
+  local span = ffi.cast('bridge_span_t**', active_span)[0]
+  if C.bridge_span_tracer_id(span) ~= C.bridge_tracer_id(tracer.c_tracer) then
+    return nil
+  end
+  return C.bridge_span_context(span)
+end
+
+-- Starts a span with the module's start_span, for options the C API doesn't
+-- cover.
+local function start_lua_span(tracer, operation_name, options)
+  local lua_options = {}
+  for key, value in pairs(options) do
+    lua_options[key] = value
+  end
+  if type(options.references) == 'table' then
+    lua_options.references = {}
+    for i, reference in ipairs(options.references) do
+      lua_options.references[i] = {
+        reference[1], to_lua_span_context(tracer, reference[2])}
+    end
+  end
+  return tracer.lua_tracer:start_span(operation_name, lua_options)
+end
+
+function Tracer:start_span(operation_name, options)
+  local reference, reference_type, start_time = nil, CHILD_OF, 0
+  if options ~= nil then
+    local references = options.references
+    if options.aggregate or options.tag_template or options.cost or
+       (references ~= nil and (type(references) ~= 'table' or #references > 1))
+    then
+      return start_lua_span(self, operation_name, options)
+    end
+    if references ~= nil and #references == 1 then
+      reference = references[1][2]
+      if not ffi.istype(span_context_type, reference) then
+        return start_lua_span(self, operation_name, options)
+      end
+      local type_name = references[1][1]
+      if type_name == 'follows_from' or type_name == 'FOLLOWS_FROM' then
+        reference_type = FOLLOWS_FROM
+      elseif type_name ~= 'child_of' and type_name ~= 'CHILD_OF' then
+        error('invalid reference type: ' .. tostring(type_name), 2)
+      end
+    end
+    start_time = options.start_time or 0
+  end
+  local active_parent = nil
+  if reference == nil and not (options ~= nil and options.ignore_active_span)
+  then
+    active_parent = get_active_parent(self)
+    reference = active_parent
+  end
+  local span = C.bridge_tracer_start_span(self.c_tracer, operation_name,
+                                          reference, reference_type,
+                                          start_time)
+  if active_parent ~= nil then
+    C.bridge_span_context_free(active_parent)
+  end
+  if span == nil then
+    error(ffi.string(C.bridge_last_error()), 2)
+  end
+  span = ffi.gc(span, C.bridge_span_free)
+  if options ~= nil and options.tags ~= nil then
+    for key, value in pairs(options.tags) do
+      set_tag(span, key, value)
+    end
+  end
+  return span
+end
+
+function Tracer:start_spans(specs, options)
+  if ffi.istype(span_context_type, options) then
+    options = to_lua_span_context(self, options)
+  elseif type(options) == 'table' then
+    options = {start_time = options.start_time, tags = options.tags,
+               aggregate = options.aggregate,
+               tag_template = options.tag_template,
+               tag_values = options.tag_values,
+               references = options.references}
+    if type(options.references) == 'table' then
+      local references = {}
+      for i, reference in ipairs(options.references) do
+        references[i] = {reference[1], to_lua_span_context(self, reference[2])}
+      end
+      options.references = references
+    end
+  end
+  return self.lua_tracer:start_spans(specs, options)
+end
+
+function Tracer:finish_spans(spans, finish_time)
+  for i, span in ipairs(spans) do
+    if type(finish_time) == 'table' then
+      span:finish(finish_time[i])
+    else
+      span:finish(finish_time)
+    end
+  end
+end
+
+local function inject(tracer, span_context, format)
+  check(C.bridge_tracer_inject(tracer.c_tracer, span_context, format, buffer,
+                               buffer_capacity, size))
+  if grow_buffer() then
+    check(C.bridge_tracer_inject(tracer.c_tracer, span_context, format,
+                                 buffer, buffer_capacity, size))
+  end
+  return ffi.string(buffer, size[0])
+end
+
+local function inject_text(tracer, span_context, carrier, format, method)
+  if not ffi.istype(span_context_type, span_context) then
+    return tracer.lua_tracer[method](tracer.lua_tracer, span_context, carrier)
+  end
+  local data = inject(tracer, span_context, format)
+  local first = 1
+  while first <= #data do
+    local key_last = data:find('\0', first, true)
+    local value_last = data:find('\0', key_last + 1, true)
+    carrier[data:sub(first, key_last - 1)] =
+        data:sub(key_last + 1, value_last - 1)
+    first = value_last + 1
+  end
+end
+
+function Tracer:text_map_inject(span_context, carrier)
+  inject_text(self, span_context, carrier, TEXT_MAP, 'text_map_inject')
+end
+
+function Tracer:http_headers_inject(span_context, carrier)
+  inject_text(self, span_context, carrier, HTTP_HEADERS,
+              'http_headers_inject')
+end
+
+function Tracer:binary_inject(span_context)
+  if not ffi.istype(span_context_type, span_context) then
+    return self.lua_tracer:binary_inject(span_context)
+  end
+  return inject(self, span_context, BINARY)
+end
+
+local function extract(tracer, carrier, format)
+  local span_context = C.bridge_tracer_extract(tracer.c_tracer, format,
+                                               carrier, #carrier, error_flag)
+  if error_flag[0] ~= 0 then
+    error(ffi.string(C.bridge_last_error()), 3)
+  end
+  return wrap_span_context(span_context)
+end
+
+local function encode_carrier(carrier)
+  local entries = {}
+  for key, value in pairs(carrier) do
+    entries[#entries + 1] = key
+    entries[#entries + 1] = value
+  end
+  entries[#entries + 1] = ''
+  return table.concat(entries, '\0')
+end
+
+function Tracer:text_map_extract(carrier)
+  return extract(self, encode_carrier(carrier), TEXT_MAP)
+end
+
+function Tracer:http_headers_extract(carrier)
+  return extract(self, encode_carrier(carrier), HTTP_HEADERS)
+end
+
+function Tracer:binary_extract(carrier)
+  return extract(self, carrier, BINARY)
+end
+
+--------------------------------------------------------------------------------
+-- module
+--------------------------------------------------------------------------------
+local module = setmetatable({}, {__index = bridge_tracer})
+
+function module:new(...)
+  return wrap_tracer(bridge_tracer:new(...))
+end
+
+function module:new_from_global()
+  return wrap_tracer(bridge_tracer:new_from_global())
+end
+
+return module
@@ -0,0 +1,110 @@
+#include "active_span.h"
+
+#include "lua_span.h"
+#include "utility.h"
+
+// The registry holds the table of stacks under the address of this variable.
+static const char active_spans_key = 0;
+
+namespace lua_bridge_tracer {
+//------------------------------------------------------------------------------
+// push_active_spans
+//------------------------------------------------------------------------------
+// Pushes the running coroutine's stack of active spans and returns true, or,
+// if it doesn't have one and `create` is false, pushes nothing and returns
+// false.
+static bool push_active_spans(lua_State* L, bool create) {
+  lua_pushlightuserdata(L, const_cast<char*>(&active_spans_key));
+  lua_rawget(L, LUA_REGISTRYINDEX);
+  if (lua_isnil(L, -1)) {
+    lua_pop(L, 1);
+    if (!create) {
+      return false;
+    }
+    lua_newtable(L);
+    lua_createtable(L, 0, 1);
+    lua_pushstring(L, "k");
+    lua_setfield(L, -2, "__mode");
+    lua_setmetatable(L, -2);
+    lua_pushlightuserdata(L, const_cast<char*>(&active_spans_key));
+    lua_pushvalue(L, -2);
+    lua_rawset(L, LUA_REGISTRYINDEX);
+  }
+
+  lua_pushthread(L);
+  lua_rawget(L, -2);
+  if (lua_isnil(L, -1)) {
+    lua_pop(L, 1);
+    if (!create) {
+      lua_pop(L, 1);
+      return false;
+    }
+    lua_createtable(L, 4, 0);
+    lua_pushthread(L);
+    lua_pushvalue(L, -2);
+    lua_rawset(L, -4);
+  }
+  lua_remove(L, -2);
+  return true;
+}
+
+//------------------------------------------------------------------------------
+// get_active_span
+//------------------------------------------------------------------------------
+LuaSpan* get_active_span(lua_State* L) {
+  if (!push_active_spans(L, false)) {
+    return nullptr;
+  }
+  for (auto i = static_cast<int>(get_table_len(L, -1)); i > 0; --i) {
+    lua_rawgeti(L, -1, i);
+    auto span = LuaSpan::to_lua_span(L, -1);
+    if (span != nullptr && !span->is_finished()) {
+      lua_remove(L, -2);
+      return span;
+    }
+    lua_pop(L, 1);
+    lua_pushnil(L);
+    lua_rawseti(L, -2, i);
+  }
+  lua_pop(L, 1);
+  return nullptr;
+}
+
+//------------------------------------------------------------------------------
+// push_active_span
+//------------------------------------------------------------------------------
+void push_active_span(lua_State* L, int index) {
+  if (index < 0) {
+    index = lua_gettop(L) + index + 1;
+  }
+  auto span = LuaSpan::to_lua_span(L, index);
+  if (span == nullptr) {
+    return;
+  }
+  span->mark_active();
+  push_active_spans(L, true);
+  lua_pushvalue(L, index);
+  lua_rawseti(L, -2, static_cast<int>(get_table_len(L, -2)) + 1);
+  lua_pop(L, 1);
+}
+
+//------------------------------------------------------------------------------
+// pop_active_span
+//------------------------------------------------------------------------------
+void pop_active_span(lua_State* L, const LuaSpan& span) {
+  if (!span.is_active() || !push_active_spans(L, false)) {
+    return;
+  }
+  auto num_spans = static_cast<int>(get_table_len(L, -1));
+  if (num_spans > 0) {
+    lua_rawgeti(L, -1, num_spans);
+    auto is_innermost = LuaSpan::to_lua_span(L, -1) == &span;
+    lua_pop(L, 1);
+    if (is_innermost) {
+      lua_pushnil(L);
+      lua_rawseti(L, -2, num_spans);
+    }
+  }
+  lua_pop(L, 1);
+}
+}  // namespace lua_bridge_tracer
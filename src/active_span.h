@@ -0,0 +1,28 @@
+#pragma once
+
+extern "C" {
+#include <lua.h>
+}  // extern "C"
+
+namespace lua_bridge_tracer {
+class LuaSpan;
+
+// Each coroutine's stack of active spans, for tracer:start_active_span.
+//
+// The stacks are arrays of span userdata, kept in a table in the registry
+// whose keys are the coroutines and are weak, so that a coroutine's stack is
+// freed along with it. Finishing the innermost active span pops it; spans
+// finished out of order are skipped, and dropped, when the stack is next
+// read.
+
+// Returns the innermost unfinished span made active by the running coroutine,
+// leaving its userdata on the top of the stack, or returns nullptr and leaves
+// the stack as it was.
+LuaSpan* get_active_span(lua_State* L);
+
+// Makes the span at `index` the running coroutine's innermost active span.
+void push_active_span(lua_State* L, int index);
+
+// Pops `span` if it's the running coroutine's innermost active span.
+void pop_active_span(lua_State* L, const LuaSpan& span);
+}  // namespace lua_bridge_tracer
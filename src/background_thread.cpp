@@ -0,0 +1,102 @@
+#include "background_thread.h"
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+extern "C" {
+#include <lauxlib.h>
+}  // extern "C"
+
+#define METATABLE "lua_opentracing_bridge.background_threads"
+
+namespace lua_bridge_tracer {
+namespace {
+struct BackgroundThread {
+  std::thread thread;
+  std::shared_ptr<std::atomic<bool>> is_done;
+};
+
+// Never freed, so that it outlives the lua_States that use it.
+struct BackgroundThreads {
+  std::mutex mutex;
+  size_t num_lua_states = 0;
+  std::vector<BackgroundThread> threads;
+};
+}  // namespace
+
+static BackgroundThreads& background_threads() {
+  static auto threads = new BackgroundThreads{};
+  return *threads;
+}
+
+//------------------------------------------------------------------------------
+// start_background_thread
+//------------------------------------------------------------------------------
+void start_background_thread(std::function<void()>&& f) {
+  auto& background = background_threads();
+  {
+    std::lock_guard<std::mutex> lock{background.mutex};
+    if (background.num_lua_states != 0) {
+      // Reap the threads that have finished, so that they don't pile up.
+      auto& threads = background.threads;
+      for (auto iter = threads.begin(); iter != threads.end();) {
+        if (iter->is_done->load(std::memory_order_acquire)) {
+          iter->thread.join();
+          iter = threads.erase(iter);
+        } else {
+          ++iter;
+        }
+      }
+      auto is_done = std::make_shared<std::atomic<bool>>(false);
+      threads.reserve(threads.size() + 1);
+      std::thread thread{[f, is_done] {
+        f();
+        is_done->store(true, std::memory_order_release);
+      }};
+      threads.push_back(BackgroundThread{std::move(thread), is_done});
+      f = nullptr;
+    }
+  }
+  if (f) {
+    f();
+  }
+}
+
+//------------------------------------------------------------------------------
+// close_background_threads
+//------------------------------------------------------------------------------
+static int close_background_threads(lua_State* /*L*/) noexcept {
+  auto& background = background_threads();
+  std::vector<BackgroundThread> threads;
+  {
+    std::lock_guard<std::mutex> lock{background.mutex};
+    if (--background.num_lua_states == 0) {
+      threads.swap(background.threads);
+    }
+  }
+  for (auto& thread : threads) {
+    thread.thread.join();
+  }
+  return 0;
+}
+
+//------------------------------------------------------------------------------
+// open_background_threads
+//------------------------------------------------------------------------------
+// The module's userdata is finalized by lua_close before the library handle
+// that require made ahead of it, since finalizers run in the reverse order
+// their userdata were created.
+void open_background_threads(lua_State* L) {
+  lua_newuserdata(L, 1);
+  luaL_newmetatable(L, METATABLE);
+  lua_pushcfunction(L, close_background_threads);
+  lua_setfield(L, -2, "__gc");
+  lua_setmetatable(L, -2);
+  lua_setfield(L, LUA_REGISTRYINDEX, METATABLE);
+  std::lock_guard<std::mutex> lock{background_threads().mutex};
+  ++background_threads().num_lua_states;
+}
+}  // namespace lua_bridge_tracer
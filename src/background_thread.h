@@ -0,0 +1,20 @@
+#pragma once
+
+#include <functional>
+
+extern "C" {
+#include <lua.h>
+}  // extern "C"
+
+namespace lua_bridge_tracer {
+// Runs `f` on a thread of its own, for work that can block, such as closing a
+// plugin's tracer. The threads aren't detached: they're joined when the last
+// lua_State to open the module closes, so that none is still running the
+// module's code once lua_close dlclose's it. With no lua_State open, `f` is
+// run in place.
+void start_background_thread(std::function<void()>&& f);
+
+// Counts the module as open in `L` until `L` is closed, when the module's
+// background threads are joined if no other lua_State has it open.
+void open_background_threads(lua_State* L);
+}  // namespace lua_bridge_tracer
@@ -0,0 +1,674 @@
+#include "c_api.h"
+
+#include "log_record_pool.h"
+#include "lua_span.h"
+#include "lua_span_context.h"
+#include "lua_tag_template.h"
+#include "lua_tracer.h"
+#include "stats.h"
+
+#include <opentracing/propagation.h>
+
+#include <chrono>
+#include <cstring>
+#include <exception>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+using lua_bridge_tracer::LogRecordPool;
+using lua_bridge_tracer::LuaSpan;
+using lua_bridge_tracer::LuaSpanContext;
+using lua_bridge_tracer::LuaTagTemplate;
+using lua_bridge_tracer::LuaTracer;
+using lua_bridge_tracer::PluginTimer;
+using lua_bridge_tracer::SpanBudget;
+using lua_bridge_tracer::add_stat;
+using lua_bridge_tracer::is_shed;
+using lua_bridge_tracer::stats;
+
+// The handles are the bridge's own objects; the C types only hide them.
+static LuaTracer* to_tracer(bridge_tracer_t* tracer) noexcept {
+  return reinterpret_cast<LuaTracer*>(tracer);
+}
+
+static LuaSpan* to_span(bridge_span_t* span) noexcept {
+  return reinterpret_cast<LuaSpan*>(span);
+}
+
+static const LuaSpanContext* to_span_context(
+    const bridge_span_context_t* span_context) noexcept {
+  return reinterpret_cast<const LuaSpanContext*>(span_context);
+}
+
+static const LuaTagTemplate* to_tag_template(
+    const bridge_tag_template_t* tag_template) noexcept {
+  return reinterpret_cast<const LuaTagTemplate*>(tag_template);
+}
+
+static thread_local std::string last_error;
+
+//------------------------------------------------------------------------------
+// set_last_error
+//------------------------------------------------------------------------------
+static int set_last_error(const std::exception& e) noexcept {
+  try {
+    last_error = e.what();
+  } catch (...) {
+    last_error.clear();
+  }
+  return -1;
+}
+
+//------------------------------------------------------------------------------
+// to_time_point
+//------------------------------------------------------------------------------
+// Converts microseconds since the epoch the same way convert_timestamp does,
+// with 0 left as an empty time point.
+static std::chrono::system_clock::time_point to_time_point(double timestamp) {
+  using SystemClock = std::chrono::system_clock;
+  if (timestamp == 0) {
+    return {};
+  }
+  auto time_since_epoch =
+      std::chrono::microseconds{static_cast<uint64_t>(timestamp)};
+  return SystemClock::from_time_t(std::time_t(0)) +
+         std::chrono::duration_cast<SystemClock::duration>(time_since_epoch);
+}
+
+//------------------------------------------------------------------------------
+// copy_out
+//------------------------------------------------------------------------------
+static void copy_out(const std::string& data, char* buffer, size_t capacity,
+                     size_t* size) noexcept {
+  *size = data.size();
+  if (data.size() <= capacity) {
+    std::memcpy(buffer, data.data(), data.size());
+  }
+}
+
+namespace {
+//------------------------------------------------------------------------------
+// BufferCarrierWriter
+//------------------------------------------------------------------------------
+// Encodes each entry of a text carrier as a key, a null, a value, and a null.
+class BufferCarrierWriter : public opentracing::HTTPHeadersWriter {
+ public:
+  explicit BufferCarrierWriter(std::string& buffer) noexcept
+      : buffer_{buffer} {}
+
+  opentracing::expected<void> Set(
+      opentracing::string_view key,
+      opentracing::string_view value) const final {
+    buffer_.append(key.data(), key.size());
+    buffer_.push_back('\0');
+    buffer_.append(value.data(), value.size());
+    buffer_.push_back('\0');
+    return {};
+  }
+
+ private:
+  std::string& buffer_;
+};
+
+//------------------------------------------------------------------------------
+// BufferCarrierReader
+//------------------------------------------------------------------------------
+class BufferCarrierReader : public opentracing::HTTPHeadersReader {
+ public:
+  BufferCarrierReader(const char* data, size_t size) noexcept
+      : data_{data}, size_{size} {}
+
+  opentracing::expected<void> ForeachKey(
+      std::function<opentracing::expected<void>(opentracing::string_view key,
+                                                opentracing::string_view value)>
+          f) const final {
+    auto first = data_;
+    auto last = data_ + size_;
+    while (first != last) {
+      auto key_last = static_cast<const char*>(
+          std::memchr(first, '\0', static_cast<size_t>(last - first)));
+      if (key_last == nullptr) {
+        break;
+      }
+      auto value_first = key_last + 1;
+      auto value_last = static_cast<const char*>(std::memchr(
+          value_first, '\0', static_cast<size_t>(last - value_first)));
+      if (value_last == nullptr) {
+        value_last = last;
+      }
+      auto was_successful =
+          f({first, static_cast<size_t>(key_last - first)},
+            {value_first, static_cast<size_t>(value_last - value_first)});
+      if (!was_successful) {
+        return was_successful;
+      }
+      first = value_last == last ? last : value_last + 1;
+    }
+    return {};
+  }
+
+ private:
+  const char* data_;
+  size_t size_;
+};
+
+//------------------------------------------------------------------------------
+// PendingLogRecord
+//------------------------------------------------------------------------------
+// The record being built between bridge_span_log_begin and
+// bridge_span_log_end.
+struct PendingLogRecord {
+  LuaSpan* span = nullptr;
+  LogRecordPool::Fields fields;
+  size_t start_num_bytes = 0;
+  std::chrono::system_clock::time_point timestamp;
+};
+}  // namespace
+
+static thread_local PendingLogRecord pending_log_record;
+
+//------------------------------------------------------------------------------
+// add_log_field
+//------------------------------------------------------------------------------
+// Adds a field to the pending record of `span`, charging the key's size to its
+// budget. Returns nullptr if the field should be skipped.
+static std::pair<std::string, opentracing::Value>* add_log_field(
+    LuaSpan* span, const char* key, size_t key_size, size_t value_size) {
+  if (pending_log_record.span != span) {
+    return nullptr;
+  }
+  auto& budget = span->budget();
+  if (!budget.reserve(key_size) || !budget.reserve(value_size)) {
+    return nullptr;
+  }
+  pending_log_record.fields.emplace_back(std::string{key, key_size},
+                                         opentracing::Value{});
+  return &pending_log_record.fields.back();
+}
+
+extern "C" {
+//------------------------------------------------------------------------------
+// bridge_last_error
+//------------------------------------------------------------------------------
+const char* bridge_last_error(void) { return last_error.c_str(); }
+
+//------------------------------------------------------------------------------
+// bridge_tracer_id
+//------------------------------------------------------------------------------
+const void* bridge_tracer_id(const bridge_tracer_t* tracer) {
+  return reinterpret_cast<const LuaTracer*>(tracer)->handle().get();
+}
+
+//------------------------------------------------------------------------------
+// bridge_tracer_start_span
+//------------------------------------------------------------------------------
+bridge_span_t* bridge_tracer_start_span(bridge_tracer_t* tracer,
+                                        const char* operation_name,
+                                        const bridge_span_context_t* reference,
+                                        int reference_type,
+                                        double start_time) {
+  try {
+    auto lua_tracer = to_tracer(tracer);
+    SpanBudget budget{lua_tracer->state().span_limits()};
+    if (reference == nullptr &&
+        lua_tracer->state().load_shedder().should_shed()) {
+      return reinterpret_cast<bridge_span_t*>(
+          lua_tracer->new_shed_span(budget).release());
+    }
+    opentracing::StartSpanOptions start_span_options;
+    start_span_options.start_system_timestamp = to_time_point(start_time);
+    if (reference != nullptr) {
+      if (to_span_context(reference)->is_aggregated()) {
+        throw std::runtime_error{
+            "spans started with `aggregate` can't be referenced"};
+      }
+      start_span_options.references.emplace_back(
+          reference_type == BRIDGE_FOLLOWS_FROM
+              ? opentracing::SpanReferenceType::FollowsFromRef
+              : opentracing::SpanReferenceType::ChildOfRef,
+          &to_span_context(reference)->span_context());
+    }
+    auto lua_span = lua_tracer->new_lua_span(nullptr, 0, operation_name,
+                                             start_span_options, budget);
+    return reinterpret_cast<bridge_span_t*>(lua_span.release());
+  } catch (const std::exception& e) {
+    set_last_error(e);
+  }
+  return nullptr;
+}
+
+//------------------------------------------------------------------------------
+// bridge_tracer_inject
+//------------------------------------------------------------------------------
+int bridge_tracer_inject(bridge_tracer_t* tracer,
+                         const bridge_span_context_t* span_context, int format,
+                         char* buffer, size_t capacity, size_t* size) {
+  if (format < 0 || format > BRIDGE_BINARY) {
+    return set_last_error(std::runtime_error{"invalid carrier format"});
+  }
+  add_stat(stats().injects[format]);
+  try {
+    auto& opentracing_tracer = *to_tracer(tracer)->tracer();
+    auto& context = to_span_context(span_context)->span_context();
+    std::string data;
+    if (is_shed(context)) {
+      copy_out(data, buffer, capacity, size);
+      return 0;
+    }
+    opentracing::expected<void> was_successful;
+    if (format == BRIDGE_BINARY) {
+      std::ostringstream oss;
+      {
+        PluginTimer timer;
+        was_successful = opentracing_tracer.Inject(context, oss);
+      }
+      data = oss.str();
+    } else {
+      BufferCarrierWriter writer{data};
+      PluginTimer timer;
+      if (format == BRIDGE_TEXT_MAP) {
+        was_successful = opentracing_tracer.Inject(
+            context, static_cast<const opentracing::TextMapWriter&>(writer));
+      } else {
+        was_successful = opentracing_tracer.Inject(
+            context,
+            static_cast<const opentracing::HTTPHeadersWriter&>(writer));
+      }
+    }
+    if (!was_successful) {
+      throw std::runtime_error{"failed to inject span context: " +
+                               was_successful.error().message()};
+    }
+    copy_out(data, buffer, capacity, size);
+    return 0;
+  } catch (const std::exception& e) {
+    add_stat(stats().inject_failures[format]);
+    return set_last_error(e);
+  }
+}
+
+//------------------------------------------------------------------------------
+// bridge_tracer_extract
+//------------------------------------------------------------------------------
+bridge_span_context_t* bridge_tracer_extract(bridge_tracer_t* tracer,
+                                             int format, const char* carrier,
+                                             size_t carrier_size, int* error) {
+  *error = 0;
+  if (format < 0 || format > BRIDGE_BINARY) {
+    *error = 1;
+    set_last_error(std::runtime_error{"invalid carrier format"});
+    return nullptr;
+  }
+  add_stat(stats().extracts[format]);
+  try {
+    auto& opentracing_tracer = *to_tracer(tracer)->tracer();
+    opentracing::expected<std::unique_ptr<opentracing::SpanContext>>
+        span_context_maybe;
+    if (format == BRIDGE_BINARY) {
+      std::istringstream iss{std::string{carrier, carrier_size}};
+      PluginTimer timer;
+      span_context_maybe = opentracing_tracer.Extract(iss);
+    } else {
+      BufferCarrierReader reader{carrier, carrier_size};
+      PluginTimer timer;
+      if (format == BRIDGE_TEXT_MAP) {
+        span_context_maybe = opentracing_tracer.Extract(
+            static_cast<const opentracing::TextMapReader&>(reader));
+      } else {
+        span_context_maybe = opentracing_tracer.Extract(
+            static_cast<const opentracing::HTTPHeadersReader&>(reader));
+      }
+    }
+    if (!span_context_maybe) {
+      throw std::runtime_error{"failed to extract span context: " +
+                               span_context_maybe.error().message()};
+    }
+    auto span_context = std::move(*span_context_maybe);
+    if (span_context == nullptr) {
+      return nullptr;
+    }
+    auto& handle = to_tracer(tracer)->handle();
+    std::unique_ptr<LuaSpanContext> lua_span_context{
+        new LuaSpanContext{handle, std::move(span_context)}};
+    handle->state().add_c_span_context(lua_span_context.get());
+    return reinterpret_cast<bridge_span_context_t*>(
+        lua_span_context.release());
+  } catch (const std::exception& e) {
+    add_stat(stats().extract_failures[format]);
+    *error = 1;
+    set_last_error(e);
+  }
+  return nullptr;
+}
+
+//------------------------------------------------------------------------------
+// bridge_span_free
+//------------------------------------------------------------------------------
+void bridge_span_free(bridge_span_t* span) {
+  if (pending_log_record.span == to_span(span)) {
+    pending_log_record.span = nullptr;
+    pending_log_record.fields.clear();
+  }
+  delete to_span(span);
+}
+
+//------------------------------------------------------------------------------
+// bridge_span_tracer_id
+//------------------------------------------------------------------------------
+const void* bridge_span_tracer_id(const bridge_span_t* span) {
+  return reinterpret_cast<const LuaSpan*>(span)->handle().get();
+}
+
+//------------------------------------------------------------------------------
+// bridge_span_finish
+//------------------------------------------------------------------------------
+int bridge_span_finish(bridge_span_t* span, double finish_time) {
+  try {
+    opentracing::FinishSpanOptions finish_span_options;
+    if (finish_time != 0) {
+      finish_span_options.finish_steady_timestamp =
+          opentracing::convert_time_point<opentracing::SteadyClock>(
+              to_time_point(finish_time));
+    }
+    to_span(span)->finish_with_options(finish_span_options);
+    return 0;
+  } catch (const std::exception& e) {
+    return set_last_error(e);
+  }
+}
+
+//------------------------------------------------------------------------------
+// bridge_span_set_operation_name
+//------------------------------------------------------------------------------
+int bridge_span_set_operation_name(bridge_span_t* span,
+                                   const char* operation_name,
+                                   size_t operation_name_size) {
+  try {
+    to_span(span)->rename({operation_name, operation_name_size});
+    return 0;
+  } catch (const std::exception& e) {
+    return set_last_error(e);
+  }
+}
+
+//------------------------------------------------------------------------------
+// bridge_span_set_tag_string
+//------------------------------------------------------------------------------
+int bridge_span_set_tag_string(bridge_span_t* span, const char* key,
+                               size_t key_size, const char* value,
+                               size_t value_size) {
+  try {
+    auto lua_span = to_span(span);
+    auto& budget = lua_span->budget();
+    if (!budget.reserve(key_size)) {
+      return 0;
+    }
+    value_size = budget.string_length(value_size);
+    if (budget.reserve(value_size)) {
+      lua_span->add_tag({key, key_size}, std::string{value, value_size});
+    }
+    return 0;
+  } catch (const std::exception& e) {
+    return set_last_error(e);
+  }
+}
+
+//------------------------------------------------------------------------------
+// bridge_span_set_tag_number
+//------------------------------------------------------------------------------
+int bridge_span_set_tag_number(bridge_span_t* span, const char* key,
+                               size_t key_size, double value) {
+  try {
+    auto lua_span = to_span(span);
+    auto& budget = lua_span->budget();
+    if (budget.reserve(key_size) && budget.reserve(sizeof(value))) {
+      lua_span->add_tag({key, key_size}, value);
+    }
+    return 0;
+  } catch (const std::exception& e) {
+    return set_last_error(e);
+  }
+}
+
+//------------------------------------------------------------------------------
+// bridge_span_set_tag_bool
+//------------------------------------------------------------------------------
+int bridge_span_set_tag_bool(bridge_span_t* span, const char* key,
+                             size_t key_size, int value) {
+  try {
+    auto lua_span = to_span(span);
+    auto& budget = lua_span->budget();
+    if (budget.reserve(key_size) && budget.reserve(sizeof(bool))) {
+      lua_span->add_tag({key, key_size}, value != 0);
+    }
+    return 0;
+  } catch (const std::exception& e) {
+    return set_last_error(e);
+  }
+}
+
+//------------------------------------------------------------------------------
+// bridge_span_set_tag_int
+//------------------------------------------------------------------------------
+int bridge_span_set_tag_int(bridge_span_t* span, const char* key,
+                            size_t key_size, int64_t value) {
+  try {
+    auto lua_span = to_span(span);
+    auto& budget = lua_span->budget();
+    if (budget.reserve(key_size) && budget.reserve(sizeof(value))) {
+      lua_span->add_tag({key, key_size}, value);
+    }
+    return 0;
+  } catch (const std::exception& e) {
+    return set_last_error(e);
+  }
+}
+
+//------------------------------------------------------------------------------
+// bridge_span_set_tag_uint
+//------------------------------------------------------------------------------
+int bridge_span_set_tag_uint(bridge_span_t* span, const char* key,
+                             size_t key_size, uint64_t value) {
+  try {
+    auto lua_span = to_span(span);
+    auto& budget = lua_span->budget();
+    if (budget.reserve(key_size) && budget.reserve(sizeof(value))) {
+      lua_span->add_tag({key, key_size}, value);
+    }
+    return 0;
+  } catch (const std::exception& e) {
+    return set_last_error(e);
+  }
+}
+
+//------------------------------------------------------------------------------
+// bridge_span_set_constant_tags
+//------------------------------------------------------------------------------
+int bridge_span_set_constant_tags(bridge_span_t* span,
+                                  const bridge_tag_template_t* tag_template) {
+  try {
+    auto lua_span = to_span(span);
+    if (lua_span->is_shed()) {
+      return 0;
+    }
+    to_tag_template(tag_template)
+        ->apply_constant_tags(lua_span->budget(),
+                              [lua_span](const std::string& key,
+                                         const opentracing::Value& value) {
+                                lua_span->add_tag(key, value);
+                              });
+    return 0;
+  } catch (const std::exception& e) {
+    return set_last_error(e);
+  }
+}
+
+//------------------------------------------------------------------------------
+// bridge_tag_template_num_keys
+//------------------------------------------------------------------------------
+size_t bridge_tag_template_num_keys(const bridge_tag_template_t* tag_template) {
+  return to_tag_template(tag_template)->num_keys();
+}
+
+//------------------------------------------------------------------------------
+// bridge_tag_template_key
+//------------------------------------------------------------------------------
+const char* bridge_tag_template_key(const bridge_tag_template_t* tag_template,
+                                    size_t index, size_t* key_size) {
+  auto& key = to_tag_template(tag_template)->key(index);
+  *key_size = key.size();
+  return key.data();
+}
+
+//------------------------------------------------------------------------------
+// bridge_span_log_begin
+//------------------------------------------------------------------------------
+int bridge_span_log_begin(bridge_span_t* span) {
+  try {
+    auto lua_span = to_span(span);
+    if (!lua_span->accepts_log_record()) {
+      return 0;
+    }
+    if (pending_log_record.fields.capacity() == 0) {
+      pending_log_record.fields = LogRecordPool::instance().acquire_fields();
+    }
+    pending_log_record.fields.clear();
+    pending_log_record.span = lua_span;
+    pending_log_record.start_num_bytes = lua_span->budget().num_bytes();
+    pending_log_record.timestamp = std::chrono::system_clock::now();
+    return 1;
+  } catch (const std::exception& e) {
+    return set_last_error(e);
+  }
+}
+
+//------------------------------------------------------------------------------
+// bridge_span_log_string
+//------------------------------------------------------------------------------
+void bridge_span_log_string(bridge_span_t* span, const char* key,
+                            size_t key_size, const char* value,
+                            size_t value_size) {
+  try {
+    auto lua_span = to_span(span);
+    if (pending_log_record.span != lua_span) {
+      return;
+    }
+    value_size = lua_span->budget().string_length(value_size);
+    auto field = add_log_field(lua_span, key, key_size, value_size);
+    if (field != nullptr) {
+      field->second = std::string{value, value_size};
+    }
+  } catch (const std::exception& e) {
+    set_last_error(e);
+  }
+}
+
+//------------------------------------------------------------------------------
+// bridge_span_log_number
+//------------------------------------------------------------------------------
+void bridge_span_log_number(bridge_span_t* span, const char* key,
+                            size_t key_size, double value) {
+  try {
+    auto field = add_log_field(to_span(span), key, key_size, sizeof(value));
+    if (field != nullptr) {
+      field->second = value;
+    }
+  } catch (const std::exception& e) {
+    set_last_error(e);
+  }
+}
+
+//------------------------------------------------------------------------------
+// bridge_span_log_bool
+//------------------------------------------------------------------------------
+void bridge_span_log_bool(bridge_span_t* span, const char* key,
+                          size_t key_size, int value) {
+  try {
+    auto field = add_log_field(to_span(span), key, key_size, sizeof(bool));
+    if (field != nullptr) {
+      field->second = value != 0;
+    }
+  } catch (const std::exception& e) {
+    set_last_error(e);
+  }
+}
+
+//------------------------------------------------------------------------------
+// bridge_span_log_end
+//------------------------------------------------------------------------------
+int bridge_span_log_end(bridge_span_t* span) {
+  auto lua_span = to_span(span);
+  if (pending_log_record.span != lua_span) {
+    return 0;
+  }
+  pending_log_record.span = nullptr;
+  try {
+    auto num_bytes =
+        lua_span->budget().num_bytes() - pending_log_record.start_num_bytes;
+    lua_span->add_log_record(pending_log_record.timestamp,
+                             std::move(pending_log_record.fields), num_bytes);
+    pending_log_record.fields = LogRecordPool::Fields{};
+    return 0;
+  } catch (const std::exception& e) {
+    pending_log_record.fields.clear();
+    return set_last_error(e);
+  }
+}
+
+//------------------------------------------------------------------------------
+// bridge_span_set_baggage_item
+//------------------------------------------------------------------------------
+int bridge_span_set_baggage_item(bridge_span_t* span, const char* key,
+                                 size_t key_size, const char* value,
+                                 size_t value_size) {
+  try {
+    to_span(span)->span().SetBaggageItem({key, key_size}, {value, value_size});
+    return 0;
+  } catch (const std::exception& e) {
+    return set_last_error(e);
+  }
+}
+
+//------------------------------------------------------------------------------
+// bridge_span_baggage_item
+//------------------------------------------------------------------------------
+int bridge_span_baggage_item(bridge_span_t* span, const char* key,
+                             size_t key_size, char* buffer, size_t capacity,
+                             size_t* size) {
+  try {
+    auto baggage_item = to_span(span)->span().BaggageItem({key, key_size});
+    copy_out(baggage_item, buffer, capacity, size);
+    return 0;
+  } catch (const std::exception& e) {
+    return set_last_error(e);
+  }
+}
+
+//------------------------------------------------------------------------------
+// bridge_span_context
+//------------------------------------------------------------------------------
+bridge_span_context_t* bridge_span_context(bridge_span_t* span) {
+  try {
+    auto lua_span = to_span(span);
+    auto span_context = lua_span->make_context();
+    lua_span->handle()->state().add_c_span_context(span_context.get());
+    return reinterpret_cast<bridge_span_context_t*>(span_context.release());
+  } catch (const std::exception& e) {
+    set_last_error(e);
+  }
+  return nullptr;
+}
+
+//------------------------------------------------------------------------------
+// bridge_span_context_free
+//------------------------------------------------------------------------------
+void bridge_span_context_free(bridge_span_context_t* span_context) {
+  auto lua_span_context = to_span_context(span_context);
+  if (lua_span_context == nullptr) {
+    return;
+  }
+  lua_span_context->handle()->state().remove_c_span_context(lua_span_context);
+  delete lua_span_context;
+}
+}  // extern "C"
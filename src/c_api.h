@@ -0,0 +1,140 @@
+/* A C interface to the bridge's hot span operations.
+ *
+ * Calls from Lua into lua_CFunctions abort LuaJIT's trace compiler, so the
+ * module also exports these functions for the wrapper in
+ * lua/opentracing_bridge_tracer_ffi.lua to call through the FFI, which it can
+ * compile. Tracer handles are obtained from a Lua tracer with
+ * `tracer:c_tracer()` and share its state: limits, filters, span tracking, and
+ * statistics. `c_tracer` returns a userdata whose block holds the handle; the
+ * handle is freed along with the userdata, so keep a reference to it for as
+ * long as the handle is in use. Tag template handles are obtained the same
+ * way, with `tag_template:c_tag_template()`, and are valid for as long as the
+ * tag template is.
+ *
+ * Functions returning int return 0 on success and -1 on failure, with a
+ * description of the failure available from bridge_last_error. Timestamps are
+ * microseconds since the epoch, with 0 meaning now. Strings needn't be null
+ * terminated unless noted.
+ *
+ * The FFI wrapper declares these functions itself, so keep it in sync.
+ */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct bridge_tracer bridge_tracer_t;
+typedef struct bridge_span bridge_span_t;
+typedef struct bridge_span_context bridge_span_context_t;
+typedef struct bridge_tag_template bridge_tag_template_t;
+
+enum { BRIDGE_CHILD_OF = 0, BRIDGE_FOLLOWS_FROM = 1 };
+
+enum { BRIDGE_TEXT_MAP = 0, BRIDGE_HTTP_HEADERS = 1, BRIDGE_BINARY = 2 };
+
+/* The failure of the last call on this thread that returned an error. */
+const char* bridge_last_error(void);
+
+/* Identifies the Lua tracer a handle was obtained from. */
+const void* bridge_tracer_id(const bridge_tracer_t* tracer);
+
+/* Starts a span with an optional reference. `operation_name` must be null
+ * terminated. Returns null on failure. */
+bridge_span_t* bridge_tracer_start_span(bridge_tracer_t* tracer,
+                                        const char* operation_name,
+                                        const bridge_span_context_t* reference,
+                                        int reference_type, double start_time);
+
+/* Injects `span_context` into `buffer`, setting `size` to the bytes required.
+ * If that's more than `capacity`, the buffer isn't written and the call should
+ * be repeated with a larger one. Text map and HTTP header carriers are written
+ * as a key, a null, a value, and a null for each entry. */
+int bridge_tracer_inject(bridge_tracer_t* tracer,
+                         const bridge_span_context_t* span_context, int format,
+                         char* buffer, size_t capacity, size_t* size);
+
+/* Extracts a span context from a carrier encoded as bridge_tracer_inject
+ * writes it. Returns null if the carrier has no context, or on failure, in
+ * which case `error` is set to 1. */
+bridge_span_context_t* bridge_tracer_extract(bridge_tracer_t* tracer,
+                                             int format, const char* carrier,
+                                             size_t carrier_size, int* error);
+
+void bridge_span_free(bridge_span_t* span);
+
+const void* bridge_span_tracer_id(const bridge_span_t* span);
+
+int bridge_span_finish(bridge_span_t* span, double finish_time);
+
+int bridge_span_set_operation_name(bridge_span_t* span,
+                                   const char* operation_name,
+                                   size_t operation_name_size);
+
+int bridge_span_set_tag_string(bridge_span_t* span, const char* key,
+                               size_t key_size, const char* value,
+                               size_t value_size);
+
+int bridge_span_set_tag_number(bridge_span_t* span, const char* key,
+                               size_t key_size, double value);
+
+int bridge_span_set_tag_bool(bridge_span_t* span, const char* key,
+                             size_t key_size, int value);
+
+/* Set integer tags exactly, for values such as IDs that a double can't hold.
+ */
+int bridge_span_set_tag_int(bridge_span_t* span, const char* key,
+                            size_t key_size, int64_t value);
+
+int bridge_span_set_tag_uint(bridge_span_t* span, const char* key,
+                             size_t key_size, uint64_t value);
+
+/* Sets the constant tags of a tag template. Its positional tags are set by
+ * key, with the functions above. */
+int bridge_span_set_constant_tags(bridge_span_t* span,
+                                  const bridge_tag_template_t* tag_template);
+
+size_t bridge_tag_template_num_keys(const bridge_tag_template_t* tag_template);
+
+/* Returns the key of the positional tag `index`, setting `key_size`. */
+const char* bridge_tag_template_key(const bridge_tag_template_t* tag_template,
+                                    size_t index, size_t* key_size);
+
+/* Logs a record built from the fields added between bridge_span_log_begin and
+ * bridge_span_log_end. bridge_span_log_begin returns 0 if the record would be
+ * dropped, in which case the fields can be skipped. */
+int bridge_span_log_begin(bridge_span_t* span);
+
+void bridge_span_log_string(bridge_span_t* span, const char* key,
+                            size_t key_size, const char* value,
+                            size_t value_size);
+
+void bridge_span_log_number(bridge_span_t* span, const char* key,
+                            size_t key_size, double value);
+
+void bridge_span_log_bool(bridge_span_t* span, const char* key,
+                          size_t key_size, int value);
+
+int bridge_span_log_end(bridge_span_t* span);
+
+int bridge_span_set_baggage_item(bridge_span_t* span, const char* key,
+                                 size_t key_size, const char* value,
+                                 size_t value_size);
+
+/* Copies the baggage item to `buffer`, setting `size` the same way
+ * bridge_tracer_inject does. */
+int bridge_span_baggage_item(bridge_span_t* span, const char* key,
+                             size_t key_size, char* buffer, size_t capacity,
+                             size_t* size);
+
+/* Returns null on failure. */
+bridge_span_context_t* bridge_span_context(bridge_span_t* span);
+
+void bridge_span_context_free(bridge_span_context_t* span_context);
+
+#ifdef __cplusplus
+}  // extern "C"
+#endif
@@ -0,0 +1,174 @@
+#include "deferred_span.h"
+
+#include "utility.h"
+
+namespace lua_bridge_tracer {
+//------------------------------------------------------------------------------
+// EmptySpanContext
+//------------------------------------------------------------------------------
+namespace {
+// Handed out from `context()` if the tracer fails to start the span.
+class EmptySpanContext final : public opentracing::SpanContext {
+ public:
+  void ForeachBaggageItem(
+      std::function<bool(const std::string&, const std::string&)> /*f*/)
+      const override {}
+};
+}  // namespace
+
+static const EmptySpanContext empty_span_context{};
+
+//------------------------------------------------------------------------------
+// constructor
+//------------------------------------------------------------------------------
+DeferredSpan::DeferredSpan(
+    const opentracing::Tracer& tracer,
+    std::shared_ptr<const opentracing::Span> parent,
+    std::shared_ptr<SpanAggregatorSlot> parent_aggregator,
+    opentracing::string_view operation_name,
+    const opentracing::StartSpanOptions& options,
+    std::chrono::microseconds min_duration)
+    : tracer_{tracer},
+      parent_{std::move(parent)},
+      parent_aggregator_{std::move(parent_aggregator)},
+      operation_name_{operation_name},
+      min_duration_{min_duration},
+      options_{options} {
+  // The references point into `parent_`, which we keep alive, so they remain
+  // valid until the span is started.
+  fill_start_timestamps(options_.start_system_timestamp,
+                        options_.start_steady_timestamp);
+}
+
+//------------------------------------------------------------------------------
+// materialize
+//------------------------------------------------------------------------------
+opentracing::Span* DeferredSpan::materialize() const noexcept {
+  if (span_ != nullptr) {
+    return span_.get();
+  }
+  span_ = tracer_.StartSpanWithOptions(operation_name_, options_);
+  if (span_ == nullptr) {
+    return nullptr;
+  }
+  for (auto& baggage_item : baggage_) {
+    span_->SetBaggageItem(baggage_item.first, baggage_item.second);
+  }
+  return span_.get();
+}
+
+//------------------------------------------------------------------------------
+// FinishWithOptions
+//------------------------------------------------------------------------------
+void DeferredSpan::FinishWithOptions(
+    const opentracing::FinishSpanOptions& finish_span_options) noexcept {
+  if (finished_) {
+    return;
+  }
+  finished_ = true;
+  if (span_ == nullptr) {
+    auto finish_steady_timestamp = finish_span_options.finish_steady_timestamp;
+    if (finish_steady_timestamp == opentracing::SteadyTime{}) {
+      finish_steady_timestamp = opentracing::SteadyClock::now();
+    }
+    auto duration = finish_steady_timestamp - options_.start_steady_timestamp;
+    if (duration < min_duration_) {
+      if (parent_aggregator_ != nullptr) {
+        try {
+          parent_aggregator_->get()->RecordFiltered(duration);
+        } catch (const std::exception&) {
+          // Only the parent's count of filtered children is lost.
+        }
+      }
+      return;
+    }
+  }
+  auto span = materialize();
+  if (span != nullptr) {
+    span->FinishWithOptions(finish_span_options);
+  }
+}
+
+//------------------------------------------------------------------------------
+// SetOperationName
+//------------------------------------------------------------------------------
+void DeferredSpan::SetOperationName(
+    opentracing::string_view name) noexcept try {
+  if (span_ != nullptr) {
+    return span_->SetOperationName(name);
+  }
+  operation_name_ = name;
+} catch (const std::exception&) {
+}
+
+//------------------------------------------------------------------------------
+// SetTag
+//------------------------------------------------------------------------------
+void DeferredSpan::SetTag(opentracing::string_view key,
+                          const opentracing::Value& value) noexcept try {
+  if (span_ != nullptr) {
+    return span_->SetTag(key, value);
+  }
+  options_.tags.emplace_back(key, value);
+} catch (const std::exception&) {
+}
+
+//------------------------------------------------------------------------------
+// SetBaggageItem
+//------------------------------------------------------------------------------
+void DeferredSpan::SetBaggageItem(opentracing::string_view restricted_key,
+                                  opentracing::string_view value) noexcept try {
+  if (span_ != nullptr) {
+    return span_->SetBaggageItem(restricted_key, value);
+  }
+  baggage_.emplace_back(restricted_key, value);
+} catch (const std::exception&) {
+}
+
+//------------------------------------------------------------------------------
+// BaggageItem
+//------------------------------------------------------------------------------
+std::string DeferredSpan::BaggageItem(
+    opentracing::string_view restricted_key) const noexcept try {
+  if (span_ != nullptr) {
+    return span_->BaggageItem(restricted_key);
+  }
+  for (auto iter = baggage_.rbegin(); iter != baggage_.rend(); ++iter) {
+    if (iter->first == restricted_key) {
+      return iter->second;
+    }
+  }
+  if (parent_ != nullptr) {
+    return parent_->BaggageItem(restricted_key);
+  }
+  return {};
+} catch (const std::exception&) {
+  return {};
+}
+
+//------------------------------------------------------------------------------
+// Log
+//------------------------------------------------------------------------------
+void DeferredSpan::Log(
+    std::initializer_list<
+        std::pair<opentracing::string_view, opentracing::Value>>
+        fields) noexcept {
+  auto span = materialize();
+  if (span != nullptr) {
+    span->Log(fields);
+  }
+}
+
+//------------------------------------------------------------------------------
+// context
+//------------------------------------------------------------------------------
+const opentracing::SpanContext& DeferredSpan::context() const noexcept {
+  // Anything that needs the context, such as a child span or an inject call,
+  // needs the span to exist in the tracer.
+  auto span = materialize();
+  if (span == nullptr) {
+    return empty_span_context;
+  }
+  return span->context();
+}
+}  // namespace lua_bridge_tracer
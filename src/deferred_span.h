@@ -0,0 +1,68 @@
+#pragma once
+
+#include "span_aggregator.h"
+
+#include <opentracing/span.h>
+#include <opentracing/tracer.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace lua_bridge_tracer {
+// A span whose operation name has a duration filter configured. Starting the
+// span with the tracer is put off until it's known to be needed: when it
+// finishes after the filter's minimum duration or when its context is
+// requested. Spans that finish sooner never reach the tracer and are only
+// counted in their parent's tags.
+class DeferredSpan final : public opentracing::Span {
+ public:
+  // `tracer` must outlive the span, as it does when the span is held by a
+  // LuaSpan, whose TracerGenerationPtr pins it.
+  DeferredSpan(const opentracing::Tracer& tracer,
+               std::shared_ptr<const opentracing::Span> parent,
+               std::shared_ptr<SpanAggregatorSlot> parent_aggregator,
+               opentracing::string_view operation_name,
+               const opentracing::StartSpanOptions& options,
+               std::chrono::microseconds min_duration);
+
+  void FinishWithOptions(const opentracing::FinishSpanOptions&
+                             finish_span_options) noexcept override;
+
+  void SetOperationName(opentracing::string_view name) noexcept override;
+
+  void SetTag(opentracing::string_view key,
+              const opentracing::Value& value) noexcept override;
+
+  void SetBaggageItem(opentracing::string_view restricted_key,
+                      opentracing::string_view value) noexcept override;
+
+  std::string BaggageItem(opentracing::string_view restricted_key) const
+      noexcept override;
+
+  void Log(std::initializer_list<
+           std::pair<opentracing::string_view, opentracing::Value>>
+               fields) noexcept override;
+
+  const opentracing::SpanContext& context() const noexcept override;
+
+  const opentracing::Tracer& tracer() const noexcept override {
+    return tracer_;
+  }
+
+ private:
+  const opentracing::Tracer& tracer_;
+  std::shared_ptr<const opentracing::Span> parent_;
+  std::shared_ptr<SpanAggregatorSlot> parent_aggregator_;
+  std::string operation_name_;
+  std::chrono::microseconds min_duration_;
+  opentracing::StartSpanOptions options_;
+  std::vector<std::pair<std::string, std::string>> baggage_;
+  bool finished_ = false;
+
+  // Started lazily from `context()`, hence mutable.
+  mutable std::unique_ptr<opentracing::Span> span_;
+
+  opentracing::Span* materialize() const noexcept;
+};
+}  // namespace lua_bridge_tracer
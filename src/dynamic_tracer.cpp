@@ -4,6 +4,10 @@
 
 #include <stdexcept>
 
+// The bridge keeps a tracer alive for as long as any of its spans or span
+// contexts (see TracerGeneration), so they refer to it with plain pointers
+// rather than each taking a reference.
+
 namespace lua_bridge_tracer {
 //--------------------------------------------------------------------------------------------------
 // DynamicSpanContext
@@ -12,9 +16,9 @@ namespace {
 class DynamicSpanContext final : public opentracing::SpanContext {
  public:
   DynamicSpanContext(
-      std::shared_ptr<const opentracing::Tracer> tracer,
+      const opentracing::Tracer* tracer,
       std::unique_ptr<opentracing::SpanContext>&& span_context) noexcept
-      : tracer_{std::move(tracer)}, span_context_{std::move(span_context)} {}
+      : tracer_{tracer}, span_context_{std::move(span_context)} {}
 
   void ForeachBaggageItem(
       std::function<bool(const std::string&, const std::string&)> callback)
@@ -27,7 +31,7 @@ class DynamicSpanContext final : public opentracing::SpanContext {
   }
 
  private:
-  std::shared_ptr<const opentracing::Tracer> tracer_;
+  const opentracing::Tracer* tracer_;
   std::unique_ptr<opentracing::SpanContext> span_context_;
 
   friend class DynamicTracer;
@@ -40,12 +44,12 @@ class DynamicSpanContext final : public opentracing::SpanContext {
 namespace {
 class DynamicSpan final : public opentracing::Span {
  public:
-  DynamicSpan(std::shared_ptr<const opentracing::Tracer> tracer,
+  DynamicSpan(const opentracing::Tracer* tracer,
               std::unique_ptr<opentracing::Span>&& span) noexcept
-      : tracer_{std::move(tracer)}, span_{std::move(span)} {}
+      : tracer_{tracer}, span_{std::move(span)} {}
 
  private:
-  std::shared_ptr<const opentracing::Tracer> tracer_;
+  const opentracing::Tracer* tracer_;
   std::unique_ptr<opentracing::Span> span_;
 
   void FinishWithOptions(const opentracing::FinishSpanOptions&
@@ -92,8 +96,7 @@ class DynamicSpan final : public opentracing::Span {
 // DynamicTracer
 //------------------------------------------------------------------------------
 namespace {
-class DynamicTracer final : public opentracing::Tracer,
-                            public std::enable_shared_from_this<DynamicTracer> {
+class DynamicTracer final : public opentracing::Tracer {
  public:
   DynamicTracer(opentracing::DynamicTracingLibraryHandle&& handle,
                 std::shared_ptr<opentracing::Tracer>&& tracer) noexcept
@@ -119,7 +122,7 @@ class DynamicTracer final : public opentracing::Tracer,
       return nullptr;
     }
     return std::unique_ptr<opentracing::Span>{
-        new (std::nothrow) DynamicSpan(shared_from_this(), std::move(span))};
+        new (std::nothrow) DynamicSpan(this, std::move(span))};
   }
 
   opentracing::expected<void> Inject(const opentracing::SpanContext& sc,
@@ -191,8 +194,8 @@ class DynamicTracer final : public opentracing::Tracer,
     if (*span_context_maybe == nullptr) {
       return std::unique_ptr<opentracing::SpanContext>{};
     }
-    return std::unique_ptr<opentracing::SpanContext>{new DynamicSpanContext{
-        shared_from_this(), std::move(*span_context_maybe)}};
+    return std::unique_ptr<opentracing::SpanContext>{
+        new DynamicSpanContext{this, std::move(*span_context_maybe)}};
   }
 
   void Close() noexcept final { tracer_->Close(); }
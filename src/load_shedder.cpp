@@ -0,0 +1,134 @@
+#include "load_shedder.h"
+
+#include "stats.h"
+
+#include <cstdio>
+
+namespace lua_bridge_tracer {
+// The weight given to each new latency sample is 1 / 2^finish_latency_shift.
+static const int finish_latency_shift = 3;
+
+//------------------------------------------------------------------------------
+// ShedSpanContext
+//------------------------------------------------------------------------------
+namespace {
+class ShedSpanContext final : public opentracing::SpanContext {
+ public:
+  void ForeachBaggageItem(
+      std::function<bool(const std::string&, const std::string&)> /*f*/)
+      const override {}
+};
+}  // namespace
+
+static const ShedSpanContext shed_span_context;
+
+//------------------------------------------------------------------------------
+// is_shed
+//------------------------------------------------------------------------------
+bool is_shed(const opentracing::SpanContext& span_context) noexcept {
+  return &span_context == &shed_span_context;
+}
+
+//------------------------------------------------------------------------------
+// ShedSpan::context
+//------------------------------------------------------------------------------
+const opentracing::SpanContext& ShedSpan::context() const noexcept {
+  return shed_span_context;
+}
+
+//------------------------------------------------------------------------------
+// set_options
+//------------------------------------------------------------------------------
+void LoadShedder::set_options(const LoadSheddingOptions& options) noexcept {
+  options_ = options;
+  is_enabled_ =
+      options.max_finish_latency.count() > 0 || options.max_open_spans > 0;
+  if (options_.probe_interval == 0) {
+    options_.probe_interval = 1;
+  }
+  if (is_enabled_) {
+    update();
+  } else {
+    is_shedding_ = false;
+  }
+}
+
+//------------------------------------------------------------------------------
+// should_shed
+//------------------------------------------------------------------------------
+bool LoadShedder::should_shed() noexcept {
+  if (!is_shedding_) {
+    return false;
+  }
+  if (++num_shed_since_probe_ >= options_.probe_interval) {
+    num_shed_since_probe_ = 0;
+    return false;
+  }
+  ++num_shed_;
+  add_stat(stats().spans_shed);
+  return true;
+}
+
+//------------------------------------------------------------------------------
+// record_finish_latency
+//------------------------------------------------------------------------------
+void LoadShedder::record_finish_latency(
+    std::chrono::nanoseconds latency) noexcept {
+  finish_latency_ += (latency - finish_latency_) / (1 << finish_latency_shift);
+  update();
+}
+
+//------------------------------------------------------------------------------
+// is_overloaded
+//------------------------------------------------------------------------------
+bool LoadShedder::is_overloaded() const noexcept {
+  if (options_.max_finish_latency.count() > 0 &&
+      finish_latency_ > options_.max_finish_latency) {
+    return true;
+  }
+  return options_.max_open_spans > 0 &&
+         num_open_spans_ > options_.max_open_spans;
+}
+
+//------------------------------------------------------------------------------
+// has_recovered
+//------------------------------------------------------------------------------
+bool LoadShedder::has_recovered() const noexcept {
+  if (options_.max_finish_latency.count() > 0 &&
+      static_cast<double>(finish_latency_.count()) >=
+          options_.recover_ratio *
+              std::chrono::duration_cast<std::chrono::nanoseconds>(
+                  options_.max_finish_latency)
+                  .count()) {
+    return false;
+  }
+  return options_.max_open_spans == 0 ||
+         static_cast<double>(num_open_spans_) <
+             options_.recover_ratio * options_.max_open_spans;
+}
+
+//------------------------------------------------------------------------------
+// update
+//------------------------------------------------------------------------------
+// Starts or stops shedding. Transitions are rare, so each is logged to
+// stderr, which servers such as nginx send to their error log.
+void LoadShedder::update() noexcept {
+  if (!is_shedding_ && is_overloaded()) {
+    is_shedding_ = true;
+    num_shed_since_probe_ = 0;
+    num_shed_ = 0;
+    add_stat(stats().load_shedding_episodes);
+    std::fprintf(stderr,
+                 "opentracing_bridge_tracer: shedding root spans (finish "
+                 "latency %lldus, %zu spans in flight)\n",
+                 static_cast<long long>(finish_latency_.count() / 1000),
+                 num_open_spans_);
+  } else if (is_shedding_ && has_recovered()) {
+    is_shedding_ = false;
+    std::fprintf(stderr,
+                 "opentracing_bridge_tracer: stopped shedding after %llu "
+                 "root spans\n",
+                 static_cast<unsigned long long>(num_shed_));
+  }
+}
+}  // namespace lua_bridge_tracer
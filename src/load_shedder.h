@@ -0,0 +1,126 @@
+#pragma once
+
+#include <opentracing/span.h>
+#include <opentracing/tracer.h>
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+namespace lua_bridge_tracer {
+struct LoadSheddingOptions {
+  // The limits on each signal; zero leaves a signal unwatched.
+  std::chrono::microseconds max_finish_latency{0};
+  size_t max_open_spans = 0;
+
+  // Shedding stops once every watched signal is below this fraction of its
+  // limit.
+  double recover_ratio = 0.5;
+
+  // While shedding, one root span in this many is still traced, so that the
+  // finish latency keeps being measured.
+  uint64_t probe_interval = 100;
+};
+
+// Watches a tracer's backpressure, and past the configured limits sheds new
+// root spans, along with their descendants, so that tracing costs next to
+// nothing until the tracer catches up.
+//
+// The signals are the latency of finishing a span with the tracer, smoothed
+// with a moving average, and the number of spans in flight. Plugins expose
+// no queue depth through OpenTracing, but a reporter that's behind shows up
+// as a rise in one or the other.
+//
+// A shedder belongs to a single lua_State, so it isn't synchronized.
+class LoadShedder {
+ public:
+  // Starts watching, or stops if no signal is watched.
+  void set_options(const LoadSheddingOptions& options) noexcept;
+
+  bool is_enabled() const noexcept { return is_enabled_; }
+
+  bool is_shedding() const noexcept { return is_shedding_; }
+
+  // Whether a new root span should be shed.
+  bool should_shed() noexcept;
+
+  // Counts spans in flight, other than shed spans.
+  void open_span() noexcept {
+    ++num_open_spans_;
+    if (is_enabled_) {
+      update();
+    }
+  }
+
+  void close_span() noexcept {
+    --num_open_spans_;
+    if (is_enabled_) {
+      update();
+    }
+  }
+
+  void record_finish_latency(std::chrono::nanoseconds latency) noexcept;
+
+  std::chrono::nanoseconds finish_latency() const noexcept {
+    return finish_latency_;
+  }
+
+  size_t num_open_spans() const noexcept { return num_open_spans_; }
+
+ private:
+  LoadSheddingOptions options_;
+  bool is_enabled_ = false;
+  bool is_shedding_ = false;
+  std::chrono::nanoseconds finish_latency_{0};
+  size_t num_open_spans_ = 0;
+  uint64_t num_shed_since_probe_ = 0;
+  uint64_t num_shed_ = 0;
+
+  bool is_overloaded() const noexcept;
+
+  bool has_recovered() const noexcept;
+
+  void update() noexcept;
+};
+
+// Stands in for a span that's been shed. It never reaches the tracer.
+class ShedSpan final : public opentracing::Span {
+ public:
+  explicit ShedSpan(const opentracing::Tracer& tracer) noexcept
+      : tracer_{tracer} {}
+
+  void FinishWithOptions(
+      const opentracing::FinishSpanOptions& /*finish_span_options*/) noexcept
+      override {}
+
+  void SetOperationName(opentracing::string_view /*name*/) noexcept override {}
+
+  void SetTag(opentracing::string_view /*key*/,
+              const opentracing::Value& /*value*/) noexcept override {}
+
+  void SetBaggageItem(opentracing::string_view /*restricted_key*/,
+                      opentracing::string_view /*value*/) noexcept override {}
+
+  std::string BaggageItem(opentracing::string_view /*restricted_key*/) const
+      noexcept override {
+    return {};
+  }
+
+  void Log(std::initializer_list<
+           std::pair<opentracing::string_view, opentracing::Value>>
+           /*fields*/) noexcept override {}
+
+  const opentracing::SpanContext& context() const noexcept override;
+
+  const opentracing::Tracer& tracer() const noexcept override {
+    return tracer_;
+  }
+
+ private:
+  const opentracing::Tracer& tracer_;
+};
+
+// Whether `span_context` belongs to a shed span. Such contexts are never
+// injected, and spans referring to them are shed as well.
+bool is_shed(const opentracing::SpanContext& span_context) noexcept;
+}  // namespace lua_bridge_tracer
@@ -0,0 +1,69 @@
+#include "log_record_pool.h"
+
+namespace lua_bridge_tracer {
+//------------------------------------------------------------------------------
+// instance
+//------------------------------------------------------------------------------
+LogRecordPool& LogRecordPool::instance() noexcept {
+  static thread_local LogRecordPool pool;
+  return pool;
+}
+
+//------------------------------------------------------------------------------
+// acquire_records
+//------------------------------------------------------------------------------
+std::vector<opentracing::LogRecord> LogRecordPool::acquire_records() noexcept {
+  if (records_.empty()) {
+    return {};
+  }
+  auto result = std::move(records_.back());
+  records_.pop_back();
+  return result;
+}
+
+//------------------------------------------------------------------------------
+// acquire_fields
+//------------------------------------------------------------------------------
+LogRecordPool::Fields LogRecordPool::acquire_fields() noexcept {
+  if (fields_.empty()) {
+    return {};
+  }
+  auto result = std::move(fields_.back());
+  fields_.pop_back();
+  return result;
+}
+
+//------------------------------------------------------------------------------
+// release
+//------------------------------------------------------------------------------
+void LogRecordPool::release(
+    std::vector<opentracing::LogRecord>&& log_records) noexcept {
+  for (auto& log_record : log_records) {
+    release(std::move(log_record.fields));
+  }
+  if (log_records.capacity() == 0 ||
+      log_records.capacity() > max_record_buffer_capacity ||
+      records_.size() >= max_record_buffers) {
+    return;
+  }
+  log_records.clear();
+  try {
+    records_.emplace_back(std::move(log_records));
+  } catch (const std::exception&) {
+    // The buffer is simply freed if the pool can't grow.
+  }
+}
+
+void LogRecordPool::release(Fields&& fields) noexcept {
+  if (fields.capacity() == 0 || fields.capacity() > max_field_buffer_capacity ||
+      fields_.size() >= max_field_buffers) {
+    return;
+  }
+  fields.clear();
+  try {
+    fields_.emplace_back(std::move(fields));
+  } catch (const std::exception&) {
+    // The buffer is simply freed if the pool can't grow.
+  }
+}
+}  // namespace lua_bridge_tracer
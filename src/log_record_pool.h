@@ -0,0 +1,44 @@
+#pragma once
+
+#include <opentracing/span.h>
+
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace lua_bridge_tracer {
+// Recycles the buffers behind spans' log records.
+//
+// The opentracing::LogRecords handed to a tracer have to use std::allocator,
+// so rather than allocating them from an arena we keep the vectors they're
+// stored in once a span is done with them. Verbose spans then fill buffers
+// that already have capacity instead of growing new ones record by record.
+//
+// Pools are kept per thread so that they need no locking.
+class LogRecordPool {
+ public:
+  using Fields = std::vector<std::pair<std::string, opentracing::Value>>;
+
+  // Bound how much memory an idle pool holds on to.
+  static const size_t max_record_buffers = 64;
+  static const size_t max_record_buffer_capacity = 1024;
+  static const size_t max_field_buffers = 1024;
+  static const size_t max_field_buffer_capacity = 64;
+
+  static LogRecordPool& instance() noexcept;
+
+  std::vector<opentracing::LogRecord> acquire_records() noexcept;
+
+  Fields acquire_fields() noexcept;
+
+  // Returns the buffers of `log_records`, and of each record's fields, to the
+  // pool.
+  void release(std::vector<opentracing::LogRecord>&& log_records) noexcept;
+
+ private:
+  std::vector<std::vector<opentracing::LogRecord>> records_;
+  std::vector<Fields> fields_;
+
+  void release(Fields&& fields) noexcept;
+};
+}  // namespace lua_bridge_tracer
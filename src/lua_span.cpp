@@ -1,12 +1,24 @@
 #include "lua_span.h"
 
+#include "active_span.h"
+#include "log_record_pool.h"
 #include "lua_span_context.h"
+#include "lua_tag_template.h"
 #include "lua_tracer.h"
 #include "utility.h"
 
+#include <cmath>
+
 #define METATABLE "lua_opentracing_bridge.span"
 
 namespace lua_bridge_tracer {
+namespace {
+struct SpanWithAggregator {
+  std::unique_ptr<opentracing::Span> span;
+  SpanAggregatorSlot aggregator;
+};
+}  // namespace
+
 //------------------------------------------------------------------------------
 // check_lua_span
 //------------------------------------------------------------------------------
@@ -30,6 +42,273 @@ static opentracing::FinishSpanOptions get_finish_span_options(lua_State* L,
   return result;
 }
 
+//------------------------------------------------------------------------------
+// take_log_records
+//------------------------------------------------------------------------------
+std::vector<opentracing::LogRecord> LuaSpan::take_log_records() noexcept {
+  auto& counters = stats();
+  subtract_stat(counters.buffered_log_records,
+                static_cast<int64_t>(log_records_.size()));
+  subtract_stat(counters.buffered_log_bytes, static_cast<int64_t>(log_bytes_));
+  log_bytes_ = 0;
+  return std::move(log_records_);
+}
+
+//------------------------------------------------------------------------------
+// expire
+//------------------------------------------------------------------------------
+void LuaSpan::expire(ExpiredSpanAction action) noexcept {
+  handle_->state().span_registry().remove(*this);
+  is_expired_ = true;
+  is_finished_ = true;
+  handle_->state().load_shedder().close_span();
+  add_stat(stats().spans_expired);
+  opentracing::FinishSpanOptions finish_span_options;
+  finish_span_options.log_records = take_log_records();
+  // With `drop`, span_ is left as it is: contexts and aggregated children may
+  // still share it, so it's only destroyed with the last of them, and a
+  // plugin's destructor may then finish it without the tag or the logs.
+  if (action == ExpiredSpanAction::finish) {
+    try {
+      span_->SetTag("bridge.expired", true);
+      budget_.tag(*span_);
+      if (aggregator_ != nullptr) {
+        aggregator_->Flush(*span_);
+      }
+      PluginTimer timer;
+      span_->FinishWithOptions(finish_span_options);
+      handle_->state().count_finished_span();
+    } catch (const std::exception&) {
+      // The span is abandoned either way.
+    }
+  }
+  LogRecordPool::instance().release(std::move(finish_span_options.log_records));
+}
+
+//------------------------------------------------------------------------------
+// constructor
+//------------------------------------------------------------------------------
+LuaSpan::LuaSpan(const TracerHandlePtr& handle,
+                 std::unique_ptr<opentracing::Span>&& span,
+                 const SpanBudget& budget)
+    : LuaSpan{handle, std::shared_ptr<opentracing::Span>{}, budget} {
+  auto holder = std::make_shared<SpanWithAggregator>();
+  holder->span = std::move(span);
+  span_ = std::shared_ptr<opentracing::Span>{holder, holder->span.get()};
+  aggregator_ =
+      std::shared_ptr<SpanAggregatorSlot>{holder, &holder->aggregator};
+}
+
+//------------------------------------------------------------------------------
+// destructor
+//------------------------------------------------------------------------------
+LuaSpan::~LuaSpan() noexcept {
+  if (!is_finished_ && !is_shed_) {
+    add_stat(stats().spans_abandoned);
+    handle_->state().load_shedder().close_span();
+  }
+  handle_->state().span_registry().remove(*this);
+  LogRecordPool::instance().release(take_log_records());
+  subtract_stat(stats().live_spans);
+}
+
+//------------------------------------------------------------------------------
+// is_log_stream_due
+//------------------------------------------------------------------------------
+bool LuaSpan::is_log_stream_due(const LogStreaming& log_streaming) const
+    noexcept {
+  if (log_streaming.max_records > 0 &&
+      log_records_.size() >= log_streaming.max_records) {
+    return true;
+  }
+  if (log_streaming.max_bytes > 0 && log_bytes_ >= log_streaming.max_bytes) {
+    return true;
+  }
+  return log_streaming.max_age.count() > 0 &&
+         std::chrono::system_clock::now() - log_records_.front().timestamp >=
+             log_streaming.max_age;
+}
+
+//------------------------------------------------------------------------------
+// stream_log_records
+//------------------------------------------------------------------------------
+void LuaSpan::stream_log_records() noexcept {
+  auto num_log_records = log_records_.size();
+  opentracing::FinishSpanOptions finish_span_options;
+  finish_span_options.log_records = take_log_records();
+  num_streamed_log_records_ += num_log_records;
+  add_stat(stats().log_records_streamed,
+           static_cast<int64_t>(num_log_records));
+  try {
+    opentracing::StartSpanOptions start_span_options;
+    start_span_options.start_system_timestamp =
+        finish_span_options.log_records.front().timestamp;
+    fill_start_timestamps(start_span_options.start_system_timestamp,
+                          start_span_options.start_steady_timestamp);
+    start_span_options.references.emplace_back(
+        opentracing::SpanReferenceType::ChildOfRef, &span_->context());
+    PluginTimer timer;
+    auto span = span_->tracer().StartSpanWithOptions("log_stream",
+                                                     start_span_options);
+    if (span != nullptr) {
+      span->FinishWithOptions(finish_span_options);
+      ++num_log_streams_;
+      handle_->state().count_finished_span();
+    }
+  } catch (const std::exception& /*e*/) {
+    // Drop the records rather than let them build up.
+  }
+  LogRecordPool::instance().release(
+      std::move(finish_span_options.log_records));
+}
+
+//------------------------------------------------------------------------------
+// finish_with_options
+//------------------------------------------------------------------------------
+void LuaSpan::finish_with_options(
+    opentracing::FinishSpanOptions& finish_span_options, lua_State* L) {
+  if (is_expired_) {
+    return;
+  }
+  if (is_shed_) {
+    is_finished_ = true;
+    return;
+  }
+  handle_->state().span_registry().remove(*this);
+  finish_span_options.log_records = take_log_records();
+  if (profile_samples_ != nullptr) {
+    auto fields = LogRecordPool::instance().acquire_fields();
+    fields.emplace_back("event", "profile");
+    fields.emplace_back("profile.folded_stacks", profile_samples_->to_string());
+    finish_span_options.log_records.push_back(
+        {std::chrono::system_clock::now(), std::move(fields)});
+    profile_samples_ = nullptr;
+  }
+  if (cost_ != nullptr) {
+    cost_->finish(L, *span_);
+    cost_ = nullptr;
+  }
+  budget_.tag(*span_);
+  if (num_log_streams_ > 0) {
+    span_->SetTag("bridge.log_streams", static_cast<int64_t>(num_log_streams_));
+  }
+  if (aggregator_ != nullptr) {
+    aggregator_->Flush(*span_);
+  }
+  auto& load_shedder = handle_->state().load_shedder();
+  {
+    PluginTimer timer;
+    if (load_shedder.is_enabled()) {
+      auto start = std::chrono::steady_clock::now();
+      span_->FinishWithOptions(finish_span_options);
+      load_shedder.record_finish_latency(std::chrono::steady_clock::now() -
+                                         start);
+    } else {
+      span_->FinishWithOptions(finish_span_options);
+    }
+  }
+  if (!is_finished_) {
+    is_finished_ = true;
+    add_stat(stats().spans_finished);
+    handle_->state().count_finished_span();
+    load_shedder.close_span();
+  }
+
+  // Tracers copy what they need from the options, so the buffers can be
+  // reused.
+  LogRecordPool::instance().release(
+      std::move(finish_span_options.log_records));
+}
+
+//------------------------------------------------------------------------------
+// rename
+//------------------------------------------------------------------------------
+void LuaSpan::rename(opentracing::string_view operation_name) {
+  span_->SetOperationName(operation_name);
+  if (registry_entry_.is_registered) {
+    registry_entry_.operation_name.assign(operation_name.data(),
+                                          operation_name.size());
+  }
+}
+
+//------------------------------------------------------------------------------
+// add_tag
+//------------------------------------------------------------------------------
+void LuaSpan::add_tag(opentracing::string_view key,
+                      const opentracing::Value& value) {
+  span_->SetTag(key, value);
+  ++registry_entry_.num_tags;
+}
+
+//------------------------------------------------------------------------------
+// accepts_log_record
+//------------------------------------------------------------------------------
+bool LuaSpan::accepts_log_record() noexcept {
+  return !is_expired_ && !is_shed_ &&
+         !budget_.log_records_exceeded(num_streamed_log_records_ +
+                                       log_records_.size());
+}
+
+//------------------------------------------------------------------------------
+// add_log_record
+//------------------------------------------------------------------------------
+void LuaSpan::add_log_record(std::chrono::system_clock::time_point timestamp,
+                             LogRecordPool::Fields&& fields,
+                             size_t num_bytes) {
+  if (log_records_.capacity() == 0) {
+    log_records_ = LogRecordPool::instance().acquire_records();
+  }
+  log_records_.push_back({timestamp, std::move(fields)});
+  log_bytes_ += num_bytes;
+  auto& counters = stats();
+  add_stat(counters.buffered_log_records);
+  add_stat(counters.buffered_log_bytes, static_cast<int64_t>(num_bytes));
+  auto& log_streaming = handle_->state().log_streaming();
+  if (log_streaming.is_enabled() && is_log_stream_due(log_streaming)) {
+    stream_log_records();
+  }
+}
+
+//------------------------------------------------------------------------------
+// add_profile_sample
+//------------------------------------------------------------------------------
+void LuaSpan::add_profile_sample(const std::string& stack,
+                                 size_t max_stacks) {
+  if (is_finished_) {
+    return;
+  }
+  if (profile_samples_ == nullptr) {
+    profile_samples_ =
+        std::unique_ptr<FoldedStacks>{new FoldedStacks{max_stacks}};
+  }
+  profile_samples_->add(stack);
+}
+
+//------------------------------------------------------------------------------
+// make_context
+//------------------------------------------------------------------------------
+std::unique_ptr<LuaSpanContext> LuaSpan::make_context() {
+  return std::unique_ptr<LuaSpanContext>{
+      new LuaSpanContext{handle_, generation_, span_, aggregator_, cost_}};
+}
+
+//------------------------------------------------------------------------------
+// to_lua_span
+//------------------------------------------------------------------------------
+LuaSpan* LuaSpan::to_lua_span(lua_State* L, int index) noexcept {
+  if (index < 0) {
+    index = lua_gettop(L) + index + 1;
+  }
+  auto user_data = lua_touserdata(L, index);
+  if (user_data == nullptr || !lua_getmetatable(L, index)) {
+    return nullptr;
+  }
+  luaL_getmetatable(L, METATABLE);
+  auto is_span = lua_rawequal(L, -1, -2);
+  lua_pop(L, 2);
+  return is_span ? *static_cast<LuaSpan**>(user_data) : nullptr;
+}
+
 //------------------------------------------------------------------------------
 // free
 //------------------------------------------------------------------------------
@@ -46,8 +325,13 @@ int LuaSpan::set_operation_name(lua_State* L) noexcept {
   auto span = check_lua_span(L);
   size_t operation_name_len;
   auto operation_name_data = luaL_checklstring(L, -1, &operation_name_len);
-  span->span_->SetOperationName({operation_name_data, operation_name_len});
-  return 0;
+  try {
+    span->rename({operation_name_data, operation_name_len});
+    return 0;
+  } catch (const std::exception& e) {
+    lua_pushstring(L, e.what());
+  }
+  return lua_error(L);
 }
 
 //------------------------------------------------------------------------------
@@ -59,7 +343,8 @@ int LuaSpan::tracer(lua_State* L) noexcept {
       static_cast<LuaTracer**>(lua_newuserdata(L, sizeof(LuaTracer*)));
 
   try {
-    auto tracer = std::unique_ptr<LuaTracer>{new LuaTracer{span->tracer_}};
+    auto tracer = std::unique_ptr<LuaTracer>{
+        new LuaTracer{span->handle_}};
     *userdata = tracer.release();
 
     // tag the metatable
@@ -87,8 +372,8 @@ int LuaSpan::finish(lua_State* L) noexcept {
     if (num_arguments >= 2) {
       finish_span_options = get_finish_span_options(L, 2);
     }
-    finish_span_options.log_records = std::move(span->log_records_);
-    span->span_->FinishWithOptions(finish_span_options);
+    span->finish_with_options(finish_span_options, L);
+    pop_active_span(L, *span);
     return 0;
   } catch (const std::exception& e) {
     lua_pushstring(L, e.what());
@@ -104,9 +389,7 @@ int LuaSpan::context(lua_State* L) noexcept {
   auto userdata = static_cast<LuaSpanContext**>(
       lua_newuserdata(L, sizeof(LuaSpanContext*)));
   try {
-    auto lua_span_context =
-        std::unique_ptr<LuaSpanContext>{new LuaSpanContext{span->span_}};
-    *userdata = lua_span_context.release();
+    *userdata = span->make_context().release();
 
     luaL_getmetatable(L, LuaSpanContext::description.metatable);
     lua_setmetatable(L, -2);
@@ -125,10 +408,131 @@ int LuaSpan::set_tag(lua_State* L) noexcept {
   auto span = check_lua_span(L);
   size_t key_len;
   auto key_data = luaL_checklstring(L, -2, &key_len);
+  if (span->is_shed_) {
+    return 0;
+  }
   try {
     opentracing::string_view key{key_data, key_len};
-    auto value = to_value(L, -1);
-    span->span_->SetTag(key, std::move(value));
+    opentracing::Value value;
+    if (span->budget_.reserve(key_len) &&
+        to_value(L, -1, span->budget_, value)) {
+      span->add_tag(key, std::move(value));
+    }
+    return 0;
+  } catch (const std::exception& e) {
+    lua_pushstring(L, e.what());
+  }
+  return lua_error(L);
+}
+
+//------------------------------------------------------------------------------
+// check_int64
+//------------------------------------------------------------------------------
+static int64_t check_int64(lua_State* L, int index) noexcept {
+#if LUA_VERSION_NUM >= 503
+  if (lua_isinteger(L, index)) {
+    return static_cast<int64_t>(lua_tointeger(L, index));
+  }
+#endif
+  auto value = luaL_checknumber(L, index);
+  luaL_argcheck(L,
+                value == std::floor(value) && value >= -9223372036854775808.0 &&
+                    value < 9223372036854775808.0,
+                index, "integer expected");
+  return static_cast<int64_t>(value);
+}
+
+//------------------------------------------------------------------------------
+// check_uint64
+//------------------------------------------------------------------------------
+// Integers are taken as unsigned, so that IDs of 2^63 and above, which Lua 5.3
+// holds as negative integers, keep their value.
+static uint64_t check_uint64(lua_State* L, int index) noexcept {
+#if LUA_VERSION_NUM >= 503
+  if (lua_isinteger(L, index)) {
+    return static_cast<uint64_t>(lua_tointeger(L, index));
+  }
+#endif
+  auto value = luaL_checknumber(L, index);
+  luaL_argcheck(L,
+                value == std::floor(value) && value >= 0 &&
+                    value < 18446744073709551616.0,
+                index, "unsigned integer expected");
+  return static_cast<uint64_t>(value);
+}
+
+//------------------------------------------------------------------------------
+// set_integer_tag
+//------------------------------------------------------------------------------
+template <class T>
+static int set_integer_tag(lua_State* L, LuaSpan& span, const char* key,
+                           size_t key_len, T value) noexcept {
+  try {
+    auto& budget = span.budget();
+    if (budget.reserve(key_len) && budget.reserve(sizeof(value))) {
+      span.add_tag({key, key_len}, value);
+    }
+    return 0;
+  } catch (const std::exception& e) {
+    lua_pushstring(L, e.what());
+  }
+  return lua_error(L);
+}
+
+//------------------------------------------------------------------------------
+// set_tag_int
+//------------------------------------------------------------------------------
+int LuaSpan::set_tag_int(lua_State* L) noexcept {
+  auto span = check_lua_span(L);
+  size_t key_len;
+  auto key_data = luaL_checklstring(L, 2, &key_len);
+  auto value = check_int64(L, 3);
+  if (span->is_shed_) {
+    return 0;
+  }
+  return set_integer_tag(L, *span, key_data, key_len, value);
+}
+
+//------------------------------------------------------------------------------
+// set_tag_uint
+//------------------------------------------------------------------------------
+int LuaSpan::set_tag_uint(lua_State* L) noexcept {
+  auto span = check_lua_span(L);
+  size_t key_len;
+  auto key_data = luaL_checklstring(L, 2, &key_len);
+  auto value = check_uint64(L, 3);
+  if (span->is_shed_) {
+    return 0;
+  }
+  return set_integer_tag(L, *span, key_data, key_len, value);
+}
+
+//------------------------------------------------------------------------------
+// set_tags_with
+//------------------------------------------------------------------------------
+// Sets the tags of a tag template, taking the values of its positional tags
+// from the remaining arguments.
+int LuaSpan::set_tags_with(lua_State* L) noexcept {
+  auto span = check_lua_span(L);
+  auto tag_template = LuaTagTemplate::to_lua_tag_template(L, 2);
+  luaL_argcheck(L, tag_template != nullptr, 2, "tag template expected");
+  auto num_values = static_cast<size_t>(lua_gettop(L) - 2);
+  luaL_argcheck(L, num_values <= tag_template->num_keys(),
+                static_cast<int>(tag_template->num_keys()) + 3,
+                "more values than tag template keys");
+  if (span->is_shed_) {
+    return 0;
+  }
+  try {
+    auto add_tag = [span](const std::string& key,
+                          const opentracing::Value& value) {
+      span->add_tag(key, value);
+    };
+    tag_template->apply_constant_tags(span->budget_, add_tag);
+    for (size_t i = 0; i < num_values; ++i) {
+      tag_template->apply_tag(L, i, static_cast<int>(i) + 3, span->budget_,
+                              add_tag);
+    }
     return 0;
   } catch (const std::exception& e) {
     lua_pushstring(L, e.what());
@@ -143,10 +547,15 @@ int LuaSpan::log_kv(lua_State* L) noexcept {
   auto span = check_lua_span(L);
   luaL_checktype(L, -1, LUA_TTABLE);
   try {
-    opentracing::LogRecord log_record;
-    log_record.timestamp = std::chrono::system_clock::now();
-    log_record.fields = to_key_values(L, -1);
-    span->log_records_.push_back(log_record);
+    if (!span->accepts_log_record()) {
+      return 0;
+    }
+    auto timestamp = std::chrono::system_clock::now();
+    auto fields = LogRecordPool::instance().acquire_fields();
+    auto num_bytes = span->budget_.num_bytes();
+    to_key_values(L, -1, span->budget_, fields);
+    num_bytes = span->budget_.num_bytes() - num_bytes;
+    span->add_log_record(timestamp, std::move(fields), num_bytes);
     return 0;
   } catch (const std::exception& e) {
     lua_pushstring(L, e.what());
@@ -200,6 +609,9 @@ const LuaClassDescription LuaSpan::description = {
      {"set_operation_name", LuaSpan::set_operation_name},
      {"finish", LuaSpan::finish},
      {"set_tag", LuaSpan::set_tag},
+     {"set_tag_int", LuaSpan::set_tag_int},
+     {"set_tag_uint", LuaSpan::set_tag_uint},
+     {"set_tags_with", LuaSpan::set_tags_with},
      {"log_kv", LuaSpan::log_kv},
      {"set_baggage_item", LuaSpan::set_baggage_item},
      {"get_baggage_item", LuaSpan::get_baggage_item},
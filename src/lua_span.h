@@ -1,24 +1,142 @@
 #pragma once
 
+#include "log_record_pool.h"
 #include "lua_class_description.h"
+#include "span_aggregator.h"
+#include "span_budget.h"
+#include "span_cost.h"
+#include "span_profiler.h"
+#include "span_registry.h"
+#include "stats.h"
+#include "tracer_handle.h"
 
 #include <opentracing/tracer.h>
 
+#include <chrono>
 #include <memory>
 
 namespace lua_bridge_tracer {
+class LuaSpanContext;
+
 class LuaSpan {
  public:
-  explicit LuaSpan(const std::shared_ptr<opentracing::Tracer>& tracer,
-                   const std::shared_ptr<opentracing::Span>& span)
-      : tracer_{tracer}, span_{span} {}
+  // A span that can't have aggregated or filtered children, such as a
+  // ShedSpan.
+  LuaSpan(const TracerHandlePtr& handle,
+          const std::shared_ptr<opentracing::Span>& span,
+          const SpanBudget& budget)
+      : handle_{handle},
+        generation_{handle->generation()},
+        span_{span},
+        budget_{budget} {
+    add_stat(stats().live_spans);
+  }
+
+  // A span started by the tracer. It's kept in one allocation with the slot
+  // for its children's SpanAggregator.
+  LuaSpan(const TracerHandlePtr& handle,
+          std::unique_ptr<opentracing::Span>&& span, const SpanBudget& budget);
+
+  LuaSpan(const LuaSpan&) = delete;
+  LuaSpan& operator=(const LuaSpan&) = delete;
+
+  ~LuaSpan() noexcept;
 
   static const LuaClassDescription description;
 
+  // Returns the span at `index`, or nullptr if the value there isn't a span.
+  static LuaSpan* to_lua_span(lua_State* L, int index) noexcept;
+
+  SpanRegistryEntry& registry_entry() noexcept { return registry_entry_; }
+
+  const SpanRegistryEntry& registry_entry() const noexcept {
+    return registry_entry_;
+  }
+
+  size_t num_log_records() const noexcept { return log_records_.size(); }
+
+  size_t log_bytes() const noexcept { return log_bytes_; }
+
+  bool is_finished() const noexcept { return is_finished_; }
+
+  // Whether the span was made active by start_active_span.
+  bool is_active() const noexcept { return is_active_; }
+
+  void mark_active() noexcept { is_active_ = true; }
+
+  // Whether the span was shed under load, in which case it's a ShedSpan and
+  // its tags and logs are ignored.
+  bool is_shed() const noexcept { return is_shed_; }
+
+  void mark_shed() noexcept { is_shed_ = true; }
+
+  // Ends a span that's been in flight for too long. Later calls to `finish`
+  // are ignored.
+  void expire(ExpiredSpanAction action) noexcept;
+
+  // Finishes the span, adding its buffered log records to
+  // `finish_span_options`. `L`, if given, is used to measure the span's cost.
+  void finish_with_options(opentracing::FinishSpanOptions& finish_span_options,
+                           lua_State* L = nullptr);
+
+  // Measures the span's cost until it finishes.
+  void set_cost(std::shared_ptr<SpanCost>&& cost) noexcept {
+    cost_ = std::move(cost);
+  }
+
+  // The rest of the span's operations, for callers other than Lua such as
+  // the C API. Values must already be charged to budget().
+  SpanBudget& budget() noexcept { return budget_; }
+
+  opentracing::Span& span() noexcept { return *span_; }
+
+  const TracerHandlePtr& handle() const noexcept { return handle_; }
+
+  void rename(opentracing::string_view operation_name);
+
+  void add_tag(opentracing::string_view key, const opentracing::Value& value);
+
+  // Whether a log record added now would be kept.
+  bool accepts_log_record() noexcept;
+
+  // Buffers a log record whose fields were charged `num_bytes` bytes. Past
+  // the tracer's LogStreaming limits, the buffered records are streamed.
+  void add_log_record(std::chrono::system_clock::time_point timestamp,
+                      LogRecordPool::Fields&& fields, size_t num_bytes);
+
+  std::unique_ptr<LuaSpanContext> make_context();
+
+  // Counts a stack sampled while the span was in flight. The samples are
+  // logged when it finishes.
+  void add_profile_sample(const std::string& stack, size_t max_stacks);
+
  private:
-  std::shared_ptr<opentracing::Tracer> tracer_;
+  TracerHandlePtr handle_;
+  TracerGenerationPtr generation_;
   std::shared_ptr<opentracing::Span> span_;
+  SpanBudget budget_;
   std::vector<opentracing::LogRecord> log_records_;
+  size_t log_bytes_ = 0;
+  size_t num_streamed_log_records_ = 0;
+  uint64_t num_log_streams_ = 0;
+  bool is_finished_ = false;
+  bool is_expired_ = false;
+  bool is_active_ = false;
+  bool is_shed_ = false;
+  SpanRegistryEntry registry_entry_;
+  std::shared_ptr<SpanAggregatorSlot> aggregator_;
+  std::unique_ptr<FoldedStacks> profile_samples_;
+  std::shared_ptr<SpanCost> cost_;
+
+  // Moves out the span's log records, removing them from
+  // Stats::buffered_log_records and Stats::buffered_log_bytes.
+  std::vector<opentracing::LogRecord> take_log_records() noexcept;
+
+  bool is_log_stream_due(const LogStreaming& log_streaming) const noexcept;
+
+  // Passes the buffered log records to the tracer in a child span, since
+  // OpenTracing's Span::Log can't be given their timestamps.
+  void stream_log_records() noexcept;
 
   static int free(lua_State* L) noexcept;
 
@@ -32,6 +150,12 @@ class LuaSpan {
 
   static int set_tag(lua_State* L) noexcept;
 
+  static int set_tag_int(lua_State* L) noexcept;
+
+  static int set_tag_uint(lua_State* L) noexcept;
+
+  static int set_tags_with(lua_State* L) noexcept;
+
   static int log_kv(lua_State* L) noexcept;
 
   static int set_baggage_item(lua_State* L) noexcept;
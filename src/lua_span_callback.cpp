@@ -0,0 +1,187 @@
+#include "lua_span_callback.h"
+
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+
+extern "C" {
+#include <lauxlib.h>
+}  // extern "C"
+
+namespace lua_bridge_tracer {
+// Bounds the stack used to convert nested values.
+static const int max_value_depth = 64;
+
+namespace {
+struct CallbackArguments {
+  int function_reference;
+  const SpanRecord* record;
+  const std::vector<opentracing::LogRecord>* log_records;
+};
+}  // namespace
+
+//------------------------------------------------------------------------------
+// push_id
+//------------------------------------------------------------------------------
+static void push_id(lua_State* L, uint64_t high, uint64_t low) {
+  char id[40];
+  if (high == 0) {
+    std::snprintf(id, sizeof(id), "%016" PRIx64, low);
+  } else {
+    std::snprintf(id, sizeof(id), "%016" PRIx64 "%016" PRIx64, high, low);
+  }
+  lua_pushstring(L, id);
+}
+
+//------------------------------------------------------------------------------
+// push_value
+//------------------------------------------------------------------------------
+static void push_value(lua_State* L, const opentracing::Value& value,
+                       int depth) {
+  luaL_checkstack(L, 3, "span value too deeply nested");
+  if (value.is<bool>()) {
+    lua_pushboolean(L, static_cast<int>(value.get<bool>()));
+  } else if (value.is<double>()) {
+    lua_pushnumber(L, value.get<double>());
+  } else if (value.is<int64_t>()) {
+#if LUA_VERSION_NUM >= 503
+    lua_pushinteger(L, static_cast<lua_Integer>(value.get<int64_t>()));
+#else
+    lua_pushnumber(L, static_cast<lua_Number>(value.get<int64_t>()));
+#endif
+  } else if (value.is<uint64_t>()) {
+    lua_pushnumber(L, static_cast<lua_Number>(value.get<uint64_t>()));
+  } else if (value.is<std::string>()) {
+    auto& s = value.get<std::string>();
+    lua_pushlstring(L, s.data(), s.size());
+  } else if (value.is<const char*>()) {
+    lua_pushstring(L, value.get<const char*>());
+  } else if (value.is<opentracing::Values>() && depth < max_value_depth) {
+    auto& values = value.get<opentracing::Values>();
+    lua_createtable(L, static_cast<int>(values.size()), 0);
+    int index = 1;
+    for (auto& element : values) {
+      push_value(L, element, depth + 1);
+      lua_rawseti(L, -2, index++);
+    }
+  } else if (value.is<opentracing::Dictionary>() && depth < max_value_depth) {
+    auto& dictionary = value.get<opentracing::Dictionary>();
+    lua_createtable(L, 0, static_cast<int>(dictionary.size()));
+    for (auto& element : dictionary) {
+      lua_pushlstring(L, element.first.data(), element.first.size());
+      push_value(L, element.second, depth + 1);
+      lua_rawset(L, -3);
+    }
+  } else {
+    lua_pushnil(L);
+  }
+}
+
+//------------------------------------------------------------------------------
+// push_log_record
+//------------------------------------------------------------------------------
+static void push_log_record(lua_State* L,
+                            const opentracing::LogRecord& log_record) {
+  lua_createtable(L, 0, 2);
+  lua_pushnumber(L, static_cast<lua_Number>(
+                        std::chrono::duration_cast<std::chrono::microseconds>(
+                            log_record.timestamp.time_since_epoch())
+                            .count()));
+  lua_setfield(L, -2, "timestamp");
+  lua_createtable(L, 0, static_cast<int>(log_record.fields.size()));
+  for (auto& field : log_record.fields) {
+    lua_pushlstring(L, field.first.data(), field.first.size());
+    push_value(L, field.second, 0);
+    lua_rawset(L, -3);
+  }
+  lua_setfield(L, -2, "fields");
+}
+
+//------------------------------------------------------------------------------
+// call_callback
+//------------------------------------------------------------------------------
+// Builds the span's table and calls the function. It runs as a protected call
+// so that running out of memory, or an error from the function, doesn't
+// escape.
+static int call_callback(lua_State* L) {
+  auto& arguments = *static_cast<CallbackArguments*>(lua_touserdata(L, 1));
+  auto& record = *arguments.record;
+  lua_rawgeti(L, LUA_REGISTRYINDEX, arguments.function_reference);
+  lua_createtable(L, 0, 10);
+
+  push_id(L, record.trace_id_high, record.trace_id_low);
+  lua_setfield(L, -2, "trace_id");
+  push_id(L, 0, record.span_id);
+  lua_setfield(L, -2, "span_id");
+  if (record.parent_span_id != 0) {
+    push_id(L, 0, record.parent_span_id);
+    lua_setfield(L, -2, "parent_span_id");
+    lua_pushstring(L, record.follows_from ? "follows_from" : "child_of");
+    lua_setfield(L, -2, "reference_type");
+  }
+  lua_pushlstring(L, record.operation_name.data(),
+                  record.operation_name.size());
+  lua_setfield(L, -2, "operation_name");
+  lua_pushnumber(L, static_cast<lua_Number>(record.start_timestamp));
+  lua_setfield(L, -2, "start_timestamp");
+  lua_pushnumber(L, static_cast<lua_Number>(record.duration_ns));
+  lua_setfield(L, -2, "duration_ns");
+
+  lua_createtable(L, 0, static_cast<int>(record.tags.size()));
+  for (auto& tag : record.tags) {
+    lua_pushlstring(L, tag.first.data(), tag.first.size());
+    push_value(L, tag.second, 0);
+    lua_rawset(L, -3);
+  }
+  lua_setfield(L, -2, "tags");
+
+  auto& log_records = *arguments.log_records;
+  lua_createtable(L, static_cast<int>(record.logs.size() + log_records.size()),
+                  0);
+  int index = 1;
+  for (auto& log_record : record.logs) {
+    push_log_record(L, log_record);
+    lua_rawseti(L, -2, index++);
+  }
+  for (auto& log_record : log_records) {
+    push_log_record(L, log_record);
+    lua_rawseti(L, -2, index++);
+  }
+  lua_setfield(L, -2, "logs");
+
+  lua_call(L, 1, 0);
+  return 0;
+}
+
+//------------------------------------------------------------------------------
+// constructor
+//------------------------------------------------------------------------------
+LuaSpanCallback::LuaSpanCallback(lua_State* L, int index) {
+  lua_pushvalue(L, index);
+  function_reference_ = luaL_ref(L, LUA_REGISTRYINDEX);
+  thread_ = lua_newthread(L);
+  thread_reference_ = luaL_ref(L, LUA_REGISTRYINDEX);
+}
+
+//------------------------------------------------------------------------------
+// destructor
+//------------------------------------------------------------------------------
+LuaSpanCallback::~LuaSpanCallback() {
+  luaL_unref(thread_, LUA_REGISTRYINDEX, function_reference_);
+  luaL_unref(thread_, LUA_REGISTRYINDEX, thread_reference_);
+}
+
+//------------------------------------------------------------------------------
+// operator()
+//------------------------------------------------------------------------------
+void LuaSpanCallback::operator()(
+    const SpanRecord& record,
+    const std::vector<opentracing::LogRecord>& log_records) noexcept {
+  CallbackArguments arguments{function_reference_, &record, &log_records};
+  auto top = lua_gettop(thread_);
+  lua_pushcfunction(thread_, call_callback);
+  lua_pushlightuserdata(thread_, static_cast<void*>(&arguments));
+  lua_pcall(thread_, 1, 0, 0);
+  lua_settop(thread_, top);
+}
+}  // namespace lua_bridge_tracer
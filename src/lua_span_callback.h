@@ -0,0 +1,36 @@
+#pragma once
+
+#include "span_record.h"
+
+#include <vector>
+
+extern "C" {
+#include <lua.h>
+}  // extern "C"
+
+namespace lua_bridge_tracer {
+// Calls a Lua function with each span a native tracer finishes, as a table.
+//
+// The function is called on a Lua thread of its own, so that it can run while
+// whichever coroutine finished the span is in the middle of a call. Errors it
+// raises are ignored.
+class LuaSpanCallback {
+ public:
+  // Anchors the function at `index`.
+  LuaSpanCallback(lua_State* L, int index);
+
+  LuaSpanCallback(const LuaSpanCallback&) = delete;
+  LuaSpanCallback& operator=(const LuaSpanCallback&) = delete;
+
+  ~LuaSpanCallback();
+
+  void operator()(
+      const SpanRecord& record,
+      const std::vector<opentracing::LogRecord>& log_records) noexcept;
+
+ private:
+  lua_State* thread_;
+  int thread_reference_;
+  int function_reference_;
+};
+}  // namespace lua_bridge_tracer
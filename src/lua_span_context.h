@@ -1,6 +1,10 @@
 #pragma once
 
 #include "lua_class_description.h"
+#include "span_aggregator.h"
+#include "span_cost.h"
+#include "stats.h"
+#include "tracer_handle.h"
 
 #include <opentracing/span.h>
 
@@ -15,12 +19,33 @@ class LuaSpanContext {
   //
   // So when the opentracing::SpanContext is referenced we need to hold an
   // std::shared_ptr to the opentracing::Span to ensure that it isn't freed.
-  explicit LuaSpanContext(const std::shared_ptr<const opentracing::Span>& span)
-      : span_{span} {}
+  //
+  // Contexts also pin the generation of the tracer they came from, which
+  // keeps it, and the plugin behind it, loaded.
+  LuaSpanContext(
+      const TracerHandlePtr& handle, const TracerGenerationPtr& generation,
+      const std::shared_ptr<const opentracing::Span>& span,
+      const std::shared_ptr<SpanAggregatorSlot>& aggregator = nullptr,
+      const std::shared_ptr<SpanCost>& cost = nullptr)
+      : handle_{handle},
+        generation_{generation},
+        span_{span},
+        aggregator_{aggregator},
+        cost_{cost} {
+    add_stat(stats().live_span_contexts);
+  }
+
+  LuaSpanContext(const TracerHandlePtr& handle,
+                 std::unique_ptr<const opentracing::SpanContext>&& span_context)
+      : handle_{handle},
+        generation_{handle->generation()},
+        span_context_{std::move(span_context)} {
+    add_stat(stats().live_span_contexts);
+  }
+
+  LuaSpanContext& operator=(const LuaSpanContext&) = delete;
 
-  explicit LuaSpanContext(
-      std::unique_ptr<const opentracing::SpanContext>&& span_context)
-      : span_context_{std::move(span_context)} {}
+  ~LuaSpanContext() noexcept { subtract_stat(stats().live_span_contexts); }
 
   static const LuaClassDescription description;
 
@@ -29,9 +54,51 @@ class LuaSpanContext {
     return *span_context_;
   }
 
+  const TracerHandlePtr& handle() const noexcept { return handle_; }
+
+  // The span the context was obtained from, or nullptr if it was extracted.
+  const std::shared_ptr<const opentracing::Span>& span() const noexcept {
+    return span_;
+  }
+
+  // Returns another object referring to the same context.
+  std::unique_ptr<LuaSpanContext> clone() const {
+    return std::unique_ptr<LuaSpanContext>{new LuaSpanContext{*this}};
+  }
+
+  // Collects children started with the `aggregate` option, and those
+  // dropped by a duration filter. nullptr if the context can't have such
+  // children.
+  const std::shared_ptr<SpanAggregatorSlot>& aggregator() const noexcept {
+    return aggregator_;
+  }
+
+  // Whether the context's span was started with the `aggregate` option, in
+  // which case the context is its parent's and can't be referenced.
+  bool is_aggregated() const noexcept {
+    return span_ != nullptr && lua_bridge_tracer::is_aggregated(*span_);
+  }
+
+  // The cost of the context's span, if it's being measured.
+  const std::shared_ptr<SpanCost>& cost() const noexcept { return cost_; }
+
  private:
+  TracerHandlePtr handle_;
+  TracerGenerationPtr generation_;
   std::shared_ptr<const opentracing::Span> span_;
-  std::unique_ptr<const opentracing::SpanContext> span_context_;
+  std::shared_ptr<const opentracing::SpanContext> span_context_;
+  std::shared_ptr<SpanAggregatorSlot> aggregator_;
+  std::shared_ptr<SpanCost> cost_;
+
+  LuaSpanContext(const LuaSpanContext& other)
+      : handle_{other.handle_},
+        generation_{other.generation_},
+        span_{other.span_},
+        span_context_{other.span_context_},
+        aggregator_{other.aggregator_},
+        cost_{other.cost_} {
+    add_stat(stats().live_span_contexts);
+  }
 
   static int free(lua_State* L) noexcept;
 };
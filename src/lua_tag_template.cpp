@@ -0,0 +1,108 @@
+#include "lua_tag_template.h"
+
+#include <stdexcept>
+
+#define METATABLE "lua_opentracing_bridge.tag_template"
+
+namespace lua_bridge_tracer {
+//------------------------------------------------------------------------------
+// check_lua_tag_template
+//------------------------------------------------------------------------------
+static LuaTagTemplate* check_lua_tag_template(lua_State* L) noexcept {
+  void* user_data = luaL_checkudata(L, 1, METATABLE);
+  luaL_argcheck(L, user_data != NULL, 1, "`" METATABLE "' expected");
+  return *static_cast<LuaTagTemplate**>(user_data);
+}
+
+//------------------------------------------------------------------------------
+// constructor
+//------------------------------------------------------------------------------
+LuaTagTemplate::LuaTagTemplate(lua_State* L, int index,
+                               const SpanLimits& limits) {
+  if (index < 0) {
+    index = lua_gettop(L) + index + 1;
+  }
+  auto num_keys = get_table_len(L, index);
+  keys_.reserve(num_keys);
+  for (int i = 1; i < static_cast<int>(num_keys) + 1; ++i) {
+    lua_rawgeti(L, index, i);
+    if (lua_type(L, -1) != LUA_TSTRING) {
+      lua_pop(L, 1);
+      throw std::runtime_error{"tag template keys must be strings"};
+    }
+    size_t key_len;
+    auto key = lua_tolstring(L, -1, &key_len);
+    keys_.emplace_back(key, key_len);
+    lua_pop(L, 1);
+  }
+
+  // Constant tags are charged to each span they're applied to, so only the
+  // per-value limits apply here.
+  auto constant_limits = limits;
+  constant_limits.max_bytes = 0;
+  lua_pushnil(L);
+  while (lua_next(L, index)) {
+    if (lua_type(L, -2) != LUA_TSTRING) {
+      lua_pop(L, 1);
+      continue;
+    }
+    size_t key_len;
+    auto key = lua_tolstring(L, -2, &key_len);
+    SpanBudget budget{constant_limits};
+    ConstantTag tag;
+    if (to_value(L, -1, budget, tag.value)) {
+      tag.key.assign(key, key_len);
+      tag.num_bytes = key_len + budget.num_bytes();
+      constant_tags_.emplace_back(std::move(tag));
+    }
+    lua_pop(L, 1);
+  }
+}
+
+//------------------------------------------------------------------------------
+// to_lua_tag_template
+//------------------------------------------------------------------------------
+LuaTagTemplate* LuaTagTemplate::to_lua_tag_template(lua_State* L,
+                                                    int index) noexcept {
+  if (index < 0) {
+    index = lua_gettop(L) + index + 1;
+  }
+  auto user_data = lua_touserdata(L, index);
+  if (user_data == nullptr || !lua_getmetatable(L, index)) {
+    return nullptr;
+  }
+  luaL_getmetatable(L, METATABLE);
+  auto is_tag_template = lua_rawequal(L, -1, -2);
+  lua_pop(L, 2);
+  return is_tag_template ? *static_cast<LuaTagTemplate**>(user_data)
+                         : nullptr;
+}
+
+//------------------------------------------------------------------------------
+// free
+//------------------------------------------------------------------------------
+int LuaTagTemplate::free(lua_State* L) noexcept {
+  auto tag_template = check_lua_tag_template(L);
+  delete tag_template;
+  return 0;
+}
+
+//------------------------------------------------------------------------------
+// c_tag_template
+//------------------------------------------------------------------------------
+// Returns a handle to the template for the C API (see c_api.h), valid for as
+// long as the template is.
+int LuaTagTemplate::c_tag_template(lua_State* L) noexcept {
+  auto tag_template = check_lua_tag_template(L);
+  lua_pushlightuserdata(L, static_cast<void*>(tag_template));
+  return 1;
+}
+
+//------------------------------------------------------------------------------
+// description
+//------------------------------------------------------------------------------
+const LuaClassDescription LuaTagTemplate::description = {
+    METATABLE,
+    LuaTagTemplate::free,
+    {{"c_tag_template", LuaTagTemplate::c_tag_template}, {nullptr, nullptr}}};
+}  // namespace lua_bridge_tracer
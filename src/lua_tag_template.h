@@ -0,0 +1,80 @@
+#pragma once
+
+#include "lua_class_description.h"
+#include "span_budget.h"
+#include "utility.h"
+
+#include <opentracing/value.h>
+
+#include <string>
+#include <vector>
+
+namespace lua_bridge_tracer {
+// A set of tag keys, and of tags with constant values, compiled once by
+// tracer:tag_template so that spans can be tagged with values given by
+// position, without building a table of tags or converting keys for each
+// span.
+class LuaTagTemplate {
+ public:
+  // Compiles the template table at `index`: its array entries are the keys of
+  // the positional tags, and its other string keys are constant tags, whose
+  // values are converted with `limits`.
+  LuaTagTemplate(lua_State* L, int index, const SpanLimits& limits);
+
+  LuaTagTemplate(const LuaTagTemplate&) = delete;
+  LuaTagTemplate& operator=(const LuaTagTemplate&) = delete;
+
+  static const LuaClassDescription description;
+
+  // Returns the template at `index`, or nullptr if the value there isn't one.
+  static LuaTagTemplate* to_lua_tag_template(lua_State* L, int index) noexcept;
+
+  size_t num_keys() const noexcept { return keys_.size(); }
+
+  // The key of the positional tag `position`.
+  const std::string& key(size_t position) const noexcept {
+    return keys_[position];
+  }
+
+  // Passes each constant tag that fits in `budget` to `f`.
+  template <class F>
+  void apply_constant_tags(SpanBudget& budget, F f) const {
+    for (auto& tag : constant_tags_) {
+      if (budget.reserve(tag.num_bytes)) {
+        f(tag.key, tag.value);
+      }
+    }
+  }
+
+  // Converts the value at `index` for the positional tag `position`, passing
+  // it to `f` if it fits in `budget`. Nil values are skipped.
+  template <class F>
+  void apply_tag(lua_State* L, size_t position, int index, SpanBudget& budget,
+                 F f) const {
+    if (lua_isnil(L, index)) {
+      return;
+    }
+    auto& key = keys_[position];
+    opentracing::Value value;
+    if (budget.reserve(key.size()) && to_value(L, index, budget, value)) {
+      f(key, value);
+    }
+  }
+
+ private:
+  struct ConstantTag {
+    std::string key;
+    opentracing::Value value;
+
+    // The bytes charged to a span's budget for the tag.
+    size_t num_bytes;
+  };
+
+  std::vector<std::string> keys_;
+  std::vector<ConstantTag> constant_tags_;
+
+  static int free(lua_State* L) noexcept;
+
+  static int c_tag_template(lua_State* L) noexcept;
+};
+}  // namespace lua_bridge_tracer
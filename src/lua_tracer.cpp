@@ -1,18 +1,31 @@
 #include "lua_tracer.h"
 
+#include "active_span.h"
 #include "carrier.h"
+#include "deferred_span.h"
 #include "dynamic_tracer.h"
 #include "lua_span.h"
+#include "lua_span_callback.h"
 #include "lua_span_context.h"
+#include "lua_tag_template.h"
+#include "lua_tracer_drain.h"
+#include "native_tracer.h"
 #include "utility.h"
 
 #include <opentracing/dynamic_load.h>
 
+#include <algorithm>
+#include <cmath>
 #include <cstdint>
+#include <limits>
 #include <sstream>
 #include <stdexcept>
+#include <type_traits>
 
 #define METATABLE "lua_opentracing_bridge.tracer"
+#define C_TRACER_METATABLE "lua_opentracing_bridge.c_tracer"
+
+static const size_t default_span_ring_capacity = 16 * 1024 * 1024;
 
 namespace lua_bridge_tracer {
 //------------------------------------------------------------------------------
@@ -45,8 +58,7 @@ static opentracing::SpanReferenceType get_reference_type(lua_State* L) {
 //------------------------------------------------------------------------------
 // get_span_context
 //------------------------------------------------------------------------------
-static const opentracing::SpanContext& get_span_context(lua_State* L,
-                                                        int index) {
+static const LuaSpanContext& get_lua_span_context(lua_State* L, int index) {
   void* user_data =
       luaL_checkudata(L, index, LuaSpanContext::description.metatable);
   if (user_data == nullptr) {
@@ -55,8 +67,12 @@ static const opentracing::SpanContext& get_span_context(lua_State* L,
         std::string{LuaSpanContext::description.metatable}};
   }
 
-  auto span_context = *static_cast<LuaSpanContext**>(user_data);
-  return span_context->span_context();
+  return **static_cast<LuaSpanContext**>(user_data);
+}
+
+static const opentracing::SpanContext& get_span_context(lua_State* L,
+                                                        int index) {
+  return get_lua_span_context(L, index).span_context();
 }
 
 //------------------------------------------------------------------------------
@@ -91,10 +107,14 @@ get_reference(lua_State* L) {
   lua_pushinteger(L, 2);
   lua_gettable(L, -2);
 
-  auto& span_context = get_span_context(L, -1);
+  auto& span_context = get_lua_span_context(L, -1);
   lua_pop(L, 1);
+  if (span_context.is_aggregated()) {
+    throw std::runtime_error{
+        "spans started with `aggregate` can't be referenced"};
+  }
 
-  return {reference_type, &span_context};
+  return {reference_type, &span_context.span_context()};
 }
 
 //------------------------------------------------------------------------------
@@ -132,7 +152,7 @@ get_references(lua_State* L) {
 // get_tags
 //------------------------------------------------------------------------------
 static std::vector<std::pair<std::string, opentracing::Value>> get_tags(
-    lua_State* L) {
+    lua_State* L, SpanBudget& budget) {
   switch (lua_type(L, -1)) {
     case LUA_TTABLE:
       break;
@@ -142,14 +162,62 @@ static std::vector<std::pair<std::string, opentracing::Value>> get_tags(
     default:
       throw std::runtime_error{"tags must be a table"};
   }
-  return to_key_values(L, -1);
+  std::vector<std::pair<std::string, opentracing::Value>> result;
+  to_key_values(L, -1, budget, result);
+  return result;
+}
+
+//------------------------------------------------------------------------------
+// add_template_tags
+//------------------------------------------------------------------------------
+// Appends the tags of the options' `tag_template`, if any, taking the values
+// of its positional tags from the array `tag_values`.
+static void add_template_tags(
+    lua_State* L, int index, SpanBudget& budget,
+    std::vector<std::pair<std::string, opentracing::Value>>& tags) {
+  lua_getfield(L, index, "tag_template");
+  if (lua_isnil(L, -1)) {
+    lua_pop(L, 1);
+    return;
+  }
+  auto tag_template = LuaTagTemplate::to_lua_tag_template(L, -1);
+  lua_pop(L, 1);
+  if (tag_template == nullptr) {
+    throw std::runtime_error{"tag_template must be a tag template"};
+  }
+  auto add_tag = [&tags](const std::string& key,
+                         const opentracing::Value& value) {
+    tags.emplace_back(key, value);
+  };
+  tag_template->apply_constant_tags(budget, add_tag);
+
+  lua_getfield(L, index, "tag_values");
+  switch (lua_type(L, -1)) {
+    case LUA_TTABLE:
+      break;
+    case LUA_TNIL:
+      lua_pop(L, 1);
+      return;
+    default:
+      throw std::runtime_error{"tag_values must be a table"};
+  }
+  auto num_values = get_table_len(L, -1);
+  if (num_values > tag_template->num_keys()) {
+    throw std::runtime_error{"more tag_values than tag template keys"};
+  }
+  for (size_t i = 0; i < num_values; ++i) {
+    lua_rawgeti(L, -1, static_cast<int>(i) + 1);
+    tag_template->apply_tag(L, i, -1, budget, add_tag);
+    lua_pop(L, 1);
+  }
+  lua_pop(L, 1);
 }
 
 //------------------------------------------------------------------------------
 // get_start_span_options
 //------------------------------------------------------------------------------
-static opentracing::StartSpanOptions get_start_span_options(lua_State* L,
-                                                            int index) {
+static opentracing::StartSpanOptions get_start_span_options(
+    lua_State* L, int index, SpanBudget& budget) {
   opentracing::StartSpanOptions result;
 
   lua_getfield(L, index, "start_time");
@@ -161,24 +229,286 @@ static opentracing::StartSpanOptions get_start_span_options(lua_State* L,
   lua_pop(L, 1);
 
   lua_getfield(L, index, "tags");
-  result.tags = get_tags(L);
+  result.tags = get_tags(L, budget);
+  lua_pop(L, 1);
+
+  add_template_tags(L, index, budget, result.tags);
+
+  return result;
+}
+
+//------------------------------------------------------------------------------
+// add_active_parent
+//------------------------------------------------------------------------------
+// Makes a span with no references a child of the running coroutine's active
+// span, if it has one and it was started through `handle`, unless the options
+// at `index` (0 if there are none) set `ignore_active_span`.
+static void add_active_parent(
+    lua_State* L, const TracerHandlePtr& handle, int index,
+    opentracing::StartSpanOptions& start_span_options) {
+  if (!start_span_options.references.empty()) {
+    return;
+  }
+  auto active_span = get_active_span(L);
+  if (active_span == nullptr) {
+    return;
+  }
+  auto ignore_active_span = active_span->handle().get() != handle.get();
+  if (index != 0 && !ignore_active_span) {
+    lua_getfield(L, index, "ignore_active_span");
+    ignore_active_span = lua_toboolean(L, -1);
+    lua_pop(L, 1);
+  }
+  if (!ignore_active_span) {
+    if (is_aggregated(active_span->span())) {
+      throw std::runtime_error{
+          "spans started with `aggregate` can't be referenced"};
+    }
+    // The active span stays referenced by its coroutine's stack.
+    start_span_options.references.emplace_back(
+        opentracing::SpanReferenceType::ChildOfRef,
+        &active_span->span().context());
+  }
+  lua_pop(L, 1);
+}
+
+//------------------------------------------------------------------------------
+// get_local_parent
+//------------------------------------------------------------------------------
+// Returns the context of the span that the first reference of the options at
+// `index` is a child of if that span was started in this process, or nullptr
+// otherwise.
+static const LuaSpanContext* get_local_parent(lua_State* L, int index) {
+  const LuaSpanContext* result = nullptr;
+  lua_getfield(L, index, "references");
+  if (lua_type(L, -1) == LUA_TTABLE) {
+    lua_pushinteger(L, 1);
+    lua_gettable(L, -2);
+    if (lua_type(L, -1) == LUA_TTABLE && get_table_len(L, -1) == 2) {
+      lua_pushinteger(L, 1);
+      lua_gettable(L, -2);
+      auto is_child_of =
+          get_reference_type(L) == opentracing::SpanReferenceType::ChildOfRef;
+      lua_pop(L, 1);
+
+      lua_pushinteger(L, 2);
+      lua_gettable(L, -2);
+      auto user_data =
+          luaL_checkudata(L, -1, LuaSpanContext::description.metatable);
+      auto span_context = *static_cast<const LuaSpanContext**>(user_data);
+      if (is_child_of && span_context->span() != nullptr) {
+        result = span_context;
+      }
+      lua_pop(L, 1);
+    }
+    lua_pop(L, 1);
+  }
   lua_pop(L, 1);
+  return result;
+}
+
+//------------------------------------------------------------------------------
+// start_lua_span
+//------------------------------------------------------------------------------
+// Starts a span with the tracer unless the options call for one of the
+// bridge's own span types. `index` is the stack position of the options table
+// passed to start_span, or 0 if there wasn't one.
+static std::unique_ptr<opentracing::Span> start_lua_span(
+    lua_State* L, int index,
+    const std::shared_ptr<opentracing::Tracer>& tracer,
+    const TracerState& state, const char* operation_name,
+    const opentracing::StartSpanOptions& start_span_options) {
+  auto has_options = index != 0;
+  auto aggregate = false;
+  if (has_options) {
+    lua_getfield(L, index, "aggregate");
+    aggregate = lua_toboolean(L, -1);
+    lua_pop(L, 1);
+  }
+  auto min_duration = state.span_filter(operation_name);
+  auto is_filtered = min_duration.count() > 0;
+
+  const LuaSpanContext* parent = nullptr;
+  if (has_options && (aggregate || is_filtered)) {
+    parent = get_local_parent(L, index);
+  }
+
+  if (aggregate && parent != nullptr && parent->aggregator() != nullptr) {
+    return std::unique_ptr<opentracing::Span>{
+        new AggregatedSpan{parent->aggregator()->get(), parent->span(),
+                           operation_name, start_span_options}};
+  }
+
+  // A filtered span can only be put off if its references are guaranteed to
+  // outlive it.
+  auto& references = start_span_options.references;
+  if (is_filtered &&
+      (references.empty() || (references.size() == 1 && parent != nullptr))) {
+    std::shared_ptr<const opentracing::Span> parent_span;
+    std::shared_ptr<SpanAggregatorSlot> parent_aggregator;
+    if (parent != nullptr) {
+      parent_span = parent->span();
+      parent_aggregator = parent->aggregator();
+    }
+    return std::unique_ptr<opentracing::Span>{new DeferredSpan{
+        *tracer, std::move(parent_span), std::move(parent_aggregator),
+        operation_name, start_span_options, min_duration}};
+  }
 
+  PluginTimer timer;
+  return tracer->StartSpanWithOptions(operation_name, start_span_options);
+}
+
+//------------------------------------------------------------------------------
+// get_limit
+//------------------------------------------------------------------------------
+// Returns the field `name` of the table at `index`, or 0 if it's nil. Values
+// must be in [0, `max_value`), which excludes NaN, and default to what fits in
+// a size_t.
+static size_t get_limit(
+    lua_State* L, int index, const char* name,
+    double max_value = std::ldexp(1.0, std::numeric_limits<size_t>::digits)) {
+  lua_getfield(L, index, name);
+  size_t result = 0;
+  switch (lua_type(L, -1)) {
+    case LUA_TNUMBER: {
+      auto value = lua_tonumber(L, -1);
+      if (!(value >= 0 && value < max_value)) {
+        throw std::runtime_error{std::string{name} + " out of range"};
+      }
+      result = static_cast<size_t>(value);
+      break;
+    }
+    case LUA_TNIL:
+      break;
+    default:
+      throw std::runtime_error{std::string{name} + " must be a number"};
+  }
+  lua_pop(L, 1);
   return result;
 }
 
+//------------------------------------------------------------------------------
+// max_duration_us
+//------------------------------------------------------------------------------
+// Durations given in microseconds are compared with the steady clock's, and
+// log ages with the system clock's, so they must fit in both.
+static double max_duration_us() noexcept {
+  using std::chrono::microseconds;
+  return static_cast<double>(std::min<int64_t>(
+      std::chrono::duration_cast<microseconds>(
+          opentracing::SteadyClock::duration::max())
+          .count(),
+      std::chrono::duration_cast<microseconds>(
+          std::chrono::system_clock::duration::max())
+          .count()));
+}
+
+//------------------------------------------------------------------------------
+// get_duration_limit
+//------------------------------------------------------------------------------
+// Returns the duration in microseconds given by the field `name` of the table
+// at `index`, or 0 if it's nil.
+static std::chrono::microseconds get_duration_limit(lua_State* L, int index,
+                                                    const char* name) {
+  return std::chrono::microseconds{
+      static_cast<int64_t>(get_limit(L, index, name, max_duration_us()))};
+}
+
+//------------------------------------------------------------------------------
+// make_builtin_tracer
+//------------------------------------------------------------------------------
+// Constructs a NativeTracer with the sinks given by the table of options at
+// `index`.
+static std::shared_ptr<opentracing::Tracer> make_builtin_tracer(lua_State* L,
+                                                                int index) {
+  std::vector<std::unique_ptr<SpanSink>> sinks;
+
+  lua_getfield(L, index, "span_ring");
+  if (!lua_isnil(L, -1)) {
+    if (lua_type(L, -1) != LUA_TSTRING) {
+      throw std::runtime_error{"span_ring must be a string"};
+    }
+    std::string span_ring_path = lua_tostring(L, -1);
+    auto span_ring_capacity = get_limit(L, index, "span_ring_capacity");
+    if (span_ring_capacity == 0) {
+      span_ring_capacity = default_span_ring_capacity;
+    }
+    sinks.emplace_back(std::unique_ptr<SpanSink>{new RingSpanSink{
+        SpanRing::open(span_ring_path, span_ring_capacity)}});
+  }
+  lua_pop(L, 1);
+
+  lua_getfield(L, index, "span_file");
+  if (!lua_isnil(L, -1)) {
+    if (lua_type(L, -1) != LUA_TSTRING) {
+      throw std::runtime_error{"span_file must be a string"};
+    }
+    sinks.emplace_back(
+        std::unique_ptr<SpanSink>{new FileSpanSink{lua_tostring(L, -1)}});
+  }
+  lua_pop(L, 1);
+
+  lua_getfield(L, index, "span_callback");
+  if (!lua_isnil(L, -1)) {
+    if (lua_type(L, -1) != LUA_TFUNCTION) {
+      throw std::runtime_error{"span_callback must be a function"};
+    }
+    auto callback = std::make_shared<LuaSpanCallback>(L, -1);
+    sinks.emplace_back(std::unique_ptr<SpanSink>{new CallbackSpanSink{
+        [callback](const SpanRecord& record,
+                   const std::vector<opentracing::LogRecord>& log_records) {
+          (*callback)(record, log_records);
+        }}});
+  }
+  lua_pop(L, 1);
+
+  return std::make_shared<NativeTracer>(std::move(sinks));
+}
+
+//------------------------------------------------------------------------------
+// expire_spans
+//------------------------------------------------------------------------------
+// Ends the tracked spans that have been in flight for longer than the
+// tracer's maximum age. Since the registry is ordered by age, only the spans
+// that expire are visited.
+static void expire_spans(TracerState& state,
+                         opentracing::SteadyTime now) noexcept {
+  auto& span_tracking = state.span_tracking();
+  if (span_tracking.max_age.count() <= 0) {
+    return;
+  }
+  auto& span_registry = state.span_registry();
+  while (true) {
+    auto span = span_registry.oldest();
+    if (span == nullptr ||
+        now - span->registry_entry().start_timestamp <= span_tracking.max_age) {
+      return;
+    }
+    span->expire(span_tracking.expired_action);
+  }
+}
+
 //------------------------------------------------------------------------------
 // new_lua_tracer
 //------------------------------------------------------------------------------
 int LuaTracer::new_lua_tracer(lua_State* L) noexcept {
-  auto library_name = luaL_checkstring(L, -2);
-  auto config = luaL_checkstring(L, -1);
+  auto top = lua_gettop(L);
+  auto options_index = lua_type(L, -1) == LUA_TTABLE ? top : 0;
+  const char* library_name = nullptr;
+  const char* config = nullptr;
+  if (options_index == 0) {
+    library_name = luaL_checkstring(L, -2);
+    config = luaL_checkstring(L, -1);
+  }
   auto userdata =
       static_cast<LuaTracer**>(lua_newuserdata(L, sizeof(LuaTracer*)));
 
   try {
-    auto tracer = std::unique_ptr<LuaTracer>{
-        new LuaTracer{load_tracer(library_name, config)}};
+    auto ot_tracer = options_index != 0 ? make_builtin_tracer(L, options_index)
+                                        : load_tracer(library_name, config);
+    auto tracer = std::unique_ptr<LuaTracer>{new LuaTracer{TracerHandle::make(
+        std::move(ot_tracer), library_name != nullptr ? library_name : "")}};
     *userdata = tracer.release();
 
     // tag the metatable
@@ -203,7 +533,8 @@ int LuaTracer::new_lua_tracer_from_global(lua_State* L) noexcept {
     if (ot_tracer == nullptr) {
       throw std::runtime_error{"opentracing::Global not initialized"};
     }
-    auto tracer = std::unique_ptr<LuaTracer>{new LuaTracer{ot_tracer}};
+    auto tracer = std::unique_ptr<LuaTracer>{
+        new LuaTracer{TracerHandle::make(std::move(ot_tracer))}};
     *userdata = tracer.release();
 
     // tag the metatable
@@ -226,6 +557,89 @@ int LuaTracer::free(lua_State* L) noexcept {
   return 0;
 }
 
+//------------------------------------------------------------------------------
+// new_lua_span
+//------------------------------------------------------------------------------
+std::unique_ptr<LuaSpan> LuaTracer::new_lua_span(
+    lua_State* L, int options_index, const char* operation_name,
+    const opentracing::StartSpanOptions& start_span_options,
+    const SpanBudget& budget) {
+  handle_->update();
+  for (auto& reference : start_span_options.references) {
+    if (reference.second != nullptr && is_shed(*reference.second)) {
+      add_stat(stats().spans_shed);
+      return new_shed_span(budget);
+    }
+  }
+  auto& state = handle_->state();
+  auto span = start_lua_span(L, options_index, handle_->tracer(), state,
+                             operation_name, start_span_options);
+  if (span == nullptr) {
+    throw std::runtime_error{"unable to create span"};
+  }
+  auto lua_span =
+      std::unique_ptr<LuaSpan>{new LuaSpan{handle_, std::move(span), budget}};
+  lua_span->registry_entry().num_tags = start_span_options.tags.size();
+  if (options_index != 0) {
+    lua_getfield(L, options_index, "cost");
+    auto is_measured = lua_toboolean(L, -1);
+    lua_pop(L, 1);
+    if (is_measured) {
+      std::shared_ptr<SpanCost> parent_cost;
+      auto parent = get_local_parent(L, options_index);
+      if (parent != nullptr) {
+        parent_cost = parent->cost();
+      }
+      lua_span->set_cost(std::make_shared<SpanCost>(L, std::move(parent_cost)));
+    }
+  }
+  auto is_tracked = state.span_tracking().enabled;
+  if (is_tracked || state.profiler() != nullptr) {
+    auto now = opentracing::SteadyClock::now();
+    if (is_tracked) {
+      expire_spans(state, now);
+    }
+    state.span_registry().insert(*lua_span, now, operation_name);
+    lua_span->registry_entry().thread = L;
+  }
+  state.load_shedder().open_span();
+  add_stat(stats().spans_started);
+  return lua_span;
+}
+
+//------------------------------------------------------------------------------
+// new_shed_span
+//------------------------------------------------------------------------------
+std::unique_ptr<LuaSpan> LuaTracer::new_shed_span(const SpanBudget& budget) {
+  auto lua_span = std::unique_ptr<LuaSpan>{new LuaSpan{
+      handle_, std::make_shared<ShedSpan>(*handle_->tracer()), budget}};
+  lua_span->mark_shed();
+  return lua_span;
+}
+
+//------------------------------------------------------------------------------
+// sheds_root_span
+//------------------------------------------------------------------------------
+bool LuaTracer::sheds_root_span(lua_State* L, int options_index) {
+  auto& load_shedder = handle_->state().load_shedder();
+  if (!load_shedder.is_shedding()) {
+    return false;
+  }
+  if (options_index != 0) {
+    lua_getfield(L, options_index, "references");
+    auto has_references = !lua_isnil(L, -1);
+    lua_pop(L, 1);
+    if (has_references) {
+      return false;
+    }
+  }
+  if (get_active_span(L) != nullptr) {
+    lua_pop(L, 1);
+    return false;
+  }
+  return load_shedder.should_shed();
+}
+
 //------------------------------------------------------------------------------
 // start_span
 //------------------------------------------------------------------------------
@@ -240,18 +654,20 @@ int LuaTracer::start_span(lua_State* L) noexcept {
   auto userdata = static_cast<LuaSpan**>(lua_newuserdata(L, sizeof(LuaSpan*)));
 
   try {
-    opentracing::StartSpanOptions start_span_options;
-    if (num_arguments >= 3) {
-      start_span_options = get_start_span_options(L, -2);
-    }
-    auto span = tracer->tracer_->StartSpanWithOptions(operation_name,
-                                                      start_span_options);
-    if (span == nullptr) {
-      throw std::runtime_error{"unable to create span"};
+    SpanBudget budget{tracer->state().span_limits()};
+    auto options_index = num_arguments >= 3 ? 3 : 0;
+    if (tracer->sheds_root_span(L, options_index)) {
+      *userdata = tracer->new_shed_span(budget).release();
+    } else {
+      opentracing::StartSpanOptions start_span_options;
+      if (options_index != 0) {
+        start_span_options = get_start_span_options(L, options_index, budget);
+      }
+      add_active_parent(L, tracer->handle_, options_index, start_span_options);
+      auto lua_span = tracer->new_lua_span(L, options_index, operation_name,
+                                           start_span_options, budget);
+      *userdata = lua_span.release();
     }
-    auto lua_span = std::unique_ptr<LuaSpan>{new LuaSpan{
-        tracer->tracer_, std::shared_ptr<opentracing::Span>{span.release()}}};
-    *userdata = lua_span.release();
 
     luaL_getmetatable(L, LuaSpan::description.metatable);
     lua_setmetatable(L, -2);
@@ -264,15 +680,729 @@ int LuaTracer::start_span(lua_State* L) noexcept {
   return lua_error(L);
 }
 
+//------------------------------------------------------------------------------
+// start_active_span
+//------------------------------------------------------------------------------
+// Starts a span, like start_span, and makes it the running coroutine's
+// active span until it finishes.
+int LuaTracer::start_active_span(lua_State* L) noexcept {
+  start_span(L);
+  push_active_span(L, -1);
+  return 1;
+}
+
+//------------------------------------------------------------------------------
+// active_span
+//------------------------------------------------------------------------------
+int LuaTracer::active_span(lua_State* L) noexcept {
+  check_lua_tracer(L);
+  if (get_active_span(L) == nullptr) {
+    lua_pushnil(L);
+  }
+  return 1;
+}
+
+//------------------------------------------------------------------------------
+// start_spans
+//------------------------------------------------------------------------------
+// Starts a span for each name, or {operation_name, tags} table, in an array,
+// with options shared by all of them. The options are given as a table, like
+// start_span's, or as a parent span context. They're parsed and the start
+// time taken once for the batch.
+int LuaTracer::start_spans(lua_State* L) noexcept {
+  auto tracer = check_lua_tracer(L);
+  luaL_checktype(L, 2, LUA_TTABLE);
+  lua_settop(L, 3);
+  auto options_index = 0;
+  switch (lua_type(L, 3)) {
+    case LUA_TTABLE:
+      options_index = 3;
+      break;
+    case LUA_TUSERDATA:
+      // {references = {{"child_of", parent}}}
+      lua_createtable(L, 0, 1);
+      lua_createtable(L, 1, 0);
+      lua_createtable(L, 2, 0);
+      lua_pushstring(L, "child_of");
+      lua_rawseti(L, -2, 1);
+      lua_pushvalue(L, 3);
+      lua_rawseti(L, -2, 2);
+      lua_rawseti(L, -2, 1);
+      lua_setfield(L, -2, "references");
+      options_index = 4;
+      break;
+    case LUA_TNIL:
+      break;
+    default:
+      return luaL_argerror(L, 3, "expected a table or span context");
+  }
+  auto num_spans = static_cast<int>(get_table_len(L, 2));
+  lua_createtable(L, num_spans, 0);
+  auto results_index = lua_gettop(L);
+
+  try {
+    SpanBudget budget{tracer->state().span_limits()};
+    auto is_shed_batch = tracer->sheds_root_span(L, options_index);
+    opentracing::StartSpanOptions start_span_options;
+    if (options_index != 0 && !is_shed_batch) {
+      start_span_options = get_start_span_options(L, options_index, budget);
+    }
+    add_active_parent(L, tracer->handle_, options_index, start_span_options);
+    fill_start_timestamps(start_span_options.start_system_timestamp,
+                          start_span_options.start_steady_timestamp);
+    auto num_shared_tags = start_span_options.tags.size();
+    for (int i = 1; i <= num_spans; ++i) {
+      lua_rawgeti(L, 2, i);
+      const char* operation_name = nullptr;
+      auto span_budget = budget;
+      start_span_options.tags.resize(num_shared_tags);
+      switch (lua_type(L, -1)) {
+        case LUA_TSTRING:
+          operation_name = lua_tostring(L, -1);
+          break;
+        case LUA_TTABLE:
+          lua_getfield(L, -1, "tags");
+          if (lua_type(L, -1) == LUA_TTABLE) {
+            if (!is_shed_batch) {
+              to_key_values(L, -1, span_budget, start_span_options.tags);
+            }
+          } else if (!lua_isnil(L, -1)) {
+            throw std::runtime_error{"tags must be a table"};
+          }
+          lua_getfield(L, -2, "operation_name");
+          operation_name = lua_tostring(L, -1);
+          break;
+      }
+      if (operation_name == nullptr) {
+        throw std::runtime_error{
+            "spans must be given as operation names or tables with an "
+            "operation_name"};
+      }
+      auto userdata =
+          static_cast<LuaSpan**>(lua_newuserdata(L, sizeof(LuaSpan*)));
+      if (is_shed_batch) {
+        *userdata = tracer->new_shed_span(span_budget).release();
+      } else {
+        auto lua_span = tracer->new_lua_span(
+            L, options_index, operation_name, start_span_options, span_budget);
+        *userdata = lua_span.release();
+      }
+      luaL_getmetatable(L, LuaSpan::description.metatable);
+      lua_setmetatable(L, -2);
+      lua_rawseti(L, results_index, i);
+      lua_settop(L, results_index);
+    }
+    return 1;
+  } catch (const std::exception& e) {
+    lua_settop(L, results_index);
+    lua_pushstring(L, e.what());
+  }
+  return lua_error(L);
+}
+
+//------------------------------------------------------------------------------
+// finish_spans
+//------------------------------------------------------------------------------
+// Finishes each span in an array. The finish time is given as a timestamp
+// shared by all the spans, or an array of timestamps; otherwise it's taken
+// once for the batch.
+int LuaTracer::finish_spans(lua_State* L) noexcept {
+  check_lua_tracer(L);
+  luaL_checktype(L, 2, LUA_TTABLE);
+  lua_settop(L, 3);
+  auto timestamps_type = lua_type(L, 3);
+  if (timestamps_type != LUA_TNIL && timestamps_type != LUA_TNUMBER &&
+      timestamps_type != LUA_TTABLE) {
+    return luaL_argerror(L, 3, "expected a number or table of numbers");
+  }
+  auto num_spans = static_cast<int>(get_table_len(L, 2));
+  try {
+    opentracing::SteadyTime finish_steady_timestamp;
+    if (timestamps_type == LUA_TNUMBER) {
+      finish_steady_timestamp =
+          opentracing::convert_time_point<opentracing::SteadyClock>(
+              convert_timestamp(L, 3));
+    } else {
+      finish_steady_timestamp = opentracing::SteadyClock::now();
+    }
+    for (int i = 1; i <= num_spans; ++i) {
+      lua_rawgeti(L, 2, i);
+      auto span = LuaSpan::to_lua_span(L, -1);
+      if (span == nullptr) {
+        throw std::runtime_error{"finish_spans expects an array of spans"};
+      }
+      opentracing::FinishSpanOptions finish_span_options;
+      finish_span_options.finish_steady_timestamp = finish_steady_timestamp;
+      if (timestamps_type == LUA_TTABLE) {
+        lua_rawgeti(L, 3, i);
+        if (!lua_isnil(L, -1)) {
+          finish_span_options.finish_steady_timestamp =
+              opentracing::convert_time_point<opentracing::SteadyClock>(
+                  convert_timestamp(L, -1));
+        }
+      }
+      span->finish_with_options(finish_span_options, L);
+      pop_active_span(L, *span);
+      lua_settop(L, 3);
+    }
+    return 0;
+  } catch (const std::exception& e) {
+    lua_settop(L, 3);
+    lua_pushstring(L, e.what());
+  }
+  return lua_error(L);
+}
+
+//------------------------------------------------------------------------------
+// set_span_filter
+//------------------------------------------------------------------------------
+int LuaTracer::set_span_filter(lua_State* L) noexcept {
+  auto tracer = check_lua_tracer(L);
+  size_t operation_name_len;
+  auto operation_name_data = luaL_checklstring(L, 2, &operation_name_len);
+  auto min_duration = luaL_optnumber(L, 3, 0);
+  luaL_argcheck(L, min_duration >= 0 && min_duration < max_duration_us(), 3,
+                "duration out of range");
+  try {
+    tracer->state().set_span_filter(
+        {operation_name_data, operation_name_len},
+        std::chrono::microseconds{static_cast<int64_t>(min_duration)});
+    return 0;
+  } catch (const std::exception& e) {
+    lua_pushstring(L, e.what());
+  }
+  return lua_error(L);
+}
+
+//------------------------------------------------------------------------------
+// set_limits
+//------------------------------------------------------------------------------
+int LuaTracer::set_limits(lua_State* L) noexcept {
+  auto top = lua_gettop(L);
+  auto tracer = check_lua_tracer(L);
+  luaL_checktype(L, 2, LUA_TTABLE);
+  try {
+    SpanLimits limits;
+    limits.max_string_length = get_limit(L, 2, "max_string_length");
+    limits.max_table_depth = get_limit(L, 2, "max_table_depth");
+    limits.max_table_size = get_limit(L, 2, "max_table_size");
+    limits.max_log_records = get_limit(L, 2, "max_log_records");
+    limits.max_bytes = get_limit(L, 2, "max_bytes");
+    tracer->state().set_span_limits(limits);
+    return 0;
+  } catch (const std::exception& e) {
+    lua_settop(L, top);
+    lua_pushstring(L, e.what());
+  }
+  return lua_error(L);
+}
+
+//------------------------------------------------------------------------------
+// get_expired_span_action
+//------------------------------------------------------------------------------
+static ExpiredSpanAction get_expired_span_action(lua_State* L, int index) {
+  lua_getfield(L, index, "expired_action");
+  auto result = ExpiredSpanAction::finish;
+  switch (lua_type(L, -1)) {
+    case LUA_TSTRING: {
+      auto action = opentracing::string_view{lua_tostring(L, -1)};
+      if (action == "drop") {
+        result = ExpiredSpanAction::drop;
+      } else if (action != "finish") {
+        throw std::runtime_error{"invalid expired_action: " +
+                                 std::string{action}};
+      }
+      break;
+    }
+    case LUA_TNIL:
+      break;
+    default:
+      throw std::runtime_error{"expired_action must be a string"};
+  }
+  lua_pop(L, 1);
+  return result;
+}
+
+//------------------------------------------------------------------------------
+// set_span_tracking
+//------------------------------------------------------------------------------
+int LuaTracer::set_span_tracking(lua_State* L) noexcept {
+  auto top = lua_gettop(L);
+  auto tracer = check_lua_tracer(L);
+  SpanTracking span_tracking;
+  if (lua_type(L, 2) == LUA_TBOOLEAN) {
+    span_tracking.enabled = lua_toboolean(L, 2);
+  } else if (!lua_isnoneornil(L, 2)) {
+    luaL_checktype(L, 2, LUA_TTABLE);
+    span_tracking.enabled = true;
+  }
+  try {
+    if (lua_type(L, 2) == LUA_TTABLE) {
+      span_tracking.max_age = get_duration_limit(L, 2, "max_age_us");
+      span_tracking.expired_action = get_expired_span_action(L, 2);
+    }
+    tracer->state().set_span_tracking(span_tracking);
+    return 0;
+  } catch (const std::exception& e) {
+    lua_settop(L, top);
+    lua_pushstring(L, e.what());
+  }
+  return lua_error(L);
+}
+
+//------------------------------------------------------------------------------
+// tag_template
+//------------------------------------------------------------------------------
+int LuaTracer::tag_template(lua_State* L) noexcept {
+  auto tracer = check_lua_tracer(L);
+  luaL_checktype(L, 2, LUA_TTABLE);
+  auto userdata = static_cast<LuaTagTemplate**>(
+      lua_newuserdata(L, sizeof(LuaTagTemplate*)));
+  try {
+    *userdata = new LuaTagTemplate{L, 2, tracer->state().span_limits()};
+    luaL_getmetatable(L, LuaTagTemplate::description.metatable);
+    lua_setmetatable(L, -2);
+    return 1;
+  } catch (const std::exception& e) {
+    lua_settop(L, 2);
+    lua_pushstring(L, e.what());
+  }
+  return lua_error(L);
+}
+
+//------------------------------------------------------------------------------
+// set_log_streaming
+//------------------------------------------------------------------------------
+int LuaTracer::set_log_streaming(lua_State* L) noexcept {
+  auto top = lua_gettop(L);
+  auto tracer = check_lua_tracer(L);
+  if (lua_type(L, 2) != LUA_TBOOLEAN || lua_toboolean(L, 2)) {
+    luaL_checktype(L, 2, LUA_TTABLE);
+  }
+  try {
+    LogStreaming log_streaming;
+    if (lua_type(L, 2) == LUA_TTABLE) {
+      log_streaming.max_records = get_limit(L, 2, "max_records");
+      log_streaming.max_bytes = get_limit(L, 2, "max_bytes");
+      log_streaming.max_age = get_duration_limit(L, 2, "max_age_us");
+    }
+    tracer->state().set_log_streaming(log_streaming);
+    return 0;
+  } catch (const std::exception& e) {
+    lua_settop(L, top);
+    lua_pushstring(L, e.what());
+  }
+  return lua_error(L);
+}
+
+//------------------------------------------------------------------------------
+// set_load_shedding
+//------------------------------------------------------------------------------
+int LuaTracer::set_load_shedding(lua_State* L) noexcept {
+  auto top = lua_gettop(L);
+  auto tracer = check_lua_tracer(L);
+  if (lua_type(L, 2) != LUA_TBOOLEAN || lua_toboolean(L, 2)) {
+    luaL_checktype(L, 2, LUA_TTABLE);
+  }
+  try {
+    LoadSheddingOptions options;
+    if (lua_type(L, 2) == LUA_TTABLE) {
+      options.max_finish_latency =
+          get_duration_limit(L, 2, "max_finish_latency_us");
+      options.max_open_spans = get_limit(L, 2, "max_open_spans");
+      lua_getfield(L, 2, "recover_ratio");
+      if (!lua_isnil(L, -1)) {
+        options.recover_ratio = lua_tonumber(L, -1);
+        if (!lua_isnumber(L, -1) || options.recover_ratio <= 0 ||
+            options.recover_ratio > 1) {
+          throw std::runtime_error{"recover_ratio must be in (0, 1]"};
+        }
+      }
+      lua_pop(L, 1);
+      lua_getfield(L, 2, "probe_interval");
+      auto has_probe_interval = !lua_isnil(L, -1);
+      lua_pop(L, 1);
+      if (has_probe_interval) {
+        options.probe_interval = get_limit(L, 2, "probe_interval");
+      }
+    }
+    tracer->state().load_shedder().set_options(options);
+    return 0;
+  } catch (const std::exception& e) {
+    lua_settop(L, top);
+    lua_pushstring(L, e.what());
+  }
+  return lua_error(L);
+}
+
+//------------------------------------------------------------------------------
+// in_flight_spans
+//------------------------------------------------------------------------------
+int LuaTracer::in_flight_spans(lua_State* L) noexcept {
+  auto tracer = check_lua_tracer(L);
+  auto max_spans = std::max<lua_Integer>(luaL_optinteger(L, 2, 10), 0);
+  auto now = opentracing::SteadyClock::now();
+  auto& span_registry = tracer->state().span_registry();
+  lua_createtable(L, static_cast<int>(std::min<lua_Integer>(
+                         max_spans, span_registry.size())),
+                  0);
+  auto span = span_registry.oldest();
+  for (lua_Integer i = 1; i <= max_spans && span != nullptr; ++i) {
+    auto& entry = span->registry_entry();
+    lua_createtable(L, 0, 5);
+    lua_pushlstring(L, entry.operation_name.data(),
+                    entry.operation_name.size());
+    lua_setfield(L, -2, "operation_name");
+    lua_pushnumber(L, static_cast<lua_Number>(
+                          std::chrono::duration_cast<std::chrono::microseconds>(
+                              now - entry.start_timestamp)
+                              .count()));
+    lua_setfield(L, -2, "age_us");
+    lua_pushnumber(L, static_cast<lua_Number>(entry.num_tags));
+    lua_setfield(L, -2, "num_tags");
+    lua_pushnumber(L, static_cast<lua_Number>(span->num_log_records()));
+    lua_setfield(L, -2, "num_log_records");
+    lua_pushnumber(L, static_cast<lua_Number>(span->log_bytes()));
+    lua_setfield(L, -2, "log_bytes");
+    lua_rawseti(L, -2, static_cast<int>(i));
+    span = entry.next;
+  }
+  return 1;
+}
+
+//------------------------------------------------------------------------------
+// profile_hook
+//------------------------------------------------------------------------------
+// The registry holds the tracer being profiled under the address of this
+// variable.
+static const char profiled_tracer_key = 0;
+
+// Samples the stack for the profiled tracer. Coroutines created while
+// profiling inherit the hook, so it removes itself once profiling stops.
+static void profile_hook(lua_State* L, lua_Debug* /*debug*/) noexcept {
+  lua_pushlightuserdata(L, const_cast<char*>(&profiled_tracer_key));
+  lua_rawget(L, LUA_REGISTRYINDEX);
+  auto user_data = lua_touserdata(L, -1);
+  lua_pop(L, 1);
+  if (user_data == nullptr) {
+    lua_sethook(L, nullptr, 0, 0);
+    return;
+  }
+  auto& state = (*static_cast<LuaTracer**>(user_data))->state();
+  if (state.profiler() == nullptr) {
+    lua_sethook(L, nullptr, 0, 0);
+    return;
+  }
+  state.profiler()->sample(L, state.span_registry());
+}
+
+//------------------------------------------------------------------------------
+// get_profiler_options
+//------------------------------------------------------------------------------
+static ProfilerOptions get_profiler_options(lua_State* L, int index) {
+  ProfilerOptions result;
+  if (lua_type(L, index) != LUA_TTABLE) {
+    return result;
+  }
+  auto instructions = get_limit(L, index, "instructions");
+  if (instructions != 0) {
+    result.instructions = static_cast<int>(
+        std::min<size_t>(instructions, std::numeric_limits<int>::max()));
+  }
+  auto max_depth = get_limit(L, index, "max_depth");
+  if (max_depth != 0) {
+    result.max_depth = max_depth;
+  }
+  auto max_stacks = get_limit(L, index, "max_stacks");
+  if (max_stacks != 0) {
+    result.max_stacks = max_stacks;
+  }
+  lua_getfield(L, index, "log_samples");
+  if (!lua_isnil(L, -1)) {
+    result.log_samples = lua_toboolean(L, -1);
+  }
+  lua_pop(L, 1);
+  return result;
+}
+
+//------------------------------------------------------------------------------
+// set_profiling
+//------------------------------------------------------------------------------
+// Starts sampling the stack of the calling coroutine, and of coroutines it
+// creates afterwards, with a count hook, or stops if passed false. Only one
+// tracer per lua_State can be profiled at a time.
+int LuaTracer::set_profiling(lua_State* L) noexcept {
+  auto top = lua_gettop(L);
+  auto tracer = check_lua_tracer(L);
+  auto is_enabled = lua_type(L, 2) == LUA_TTABLE || lua_toboolean(L, 2);
+  try {
+    std::unique_ptr<SpanProfiler> profiler;
+    if (is_enabled) {
+      profiler = std::unique_ptr<SpanProfiler>{
+          new SpanProfiler{get_profiler_options(L, 2)}};
+    }
+    lua_pushlightuserdata(L, const_cast<char*>(&profiled_tracer_key));
+    if (is_enabled) {
+      lua_pushvalue(L, 1);
+      lua_sethook(L, profile_hook, LUA_MASKCOUNT,
+                  profiler->options().instructions);
+    } else {
+      lua_pushnil(L);
+      lua_sethook(L, nullptr, 0, 0);
+    }
+    lua_rawset(L, LUA_REGISTRYINDEX);
+    tracer->state().set_profiler(std::move(profiler));
+    return 0;
+  } catch (const std::exception& e) {
+    lua_settop(L, top);
+    lua_pushstring(L, e.what());
+  }
+  return lua_error(L);
+}
+
+//------------------------------------------------------------------------------
+// dump_profile
+//------------------------------------------------------------------------------
+// Returns the samples taken since the last call as folded stacks, rooted at
+// the operation name of the span each was attributed to.
+int LuaTracer::dump_profile(lua_State* L) noexcept {
+  auto tracer = check_lua_tracer(L);
+  auto profiler = tracer->state().profiler();
+  if (profiler == nullptr) {
+    lua_pushnil(L);
+    return 1;
+  }
+  try {
+    auto folded_stacks = profiler->take_folded_stacks();
+    lua_pushlstring(L, folded_stacks.data(), folded_stacks.size());
+    return 1;
+  } catch (const std::exception& e) {
+    lua_pushstring(L, e.what());
+  }
+  return lua_error(L);
+}
+
+//------------------------------------------------------------------------------
+// reconfigure
+//------------------------------------------------------------------------------
+// Replaces the tracer of every LuaTracer sharing this one's handle. A string
+// reloads the plugin the tracer came from with a new configuration, in the
+// background; a table of options builds a native tracer, which takes effect
+// immediately.
+int LuaTracer::reconfigure(lua_State* L) noexcept {
+  auto tracer = check_lua_tracer(L);
+  auto config_type = lua_type(L, 2);
+  if (config_type != LUA_TTABLE) {
+    luaL_checkstring(L, 2);
+  }
+  try {
+    if (config_type == LUA_TTABLE) {
+      tracer->handle_->replace_tracer(make_builtin_tracer(L, 2));
+    } else {
+      tracer->handle_->reload_tracer(lua_tostring(L, 2));
+    }
+    return 0;
+  } catch (const std::exception& e) {
+    lua_pushstring(L, e.what());
+  }
+  return lua_error(L);
+}
+
+//------------------------------------------------------------------------------
+// reconfigure_status
+//------------------------------------------------------------------------------
+// Returns the generation of the tracer in use, counting from 1, whether a
+// reload is still loading, and the error the last reload failed with.
+int LuaTracer::reconfigure_status(lua_State* L) noexcept {
+  auto tracer = check_lua_tracer(L);
+  auto& handle = *tracer->handle_;
+  try {
+    handle.update();
+    lua_createtable(L, 0, 3);
+    lua_pushnumber(L, static_cast<lua_Number>(handle.generation()->number()));
+    lua_setfield(L, -2, "generation");
+    lua_pushboolean(L, handle.is_reloading());
+    lua_setfield(L, -2, "pending");
+    if (!handle.reload_error().empty()) {
+      lua_pushstring(L, handle.reload_error().c_str());
+      lua_setfield(L, -2, "error");
+    }
+    return 1;
+  } catch (const std::exception& e) {
+    lua_pushstring(L, e.what());
+  }
+  return lua_error(L);
+}
+
 //------------------------------------------------------------------------------
 // close
 //------------------------------------------------------------------------------
 int LuaTracer::close(lua_State* L) noexcept {
   auto tracer = check_lua_tracer(L);
-  tracer->tracer_->Close();
+  PluginTimer timer;
+  tracer->tracer()->Close();
+  return 0;
+}
+
+//------------------------------------------------------------------------------
+// start_drain
+//------------------------------------------------------------------------------
+// Starts flushing, or closing, the tracer on a background thread. The spans
+// passed to it since it was last drained are counted towards the result.
+//
+// OpenTracing 1.4 has no way to flush a plugin's tracer other than closing it,
+// so flushing one does nothing, and since a plugin's reporter doesn't say how
+// many spans it sent or dropped, its counts are left unknown.
+static std::unique_ptr<LuaTracerDrain> start_drain(
+    const TracerHandlePtr& handle, bool close) {
+  auto tracer = handle->tracer();
+  auto native_tracer = std::dynamic_pointer_cast<NativeTracer>(tracer);
+  auto num_spans = handle->state().take_unflushed_spans();
+  LuaTracerDrain::Result result;
+  if (native_tracer != nullptr) {
+    result.has_counts = true;
+    result.spans_dropped =
+        std::min(native_tracer->take_num_dropped(), num_spans);
+    result.spans_flushed = num_spans - result.spans_dropped;
+  }
+
+  std::function<void()> drain;
+  if (close) {
+    drain = [tracer] {
+      PluginTimer timer;
+      tracer->Close();
+    };
+  } else if (native_tracer != nullptr) {
+    drain = [native_tracer] { native_tracer->Flush(); };
+  }
+  return std::unique_ptr<LuaTracerDrain>{
+      new LuaTracerDrain{std::move(drain), result}};
+}
+
+//------------------------------------------------------------------------------
+// push_drain
+//------------------------------------------------------------------------------
+// Implements flush and close_async, which return a LuaTracerDrain after waiting
+// up to the timeout, if one is given, for it to complete.
+static int push_drain(lua_State* L, const TracerHandlePtr& handle, bool close,
+                      int timeout_index) noexcept {
+  auto timeout = LuaTracerDrain::check_timeout(L, timeout_index);
+  auto userdata = static_cast<LuaTracerDrain**>(
+      lua_newuserdata(L, sizeof(LuaTracerDrain*)));
+  try {
+    auto drain = start_drain(handle, close);
+    if (timeout.count() > 0) {
+      drain->wait_for(timeout);
+    }
+    *userdata = drain.release();
+
+    luaL_getmetatable(L, LuaTracerDrain::description.metatable);
+    lua_setmetatable(L, -2);
+
+    return 1;
+  } catch (const std::exception& e) {
+    lua_pushstring(L, e.what());
+  }
+  return lua_error(L);
+}
+
+//------------------------------------------------------------------------------
+// flush
+//------------------------------------------------------------------------------
+int LuaTracer::flush(lua_State* L) noexcept {
+  auto tracer = check_lua_tracer(L);
+  return push_drain(L, tracer->handle_, false, 2);
+}
+
+//------------------------------------------------------------------------------
+// close_async
+//------------------------------------------------------------------------------
+int LuaTracer::close_async(lua_State* L) noexcept {
+  auto tracer = check_lua_tracer(L);
+  return push_drain(L, tracer->handle_, true, 2);
+}
+
+//------------------------------------------------------------------------------
+// c_tracer
+//------------------------------------------------------------------------------
+// Returns a userdata holding a handle to the tracer for the C API (see
+// c_api.h): its block is a single bridge_tracer_t*. The handle shares the
+// tracer's state and is freed when the userdata is garbage collected, so
+// callers must keep the userdata for as long as they use the handle.
+int LuaTracer::c_tracer(lua_State* L) noexcept {
+  auto tracer = check_lua_tracer(L);
+  auto userdata =
+      static_cast<LuaTracer**>(lua_newuserdata(L, sizeof(LuaTracer*)));
+  try {
+    *userdata = new LuaTracer{tracer->handle_};
+    luaL_getmetatable(L, C_TRACER_METATABLE);
+    lua_setmetatable(L, -2);
+    return 1;
+  } catch (const std::exception& e) {
+    lua_pushstring(L, e.what());
+  }
+  return lua_error(L);
+}
+
+//------------------------------------------------------------------------------
+// free_c_tracer
+//------------------------------------------------------------------------------
+int LuaTracer::free_c_tracer(lua_State* L) noexcept {
+  auto userdata = static_cast<LuaTracer**>(
+      luaL_checkudata(L, 1, C_TRACER_METATABLE));
+  delete *userdata;
+  *userdata = nullptr;
   return 0;
 }
 
+//------------------------------------------------------------------------------
+// import_c_span_context
+//------------------------------------------------------------------------------
+// Wraps a span context obtained from the C API, given by its address, so that
+// it can be passed to the tracer's other methods. The C API's context remains
+// owned by the caller. Addresses of anything other than a live context handed
+// out by this tracer's C API are rejected.
+int LuaTracer::import_c_span_context(lua_State* L) noexcept {
+  auto tracer = check_lua_tracer(L);
+  const LuaSpanContext* c_span_context = nullptr;
+  if (lua_type(L, 2) == LUA_TLIGHTUSERDATA) {
+    c_span_context = static_cast<const LuaSpanContext*>(lua_touserdata(L, 2));
+  } else {
+    auto address = luaL_checknumber(L, 2);
+    luaL_argcheck(L, address >= 0 && address < 18446744073709551616.0, 2,
+                  "span context expected");
+    c_span_context = reinterpret_cast<const LuaSpanContext*>(
+        static_cast<uintptr_t>(address));
+  }
+  luaL_argcheck(L,
+                c_span_context != nullptr &&
+                    tracer->state().has_c_span_context(c_span_context) &&
+                    c_span_context->handle().get() == tracer->handle_.get(),
+                2, "not a span context from this tracer's C API");
+  auto userdata = static_cast<LuaSpanContext**>(
+      lua_newuserdata(L, sizeof(LuaSpanContext*)));
+  try {
+    *userdata = c_span_context->clone().release();
+    luaL_getmetatable(L, LuaSpanContext::description.metatable);
+    lua_setmetatable(L, -2);
+    return 1;
+  } catch (const std::exception& e) {
+    lua_pushstring(L, e.what());
+  }
+  return lua_error(L);
+}
+
+//------------------------------------------------------------------------------
+// get_carrier_format
+//------------------------------------------------------------------------------
+template <class Carrier>
+static int get_carrier_format() noexcept {
+  auto is_text_map = std::is_same<Carrier, opentracing::TextMapWriter>::value ||
+                     std::is_same<Carrier, opentracing::TextMapReader>::value;
+  return static_cast<int>(is_text_map ? CarrierFormat::text_map
+                                      : CarrierFormat::http_headers);
+}
+
 //------------------------------------------------------------------------------
 // inject
 //------------------------------------------------------------------------------
@@ -281,10 +1411,16 @@ int LuaTracer::inject(lua_State* L) noexcept {
   auto top = lua_gettop(L);
   auto tracer = check_lua_tracer(L);
   luaL_checktype(L, -1, LUA_TTABLE);
+  auto format = get_carrier_format<Carrier>();
+  add_stat(stats().injects[format]);
   try {
     auto& span_context = get_span_context(L, -2);
+    if (is_shed(span_context)) {
+      return 0;
+    }
     LuaCarrierWriter writer{L};
-    auto was_successful = tracer->tracer_->Inject(
+    PluginTimer timer;
+    auto was_successful = tracer->tracer()->Inject(
         span_context, static_cast<const Carrier&>(writer));
     if (!was_successful) {
       throw std::runtime_error{"failed to inject span context: " +
@@ -292,6 +1428,7 @@ int LuaTracer::inject(lua_State* L) noexcept {
     }
     return 0;
   } catch (const std::exception& e) {
+    add_stat(stats().inject_failures[format]);
     lua_settop(L, top);
     lua_pushstring(L, e.what());
   }
@@ -303,22 +1440,41 @@ int LuaTracer::inject(lua_State* L) noexcept {
 //------------------------------------------------------------------------------
 int LuaTracer::binary_inject(lua_State* L) noexcept {
   auto tracer = check_lua_tracer(L);
+  auto format = static_cast<int>(CarrierFormat::binary);
+  add_stat(stats().injects[format]);
   try {
     auto& span_context = get_span_context(L, -1);
+    if (is_shed(span_context)) {
+      lua_pushliteral(L, "");
+      return 1;
+    }
     std::ostringstream oss;
-    auto was_successful = tracer->tracer_->Inject(span_context, oss);
+    PluginTimer timer;
+    auto was_successful = tracer->tracer()->Inject(span_context, oss);
     if (!was_successful) {
       throw std::runtime_error{"failed to inject span context: " +
                                was_successful.error().message()};
     }
-    lua_pushstring(L, oss.str().c_str());
+    auto context = oss.str();
+    lua_pushlstring(L, context.data(), context.size());
     return 1;
   } catch (const std::exception& e) {
+    add_stat(stats().inject_failures[format]);
     lua_pushstring(L, e.what());
   }
   return lua_error(L);
 }
 
+//------------------------------------------------------------------------------
+// extract_span_context
+//------------------------------------------------------------------------------
+template <class Carrier>
+static opentracing::expected<std::unique_ptr<opentracing::SpanContext>>
+extract_span_context(const opentracing::Tracer& tracer, Carrier& carrier) {
+  PluginTimer timer;
+  return tracer.Extract(carrier);
+}
+
 //------------------------------------------------------------------------------
 // extract
 //------------------------------------------------------------------------------
@@ -329,11 +1485,13 @@ int LuaTracer::extract(lua_State* L) noexcept {
   luaL_checktype(L, -1, LUA_TTABLE);
   auto userdata = static_cast<LuaSpanContext**>(
       lua_newuserdata(L, sizeof(LuaSpanContext*)));
+  auto format = get_carrier_format<Carrier>();
+  add_stat(stats().extracts[format]);
   try {
     lua_pushvalue(L, -2);
     LuaCarrierReader reader{L};
-    auto span_context_maybe =
-        tracer->tracer_->Extract(static_cast<const Carrier&>(reader));
+    auto span_context_maybe = extract_span_context(
+        *tracer->tracer(), static_cast<const Carrier&>(reader));
     lua_pop(L, 1);
     if (!span_context_maybe) {
       throw std::runtime_error{"failed to inject span context: " +
@@ -345,12 +1503,13 @@ int LuaTracer::extract(lua_State* L) noexcept {
       return 1;
     }
 
-    *userdata = new LuaSpanContext{std::move(span_context)};
+    *userdata = new LuaSpanContext{tracer->handle_, std::move(span_context)};
     luaL_getmetatable(L, LuaSpanContext::description.metatable);
     lua_setmetatable(L, -2);
 
     return 1;
   } catch (const std::exception& e) {
+    add_stat(stats().extract_failures[format]);
     lua_settop(L, top);
     lua_pushstring(L, e.what());
   }
@@ -363,9 +1522,11 @@ int LuaTracer::binary_extract(lua_State* L) noexcept {
   auto context_data = luaL_checklstring(L, -1, &context_len);
   auto userdata = static_cast<LuaSpanContext**>(
       lua_newuserdata(L, sizeof(LuaSpanContext*)));
+  auto format = static_cast<int>(CarrierFormat::binary);
+  add_stat(stats().extracts[format]);
   try {
     std::istringstream iss{std::string{context_data, context_len}};
-    auto span_context_maybe = tracer->tracer_->Extract(iss);
+    auto span_context_maybe = extract_span_context(*tracer->tracer(), iss);
     if (!span_context_maybe) {
       throw std::runtime_error{"failed to inject span context: " +
                                span_context_maybe.error().message()};
@@ -376,17 +1537,146 @@ int LuaTracer::binary_extract(lua_State* L) noexcept {
       return 1;
     }
 
-    *userdata = new LuaSpanContext{std::move(span_context)};
+    *userdata = new LuaSpanContext{tracer->handle_, std::move(span_context)};
     luaL_getmetatable(L, LuaSpanContext::description.metatable);
     lua_setmetatable(L, -2);
 
     return 1;
   } catch (const std::exception& e) {
+    add_stat(stats().extract_failures[format]);
     lua_pushstring(L, e.what());
   }
   return lua_error(L);
 }
 
+//------------------------------------------------------------------------------
+// set_extract_error
+//------------------------------------------------------------------------------
+// Records why extracting from the `i`th carrier of a batch failed in the table
+// of errors, which is created above the table of results on the first failure.
+static void set_extract_error(lua_State* L, int results_index, int i,
+                              int format, const char* message) {
+  add_stat(stats().extract_failures[format]);
+  if (lua_gettop(L) == results_index) {
+    lua_newtable(L);
+  }
+  lua_pushstring(L, message);
+  lua_rawseti(L, results_index + 1, i);
+}
+
+//------------------------------------------------------------------------------
+// set_extract_result
+//------------------------------------------------------------------------------
+// Stores the result of extracting from the `i`th carrier of a batch. Absent
+// contexts are left as nil.
+static void set_extract_result(
+    lua_State* L, const TracerHandlePtr& handle, int results_index, int i,
+    int format,
+    opentracing::expected<std::unique_ptr<opentracing::SpanContext>>&
+        span_context_maybe) {
+  if (!span_context_maybe) {
+    auto message = "failed to extract span context: " +
+                   span_context_maybe.error().message();
+    set_extract_error(L, results_index, i, format, message.c_str());
+    return;
+  }
+  if (*span_context_maybe == nullptr) {
+    return;
+  }
+  auto userdata = static_cast<LuaSpanContext**>(
+      lua_newuserdata(L, sizeof(LuaSpanContext*)));
+  *userdata = new LuaSpanContext{handle, std::move(*span_context_maybe)};
+  luaL_getmetatable(L, LuaSpanContext::description.metatable);
+  lua_setmetatable(L, -2);
+  lua_rawseti(L, results_index, i);
+}
+
+//------------------------------------------------------------------------------
+// extract_many
+//------------------------------------------------------------------------------
+// Extracts a context from each carrier in an array, returning an array of the
+// contexts with nil where there wasn't one. Rather than raising an error, a
+// carrier that can't be extracted from is also left as nil and its error put
+// in a second table returned with the same index.
+template <class Carrier>
+int LuaTracer::extract_many(lua_State* L) noexcept {
+  auto tracer = check_lua_tracer(L);
+  luaL_checktype(L, 2, LUA_TTABLE);
+  lua_settop(L, 2);
+  auto num_carriers = static_cast<int>(get_table_len(L, 2));
+  const int results_index = 3;
+  lua_createtable(L, num_carriers, 0);
+  auto format = get_carrier_format<Carrier>();
+  add_stat(stats().extracts[format], num_carriers);
+
+  // The reader extracts from whichever carrier is on the top of the stack, so
+  // one serves the whole batch.
+  LuaCarrierReader reader{L};
+  PluginTimer timer;
+  for (int i = 1; i <= num_carriers; ++i) {
+    auto top = lua_gettop(L);
+    lua_rawgeti(L, 2, i);
+    if (lua_type(L, -1) != LUA_TTABLE) {
+      lua_settop(L, top);
+      set_extract_error(L, results_index, i, format,
+                        "carrier must be a table");
+      continue;
+    }
+    try {
+      auto span_context_maybe =
+          tracer->tracer()->Extract(static_cast<const Carrier&>(reader));
+      lua_settop(L, top);
+      set_extract_result(L, tracer->handle_, results_index, i, format,
+                         span_context_maybe);
+    } catch (const std::exception& e) {
+      lua_settop(L, top);
+      set_extract_error(L, results_index, i, format, e.what());
+    }
+  }
+  return lua_gettop(L) - 2;
+}
+
+//------------------------------------------------------------------------------
+// binary_extract_many
+//------------------------------------------------------------------------------
+int LuaTracer::binary_extract_many(lua_State* L) noexcept {
+  auto tracer = check_lua_tracer(L);
+  luaL_checktype(L, 2, LUA_TTABLE);
+  lua_settop(L, 2);
+  auto num_carriers = static_cast<int>(get_table_len(L, 2));
+  const int results_index = 3;
+  lua_createtable(L, num_carriers, 0);
+  auto format = static_cast<int>(CarrierFormat::binary);
+  add_stat(stats().extracts[format], num_carriers);
+
+  std::istringstream iss;
+  PluginTimer timer;
+  for (int i = 1; i <= num_carriers; ++i) {
+    auto top = lua_gettop(L);
+    lua_rawgeti(L, 2, i);
+    if (lua_type(L, -1) != LUA_TSTRING) {
+      lua_settop(L, top);
+      set_extract_error(L, results_index, i, format,
+                        "carrier must be a string");
+      continue;
+    }
+    try {
+      size_t context_len;
+      auto context_data = lua_tolstring(L, -1, &context_len);
+      iss.str(std::string{context_data, context_len});
+      iss.clear();
+      lua_settop(L, top);
+      auto span_context_maybe = tracer->tracer()->Extract(iss);
+      set_extract_result(L, tracer->handle_, results_index, i, format,
+                         span_context_maybe);
+    } catch (const std::exception& e) {
+      lua_settop(L, top);
+      set_extract_error(L, results_index, i, format, e.what());
+    }
+  }
+  return lua_gettop(L) - 2;
+}
+
 //------------------------------------------------------------------------------
 // description
 //------------------------------------------------------------------------------
@@ -394,6 +1684,10 @@ const LuaClassDescription LuaTracer::description = {
     METATABLE,
     LuaTracer::free,
     {{"start_span", LuaTracer::start_span},
+     {"start_active_span", LuaTracer::start_active_span},
+     {"active_span", LuaTracer::active_span},
+     {"start_spans", LuaTracer::start_spans},
+     {"finish_spans", LuaTracer::finish_spans},
      {"text_map_inject", LuaTracer::inject<opentracing::TextMapWriter>},
      {"http_headers_inject", LuaTracer::inject<opentracing::HTTPHeadersWriter>},
      {"binary_inject", LuaTracer::binary_inject},
@@ -401,6 +1695,32 @@ const LuaClassDescription LuaTracer::description = {
      {"http_headers_extract",
       LuaTracer::extract<opentracing::HTTPHeadersReader>},
      {"binary_extract", LuaTracer::binary_extract},
+     {"text_map_extract_many",
+      LuaTracer::extract_many<opentracing::TextMapReader>},
+     {"http_headers_extract_many",
+      LuaTracer::extract_many<opentracing::HTTPHeadersReader>},
+     {"binary_extract_many", LuaTracer::binary_extract_many},
+     {"set_span_filter", LuaTracer::set_span_filter},
+     {"set_limits", LuaTracer::set_limits},
+     {"set_span_tracking", LuaTracer::set_span_tracking},
+     {"set_log_streaming", LuaTracer::set_log_streaming},
+     {"set_load_shedding", LuaTracer::set_load_shedding},
+     {"tag_template", LuaTracer::tag_template},
+     {"in_flight_spans", LuaTracer::in_flight_spans},
+     {"set_profiling", LuaTracer::set_profiling},
+     {"dump_profile", LuaTracer::dump_profile},
+     {"c_tracer", LuaTracer::c_tracer},
+     {"import_c_span_context", LuaTracer::import_c_span_context},
+     {"reconfigure", LuaTracer::reconfigure},
+     {"reconfigure_status", LuaTracer::reconfigure_status},
      {"close", LuaTracer::close},
+     {"close_async", LuaTracer::close_async},
+     {"flush", LuaTracer::flush},
      {nullptr, nullptr}}};
+
+//------------------------------------------------------------------------------
+// c_tracer_description
+//------------------------------------------------------------------------------
+const LuaClassDescription LuaTracer::c_tracer_description = {
+    C_TRACER_METATABLE, LuaTracer::free_c_tracer, {{nullptr, nullptr}}};
 }  // namespace lua_bridge_tracer
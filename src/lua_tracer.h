@@ -1,6 +1,9 @@
 #pragma once
 
 #include "lua_class_description.h"
+#include "lua_span.h"
+#include "stats.h"
+#include "tracer_handle.h"
 
 #include <opentracing/tracer.h>
 
@@ -14,22 +17,81 @@ extern "C" {
 namespace lua_bridge_tracer {
 class LuaTracer {
  public:
-  explicit LuaTracer(const std::shared_ptr<opentracing::Tracer>& tracer)
-      : tracer_{tracer} {}
+  explicit LuaTracer(const TracerHandlePtr& handle) : handle_{handle} {
+    add_stat(stats().live_tracers);
+  }
+
+  LuaTracer(const LuaTracer&) = delete;
+  LuaTracer& operator=(const LuaTracer&) = delete;
+
+  ~LuaTracer() noexcept { subtract_stat(stats().live_tracers); }
 
   static const LuaClassDescription description;
 
+  // The userdata returned by tracer:c_tracer(), which owns a C API handle.
+  static const LuaClassDescription c_tracer_description;
+
   static int new_lua_tracer(lua_State* L) noexcept;
 
   static int new_lua_tracer_from_global(lua_State* L) noexcept;
 
+  const TracerHandlePtr& handle() const noexcept { return handle_; }
+
+  const std::shared_ptr<opentracing::Tracer>& tracer() const noexcept {
+    return handle_->tracer();
+  }
+
+  TracerState& state() const noexcept { return handle_->state(); }
+
+  // Starts a span. `options_index` is the stack position of the options table
+  // the span is started with, or 0 if there isn't one, in which case `L` can
+  // be null.
+  std::unique_ptr<LuaSpan> new_lua_span(
+      lua_State* L, int options_index, const char* operation_name,
+      const opentracing::StartSpanOptions& start_span_options,
+      const SpanBudget& budget);
+
+  // Starts a span that's been shed by the load shedder.
+  std::unique_ptr<LuaSpan> new_shed_span(const SpanBudget& budget);
+
+  // Whether the load shedder drops a new span started with the options at
+  // `options_index`. Only root spans are shed, which are those without
+  // references or an active span.
+  bool sheds_root_span(lua_State* L, int options_index);
+
  private:
-  std::shared_ptr<opentracing::Tracer> tracer_;
+  TracerHandlePtr handle_;
 
   static int free(lua_State* L) noexcept;
 
   static int start_span(lua_State* L) noexcept;
 
+  static int start_active_span(lua_State* L) noexcept;
+
+  static int active_span(lua_State* L) noexcept;
+
+  static int start_spans(lua_State* L) noexcept;
+
+  static int finish_spans(lua_State* L) noexcept;
+
+  static int set_span_filter(lua_State* L) noexcept;
+
+  static int set_limits(lua_State* L) noexcept;
+
+  static int set_span_tracking(lua_State* L) noexcept;
+
+  static int in_flight_spans(lua_State* L) noexcept;
+
+  static int set_profiling(lua_State* L) noexcept;
+
+  static int dump_profile(lua_State* L) noexcept;
+
+  static int set_log_streaming(lua_State* L) noexcept;
+
+  static int set_load_shedding(lua_State* L) noexcept;
+
+  static int tag_template(lua_State* L) noexcept;
+
   template <class Carrier>
   static int inject(lua_State* L) noexcept;
 
@@ -40,6 +102,25 @@ class LuaTracer {
 
   static int binary_extract(lua_State* L) noexcept;
 
+  template <class Carrier>
+  static int extract_many(lua_State* L) noexcept;
+
+  static int binary_extract_many(lua_State* L) noexcept;
+
+  static int c_tracer(lua_State* L) noexcept;
+
+  static int free_c_tracer(lua_State* L) noexcept;
+
+  static int import_c_span_context(lua_State* L) noexcept;
+
+  static int reconfigure(lua_State* L) noexcept;
+
+  static int reconfigure_status(lua_State* L) noexcept;
+
   static int close(lua_State* L) noexcept;
+
+  static int close_async(lua_State* L) noexcept;
+
+  static int flush(lua_State* L) noexcept;
 };
 }  // namespace lua_bridge_tracer
@@ -0,0 +1,147 @@
+#include "lua_tracer_drain.h"
+
+#include "background_thread.h"
+
+#include <stdexcept>
+
+#define METATABLE "lua_opentracing_bridge.tracer_drain"
+
+namespace lua_bridge_tracer {
+//------------------------------------------------------------------------------
+// check_lua_tracer_drain
+//------------------------------------------------------------------------------
+static LuaTracerDrain* check_lua_tracer_drain(lua_State* L) noexcept {
+  void* user_data = luaL_checkudata(L, 1, METATABLE);
+  luaL_argcheck(L, user_data != NULL, 1, "`" METATABLE "' expected");
+  return *static_cast<LuaTracerDrain**>(user_data);
+}
+
+//------------------------------------------------------------------------------
+// constructor
+//------------------------------------------------------------------------------
+LuaTracerDrain::LuaTracerDrain(std::function<void()>&& drain,
+                               const Result& result)
+    : state_{std::make_shared<State>()}, result_{result} {
+  if (!drain) {
+    state_->is_done = true;
+    return;
+  }
+  auto state = state_;
+  start_background_thread([state, drain] {
+    drain();
+    std::lock_guard<std::mutex> lock{state->mutex};
+    state->is_done = true;
+    state->condition.notify_all();
+  });
+}
+
+//------------------------------------------------------------------------------
+// is_done
+//------------------------------------------------------------------------------
+bool LuaTracerDrain::is_done() const noexcept {
+  std::lock_guard<std::mutex> lock{state_->mutex};
+  return state_->is_done;
+}
+
+//------------------------------------------------------------------------------
+// wait_for
+//------------------------------------------------------------------------------
+bool LuaTracerDrain::wait_for(std::chrono::milliseconds timeout) const {
+  std::unique_lock<std::mutex> lock{state_->mutex};
+  return state_->condition.wait_for(lock, timeout,
+                                    [this] { return state_->is_done; });
+}
+
+//------------------------------------------------------------------------------
+// check_timeout
+//------------------------------------------------------------------------------
+std::chrono::milliseconds LuaTracerDrain::check_timeout(lua_State* L,
+                                                        int index) noexcept {
+  auto timeout_ms = luaL_optnumber(L, index, 0);
+  luaL_argcheck(L, timeout_ms <= static_cast<double>(max_timeout_ms), index,
+                "timeout out of range");
+  return std::chrono::milliseconds{
+      static_cast<int64_t>(timeout_ms > 0 ? timeout_ms : 0)};
+}
+
+//------------------------------------------------------------------------------
+// free
+//------------------------------------------------------------------------------
+int LuaTracerDrain::free(lua_State* L) noexcept {
+  auto drain = check_lua_tracer_drain(L);
+  delete drain;
+  return 0;
+}
+
+//------------------------------------------------------------------------------
+// done
+//------------------------------------------------------------------------------
+int LuaTracerDrain::done(lua_State* L) noexcept {
+  auto drain = check_lua_tracer_drain(L);
+  lua_pushboolean(L, drain->is_done());
+  return 1;
+}
+
+//------------------------------------------------------------------------------
+// wait
+//------------------------------------------------------------------------------
+// Waits for up to the given number of milliseconds, or indefinitely if none is
+// given, and returns whether the drain completed.
+int LuaTracerDrain::wait(lua_State* L) noexcept {
+  auto drain = check_lua_tracer_drain(L);
+  auto has_timeout = !lua_isnoneornil(L, 2);
+  if (has_timeout) {
+    luaL_checknumber(L, 2);
+  }
+  auto timeout = check_timeout(L, 2);
+  try {
+    bool is_done;
+    if (has_timeout) {
+      is_done = drain->wait_for(timeout);
+    } else {
+      std::unique_lock<std::mutex> lock{drain->state_->mutex};
+      auto& state = *drain->state_;
+      state.condition.wait(lock, [&state] { return state.is_done; });
+      is_done = true;
+    }
+    lua_pushboolean(L, is_done);
+    return 1;
+  } catch (const std::exception& e) {
+    lua_pushstring(L, e.what());
+  }
+  return lua_error(L);
+}
+
+//------------------------------------------------------------------------------
+// result
+//------------------------------------------------------------------------------
+// Returns a table of the number of spans flushed and dropped, or nil if the
+// drain hasn't completed. The counts are nil if the tracer can't report them.
+int LuaTracerDrain::result(lua_State* L) noexcept {
+  auto drain = check_lua_tracer_drain(L);
+  if (!drain->is_done()) {
+    lua_pushnil(L);
+    return 1;
+  }
+  lua_createtable(L, 0, 2);
+  if (!drain->result_.has_counts) {
+    return 1;
+  }
+  lua_pushnumber(L, static_cast<lua_Number>(drain->result_.spans_flushed));
+  lua_setfield(L, -2, "spans_flushed");
+  lua_pushnumber(L, static_cast<lua_Number>(drain->result_.spans_dropped));
+  lua_setfield(L, -2, "spans_dropped");
+  return 1;
+}
+
+//------------------------------------------------------------------------------
+// description
+//------------------------------------------------------------------------------
+const LuaClassDescription LuaTracerDrain::description = {
+    METATABLE,
+    LuaTracerDrain::free,
+    {{"done", LuaTracerDrain::done},
+     {"wait", LuaTracerDrain::wait},
+     {"result", LuaTracerDrain::result},
+     {nullptr, nullptr}}};
+}  // namespace lua_bridge_tracer
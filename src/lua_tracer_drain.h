@@ -0,0 +1,68 @@
+#pragma once
+
+#include "lua_class_description.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+
+namespace lua_bridge_tracer {
+// Flushes or closes a tracer on a background thread, so that draining its
+// reporter doesn't block the thread running Lua. Returned by tracer:flush and
+// tracer:close_async to be polled or waited on.
+class LuaTracerDrain {
+ public:
+  // Spans passed to the tracer since it was last drained, split into those
+  // its reporter accepted and those it dropped, if the tracer can tell.
+  struct Result {
+    bool has_counts = false;
+    uint64_t spans_flushed = 0;
+    uint64_t spans_dropped = 0;
+  };
+
+  // Runs `drain` on a background thread (see start_background_thread), which
+  // finishes on its own if the LuaTracerDrain is freed first. An empty
+  // `drain` is complete immediately.
+  LuaTracerDrain(std::function<void()>&& drain, const Result& result);
+
+  LuaTracerDrain(const LuaTracerDrain&) = delete;
+  LuaTracerDrain& operator=(const LuaTracerDrain&) = delete;
+
+  static const LuaClassDescription description;
+
+  bool is_done() const noexcept;
+
+  // Waits up to `timeout` for the drain to complete, returning whether it has.
+  bool wait_for(std::chrono::milliseconds timeout) const;
+
+  // The longest timeout accepted from Lua (a day), well short of where adding
+  // it to the current time would overflow.
+  static const int64_t max_timeout_ms = 24 * 60 * 60 * 1000;
+
+  // Returns the optional timeout in milliseconds at `index`, raising an error
+  // if it's NaN or longer than max_timeout_ms. Negative timeouts are 0.
+  static std::chrono::milliseconds check_timeout(lua_State* L,
+                                                 int index) noexcept;
+
+ private:
+  struct State {
+    std::mutex mutex;
+    std::condition_variable condition;
+    bool is_done = false;
+  };
+
+  std::shared_ptr<State> state_;
+  Result result_;
+
+  static int free(lua_State* L) noexcept;
+
+  static int done(lua_State* L) noexcept;
+
+  static int wait(lua_State* L) noexcept;
+
+  static int result(lua_State* L) noexcept;
+};
+}  // namespace lua_bridge_tracer
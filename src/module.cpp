@@ -1,6 +1,10 @@
+#include "background_thread.h"
 #include "lua_span.h"
 #include "lua_span_context.h"
+#include "lua_tag_template.h"
 #include "lua_tracer.h"
+#include "lua_tracer_drain.h"
+#include "stats.h"
 
 #include <opentracing/dynamic_load.h>
 #include <iostream>
@@ -43,15 +47,20 @@ static void make_lua_class(
 }
 
 extern "C" int luaopen_opentracing_bridge_tracer(lua_State* L) {
+  lua_bridge_tracer::open_background_threads(L);
   make_lua_class(L, lua_bridge_tracer::LuaTracer::description);
+  make_lua_class(L, lua_bridge_tracer::LuaTracer::c_tracer_description);
   make_lua_class(L, lua_bridge_tracer::LuaSpan::description);
   make_lua_class(L, lua_bridge_tracer::LuaSpanContext::description);
+  make_lua_class(L, lua_bridge_tracer::LuaTracerDrain::description);
+  make_lua_class(L, lua_bridge_tracer::LuaTagTemplate::description);
 
   lua_newtable(L);
   const struct luaL_Reg functions[] = {
       {"new", lua_bridge_tracer::LuaTracer::new_lua_tracer},
       {"new_from_global",
        lua_bridge_tracer::LuaTracer::new_lua_tracer_from_global},
+      {"stats", lua_bridge_tracer::push_stats},
       {nullptr, nullptr}};
   setfuncs(L, functions, 0);
 
@@ -0,0 +1,637 @@
+#include "native_tracer.h"
+
+#include <cctype>
+#include <cstdio>
+#include <istream>
+#include <iterator>
+#include <mutex>
+#include <new>
+#include <ostream>
+#include <random>
+
+namespace lua_bridge_tracer {
+static const char* const trace_parent_key = "traceparent";
+static const char* const baggage_prefix = "ot-baggage-";
+static const size_t baggage_prefix_length = 11;
+
+//------------------------------------------------------------------------------
+// RandomNumberGenerator
+//------------------------------------------------------------------------------
+namespace {
+// xoshiro256**, which is several times faster than std::mt19937_64 and has a
+// fraction of its state. See http://prng.di.unimi.it/.
+class RandomNumberGenerator {
+ public:
+  RandomNumberGenerator() {
+    std::random_device random_device;
+    uint64_t seed = (static_cast<uint64_t>(random_device()) << 32) |
+                    static_cast<uint64_t>(random_device());
+    for (auto& word : state_) {
+      word = split_mix(seed);
+    }
+  }
+
+  uint64_t operator()() noexcept {
+    auto result = rotate_left(state_[1] * 5, 7) * 9;
+    auto t = state_[1] << 17;
+    state_[2] ^= state_[0];
+    state_[3] ^= state_[1];
+    state_[1] ^= state_[2];
+    state_[0] ^= state_[3];
+    state_[2] ^= t;
+    state_[3] = rotate_left(state_[3], 45);
+    return result;
+  }
+
+ private:
+  uint64_t state_[4];
+
+  static uint64_t rotate_left(uint64_t x, int k) noexcept {
+    return (x << k) | (x >> (64 - k));
+  }
+
+  // Expands the seed into the generator's state, as its authors recommend.
+  static uint64_t split_mix(uint64_t& seed) noexcept {
+    auto z = (seed += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+  }
+};
+}  // namespace
+
+//------------------------------------------------------------------------------
+// generate_id
+//------------------------------------------------------------------------------
+static uint64_t generate_id() noexcept {
+  static thread_local RandomNumberGenerator random_number_generator;
+  uint64_t result;
+  do {
+    result = random_number_generator();
+  } while (result == 0);
+  return result;
+}
+
+//------------------------------------------------------------------------------
+// SpanPool
+//------------------------------------------------------------------------------
+namespace {
+// Set once the thread's SpanPool has been destroyed. It's trivially
+// destructible, so unlike the pool it can still be read while the thread's
+// other thread_local objects are destroyed.
+thread_local bool is_span_pool_destroyed = false;
+
+// Keeps the memory of deleted spans for reuse. Every block is the size of a
+// NativeSpan. Pools are per thread, so they need no locking; a span deleted on
+// a different thread than it was started on goes to the deleting thread's
+// pool.
+class SpanPool {
+ public:
+  // Bounds how much memory an idle pool holds on to.
+  static const size_t max_free_blocks = 1024;
+
+  SpanPool() noexcept = default;
+
+  SpanPool(const SpanPool&) = delete;
+  SpanPool& operator=(const SpanPool&) = delete;
+
+  ~SpanPool() {
+    while (free_blocks_ != nullptr) {
+      auto block = free_blocks_;
+      free_blocks_ = block->next;
+      ::operator delete(block);
+    }
+    is_span_pool_destroyed = true;
+  }
+
+  // Returns the thread's pool, or nullptr if it's been destroyed as the thread
+  // exits, in which case spans go straight to the heap.
+  static SpanPool* instance() noexcept {
+    if (is_span_pool_destroyed) {
+      return nullptr;
+    }
+    static thread_local SpanPool pool;
+    return &pool;
+  }
+
+  void* allocate(size_t size) {
+    if (free_blocks_ == nullptr) {
+      return ::operator new(size);
+    }
+    auto block = free_blocks_;
+    free_blocks_ = block->next;
+    --num_free_blocks_;
+    return block;
+  }
+
+  void deallocate(void* data) noexcept {
+    if (num_free_blocks_ == max_free_blocks) {
+      ::operator delete(data);
+      return;
+    }
+    auto block = static_cast<Block*>(data);
+    block->next = free_blocks_;
+    free_blocks_ = block;
+    ++num_free_blocks_;
+  }
+
+ private:
+  struct Block {
+    Block* next;
+  };
+
+  Block* free_blocks_ = nullptr;
+  size_t num_free_blocks_ = 0;
+};
+}  // namespace
+
+//------------------------------------------------------------------------------
+// ForeachBaggageItem
+//------------------------------------------------------------------------------
+void NativeSpanContext::ForeachBaggageItem(
+    std::function<bool(const std::string& key, const std::string& value)> f)
+    const {
+  for (auto& baggage_item : baggage) {
+    if (!f(baggage_item.first, baggage_item.second)) {
+      return;
+    }
+  }
+}
+
+//------------------------------------------------------------------------------
+// NativeSpan
+//------------------------------------------------------------------------------
+namespace {
+class NativeSpan final : public opentracing::Span {
+ public:
+  NativeSpan(const NativeTracer* tracer,
+             opentracing::string_view operation_name,
+             const opentracing::StartSpanOptions& options);
+
+  NativeSpan(const NativeSpan&) = delete;
+  NativeSpan& operator=(const NativeSpan&) = delete;
+
+  static void* operator new(size_t size) {
+    auto pool = SpanPool::instance();
+    return pool != nullptr ? pool->allocate(size) : ::operator new(size);
+  }
+
+  static void operator delete(void* data) noexcept {
+    auto pool = SpanPool::instance();
+    if (pool != nullptr) {
+      pool->deallocate(data);
+    } else {
+      ::operator delete(data);
+    }
+  }
+
+  ~NativeSpan() override {
+    if (!finished_) {
+      FinishWithOptions({});
+    }
+  }
+
+  void FinishWithOptions(const opentracing::FinishSpanOptions&
+                             finish_span_options) noexcept override;
+
+  void SetOperationName(opentracing::string_view name) noexcept override;
+
+  void SetTag(opentracing::string_view key,
+              const opentracing::Value& value) noexcept override;
+
+  void SetBaggageItem(opentracing::string_view restricted_key,
+                      opentracing::string_view value) noexcept override;
+
+  std::string BaggageItem(opentracing::string_view restricted_key) const
+      noexcept override;
+
+  void Log(std::initializer_list<
+           std::pair<opentracing::string_view, opentracing::Value>>
+               fields) noexcept override;
+
+  const opentracing::SpanContext& context() const noexcept override {
+    return context_;
+  }
+
+  const opentracing::Tracer& tracer() const noexcept override {
+    return *tracer_;
+  }
+
+ private:
+  // The tracer outlives its spans; see NativeTracer.
+  const NativeTracer* tracer_;
+  NativeSpanContext context_;
+  SpanRecord record_;
+  opentracing::SteadyTime start_steady_timestamp_;
+  bool finished_ = false;
+
+  // Spans can be shared between threads through their contexts, so guard
+  // their state.
+  mutable std::mutex mutex_;
+};
+}  // namespace
+
+//------------------------------------------------------------------------------
+// constructor
+//------------------------------------------------------------------------------
+NativeSpan::NativeSpan(const NativeTracer* tracer,
+                       opentracing::string_view operation_name,
+                       const opentracing::StartSpanOptions& options)
+    : tracer_{tracer} {
+  const NativeSpanContext* parent = nullptr;
+  for (auto& reference : options.references) {
+    auto span_context =
+        dynamic_cast<const NativeSpanContext*>(reference.second);
+    if (span_context == nullptr) {
+      continue;
+    }
+    if (parent == nullptr ||
+        (reference.first == opentracing::SpanReferenceType::ChildOfRef &&
+         record_.follows_from)) {
+      parent = span_context;
+      record_.follows_from =
+          reference.first == opentracing::SpanReferenceType::FollowsFromRef;
+    }
+    context_.baggage.insert(span_context->baggage.begin(),
+                            span_context->baggage.end());
+  }
+  if (parent == nullptr) {
+    context_.trace_id_high = generate_id();
+    context_.trace_id_low = generate_id();
+  } else {
+    context_.trace_id_high = parent->trace_id_high;
+    context_.trace_id_low = parent->trace_id_low;
+    record_.parent_span_id = parent->span_id;
+  }
+  context_.span_id = generate_id();
+  record_.trace_id_high = context_.trace_id_high;
+  record_.trace_id_low = context_.trace_id_low;
+  record_.span_id = context_.span_id;
+
+  auto start_system_timestamp = options.start_system_timestamp;
+  start_steady_timestamp_ = options.start_steady_timestamp;
+  if (start_system_timestamp == opentracing::SystemTime{} &&
+      start_steady_timestamp_ == opentracing::SteadyTime{}) {
+    start_system_timestamp = opentracing::SystemClock::now();
+    start_steady_timestamp_ = opentracing::SteadyClock::now();
+  } else if (start_system_timestamp == opentracing::SystemTime{}) {
+    start_system_timestamp =
+        opentracing::convert_time_point<opentracing::SystemClock>(
+            start_steady_timestamp_);
+  } else if (start_steady_timestamp_ == opentracing::SteadyTime{}) {
+    start_steady_timestamp_ =
+        opentracing::convert_time_point<opentracing::SteadyClock>(
+            start_system_timestamp);
+  }
+  record_.start_timestamp =
+      std::chrono::duration_cast<std::chrono::microseconds>(
+          start_system_timestamp.time_since_epoch())
+          .count();
+  record_.operation_name.assign(operation_name.data(), operation_name.size());
+  record_.tags.assign(options.tags.begin(), options.tags.end());
+}
+
+//------------------------------------------------------------------------------
+// FinishWithOptions
+//------------------------------------------------------------------------------
+void NativeSpan::FinishWithOptions(
+    const opentracing::FinishSpanOptions& finish_span_options) noexcept {
+  std::lock_guard<std::mutex> lock{mutex_};
+  if (finished_) {
+    return;
+  }
+  finished_ = true;
+  auto finish_steady_timestamp = finish_span_options.finish_steady_timestamp;
+  if (finish_steady_timestamp == opentracing::SteadyTime{}) {
+    finish_steady_timestamp = opentracing::SteadyClock::now();
+  }
+  record_.duration_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                            finish_steady_timestamp - start_steady_timestamp_)
+                            .count();
+  tracer_->Export(record_, finish_span_options.log_records);
+}
+
+//------------------------------------------------------------------------------
+// SetOperationName
+//------------------------------------------------------------------------------
+void NativeSpan::SetOperationName(
+    opentracing::string_view name) noexcept try {
+  std::lock_guard<std::mutex> lock{mutex_};
+  record_.operation_name.assign(name.data(), name.size());
+} catch (const std::exception&) {
+  // Leave the name as it was.
+}
+
+//------------------------------------------------------------------------------
+// SetTag
+//------------------------------------------------------------------------------
+void NativeSpan::SetTag(opentracing::string_view key,
+                        const opentracing::Value& value) noexcept try {
+  std::lock_guard<std::mutex> lock{mutex_};
+  for (auto& tag : record_.tags) {
+    if (tag.first == key) {
+      tag.second = value;
+      return;
+    }
+  }
+  record_.tags.emplace_back(key, value);
+} catch (const std::exception&) {
+  // Drop the tag.
+}
+
+//------------------------------------------------------------------------------
+// SetBaggageItem
+//------------------------------------------------------------------------------
+void NativeSpan::SetBaggageItem(opentracing::string_view restricted_key,
+                                opentracing::string_view value) noexcept try {
+  std::lock_guard<std::mutex> lock{mutex_};
+  context_.baggage[restricted_key] = value;
+} catch (const std::exception&) {
+  // Drop the baggage item.
+}
+
+//------------------------------------------------------------------------------
+// BaggageItem
+//------------------------------------------------------------------------------
+std::string NativeSpan::BaggageItem(
+    opentracing::string_view restricted_key) const noexcept try {
+  std::lock_guard<std::mutex> lock{mutex_};
+  auto iter = context_.baggage.find(restricted_key);
+  if (iter == context_.baggage.end()) {
+    return {};
+  }
+  return iter->second;
+} catch (const std::exception&) {
+  return {};
+}
+
+//------------------------------------------------------------------------------
+// Log
+//------------------------------------------------------------------------------
+void NativeSpan::Log(
+    std::initializer_list<
+        std::pair<opentracing::string_view, opentracing::Value>>
+        fields) noexcept try {
+  opentracing::LogRecord log_record;
+  log_record.timestamp = opentracing::SystemClock::now();
+  log_record.fields.reserve(fields.size());
+  for (auto& field : fields) {
+    log_record.fields.emplace_back(field.first, field.second);
+  }
+  std::lock_guard<std::mutex> lock{mutex_};
+  record_.logs.push_back(std::move(log_record));
+} catch (const std::exception&) {
+  // Drop the log record.
+}
+
+//------------------------------------------------------------------------------
+// StartSpanWithOptions
+//------------------------------------------------------------------------------
+std::unique_ptr<opentracing::Span> NativeTracer::StartSpanWithOptions(
+    opentracing::string_view operation_name,
+    const opentracing::StartSpanOptions& options) const noexcept try {
+  return std::unique_ptr<opentracing::Span>{
+      new NativeSpan{this, operation_name, options}};
+} catch (const std::exception&) {
+  return nullptr;
+}
+
+//------------------------------------------------------------------------------
+// Close
+//------------------------------------------------------------------------------
+void NativeTracer::Close() noexcept {
+  for (auto& sink : sinks_) {
+    sink->Close();
+  }
+}
+
+//------------------------------------------------------------------------------
+// Flush
+//------------------------------------------------------------------------------
+void NativeTracer::Flush() noexcept {
+  for (auto& sink : sinks_) {
+    sink->Flush();
+  }
+}
+
+//------------------------------------------------------------------------------
+// Export
+//------------------------------------------------------------------------------
+void NativeTracer::Export(
+    const SpanRecord& record,
+    const std::vector<opentracing::LogRecord>& log_records) const noexcept {
+  auto was_dropped = false;
+  for (auto& sink : sinks_) {
+    was_dropped |= !sink->Export(record, log_records);
+  }
+  if (was_dropped) {
+    num_dropped_.fetch_add(1, std::memory_order_relaxed);
+  }
+}
+
+//------------------------------------------------------------------------------
+// format_trace_parent
+//------------------------------------------------------------------------------
+static std::string format_trace_parent(const NativeSpanContext& span_context) {
+  char result[56];
+  std::snprintf(result, sizeof(result), "00-%016llx%016llx-%016llx-01",
+                static_cast<unsigned long long>(span_context.trace_id_high),
+                static_cast<unsigned long long>(span_context.trace_id_low),
+                static_cast<unsigned long long>(span_context.span_id));
+  return result;
+}
+
+//------------------------------------------------------------------------------
+// parse_hex
+//------------------------------------------------------------------------------
+static bool parse_hex(opentracing::string_view text, uint64_t& value) noexcept {
+  value = 0;
+  for (auto c : text) {
+    value <<= 4;
+    if (c >= '0' && c <= '9') {
+      value |= static_cast<uint64_t>(c - '0');
+    } else if (c >= 'a' && c <= 'f') {
+      value |= static_cast<uint64_t>(c - 'a' + 10);
+    } else {
+      return false;
+    }
+  }
+  return true;
+}
+
+//------------------------------------------------------------------------------
+// parse_trace_parent
+//------------------------------------------------------------------------------
+// Parses a W3C traceparent header: 00-<32 hex trace id>-<16 hex span id>-<2
+// hex flags>.
+static bool parse_trace_parent(opentracing::string_view text,
+                               NativeSpanContext& span_context) noexcept {
+  if (text.size() != 55 || text[2] != '-' || text[35] != '-' ||
+      text[52] != '-') {
+    return false;
+  }
+  return parse_hex({text.data() + 3, 16}, span_context.trace_id_high) &&
+         parse_hex({text.data() + 19, 16}, span_context.trace_id_low) &&
+         parse_hex({text.data() + 36, 16}, span_context.span_id) &&
+         (span_context.trace_id_high | span_context.trace_id_low) != 0 &&
+         span_context.span_id != 0;
+}
+
+//------------------------------------------------------------------------------
+// equals_ignore_case
+//------------------------------------------------------------------------------
+static bool equals_ignore_case(opentracing::string_view lhs,
+                               opentracing::string_view rhs) noexcept {
+  if (lhs.size() != rhs.size()) {
+    return false;
+  }
+  for (size_t i = 0; i < lhs.size(); ++i) {
+    if (std::tolower(static_cast<unsigned char>(lhs[i])) !=
+        std::tolower(static_cast<unsigned char>(rhs[i]))) {
+      return false;
+    }
+  }
+  return true;
+}
+
+//------------------------------------------------------------------------------
+// inject_text_map
+//------------------------------------------------------------------------------
+static opentracing::expected<void> inject_text_map(
+    const opentracing::SpanContext& sc,
+    const opentracing::TextMapWriter& writer) {
+  auto span_context = dynamic_cast<const NativeSpanContext*>(&sc);
+  if (span_context == nullptr) {
+    return opentracing::make_unexpected(
+        opentracing::invalid_span_context_error);
+  }
+  auto result =
+      writer.Set(trace_parent_key, format_trace_parent(*span_context));
+  if (!result) {
+    return result;
+  }
+  for (auto& baggage_item : span_context->baggage) {
+    result = writer.Set(baggage_prefix + baggage_item.first,
+                        baggage_item.second);
+    if (!result) {
+      return result;
+    }
+  }
+  return result;
+}
+
+//------------------------------------------------------------------------------
+// extract_text_map
+//------------------------------------------------------------------------------
+static opentracing::expected<std::unique_ptr<opentracing::SpanContext>>
+extract_text_map(const opentracing::TextMapReader& reader) {
+  std::unique_ptr<NativeSpanContext> span_context{new NativeSpanContext{}};
+  auto found = false;
+  auto corrupted = false;
+  auto result = reader.ForeachKey(
+      [&](opentracing::string_view key,
+          opentracing::string_view value) -> opentracing::expected<void> {
+        if (equals_ignore_case(key, trace_parent_key)) {
+          found = true;
+          corrupted = !parse_trace_parent(value, *span_context);
+        } else if (key.size() > baggage_prefix_length &&
+                   equals_ignore_case({key.data(), baggage_prefix_length},
+                                      baggage_prefix)) {
+          span_context->baggage.emplace(
+              std::string{key.data() + baggage_prefix_length,
+                          key.size() - baggage_prefix_length},
+              value);
+        }
+        return {};
+      });
+  if (!result) {
+    return opentracing::make_unexpected(result.error());
+  }
+  if (corrupted) {
+    return opentracing::make_unexpected(
+        opentracing::span_context_corrupted_error);
+  }
+  if (!found) {
+    return std::unique_ptr<opentracing::SpanContext>{};
+  }
+  return std::unique_ptr<opentracing::SpanContext>{span_context.release()};
+}
+
+//------------------------------------------------------------------------------
+// Inject
+//------------------------------------------------------------------------------
+opentracing::expected<void> NativeTracer::Inject(
+    const opentracing::SpanContext& sc, std::ostream& writer) const {
+  auto span_context = dynamic_cast<const NativeSpanContext*>(&sc);
+  if (span_context == nullptr) {
+    return opentracing::make_unexpected(
+        opentracing::invalid_span_context_error);
+  }
+  std::string buffer;
+  SpanRecord record;
+  record.trace_id_high = span_context->trace_id_high;
+  record.trace_id_low = span_context->trace_id_low;
+  record.span_id = span_context->span_id;
+  for (auto& baggage_item : span_context->baggage) {
+    record.tags.emplace_back(baggage_item.first, baggage_item.second);
+  }
+  encode_span_record(record, {}, buffer);
+  writer.write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+  if (!writer.good()) {
+    return opentracing::make_unexpected(opentracing::invalid_carrier_error);
+  }
+  return {};
+}
+
+opentracing::expected<void> NativeTracer::Inject(
+    const opentracing::SpanContext& sc,
+    const opentracing::TextMapWriter& writer) const {
+  return inject_text_map(sc, writer);
+}
+
+opentracing::expected<void> NativeTracer::Inject(
+    const opentracing::SpanContext& sc,
+    const opentracing::HTTPHeadersWriter& writer) const {
+  return inject_text_map(sc, writer);
+}
+
+//------------------------------------------------------------------------------
+// Extract
+//------------------------------------------------------------------------------
+// The binary format reuses the span record encoding, with baggage stored as
+// tags.
+opentracing::expected<std::unique_ptr<opentracing::SpanContext>>
+NativeTracer::Extract(std::istream& reader) const {
+  std::string buffer{std::istreambuf_iterator<char>{reader},
+                     std::istreambuf_iterator<char>{}};
+  if (buffer.empty()) {
+    return std::unique_ptr<opentracing::SpanContext>{};
+  }
+  SpanRecord record;
+  if (!decode_span_record(buffer.data(), buffer.size(), record) ||
+      record.span_id == 0) {
+    return opentracing::make_unexpected(
+        opentracing::span_context_corrupted_error);
+  }
+  std::unique_ptr<NativeSpanContext> span_context{new NativeSpanContext{}};
+  span_context->trace_id_high = record.trace_id_high;
+  span_context->trace_id_low = record.trace_id_low;
+  span_context->span_id = record.span_id;
+  for (auto& tag : record.tags) {
+    if (tag.second.is<std::string>()) {
+      span_context->baggage.emplace(tag.first, tag.second.get<std::string>());
+    }
+  }
+  return std::unique_ptr<opentracing::SpanContext>{span_context.release()};
+}
+
+opentracing::expected<std::unique_ptr<opentracing::SpanContext>>
+NativeTracer::Extract(const opentracing::TextMapReader& reader) const {
+  return extract_text_map(reader);
+}
+
+opentracing::expected<std::unique_ptr<opentracing::SpanContext>>
+NativeTracer::Extract(const opentracing::HTTPHeadersReader& reader) const {
+  return extract_text_map(reader);
+}
+}  // namespace lua_bridge_tracer
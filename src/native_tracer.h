@@ -0,0 +1,89 @@
+#pragma once
+
+#include "span_sink.h"
+
+#include <opentracing/tracer.h>
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace lua_bridge_tracer {
+class NativeSpanContext final : public opentracing::SpanContext {
+ public:
+  uint64_t trace_id_high = 0;
+  uint64_t trace_id_low = 0;
+  uint64_t span_id = 0;
+  std::unordered_map<std::string, std::string> baggage;
+
+  void ForeachBaggageItem(
+      std::function<bool(const std::string& key, const std::string& value)> f)
+      const override;
+};
+
+// A tracer built into the module, for spans that don't need a vendor's
+// tracer: it passes finished spans to its sinks rather than reporting them
+// itself, and with no sinks it discards them.
+//
+// Spans get 128-bit trace IDs from a per-thread PRNG, their memory comes from
+// a per-thread pool, and their tags are stored inline, so starting and
+// finishing one is cheap.
+//
+// Contexts are propagated with the W3C `traceparent` header, and baggage with
+// `ot-baggage-` prefixed keys.
+//
+// Spans refer to the tracer with a plain pointer, so it has to outlive them.
+// The bridge ensures this for the spans it starts (see TracerHandle).
+class NativeTracer final : public opentracing::Tracer {
+ public:
+  explicit NativeTracer(
+      std::vector<std::unique_ptr<SpanSink>>&& sinks) noexcept
+      : sinks_{std::move(sinks)} {}
+
+  std::unique_ptr<opentracing::Span> StartSpanWithOptions(
+      opentracing::string_view operation_name,
+      const opentracing::StartSpanOptions& options) const noexcept override;
+
+  opentracing::expected<void> Inject(const opentracing::SpanContext& sc,
+                                     std::ostream& writer) const override;
+
+  opentracing::expected<void> Inject(
+      const opentracing::SpanContext& sc,
+      const opentracing::TextMapWriter& writer) const override;
+
+  opentracing::expected<void> Inject(
+      const opentracing::SpanContext& sc,
+      const opentracing::HTTPHeadersWriter& writer) const override;
+
+  opentracing::expected<std::unique_ptr<opentracing::SpanContext>> Extract(
+      std::istream& reader) const override;
+
+  opentracing::expected<std::unique_ptr<opentracing::SpanContext>> Extract(
+      const opentracing::TextMapReader& reader) const override;
+
+  opentracing::expected<std::unique_ptr<opentracing::SpanContext>> Extract(
+      const opentracing::HTTPHeadersReader& reader) const override;
+
+  void Close() noexcept override;
+
+  // Writes out the spans the sinks have buffered.
+  void Flush() noexcept;
+
+  // Passes a finished span to each sink.
+  void Export(const SpanRecord& record,
+              const std::vector<opentracing::LogRecord>& log_records) const
+      noexcept;
+
+  // Returns the number of spans a sink dropped since the last call.
+  uint64_t take_num_dropped() noexcept {
+    return num_dropped_.exchange(0, std::memory_order_relaxed);
+  }
+
+ private:
+  std::vector<std::unique_ptr<SpanSink>> sinks_;
+  mutable std::atomic<uint64_t> num_dropped_{0};
+};
+}  // namespace lua_bridge_tracer
@@ -0,0 +1,183 @@
+#pragma once
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace lua_bridge_tracer {
+// A vector that stores up to N elements inline and only goes to the heap when
+// it grows past them.
+//
+// Spans usually carry a handful of tags, so keeping them in the span itself
+// saves an allocation, and a pointer chase, per span.
+template <class T, size_t N>
+class SmallVector {
+ public:
+  using value_type = T;
+  using iterator = T*;
+  using const_iterator = const T*;
+
+  SmallVector() noexcept : data_{inline_data()} {}
+
+  template <class Iterator>
+  SmallVector(Iterator first, Iterator last) : SmallVector{} {
+    assign(first, last);
+  }
+
+  SmallVector(const SmallVector& other) : SmallVector{} {
+    assign(other.begin(), other.end());
+  }
+
+  SmallVector(SmallVector&& other) : SmallVector{} { take(std::move(other)); }
+
+  ~SmallVector() {
+    clear();
+    deallocate();
+  }
+
+  SmallVector& operator=(const SmallVector& other) {
+    if (this != &other) {
+      assign(other.begin(), other.end());
+    }
+    return *this;
+  }
+
+  SmallVector& operator=(SmallVector&& other) {
+    if (this != &other) {
+      clear();
+      take(std::move(other));
+    }
+    return *this;
+  }
+
+  size_t size() const noexcept { return size_; }
+
+  bool empty() const noexcept { return size_ == 0; }
+
+  size_t capacity() const noexcept { return capacity_; }
+
+  T* begin() noexcept { return data_; }
+  const T* begin() const noexcept { return data_; }
+
+  T* end() noexcept { return data_ + size_; }
+  const T* end() const noexcept { return data_ + size_; }
+
+  T& operator[](size_t index) noexcept { return data_[index]; }
+  const T& operator[](size_t index) const noexcept { return data_[index]; }
+
+  T& back() noexcept { return data_[size_ - 1]; }
+  const T& back() const noexcept { return data_[size_ - 1]; }
+
+  void clear() noexcept {
+    for (size_t i = 0; i < size_; ++i) {
+      data_[i].~T();
+    }
+    size_ = 0;
+  }
+
+  void reserve(size_t capacity) {
+    if (capacity > capacity_) {
+      grow(capacity);
+    }
+  }
+
+  void resize(size_t size) {
+    while (size_ > size) {
+      data_[--size_].~T();
+    }
+    reserve(size);
+    while (size_ < size) {
+      new (data_ + size_) T{};
+      ++size_;
+    }
+  }
+
+  template <class Iterator>
+  void assign(Iterator first, Iterator last) {
+    clear();
+    for (; first != last; ++first) {
+      emplace_back(*first);
+    }
+  }
+
+  template <class... Args>
+  T& emplace_back(Args&&... args) {
+    if (size_ == capacity_) {
+      // Construct the new element before moving the others so that `args`
+      // can refer to an element of this vector.
+      auto data = allocate(2 * capacity_);
+      try {
+        new (data + size_) T(std::forward<Args>(args)...);
+      } catch (...) {
+        ::operator delete(data);
+        throw;
+      }
+      replace_data(data, 2 * capacity_);
+    } else {
+      new (data_ + size_) T(std::forward<Args>(args)...);
+    }
+    return data_[size_++];
+  }
+
+  void push_back(const T& value) { emplace_back(value); }
+
+  void push_back(T&& value) { emplace_back(std::move(value)); }
+
+ private:
+  typename std::aligned_storage<sizeof(T), alignof(T)>::type inline_data_[N];
+  T* data_;
+  size_t size_ = 0;
+  size_t capacity_ = N;
+
+  T* inline_data() noexcept { return reinterpret_cast<T*>(inline_data_); }
+
+  bool is_inline() const noexcept {
+    return data_ == reinterpret_cast<const T*>(inline_data_);
+  }
+
+  static T* allocate(size_t capacity) {
+    return static_cast<T*>(::operator new(capacity * sizeof(T)));
+  }
+
+  void deallocate() noexcept {
+    if (!is_inline()) {
+      ::operator delete(data_);
+    }
+  }
+
+  void grow(size_t capacity) { replace_data(allocate(capacity), capacity); }
+
+  // Moves the elements into `data` and makes it the vector's storage.
+  void replace_data(T* data, size_t capacity) noexcept {
+    for (size_t i = 0; i < size_; ++i) {
+      new (data + i) T(std::move(data_[i]));
+      data_[i].~T();
+    }
+    deallocate();
+    data_ = data;
+    capacity_ = capacity;
+  }
+
+  // Takes the elements of `other`, which is left empty. Assumes this vector
+  // is empty.
+  void take(SmallVector&& other) {
+    if (other.is_inline()) {
+      reserve(other.size_);
+      for (size_t i = 0; i < other.size_; ++i) {
+        new (data_ + i) T(std::move(other.data_[i]));
+      }
+      size_ = other.size_;
+      other.clear();
+      return;
+    }
+    deallocate();
+    data_ = other.data_;
+    size_ = other.size_;
+    capacity_ = other.capacity_;
+    other.data_ = other.inline_data();
+    other.size_ = 0;
+    other.capacity_ = N;
+  }
+};
+}  // namespace lua_bridge_tracer
@@ -0,0 +1,209 @@
+#include "span_aggregator.h"
+
+#include "utility.h"
+
+#include <algorithm>
+
+namespace lua_bridge_tracer {
+//------------------------------------------------------------------------------
+// to_microseconds
+//------------------------------------------------------------------------------
+static int64_t to_microseconds(opentracing::SteadyClock::duration duration) {
+  return std::chrono::duration_cast<std::chrono::microseconds>(duration)
+      .count();
+}
+
+//------------------------------------------------------------------------------
+// Record
+//------------------------------------------------------------------------------
+void SpanAggregator::Record(
+    const opentracing::Span& parent, const std::string& operation_name,
+    opentracing::SystemTime start_system_timestamp,
+    opentracing::SteadyTime start_steady_timestamp,
+    opentracing::SteadyTime finish_steady_timestamp,
+    std::vector<std::pair<std::string, opentracing::Value>>&& tags) {
+  auto duration = finish_steady_timestamp - start_steady_timestamp;
+
+  // Children that finish after their parent can't be folded into the parent's
+  // groups anymore, so emit them right away as a group of one.
+  Group late_group;
+  Group* group = nullptr;
+  if (flushed_) {
+    group = &late_group;
+  } else {
+    auto iter = std::find_if(std::begin(groups_), std::end(groups_),
+                             [&](const Group& group) {
+                               return group.operation_name == operation_name;
+                             });
+    if (iter != std::end(groups_)) {
+      group = &*iter;
+    } else {
+      groups_.emplace_back();
+      group = &groups_.back();
+    }
+  }
+
+  if (group->count == 0) {
+    group->operation_name = operation_name;
+    group->min_duration = duration;
+    group->max_duration = duration;
+    group->start_system_timestamp = start_system_timestamp;
+    group->start_steady_timestamp = start_steady_timestamp;
+    group->finish_steady_timestamp = finish_steady_timestamp;
+  } else {
+    group->min_duration = std::min(group->min_duration, duration);
+    group->max_duration = std::max(group->max_duration, duration);
+    if (start_steady_timestamp < group->start_steady_timestamp) {
+      group->start_system_timestamp = start_system_timestamp;
+      group->start_steady_timestamp = start_steady_timestamp;
+    }
+    group->finish_steady_timestamp =
+        std::max(group->finish_steady_timestamp, finish_steady_timestamp);
+  }
+  ++group->count;
+  group->total_duration += duration;
+
+  // Keep the first value seen for each tag key.
+  for (auto& tag : tags) {
+    if (group->tags.size() >= max_sample_tags) {
+      break;
+    }
+    auto iter = std::find_if(
+        std::begin(group->tags), std::end(group->tags),
+        [&](const std::pair<std::string, opentracing::Value>& sample) {
+          return sample.first == tag.first;
+        });
+    if (iter == std::end(group->tags)) {
+      group->tags.emplace_back(std::move(tag));
+    }
+  }
+
+  if (flushed_) {
+    Emit(parent, late_group);
+  }
+}
+
+//------------------------------------------------------------------------------
+// RecordFiltered
+//------------------------------------------------------------------------------
+void SpanAggregator::RecordFiltered(
+    opentracing::SteadyClock::duration duration) noexcept {
+  ++num_filtered_;
+  filtered_duration_ += duration;
+}
+
+//------------------------------------------------------------------------------
+// Flush
+//------------------------------------------------------------------------------
+void SpanAggregator::Flush(opentracing::Span& parent) {
+  flushed_ = true;
+  if (num_filtered_ > 0) {
+    parent.SetTag("filtered.count", static_cast<int64_t>(num_filtered_));
+    parent.SetTag("filtered.total_duration_us",
+                  to_microseconds(filtered_duration_));
+  }
+  for (auto& group : groups_) {
+    Emit(parent, group);
+  }
+  groups_.clear();
+}
+
+//------------------------------------------------------------------------------
+// SpanAggregatorSlot::get
+//------------------------------------------------------------------------------
+const std::shared_ptr<SpanAggregator>& SpanAggregatorSlot::get() {
+  if (aggregator_ == nullptr) {
+    aggregator_ = std::make_shared<SpanAggregator>();
+    aggregator_->flushed_ = flushed_;
+  }
+  return aggregator_;
+}
+
+//------------------------------------------------------------------------------
+// Emit
+//------------------------------------------------------------------------------
+void SpanAggregator::Emit(const opentracing::Span& parent, Group& group) {
+  opentracing::StartSpanOptions start_span_options;
+  start_span_options.start_system_timestamp = group.start_system_timestamp;
+  start_span_options.start_steady_timestamp = group.start_steady_timestamp;
+  start_span_options.references.emplace_back(
+      opentracing::SpanReferenceType::ChildOfRef, &parent.context());
+  start_span_options.tags = std::move(group.tags);
+  auto& tags = start_span_options.tags;
+  tags.emplace_back("aggregate.count", static_cast<int64_t>(group.count));
+  tags.emplace_back("aggregate.total_duration_us",
+                    to_microseconds(group.total_duration));
+  tags.emplace_back("aggregate.min_duration_us",
+                    to_microseconds(group.min_duration));
+  tags.emplace_back("aggregate.max_duration_us",
+                    to_microseconds(group.max_duration));
+
+  auto span = parent.tracer().StartSpanWithOptions(group.operation_name,
+                                                   start_span_options);
+  if (span == nullptr) {
+    return;
+  }
+  opentracing::FinishSpanOptions finish_span_options;
+  finish_span_options.finish_steady_timestamp = group.finish_steady_timestamp;
+  span->FinishWithOptions(finish_span_options);
+}
+
+//------------------------------------------------------------------------------
+// AggregatedSpan constructor
+//------------------------------------------------------------------------------
+AggregatedSpan::AggregatedSpan(std::shared_ptr<SpanAggregator> aggregator,
+                               std::shared_ptr<const opentracing::Span> parent,
+                               opentracing::string_view operation_name,
+                               const opentracing::StartSpanOptions& options)
+    : aggregator_{std::move(aggregator)},
+      parent_{std::move(parent)},
+      operation_name_{operation_name},
+      start_system_timestamp_{options.start_system_timestamp},
+      start_steady_timestamp_{options.start_steady_timestamp},
+      tags_{options.tags} {
+  fill_start_timestamps(start_system_timestamp_, start_steady_timestamp_);
+}
+
+//------------------------------------------------------------------------------
+// FinishWithOptions
+//------------------------------------------------------------------------------
+void AggregatedSpan::FinishWithOptions(
+    const opentracing::FinishSpanOptions& finish_span_options) noexcept {
+  if (finished_) {
+    return;
+  }
+  finished_ = true;
+  auto finish_steady_timestamp = finish_span_options.finish_steady_timestamp;
+  if (finish_steady_timestamp == opentracing::SteadyTime{}) {
+    finish_steady_timestamp = opentracing::SteadyClock::now();
+  }
+  try {
+    aggregator_->Record(*parent_, operation_name_, start_system_timestamp_,
+                        start_steady_timestamp_, finish_steady_timestamp,
+                        std::move(tags_));
+  } catch (const std::exception&) {
+    // Dropping the sample is the only sensible thing to do if we can't
+    // allocate memory for it.
+  }
+}
+
+//------------------------------------------------------------------------------
+// SetOperationName
+//------------------------------------------------------------------------------
+void AggregatedSpan::SetOperationName(
+    opentracing::string_view name) noexcept try {
+  operation_name_ = name;
+} catch (const std::exception&) {
+}
+
+//------------------------------------------------------------------------------
+// SetTag
+//------------------------------------------------------------------------------
+void AggregatedSpan::SetTag(opentracing::string_view key,
+                            const opentracing::Value& value) noexcept try {
+  if (tags_.size() < SpanAggregator::max_sample_tags) {
+    tags_.emplace_back(key, value);
+  }
+} catch (const std::exception&) {
+}
+}  // namespace lua_bridge_tracer
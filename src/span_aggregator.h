@@ -0,0 +1,133 @@
+#pragma once
+
+#include <opentracing/span.h>
+#include <opentracing/tracer.h>
+
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace lua_bridge_tracer {
+// Collects the sibling spans that a parent span's children started with the
+// `aggregate` option. Children with the same operation name are merged into a
+// single group that's emitted as one span when the parent finishes.
+//
+// Children dropped by a duration filter are also rolled up here and reported
+// as tags on the parent.
+class SpanAggregator {
+ public:
+  // The maximum number of distinct tags sampled for each group.
+  static const size_t max_sample_tags = 16;
+
+  void Record(
+      const opentracing::Span& parent, const std::string& operation_name,
+      opentracing::SystemTime start_system_timestamp,
+      opentracing::SteadyTime start_steady_timestamp,
+      opentracing::SteadyTime finish_steady_timestamp,
+      std::vector<std::pair<std::string, opentracing::Value>>&& tags);
+
+  void RecordFiltered(opentracing::SteadyClock::duration duration) noexcept;
+
+  void Flush(opentracing::Span& parent);
+
+ private:
+  struct Group {
+    std::string operation_name;
+    uint64_t count = 0;
+    opentracing::SteadyClock::duration total_duration{};
+    opentracing::SteadyClock::duration min_duration{};
+    opentracing::SteadyClock::duration max_duration{};
+    opentracing::SystemTime start_system_timestamp;
+    opentracing::SteadyTime start_steady_timestamp;
+    opentracing::SteadyTime finish_steady_timestamp;
+    std::vector<std::pair<std::string, opentracing::Value>> tags;
+  };
+
+  std::vector<Group> groups_;
+  uint64_t num_filtered_ = 0;
+  opentracing::SteadyClock::duration filtered_duration_{};
+  bool flushed_ = false;
+
+  static void Emit(const opentracing::Span& parent, Group& group);
+
+  friend class SpanAggregatorSlot;
+};
+
+// Where a span's SpanAggregator is kept, shared by the span and its contexts.
+// The aggregator is only made once a child needs it, so that spans whose
+// children are never aggregated or filtered don't pay for one.
+class SpanAggregatorSlot {
+ public:
+  // Returns the aggregator, making it if need be. One made after Flush emits
+  // each child as it finishes.
+  const std::shared_ptr<SpanAggregator>& get();
+
+  void Flush(opentracing::Span& parent) {
+    flushed_ = true;
+    if (aggregator_ != nullptr) {
+      aggregator_->Flush(parent);
+    }
+  }
+
+ private:
+  std::shared_ptr<SpanAggregator> aggregator_;
+  bool flushed_ = false;
+};
+
+// A stand-in for a span started with the `aggregate` option. It never reaches
+// the tracer; instead, its timing and a sample of its tags are folded into the
+// parent's SpanAggregator when it finishes.
+//
+// Its context is its parent's, so it can't have children of its own: they'd
+// end up as its siblings. See is_aggregated.
+class AggregatedSpan final : public opentracing::Span {
+ public:
+  AggregatedSpan(std::shared_ptr<SpanAggregator> aggregator,
+                 std::shared_ptr<const opentracing::Span> parent,
+                 opentracing::string_view operation_name,
+                 const opentracing::StartSpanOptions& options);
+
+  void FinishWithOptions(const opentracing::FinishSpanOptions&
+                             finish_span_options) noexcept override;
+
+  void SetOperationName(opentracing::string_view name) noexcept override;
+
+  void SetTag(opentracing::string_view key,
+              const opentracing::Value& value) noexcept override;
+
+  void SetBaggageItem(opentracing::string_view /*restricted_key*/,
+                      opentracing::string_view /*value*/) noexcept override {}
+
+  std::string BaggageItem(opentracing::string_view restricted_key) const
+      noexcept override {
+    return parent_->BaggageItem(restricted_key);
+  }
+
+  void Log(std::initializer_list<
+           std::pair<opentracing::string_view, opentracing::Value>>
+           /*fields*/) noexcept override {}
+
+  const opentracing::SpanContext& context() const noexcept override {
+    return parent_->context();
+  }
+
+  const opentracing::Tracer& tracer() const noexcept override {
+    return parent_->tracer();
+  }
+
+ private:
+  std::shared_ptr<SpanAggregator> aggregator_;
+  std::shared_ptr<const opentracing::Span> parent_;
+  std::string operation_name_;
+  opentracing::SystemTime start_system_timestamp_;
+  opentracing::SteadyTime start_steady_timestamp_;
+  std::vector<std::pair<std::string, opentracing::Value>> tags_;
+  bool finished_ = false;
+};
+
+// Whether `span` was started with the `aggregate` option.
+inline bool is_aggregated(const opentracing::Span& span) noexcept {
+  return dynamic_cast<const AggregatedSpan*>(&span) != nullptr;
+}
+}  // namespace lua_bridge_tracer
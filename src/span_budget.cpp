@@ -0,0 +1,72 @@
+#include "span_budget.h"
+
+namespace lua_bridge_tracer {
+//------------------------------------------------------------------------------
+// reserve
+//------------------------------------------------------------------------------
+bool SpanBudget::reserve(size_t size) noexcept {
+  if (limits_.max_bytes != 0 && num_bytes_ + size > limits_.max_bytes) {
+    ++num_dropped_;
+    return false;
+  }
+  num_bytes_ += size;
+  return true;
+}
+
+//------------------------------------------------------------------------------
+// string_length
+//------------------------------------------------------------------------------
+size_t SpanBudget::string_length(size_t length) noexcept {
+  if (limits_.max_string_length != 0 && length > limits_.max_string_length) {
+    truncated_ = true;
+    return limits_.max_string_length;
+  }
+  return length;
+}
+
+//------------------------------------------------------------------------------
+// table_depth_exceeded
+//------------------------------------------------------------------------------
+bool SpanBudget::table_depth_exceeded(size_t depth) noexcept {
+  if (limits_.max_table_depth != 0 && depth > limits_.max_table_depth) {
+    ++num_dropped_;
+    return true;
+  }
+  return false;
+}
+
+//------------------------------------------------------------------------------
+// table_size_exceeded
+//------------------------------------------------------------------------------
+bool SpanBudget::table_size_exceeded(size_t size) noexcept {
+  if (limits_.max_table_size != 0 && size >= limits_.max_table_size) {
+    ++num_dropped_;
+    return true;
+  }
+  return false;
+}
+
+//------------------------------------------------------------------------------
+// log_records_exceeded
+//------------------------------------------------------------------------------
+bool SpanBudget::log_records_exceeded(size_t num_log_records) noexcept {
+  if (limits_.max_log_records != 0 &&
+      num_log_records >= limits_.max_log_records) {
+    ++num_dropped_;
+    return true;
+  }
+  return false;
+}
+
+//------------------------------------------------------------------------------
+// tag
+//------------------------------------------------------------------------------
+void SpanBudget::tag(opentracing::Span& span) const noexcept {
+  if (truncated_) {
+    span.SetTag("bridge.truncated", true);
+  }
+  if (num_dropped_ > 0) {
+    span.SetTag("bridge.dropped", static_cast<int64_t>(num_dropped_));
+  }
+}
+}  // namespace lua_bridge_tracer
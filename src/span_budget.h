@@ -0,0 +1,66 @@
+#pragma once
+
+#include <opentracing/span.h>
+
+#include <cstddef>
+#include <cstdint>
+
+namespace lua_bridge_tracer {
+// Bounds the data a single span can hold. A limit of zero means unlimited.
+struct SpanLimits {
+  // The longest string value kept; longer strings are truncated.
+  size_t max_string_length = 0;
+
+  // The deepest a table value can nest; deeper tables are dropped.
+  size_t max_table_depth = 0;
+
+  // The most entries converted from a single table; the rest are dropped.
+  size_t max_table_size = 0;
+
+  // The most log records buffered for a span; later records are dropped.
+  size_t max_log_records = 0;
+
+  // The most bytes of tag and log data a span can hold; values that don't fit
+  // are dropped.
+  size_t max_bytes = 0;
+};
+
+// Tracks how much of its SpanLimits a span has used. Values are checked
+// against the budget while they're converted from Lua so that oversized data
+// is never copied.
+class SpanBudget {
+ public:
+  explicit SpanBudget(const SpanLimits& limits) noexcept : limits_{limits} {}
+
+  const SpanLimits& limits() const noexcept { return limits_; }
+
+  // The bytes of data charged to the span so far.
+  size_t num_bytes() const noexcept { return num_bytes_; }
+
+  // Charges `size` bytes to the span. Returns false, and counts the value as
+  // dropped, if they don't fit.
+  bool reserve(size_t size) noexcept;
+
+  // Returns the number of bytes of a string of length `length` that should be
+  // kept.
+  size_t string_length(size_t length) noexcept;
+
+  bool table_depth_exceeded(size_t depth) noexcept;
+
+  bool table_size_exceeded(size_t size) noexcept;
+
+  bool log_records_exceeded(size_t num_log_records) noexcept;
+
+  void drop() noexcept { ++num_dropped_; }
+
+  // Records `bridge.truncated` and `bridge.dropped` tags on the span if any of
+  // its data was cut.
+  void tag(opentracing::Span& span) const noexcept;
+
+ private:
+  SpanLimits limits_;
+  size_t num_bytes_ = 0;
+  uint64_t num_dropped_ = 0;
+  bool truncated_ = false;
+};
+}  // namespace lua_bridge_tracer
@@ -0,0 +1,57 @@
+#include "span_cost.h"
+
+#include <time.h>
+
+extern "C" {
+#include <lua.h>
+}  // extern "C"
+
+namespace lua_bridge_tracer {
+//------------------------------------------------------------------------------
+// thread_cpu_time_ns
+//------------------------------------------------------------------------------
+static int64_t thread_cpu_time_ns() noexcept {
+  timespec time;
+  if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &time) != 0) {
+    return 0;
+  }
+  return static_cast<int64_t>(time.tv_sec) * 1000000000 + time.tv_nsec;
+}
+
+//------------------------------------------------------------------------------
+// heap_bytes
+//------------------------------------------------------------------------------
+static int64_t heap_bytes(lua_State* L) noexcept {
+  return static_cast<int64_t>(lua_gc(L, LUA_GCCOUNT, 0)) * 1024 +
+         lua_gc(L, LUA_GCCOUNTB, 0);
+}
+
+//------------------------------------------------------------------------------
+// constructor
+//------------------------------------------------------------------------------
+SpanCost::SpanCost(lua_State* L, std::shared_ptr<SpanCost>&& parent) noexcept
+    : parent_{std::move(parent)},
+      start_cpu_ns_{thread_cpu_time_ns()},
+      start_heap_bytes_{L != nullptr ? heap_bytes(L) : 0} {}
+
+//------------------------------------------------------------------------------
+// finish
+//------------------------------------------------------------------------------
+void SpanCost::finish(lua_State* L, opentracing::Span& span) {
+  auto cpu_ns = thread_cpu_time_ns() - start_cpu_ns_;
+  span.SetTag("cost.cpu_ns", cpu_ns);
+  span.SetTag("cost.self_cpu_ns", cpu_ns - children_cpu_ns_);
+  int64_t heap_delta_bytes = 0;
+  if (L != nullptr) {
+    heap_delta_bytes = heap_bytes(L) - start_heap_bytes_;
+    span.SetTag("cost.heap_delta_bytes", heap_delta_bytes);
+    span.SetTag("cost.self_heap_delta_bytes",
+                heap_delta_bytes - children_heap_bytes_);
+  }
+  if (parent_ != nullptr) {
+    parent_->children_cpu_ns_ += cpu_ns;
+    parent_->children_heap_bytes_ += heap_delta_bytes;
+    parent_ = nullptr;
+  }
+}
+}  // namespace lua_bridge_tracer
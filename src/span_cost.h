@@ -0,0 +1,37 @@
+#pragma once
+
+#include <opentracing/span.h>
+
+#include <cstdint>
+#include <memory>
+
+struct lua_State;
+
+namespace lua_bridge_tracer {
+// Measures the thread CPU time and Lua heap growth between a span's start
+// and finish, for spans started with the `cost` option.
+//
+// A measured span whose parent was also measured adds its totals to the
+// parent's, so that each span is also tagged with its own cost less that of
+// its measured children.
+//
+// CPU time is the calling thread's, so a span that's in flight while its
+// coroutine is suspended also counts whatever else the thread runs meanwhile.
+class SpanCost {
+ public:
+  SpanCost(lua_State* L, std::shared_ptr<SpanCost>&& parent) noexcept;
+
+  SpanCost(const SpanCost&) = delete;
+  SpanCost& operator=(const SpanCost&) = delete;
+
+  // Tags `span` with its cost. The heap is only measured if `L` isn't null.
+  void finish(lua_State* L, opentracing::Span& span);
+
+ private:
+  std::shared_ptr<SpanCost> parent_;
+  int64_t start_cpu_ns_;
+  int64_t start_heap_bytes_;
+  int64_t children_cpu_ns_ = 0;
+  int64_t children_heap_bytes_ = 0;
+};
+}  // namespace lua_bridge_tracer
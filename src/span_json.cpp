@@ -0,0 +1,178 @@
+#include "span_json.h"
+
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+
+namespace lua_bridge_tracer {
+//------------------------------------------------------------------------------
+// write_string
+//------------------------------------------------------------------------------
+static void write_string(std::string& out, opentracing::string_view value) {
+  out.push_back('"');
+  for (auto c : value) {
+    switch (c) {
+      case '"':
+        out.append("\\\"");
+        break;
+      case '\\':
+        out.append("\\\\");
+        break;
+      case '\n':
+        out.append("\\n");
+        break;
+      case '\r':
+        out.append("\\r");
+        break;
+      case '\t':
+        out.append("\\t");
+        break;
+      default:
+        if (static_cast<unsigned char>(c) < 0x20) {
+          char escape[8];
+          std::snprintf(escape, sizeof(escape), "\\u%04x", c);
+          out.append(escape);
+        } else {
+          out.push_back(c);
+        }
+    }
+  }
+  out.push_back('"');
+}
+
+//------------------------------------------------------------------------------
+// write_value
+//------------------------------------------------------------------------------
+static void write_value(std::string& out, const opentracing::Value& value) {
+  if (value.is<bool>()) {
+    out.append(value.get<bool>() ? "true" : "false");
+  } else if (value.is<double>()) {
+    char number[32];
+    std::snprintf(number, sizeof(number), "%.17g", value.get<double>());
+    out.append(number);
+  } else if (value.is<int64_t>()) {
+    out.append(std::to_string(value.get<int64_t>()));
+  } else if (value.is<uint64_t>()) {
+    out.append(std::to_string(value.get<uint64_t>()));
+  } else if (value.is<std::string>()) {
+    write_string(out, value.get<std::string>());
+  } else if (value.is<opentracing::Values>()) {
+    out.push_back('[');
+    auto first = true;
+    for (auto& element : value.get<opentracing::Values>()) {
+      if (!first) {
+        out.push_back(',');
+      }
+      first = false;
+      write_value(out, element);
+    }
+    out.push_back(']');
+  } else if (value.is<opentracing::Dictionary>()) {
+    out.push_back('{');
+    auto first = true;
+    for (auto& element : value.get<opentracing::Dictionary>()) {
+      if (!first) {
+        out.push_back(',');
+      }
+      first = false;
+      write_string(out, element.first);
+      out.push_back(':');
+      write_value(out, element.second);
+    }
+    out.push_back('}');
+  } else {
+    out.append("null");
+  }
+}
+
+//------------------------------------------------------------------------------
+// write_id
+//------------------------------------------------------------------------------
+static void write_id(std::string& out, const char* key, uint64_t high,
+                     uint64_t low) {
+  char id[40];
+  if (high == 0) {
+    std::snprintf(id, sizeof(id), "%016" PRIx64, low);
+  } else {
+    std::snprintf(id, sizeof(id), "%016" PRIx64 "%016" PRIx64, high, low);
+  }
+  out.push_back('"');
+  out.append(key);
+  out.append("\":");
+  write_string(out, id);
+}
+
+//------------------------------------------------------------------------------
+// write_log_record
+//------------------------------------------------------------------------------
+static void write_log_record(std::string& out,
+                             const opentracing::LogRecord& log_record) {
+  out.append("{\"timestamp\":");
+  out.append(std::to_string(
+      std::chrono::duration_cast<std::chrono::microseconds>(
+          log_record.timestamp.time_since_epoch())
+          .count()));
+  out.append(",\"fields\":[");
+  for (size_t i = 0; i < log_record.fields.size(); ++i) {
+    if (i > 0) {
+      out.push_back(',');
+    }
+    out.append("{\"key\":");
+    write_string(out, log_record.fields[i].first);
+    out.append(",\"value\":");
+    write_value(out, log_record.fields[i].second);
+    out.push_back('}');
+  }
+  out.append("]}");
+}
+
+//------------------------------------------------------------------------------
+// write_span_json
+//------------------------------------------------------------------------------
+void write_span_json(const SpanRecord& record,
+                     const std::vector<opentracing::LogRecord>& log_records,
+                     std::string& out) {
+  out.push_back('{');
+  write_id(out, "trace_id", record.trace_id_high, record.trace_id_low);
+  out.push_back(',');
+  write_id(out, "span_id", 0, record.span_id);
+  if (record.parent_span_id != 0) {
+    out.push_back(',');
+    write_id(out, "parent_span_id", 0, record.parent_span_id);
+    out.append(",\"reference_type\":");
+    write_string(out, record.follows_from ? "FOLLOWS_FROM" : "CHILD_OF");
+  }
+  out.append(",\"operation_name\":");
+  write_string(out, record.operation_name);
+  out.append(",\"start_timestamp\":");
+  out.append(std::to_string(record.start_timestamp));
+  out.append(",\"duration_ns\":");
+  out.append(std::to_string(record.duration_ns));
+  out.append(",\"tags\":{");
+  for (size_t i = 0; i < record.tags.size(); ++i) {
+    if (i > 0) {
+      out.push_back(',');
+    }
+    write_string(out, record.tags[i].first);
+    out.push_back(':');
+    write_value(out, record.tags[i].second);
+  }
+  out.append("},\"logs\":[");
+  auto first = true;
+  for (auto& log_record : record.logs) {
+    if (!first) {
+      out.push_back(',');
+    }
+    first = false;
+    write_log_record(out, log_record);
+  }
+  for (auto& log_record : log_records) {
+    if (!first) {
+      out.push_back(',');
+    }
+    first = false;
+    write_log_record(out, log_record);
+  }
+  out.append("]}");
+}
+}  // namespace lua_bridge_tracer
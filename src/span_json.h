@@ -0,0 +1,15 @@
+#pragma once
+
+#include "span_record.h"
+
+#include <string>
+#include <vector>
+
+namespace lua_bridge_tracer {
+// Appends `record` to `out` as a JSON object, with `log_records` added after
+// the record's own logs. IDs are written as hex strings and timestamps as
+// microseconds since the epoch.
+void write_span_json(const SpanRecord& record,
+                     const std::vector<opentracing::LogRecord>& log_records,
+                     std::string& out);
+}  // namespace lua_bridge_tracer
@@ -0,0 +1,128 @@
+#include "span_profiler.h"
+
+#include "lua_span.h"
+#include "stats.h"
+
+#include <chrono>
+#include <exception>
+
+extern "C" {
+#include <lua.h>
+}  // extern "C"
+
+static const char* const truncated_stack = "[truncated]";
+static const char* const unattributed_operation_name = "[no span]";
+
+namespace lua_bridge_tracer {
+//------------------------------------------------------------------------------
+// add
+//------------------------------------------------------------------------------
+void FoldedStacks::add(const std::string& stack, uint64_t count) {
+  auto iter = counts_.find(stack);
+  if (iter != counts_.end()) {
+    iter->second += count;
+  } else if (counts_.size() < max_stacks_) {
+    counts_.emplace(stack, count);
+  } else {
+    counts_[truncated_stack] += count;
+  }
+}
+
+//------------------------------------------------------------------------------
+// to_string
+//------------------------------------------------------------------------------
+std::string FoldedStacks::to_string() const {
+  std::string result;
+  for (auto& count : counts_) {
+    result.append(count.first);
+    result.push_back(' ');
+    result.append(std::to_string(count.second));
+    result.push_back('\n');
+  }
+  return result;
+}
+
+//------------------------------------------------------------------------------
+// append_frame
+//------------------------------------------------------------------------------
+// Appends a frame as `function@source:line`.
+static void append_frame(std::string& stack, const lua_Debug& debug) {
+  opentracing::string_view what = debug.what;
+  if (what == "C") {
+    stack.append(debug.name != nullptr ? debug.name : "[C]");
+    return;
+  }
+  if (what == "main") {
+    stack.append("main");
+  } else {
+    stack.append(debug.name != nullptr ? debug.name : "?");
+  }
+  stack.push_back('@');
+  stack.append(debug.short_src);
+  stack.push_back(':');
+  stack.append(std::to_string(debug.linedefined));
+}
+
+//------------------------------------------------------------------------------
+// find_span
+//------------------------------------------------------------------------------
+// Returns the newest span in `registry` that `L` started, or nullptr.
+static LuaSpan* find_span(lua_State* L, const SpanRegistry& registry) noexcept {
+  auto span = registry.newest();
+  while (span != nullptr && span->registry_entry().thread != L) {
+    span = span->registry_entry().previous;
+  }
+  return span;
+}
+
+//------------------------------------------------------------------------------
+// sample
+//------------------------------------------------------------------------------
+void SpanProfiler::sample(lua_State* L, const SpanRegistry& registry) noexcept {
+  auto start = std::chrono::steady_clock::now();
+  try {
+    lua_Debug debug;
+    int depth = 0;
+    while (static_cast<size_t>(depth) < options_.max_depth &&
+           lua_getstack(L, depth, &debug)) {
+      ++depth;
+    }
+    stack_.clear();
+    for (int level = depth - 1; level >= 0; --level) {
+      lua_getstack(L, level, &debug);
+      lua_getinfo(L, "Sn", &debug);
+      if (!stack_.empty()) {
+        stack_.push_back(';');
+      }
+      append_frame(stack_, debug);
+    }
+
+    auto span = find_span(L, registry);
+    if (span != nullptr) {
+      stacks_.add(span->registry_entry().operation_name + ";" + stack_);
+      if (options_.log_samples) {
+        span->add_profile_sample(stack_, options_.max_stacks);
+      }
+    } else {
+      stacks_.add(unattributed_operation_name + (";" + stack_));
+    }
+  } catch (const std::exception&) {
+    // Drop the sample.
+  }
+  auto& counters = stats();
+  add_stat(counters.profile_samples);
+  add_stat(counters.profile_time_ns,
+           std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now() - start)
+               .count());
+}
+
+//------------------------------------------------------------------------------
+// take_folded_stacks
+//------------------------------------------------------------------------------
+std::string SpanProfiler::take_folded_stacks() {
+  auto result = stacks_.to_string();
+  stacks_ = FoldedStacks{options_.max_stacks};
+  return result;
+}
+}  // namespace lua_bridge_tracer
@@ -0,0 +1,77 @@
+#pragma once
+
+#include "span_registry.h"
+
+#include <opentracing/string_view.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <string>
+
+struct lua_State;
+
+namespace lua_bridge_tracer {
+struct ProfilerOptions {
+  // Lua VM instructions executed between samples.
+  int instructions = 100000;
+
+  // Frames kept from the innermost out; deeper callers are dropped.
+  size_t max_depth = 32;
+
+  // Distinct stacks kept per profile. Samples of further stacks are counted
+  // under `[truncated]`.
+  size_t max_stacks = 1000;
+
+  // Whether each span is finished with a log record of its own samples.
+  bool log_samples = true;
+};
+
+// Counts of sampled stacks, each folded into a line of frames from the
+// outermost in, separated by semicolons.
+class FoldedStacks {
+ public:
+  explicit FoldedStacks(size_t max_stacks) noexcept : max_stacks_{max_stacks} {}
+
+  void add(const std::string& stack, uint64_t count = 1);
+
+  bool empty() const noexcept { return counts_.empty(); }
+
+  // Returns a line for each stack, followed by a space and its count, as
+  // flamegraph.pl reads.
+  std::string to_string() const;
+
+ private:
+  std::map<std::string, uint64_t> counts_;
+  size_t max_stacks_;
+};
+
+// Samples the Lua stack of a lua_State, from a count hook, and attributes
+// each sample to the innermost span started by the running coroutine. Samples
+// are summed by operation name, and optionally kept per span.
+//
+// A profiler belongs to a single lua_State, so it isn't synchronized.
+class SpanProfiler {
+ public:
+  explicit SpanProfiler(const ProfilerOptions& options) noexcept
+      : options_{options}, stacks_{options.max_stacks} {}
+
+  SpanProfiler(const SpanProfiler&) = delete;
+  SpanProfiler& operator=(const SpanProfiler&) = delete;
+
+  const ProfilerOptions& options() const noexcept { return options_; }
+
+  // Samples the stack of `L`. The span sampled is the newest in `registry`
+  // started by `L`.
+  void sample(lua_State* L, const SpanRegistry& registry) noexcept;
+
+  // Returns the samples taken since the last call as folded stacks, each
+  // rooted at the operation name of the span it was attributed to.
+  std::string take_folded_stacks();
+
+ private:
+  ProfilerOptions options_;
+  FoldedStacks stacks_;
+  std::string stack_;
+};
+}  // namespace lua_bridge_tracer
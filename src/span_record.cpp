@@ -0,0 +1,313 @@
+#include "span_record.h"
+
+#include <chrono>
+#include <cstring>
+
+namespace lua_bridge_tracer {
+namespace {
+enum class ValueType : uint8_t {
+  null,
+  boolean,
+  number,
+  int64,
+  uint64,
+  string,
+  array,
+  dictionary
+};
+
+// Bounds the nesting of decoded values so that corrupted data can't exhaust
+// the stack.
+const int max_value_depth = 64;
+
+class Decoder {
+ public:
+  Decoder(const char* data, size_t size) noexcept
+      : data_{data}, remaining_{size} {}
+
+  bool done() const noexcept { return remaining_ == 0; }
+
+  template <class T>
+  bool read(T& value) noexcept {
+    if (remaining_ < sizeof(T)) {
+      return false;
+    }
+    std::memcpy(&value, data_, sizeof(T));
+    data_ += sizeof(T);
+    remaining_ -= sizeof(T);
+    return true;
+  }
+
+  bool read_string(std::string& value) {
+    uint32_t size;
+    if (!read(size) || remaining_ < size) {
+      return false;
+    }
+    value.assign(data_, size);
+    data_ += size;
+    remaining_ -= size;
+    return true;
+  }
+
+  bool read_value(opentracing::Value& value, int depth = 0);
+
+  // Reads a count of items each at least `min_item_size` bytes, rejecting
+  // counts that couldn't fit in what's left.
+  bool read_count(uint32_t& count, size_t min_item_size) noexcept {
+    return read(count) && count <= remaining_ / min_item_size;
+  }
+
+ private:
+  const char* data_;
+  size_t remaining_;
+};
+}  // namespace
+
+//------------------------------------------------------------------------------
+// write
+//------------------------------------------------------------------------------
+template <class T>
+static void write(std::string& buffer, T value) {
+  buffer.append(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+static void write(std::string& buffer, opentracing::string_view value) {
+  write(buffer, static_cast<uint32_t>(value.size()));
+  buffer.append(value.data(), value.size());
+}
+
+static void write(std::string& buffer, const opentracing::Value& value) {
+  if (value.is<bool>()) {
+    write(buffer, ValueType::boolean);
+    write(buffer, static_cast<uint8_t>(value.get<bool>()));
+  } else if (value.is<double>()) {
+    write(buffer, ValueType::number);
+    write(buffer, value.get<double>());
+  } else if (value.is<int64_t>()) {
+    write(buffer, ValueType::int64);
+    write(buffer, value.get<int64_t>());
+  } else if (value.is<uint64_t>()) {
+    write(buffer, ValueType::uint64);
+    write(buffer, value.get<uint64_t>());
+  } else if (value.is<std::string>()) {
+    write(buffer, ValueType::string);
+    write(buffer, opentracing::string_view{value.get<std::string>()});
+  } else if (value.is<opentracing::string_view>()) {
+    write(buffer, ValueType::string);
+    write(buffer, value.get<opentracing::string_view>());
+  } else if (value.is<const char*>()) {
+    write(buffer, ValueType::string);
+    write(buffer, opentracing::string_view{value.get<const char*>()});
+  } else if (value.is<opentracing::Values>()) {
+    auto& values = value.get<opentracing::Values>();
+    write(buffer, ValueType::array);
+    write(buffer, static_cast<uint32_t>(values.size()));
+    for (auto& element : values) {
+      write(buffer, element);
+    }
+  } else if (value.is<opentracing::Dictionary>()) {
+    auto& dictionary = value.get<opentracing::Dictionary>();
+    write(buffer, ValueType::dictionary);
+    write(buffer, static_cast<uint32_t>(dictionary.size()));
+    for (auto& element : dictionary) {
+      write(buffer, opentracing::string_view{element.first});
+      write(buffer, element.second);
+    }
+  } else {
+    write(buffer, ValueType::null);
+  }
+}
+
+//------------------------------------------------------------------------------
+// write_key_values
+//------------------------------------------------------------------------------
+template <class KeyValues>
+static void write_key_values(std::string& buffer,
+                             const KeyValues& key_values) {
+  write(buffer, static_cast<uint32_t>(key_values.size()));
+  for (auto& key_value : key_values) {
+    write(buffer, opentracing::string_view{key_value.first});
+    write(buffer, key_value.second);
+  }
+}
+
+//------------------------------------------------------------------------------
+// write_log_record
+//------------------------------------------------------------------------------
+static void write_log_record(std::string& buffer,
+                             const opentracing::LogRecord& log_record) {
+  write(buffer, static_cast<int64_t>(
+                    std::chrono::duration_cast<std::chrono::microseconds>(
+                        log_record.timestamp.time_since_epoch())
+                        .count()));
+  write_key_values(buffer, log_record.fields);
+}
+
+//------------------------------------------------------------------------------
+// encode_span_record
+//------------------------------------------------------------------------------
+void encode_span_record(const SpanRecord& record,
+                        const std::vector<opentracing::LogRecord>& log_records,
+                        std::string& buffer) {
+  write(buffer, record.trace_id_high);
+  write(buffer, record.trace_id_low);
+  write(buffer, record.span_id);
+  write(buffer, record.parent_span_id);
+  write(buffer, static_cast<uint8_t>(record.follows_from));
+  write(buffer, record.start_timestamp);
+  write(buffer, record.duration_ns);
+  write(buffer, opentracing::string_view{record.operation_name});
+  write_key_values(buffer, record.tags);
+  write(buffer, static_cast<uint32_t>(record.logs.size() + log_records.size()));
+  for (auto& log_record : record.logs) {
+    write_log_record(buffer, log_record);
+  }
+  for (auto& log_record : log_records) {
+    write_log_record(buffer, log_record);
+  }
+}
+
+//------------------------------------------------------------------------------
+// read
+//------------------------------------------------------------------------------
+bool Decoder::read_value(opentracing::Value& value, int depth) {
+  if (depth > max_value_depth) {
+    return false;
+  }
+  ValueType type;
+  if (!read(type)) {
+    return false;
+  }
+  switch (type) {
+    case ValueType::null:
+      value = nullptr;
+      return true;
+    case ValueType::boolean: {
+      uint8_t boolean;
+      if (!read(boolean)) {
+        return false;
+      }
+      value = boolean != 0;
+      return true;
+    }
+    case ValueType::number: {
+      double number;
+      if (!read(number)) {
+        return false;
+      }
+      value = number;
+      return true;
+    }
+    case ValueType::int64: {
+      int64_t number;
+      if (!read(number)) {
+        return false;
+      }
+      value = number;
+      return true;
+    }
+    case ValueType::uint64: {
+      uint64_t number;
+      if (!read(number)) {
+        return false;
+      }
+      value = number;
+      return true;
+    }
+    case ValueType::string: {
+      std::string string;
+      if (!read_string(string)) {
+        return false;
+      }
+      value = std::move(string);
+      return true;
+    }
+    case ValueType::array: {
+      uint32_t size;
+      if (!read_count(size, sizeof(ValueType))) {
+        return false;
+      }
+      opentracing::Values values(size);
+      for (auto& element : values) {
+        if (!read_value(element, depth + 1)) {
+          return false;
+        }
+      }
+      value = std::move(values);
+      return true;
+    }
+    case ValueType::dictionary: {
+      uint32_t size;
+      if (!read_count(size, sizeof(uint32_t) + sizeof(ValueType))) {
+        return false;
+      }
+      opentracing::Dictionary dictionary;
+      for (uint32_t i = 0; i < size; ++i) {
+        std::string key;
+        opentracing::Value element;
+        if (!read_string(key) || !read_value(element, depth + 1)) {
+          return false;
+        }
+        dictionary.emplace(std::move(key), std::move(element));
+      }
+      value = std::move(dictionary);
+      return true;
+    }
+  }
+  return false;
+}
+
+//------------------------------------------------------------------------------
+// read_key_values
+//------------------------------------------------------------------------------
+template <class KeyValues>
+static bool read_key_values(Decoder& decoder, KeyValues& key_values) {
+  uint32_t size;
+  if (!decoder.read_count(size, sizeof(uint32_t) + sizeof(ValueType))) {
+    return false;
+  }
+  key_values.resize(size);
+  for (auto& key_value : key_values) {
+    if (!decoder.read_string(key_value.first) ||
+        !decoder.read_value(key_value.second)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+//------------------------------------------------------------------------------
+// decode_span_record
+//------------------------------------------------------------------------------
+bool decode_span_record(const char* data, size_t size, SpanRecord& record) {
+  Decoder decoder{data, size};
+  uint8_t follows_from;
+  if (!decoder.read(record.trace_id_high) ||
+      !decoder.read(record.trace_id_low) || !decoder.read(record.span_id) ||
+      !decoder.read(record.parent_span_id) || !decoder.read(follows_from) ||
+      !decoder.read(record.start_timestamp) ||
+      !decoder.read(record.duration_ns) ||
+      !decoder.read_string(record.operation_name) ||
+      !read_key_values(decoder, record.tags)) {
+    return false;
+  }
+  record.follows_from = follows_from != 0;
+
+  uint32_t num_logs;
+  if (!decoder.read_count(num_logs, sizeof(int64_t) + sizeof(uint32_t))) {
+    return false;
+  }
+  record.logs.resize(num_logs);
+  for (auto& log_record : record.logs) {
+    int64_t timestamp;
+    if (!decoder.read(timestamp) ||
+        !read_key_values(decoder, log_record.fields)) {
+      return false;
+    }
+    log_record.timestamp = opentracing::SystemTime{
+        std::chrono::duration_cast<opentracing::SystemClock::duration>(
+            std::chrono::microseconds{timestamp})};
+  }
+  return decoder.done();
+}
+}  // namespace lua_bridge_tracer
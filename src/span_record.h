@@ -0,0 +1,47 @@
+#pragma once
+
+#include "small_vector.h"
+
+#include <opentracing/span.h>
+#include <opentracing/value.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace lua_bridge_tracer {
+// Spans seldom have more than a few tags, so they're stored inline.
+using SpanTags = SmallVector<std::pair<std::string, opentracing::Value>, 8>;
+
+// A finished span as it's exported to a SpanSink.
+struct SpanRecord {
+  uint64_t trace_id_high = 0;
+  uint64_t trace_id_low = 0;
+  uint64_t span_id = 0;
+
+  // Zero for a root span.
+  uint64_t parent_span_id = 0;
+  bool follows_from = false;
+
+  // Microseconds since the epoch.
+  int64_t start_timestamp = 0;
+  int64_t duration_ns = 0;
+
+  std::string operation_name;
+  SpanTags tags;
+  std::vector<opentracing::LogRecord> logs;
+};
+
+// Appends the binary encoding of `record` to `buffer`, with `log_records`
+// added after the record's own logs. Integers are written in host byte order,
+// since records don't leave the host.
+void encode_span_record(const SpanRecord& record,
+                        const std::vector<opentracing::LogRecord>& log_records,
+                        std::string& buffer);
+
+// Decodes a record written by encode_span_record. Returns false if `data`
+// isn't a valid record.
+bool decode_span_record(const char* data, size_t size, SpanRecord& record);
+}  // namespace lua_bridge_tracer
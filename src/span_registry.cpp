@@ -0,0 +1,50 @@
+#include "span_registry.h"
+
+#include "lua_span.h"
+
+namespace lua_bridge_tracer {
+//------------------------------------------------------------------------------
+// insert
+//------------------------------------------------------------------------------
+void SpanRegistry::insert(LuaSpan& span,
+                          opentracing::SteadyTime start_timestamp,
+                          opentracing::string_view operation_name) {
+  auto& entry = span.registry_entry();
+  entry.operation_name.assign(operation_name.data(), operation_name.size());
+  entry.start_timestamp = start_timestamp;
+  entry.previous = tail_;
+  entry.next = nullptr;
+  entry.is_registered = true;
+  if (tail_ == nullptr) {
+    head_ = &span;
+  } else {
+    tail_->registry_entry().next = &span;
+  }
+  tail_ = &span;
+  ++size_;
+}
+
+//------------------------------------------------------------------------------
+// remove
+//------------------------------------------------------------------------------
+void SpanRegistry::remove(LuaSpan& span) noexcept {
+  auto& entry = span.registry_entry();
+  if (!entry.is_registered) {
+    return;
+  }
+  if (entry.previous == nullptr) {
+    head_ = entry.next;
+  } else {
+    entry.previous->registry_entry().next = entry.next;
+  }
+  if (entry.next == nullptr) {
+    tail_ = entry.previous;
+  } else {
+    entry.next->registry_entry().previous = entry.previous;
+  }
+  entry.previous = nullptr;
+  entry.next = nullptr;
+  entry.is_registered = false;
+  --size_;
+}
+}  // namespace lua_bridge_tracer
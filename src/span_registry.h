@@ -0,0 +1,75 @@
+#pragma once
+
+#include <opentracing/string_view.h>
+#include <opentracing/util.h>
+
+#include <chrono>
+#include <cstddef>
+#include <string>
+
+namespace lua_bridge_tracer {
+class LuaSpan;
+
+// What happens to a tracked span that's been in flight for longer than
+// SpanTracking::max_age.
+enum class ExpiredSpanAction {
+  // Finish the span, tagged with `bridge.expired`.
+  finish,
+
+  // Discard the span's buffered logs without finishing it. The
+  // span object itself lives on until the last reference to it (or to its
+  // context) is freed; what its destructor does then is up to the tracer, and
+  // most plugins finish an unfinished span there.
+  drop
+};
+
+struct SpanTracking {
+  bool enabled = false;
+
+  // Zero means spans never expire.
+  std::chrono::microseconds max_age{0};
+
+  ExpiredSpanAction expired_action = ExpiredSpanAction::finish;
+};
+
+// Links a LuaSpan into a SpanRegistry.
+struct SpanRegistryEntry {
+  LuaSpan* previous = nullptr;
+  LuaSpan* next = nullptr;
+  bool is_registered = false;
+  opentracing::SteadyTime start_timestamp;
+  std::string operation_name;
+  size_t num_tags = 0;
+
+  // The coroutine that started the span, or nullptr if it wasn't started
+  // from Lua.
+  const void* thread = nullptr;
+};
+
+// An intrusive list of unfinished spans, ordered from the oldest to the
+// newest. A registry belongs to a single lua_State, so it isn't synchronized.
+class SpanRegistry {
+ public:
+  SpanRegistry() noexcept = default;
+
+  SpanRegistry(const SpanRegistry&) = delete;
+  SpanRegistry& operator=(const SpanRegistry&) = delete;
+
+  void insert(LuaSpan& span, opentracing::SteadyTime start_timestamp,
+              opentracing::string_view operation_name);
+
+  // Unlinks `span` if it's registered.
+  void remove(LuaSpan& span) noexcept;
+
+  LuaSpan* oldest() const noexcept { return head_; }
+
+  LuaSpan* newest() const noexcept { return tail_; }
+
+  size_t size() const noexcept { return size_; }
+
+ private:
+  LuaSpan* head_ = nullptr;
+  LuaSpan* tail_ = nullptr;
+  size_t size_ = 0;
+};
+}  // namespace lua_bridge_tracer
@@ -0,0 +1,339 @@
+#include "span_ring.h"
+
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+#if ATOMIC_LLONG_LOCK_FREE != 2 || ATOMIC_INT_LOCK_FREE != 2
+#error "SpanRing requires lock-free atomics to share memory between processes"
+#endif
+
+namespace lua_bridge_tracer {
+static const uint64_t span_ring_magic = 0x474e495241545053;  // "SPTARING"
+
+// Positions are byte offsets that only ever increase; they're mapped into the
+// data area by masking with capacity - 1.
+struct SpanRing::Header {
+  uint64_t magic;
+  uint32_t version;
+  uint32_t reserved;
+  uint64_t capacity;
+
+  // Kept on separate cache lines so that writers and the reader don't contend
+  // for them.
+  alignas(64) std::atomic<uint64_t> write_position;
+  alignas(64) std::atomic<uint64_t> read_position;
+  alignas(64) std::atomic<uint64_t> num_dropped;
+  std::atomic<uint64_t> num_skipped;
+};
+
+namespace {
+// Each record starts with a header on an 8-byte boundary. `size` is zero
+// until the record is committed, then the size of the header and the data.
+// `reservation` is set as soon as the space is reserved, to the writer's pid
+// in the high 32 bits and the aligned size of the record in the low 32, so
+// that the reader can step over a record that's never committed.
+struct RecordHeader {
+  std::atomic<uint32_t> size;
+  uint32_t type;
+  std::atomic<uint64_t> reservation;
+};
+
+enum RecordType : uint32_t { data_record = 1, padding_record = 2 };
+
+// The records start after this many bytes of the file.
+const size_t header_size = 256;
+}  // namespace
+
+static_assert(sizeof(RecordHeader) == 16, "unexpected RecordHeader size");
+
+//------------------------------------------------------------------------------
+// align_record_size
+//------------------------------------------------------------------------------
+static uint64_t align_record_size(uint64_t size) noexcept {
+  return (size + 7) & ~static_cast<uint64_t>(7);
+}
+
+//------------------------------------------------------------------------------
+// round_up_capacity
+//------------------------------------------------------------------------------
+static size_t round_up_capacity(size_t capacity) noexcept {
+  size_t result = 4096;
+  while (result < capacity) {
+    result *= 2;
+  }
+  return result;
+}
+
+//------------------------------------------------------------------------------
+// get_errno_message
+//------------------------------------------------------------------------------
+static std::string get_errno_message(const std::string& message) {
+  return message + ": " + std::strerror(errno);
+}
+
+//------------------------------------------------------------------------------
+// FileDescriptor
+//------------------------------------------------------------------------------
+namespace {
+class FileDescriptor {
+ public:
+  explicit FileDescriptor(int file_descriptor) noexcept
+      : file_descriptor_{file_descriptor} {}
+
+  FileDescriptor(const FileDescriptor&) = delete;
+  FileDescriptor& operator=(const FileDescriptor&) = delete;
+
+  ~FileDescriptor() {
+    if (file_descriptor_ != -1) {
+      ::close(file_descriptor_);
+    }
+  }
+
+  int get() const noexcept { return file_descriptor_; }
+
+ private:
+  int file_descriptor_;
+};
+}  // namespace
+
+//------------------------------------------------------------------------------
+// constructor
+//------------------------------------------------------------------------------
+SpanRing::SpanRing(void* mapping, size_t mapping_size) noexcept
+    : mapping_{mapping},
+      mapping_size_{mapping_size},
+      header_{static_cast<Header*>(mapping)},
+      data_{static_cast<char*>(mapping) + header_size},
+      capacity_{static_cast<size_t>(header_->capacity)} {}
+
+//------------------------------------------------------------------------------
+// destructor
+//------------------------------------------------------------------------------
+SpanRing::~SpanRing() { ::munmap(mapping_, mapping_size_); }
+
+//------------------------------------------------------------------------------
+// open
+//------------------------------------------------------------------------------
+std::unique_ptr<SpanRing> SpanRing::open(const std::string& path,
+                                         size_t capacity) {
+  static_assert(sizeof(Header) <= header_size, "Header doesn't fit");
+  FileDescriptor file{::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600)};
+  if (file.get() == -1) {
+    throw std::runtime_error{get_errno_message("failed to open " + path)};
+  }
+
+  // Serialize initialization between processes opening a new ring at once.
+  if (::flock(file.get(), LOCK_EX) != 0) {
+    throw std::runtime_error{get_errno_message("failed to lock " + path)};
+  }
+  struct stat file_stat;
+  if (::fstat(file.get(), &file_stat) != 0) {
+    throw std::runtime_error{get_errno_message("failed to stat " + path)};
+  }
+  auto is_new = file_stat.st_size == 0;
+  size_t mapping_size;
+  if (is_new) {
+    capacity = round_up_capacity(capacity);
+    mapping_size = header_size + capacity;
+    if (::ftruncate(file.get(), static_cast<off_t>(mapping_size)) != 0) {
+      throw std::runtime_error{get_errno_message("failed to size " + path)};
+    }
+  } else {
+    mapping_size = static_cast<size_t>(file_stat.st_size);
+    if (mapping_size < header_size) {
+      throw std::runtime_error{path + " isn't a span ring"};
+    }
+  }
+
+  auto mapping = ::mmap(nullptr, mapping_size, PROT_READ | PROT_WRITE,
+                        MAP_SHARED, file.get(), 0);
+  if (mapping == MAP_FAILED) {
+    throw std::runtime_error{get_errno_message("failed to map " + path)};
+  }
+  std::unique_ptr<SpanRing> result{new SpanRing{mapping, mapping_size}};
+  auto header = static_cast<Header*>(mapping);
+  if (is_new) {
+    // The file is zero-filled, which leaves the positions and every record
+    // uncommitted.
+    header->version = version;
+    header->capacity = capacity;
+    header->magic = span_ring_magic;
+    result->capacity_ = capacity;
+  } else if (header->magic != span_ring_magic || header->version != version ||
+             header->capacity == 0 ||
+             (header->capacity & (header->capacity - 1)) != 0 ||
+             header_size + header->capacity != mapping_size) {
+    throw std::runtime_error{path + " isn't a compatible span ring"};
+  }
+  ::flock(file.get(), LOCK_UN);
+  return result;
+}
+
+//------------------------------------------------------------------------------
+// write
+//------------------------------------------------------------------------------
+bool SpanRing::write(const char* data, size_t size) noexcept {
+  auto record_data = reserve(size);
+  if (record_data == nullptr) {
+    return false;
+  }
+  std::memcpy(record_data, data, size);
+  commit(record_data, size);
+  return true;
+}
+
+//------------------------------------------------------------------------------
+// reserve
+//------------------------------------------------------------------------------
+char* SpanRing::reserve(size_t size) noexcept {
+  auto record_size = align_record_size(sizeof(RecordHeader) + size);
+  if (record_size > capacity_ || size > UINT32_MAX - sizeof(RecordHeader)) {
+    header_->num_dropped.fetch_add(1, std::memory_order_relaxed);
+    return nullptr;
+  }
+
+  // Reserve space, preceded by padding if the record would otherwise wrap
+  // around the end of the data area. Padding too short for a record header
+  // is left unmarked; the reader skips any such tail (see read).
+  auto position = header_->write_position.load(std::memory_order_relaxed);
+  uint64_t padding;
+  while (true) {
+    auto offset = position & (capacity_ - 1);
+    padding = offset + record_size > capacity_ ? capacity_ - offset : 0;
+    auto end = position + padding + record_size;
+    auto read_position =
+        header_->read_position.load(std::memory_order_acquire);
+    if (end - read_position > capacity_) {
+      header_->num_dropped.fetch_add(1, std::memory_order_relaxed);
+      return nullptr;
+    }
+    if (header_->write_position.compare_exchange_weak(
+            position, end, std::memory_order_relaxed,
+            std::memory_order_relaxed)) {
+      break;
+    }
+  }
+
+  // Record the reservation before anything else, so that the window in which
+  // a dying writer leaves the reader unable to step over it is as short as
+  // possible.
+  auto pid = static_cast<uint64_t>(static_cast<uint32_t>(::getpid()));
+  auto record = reinterpret_cast<RecordHeader*>(
+      data_ + ((position + padding) & (capacity_ - 1)));
+  record->reservation.store(pid << 32 | record_size, std::memory_order_release);
+  if (padding >= sizeof(RecordHeader)) {
+    auto padding_header = reinterpret_cast<RecordHeader*>(
+        data_ + (position & (capacity_ - 1)));
+    padding_header->type = padding_record;
+    padding_header->size.store(static_cast<uint32_t>(padding),
+                               std::memory_order_release);
+  }
+  return reinterpret_cast<char*>(record) + sizeof(RecordHeader);
+}
+
+//------------------------------------------------------------------------------
+// commit
+//------------------------------------------------------------------------------
+void SpanRing::commit(char* data, size_t size) noexcept {
+  auto record = reinterpret_cast<RecordHeader*>(data - sizeof(RecordHeader));
+  record->type = data_record;
+  record->size.store(static_cast<uint32_t>(sizeof(RecordHeader) + size),
+                     std::memory_order_release);
+}
+
+//------------------------------------------------------------------------------
+// is_abandoned
+//------------------------------------------------------------------------------
+// Whether the uncommitted record at `position` should be skipped: its writer's
+// process is gone, or it's been uncommitted for the stall timeout.
+bool SpanRing::is_abandoned(uint64_t position, uint32_t writer_pid) {
+  if (::kill(static_cast<pid_t>(writer_pid), 0) == -1 && errno == ESRCH) {
+    return true;
+  }
+  auto now = std::chrono::steady_clock::now();
+  if (position != stalled_position_) {
+    stalled_position_ = position;
+    stalled_since_ = now;
+  }
+  return now - stalled_since_ >= stall_timeout_;
+}
+
+//------------------------------------------------------------------------------
+// read
+//------------------------------------------------------------------------------
+bool SpanRing::read(std::string& record) {
+  while (true) {
+    auto position = header_->read_position.load(std::memory_order_relaxed);
+    if (position == header_->write_position.load(std::memory_order_relaxed)) {
+      return false;
+    }
+    // No record starts this close to the end of the data area, so the
+    // writer's padded past it.
+    auto offset = position & (capacity_ - 1);
+    if (capacity_ - offset < sizeof(RecordHeader)) {
+      header_->read_position.store(position + capacity_ - offset,
+                                   std::memory_order_release);
+      continue;
+    }
+    auto record_header = reinterpret_cast<RecordHeader*>(data_ + offset);
+    auto size = record_header->size.load(std::memory_order_acquire);
+    auto is_data = record_header->type == data_record;
+    uint64_t record_size;
+    if (size != 0) {
+      record_size = align_record_size(size);
+    } else {
+      // Reserved but not yet committed, or, if the reservation hasn't been
+      // recorded, still being reserved.
+      auto reservation =
+          record_header->reservation.load(std::memory_order_acquire);
+      if (reservation == 0 ||
+          !is_abandoned(position, static_cast<uint32_t>(reservation >> 32))) {
+        return false;
+      }
+      record_size = reservation & UINT32_MAX;
+      is_data = false;
+      header_->num_skipped.fetch_add(1, std::memory_order_relaxed);
+    }
+    if (is_data) {
+      record.assign(
+          reinterpret_cast<const char*>(record_header) + sizeof(RecordHeader),
+          size - sizeof(RecordHeader));
+    }
+
+    // Zero the space so that any record header later written into it reads
+    // as uncommitted until it's committed, then hand it back to writers.
+    std::memset(reinterpret_cast<char*>(record_header) + sizeof(RecordHeader),
+                0, record_size - sizeof(RecordHeader));
+    record_header->type = 0;
+    record_header->reservation.store(0, std::memory_order_relaxed);
+    record_header->size.store(0, std::memory_order_relaxed);
+    header_->read_position.store(position + record_size,
+                                 std::memory_order_release);
+    if (is_data) {
+      return true;
+    }
+  }
+}
+
+//------------------------------------------------------------------------------
+// num_dropped
+//------------------------------------------------------------------------------
+uint64_t SpanRing::num_dropped() const noexcept {
+  return header_->num_dropped.load(std::memory_order_relaxed);
+}
+
+//------------------------------------------------------------------------------
+// num_skipped
+//------------------------------------------------------------------------------
+uint64_t SpanRing::num_skipped() const noexcept {
+  return header_->num_skipped.load(std::memory_order_relaxed);
+}
+}  // namespace lua_bridge_tracer
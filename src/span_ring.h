@@ -0,0 +1,86 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+namespace lua_bridge_tracer {
+// A ring buffer of variable-length records in a memory-mapped file. Any number
+// of threads and processes can write to it without locking, while a single
+// reader (for example, a sidecar that forwards spans to a collector) consumes
+// the records in the order their space was reserved.
+//
+// Writers never wait: a record that doesn't fit in the space the reader has
+// yet to free is dropped and counted. Each reservation records its size and
+// the writer's pid, so a record that a writer never commits (because it was
+// killed, say) is skipped and counted once the writer's process is gone, or
+// once it's been left uncommitted for the stall timeout.
+class SpanRing {
+ public:
+  // Bumped whenever the layout of the file changes.
+  static const uint32_t version = 2;
+
+  // Opens the ring at `path`, creating it with room for `capacity` bytes of
+  // records (rounded up to a power of two) if it doesn't exist. Throws
+  // std::runtime_error on failure.
+  static std::unique_ptr<SpanRing> open(const std::string& path,
+                                        size_t capacity);
+
+  SpanRing(const SpanRing&) = delete;
+  SpanRing& operator=(const SpanRing&) = delete;
+
+  ~SpanRing();
+
+  size_t capacity() const noexcept { return capacity_; }
+
+  // Copies `size` bytes into the ring as a single record. Returns false, and
+  // counts the record as dropped, if there isn't room for it.
+  bool write(const char* data, size_t size) noexcept;
+
+  // Reserves space for a record of `size` bytes, returning where its data
+  // goes, or returns nullptr, and counts the record as dropped, if there
+  // isn't room for it. The record is read once it's passed to `commit`.
+  char* reserve(size_t size) noexcept;
+
+  void commit(char* data, size_t size) noexcept;
+
+  // Copies the oldest committed record into `record` and frees its space.
+  // Returns false if there's no record ready to be read.
+  bool read(std::string& record);
+
+  // How long `read` waits on a record that's reserved but uncommitted, while
+  // its writer's process is still running, before skipping it. A writer
+  // that's merely slow past the timeout corrupts the records after it, so
+  // it's generous by default.
+  void set_stall_timeout(std::chrono::milliseconds stall_timeout) noexcept {
+    stall_timeout_ = stall_timeout;
+  }
+
+  // The number of records dropped because the ring was full.
+  uint64_t num_dropped() const noexcept;
+
+  // The number of uncommitted records the reader skipped.
+  uint64_t num_skipped() const noexcept;
+
+ private:
+  struct Header;
+
+  SpanRing(void* mapping, size_t mapping_size) noexcept;
+
+  void* mapping_;
+  size_t mapping_size_;
+  Header* header_;
+  char* data_;
+  size_t capacity_;
+
+  // Reader state for the record it's waiting on.
+  std::chrono::milliseconds stall_timeout_{10000};
+  uint64_t stalled_position_ = UINT64_MAX;
+  std::chrono::steady_clock::time_point stalled_since_;
+
+  bool is_abandoned(uint64_t position, uint32_t writer_pid);
+};
+}  // namespace lua_bridge_tracer
@@ -0,0 +1,82 @@
+#include "span_sink.h"
+
+#include "span_json.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+namespace lua_bridge_tracer {
+//------------------------------------------------------------------------------
+// Export
+//------------------------------------------------------------------------------
+bool RingSpanSink::Export(
+    const SpanRecord& record,
+    const std::vector<opentracing::LogRecord>& log_records) noexcept try {
+  static thread_local std::string buffer;
+  buffer.clear();
+  encode_span_record(record, log_records, buffer);
+  return ring_->write(buffer.data(), buffer.size());
+} catch (const std::exception&) {
+  // The span is lost, the same as if the ring were full.
+  return false;
+}
+
+//------------------------------------------------------------------------------
+// constructor
+//------------------------------------------------------------------------------
+FileSpanSink::FileSpanSink(const std::string& path)
+    : fd_{::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC,
+                 0666)} {
+  if (fd_ == -1) {
+    throw std::runtime_error{"failed to open " + path + ": " +
+                             std::strerror(errno)};
+  }
+}
+
+//------------------------------------------------------------------------------
+// destructor
+//------------------------------------------------------------------------------
+FileSpanSink::~FileSpanSink() { ::close(fd_); }
+
+//------------------------------------------------------------------------------
+// Export
+//------------------------------------------------------------------------------
+bool FileSpanSink::Export(
+    const SpanRecord& record,
+    const std::vector<opentracing::LogRecord>& log_records) noexcept try {
+  static thread_local std::string buffer;
+  buffer.clear();
+  write_span_json(record, log_records, buffer);
+  buffer.push_back('\n');
+
+  // Writes to an O_APPEND descriptor each land at the end of the file as a
+  // whole, where stdio would split lines at its buffer's boundaries. A line
+  // only partly written is cut short rather than retried, since finishing it
+  // with a second write could interleave with another writer's.
+  ssize_t num_written;
+  do {
+    num_written = ::write(fd_, buffer.data(), buffer.size());
+  } while (num_written == -1 && errno == EINTR);
+  return num_written == static_cast<ssize_t>(buffer.size());
+} catch (const std::exception&) {
+  // Drop the span.
+  return false;
+}
+
+//------------------------------------------------------------------------------
+// Export
+//------------------------------------------------------------------------------
+bool CallbackSpanSink::Export(
+    const SpanRecord& record,
+    const std::vector<opentracing::LogRecord>& log_records) noexcept try {
+  callback_(record, log_records);
+  return true;
+} catch (const std::exception&) {
+  // Drop the span.
+  return false;
+}
+}  // namespace lua_bridge_tracer
@@ -0,0 +1,85 @@
+#pragma once
+
+#include "span_record.h"
+#include "span_ring.h"
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace lua_bridge_tracer {
+// Where a NativeTracer sends the spans it finishes.
+//
+// Export can be called from any thread that finishes a span, so sinks must be
+// thread-safe.
+class SpanSink {
+ public:
+  virtual ~SpanSink() = default;
+
+  // `log_records` are logs passed when the span was finished, to be treated
+  // as if they came after the record's own logs. Returns false if the span
+  // was dropped.
+  virtual bool Export(
+      const SpanRecord& record,
+      const std::vector<opentracing::LogRecord>& log_records) noexcept = 0;
+
+  // Writes out any spans the sink has buffered.
+  virtual void Flush() noexcept {}
+
+  // Called when the tracer is closed.
+  virtual void Close() noexcept { Flush(); }
+};
+
+// Encodes spans into a SpanRing for a separate process to read.
+class RingSpanSink final : public SpanSink {
+ public:
+  explicit RingSpanSink(std::unique_ptr<SpanRing>&& ring) noexcept
+      : ring_{std::move(ring)} {}
+
+  bool Export(const SpanRecord& record,
+              const std::vector<opentracing::LogRecord>& log_records) noexcept
+      override;
+
+ private:
+  std::unique_ptr<SpanRing> ring_;
+};
+
+// Appends spans to a file as JSON, one span per line. Each line is appended
+// with a single write(2), so lines written by different threads or processes
+// don't interleave.
+class FileSpanSink final : public SpanSink {
+ public:
+  explicit FileSpanSink(const std::string& path);
+
+  FileSpanSink(const FileSpanSink&) = delete;
+  FileSpanSink& operator=(const FileSpanSink&) = delete;
+
+  ~FileSpanSink() override;
+
+  bool Export(const SpanRecord& record,
+              const std::vector<opentracing::LogRecord>& log_records) noexcept
+      override;
+
+ private:
+  int fd_;
+};
+
+// Passes spans to a function.
+class CallbackSpanSink final : public SpanSink {
+ public:
+  using Callback = std::function<void(
+      const SpanRecord& record,
+      const std::vector<opentracing::LogRecord>& log_records)>;
+
+  explicit CallbackSpanSink(Callback&& callback) noexcept
+      : callback_{std::move(callback)} {}
+
+  bool Export(const SpanRecord& record,
+              const std::vector<opentracing::LogRecord>& log_records) noexcept
+      override;
+
+ private:
+  Callback callback_;
+};
+}  // namespace lua_bridge_tracer
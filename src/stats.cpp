@@ -0,0 +1,156 @@
+#include "stats.h"
+
+#include <algorithm>
+#include <mutex>
+#include <vector>
+
+namespace lua_bridge_tracer {
+//------------------------------------------------------------------------------
+// accumulate
+//------------------------------------------------------------------------------
+static void accumulate(const std::atomic<int64_t>& from,
+                       std::atomic<int64_t>& to) noexcept {
+  to.store(to.load(std::memory_order_relaxed) +
+               from.load(std::memory_order_relaxed),
+           std::memory_order_relaxed);
+}
+
+// Adds each of the counters in `from` to those in `to`.
+static void accumulate(const Stats& from, Stats& to) noexcept {
+  accumulate(from.spans_started, to.spans_started);
+  accumulate(from.spans_finished, to.spans_finished);
+  accumulate(from.spans_abandoned, to.spans_abandoned);
+  accumulate(from.spans_expired, to.spans_expired);
+  accumulate(from.live_spans, to.live_spans);
+  accumulate(from.live_span_contexts, to.live_span_contexts);
+  accumulate(from.live_tracers, to.live_tracers);
+  accumulate(from.buffered_log_records, to.buffered_log_records);
+  accumulate(from.buffered_log_bytes, to.buffered_log_bytes);
+  for (int i = 0; i < num_carrier_formats; ++i) {
+    accumulate(from.injects[i], to.injects[i]);
+    accumulate(from.inject_failures[i], to.inject_failures[i]);
+    accumulate(from.extracts[i], to.extracts[i]);
+    accumulate(from.extract_failures[i], to.extract_failures[i]);
+  }
+  accumulate(from.plugin_time_ns, to.plugin_time_ns);
+  accumulate(from.spans_shed, to.spans_shed);
+  accumulate(from.load_shedding_episodes, to.load_shedding_episodes);
+  accumulate(from.log_records_streamed, to.log_records_streamed);
+  accumulate(from.profile_samples, to.profile_samples);
+  accumulate(from.profile_time_ns, to.profile_time_ns);
+}
+
+//------------------------------------------------------------------------------
+// StatsRegistry
+//------------------------------------------------------------------------------
+namespace {
+// Keeps track of each thread's counters, and the totals of threads that have
+// exited.
+class StatsRegistry {
+ public:
+  void add(Stats& thread_stats) {
+    std::lock_guard<std::mutex> lock{mutex_};
+    thread_stats_.push_back(&thread_stats);
+  }
+
+  void remove(Stats& thread_stats) noexcept {
+    std::lock_guard<std::mutex> lock{mutex_};
+    accumulate(thread_stats, exited_stats_);
+    thread_stats_.erase(std::remove(thread_stats_.begin(),
+                                    thread_stats_.end(), &thread_stats),
+                        thread_stats_.end());
+  }
+
+  // Adds every thread's counters to `result`.
+  void sum(Stats& result) noexcept {
+    std::lock_guard<std::mutex> lock{mutex_};
+    accumulate(exited_stats_, result);
+    for (auto thread_stats : thread_stats_) {
+      accumulate(*thread_stats, result);
+    }
+  }
+
+ private:
+  std::mutex mutex_;
+  std::vector<Stats*> thread_stats_;
+  Stats exited_stats_{};
+};
+
+struct ThreadStats {
+  Stats stats{};
+
+  ThreadStats() { registry().add(stats); }
+
+  ~ThreadStats() { registry().remove(stats); }
+
+  // Never freed, so that it outlives the counters of threads that exit after
+  // static destructors have run.
+  static StatsRegistry& registry() {
+    static auto result = new StatsRegistry{};
+    return *result;
+  }
+};
+}  // namespace
+
+//------------------------------------------------------------------------------
+// stats
+//------------------------------------------------------------------------------
+Stats& stats() noexcept {
+  static thread_local ThreadStats thread_stats;
+  return thread_stats.stats;
+}
+
+//------------------------------------------------------------------------------
+// set_field
+//------------------------------------------------------------------------------
+static void set_field(lua_State* L, const char* name,
+                      const std::atomic<int64_t>& counter) noexcept {
+  lua_pushnumber(
+      L, static_cast<lua_Number>(counter.load(std::memory_order_relaxed)));
+  lua_setfield(L, -2, name);
+}
+
+//------------------------------------------------------------------------------
+// set_propagation_fields
+//------------------------------------------------------------------------------
+static void set_propagation_fields(lua_State* L, const Stats& counters,
+                                   const char* name,
+                                   CarrierFormat format) noexcept {
+  auto index = static_cast<int>(format);
+  lua_createtable(L, 0, 4);
+  set_field(L, "injects", counters.injects[index]);
+  set_field(L, "inject_failures", counters.inject_failures[index]);
+  set_field(L, "extracts", counters.extracts[index]);
+  set_field(L, "extract_failures", counters.extract_failures[index]);
+  lua_setfield(L, -2, name);
+}
+
+//------------------------------------------------------------------------------
+// push_stats
+//------------------------------------------------------------------------------
+int push_stats(lua_State* L) noexcept {
+  Stats counters{};
+  ThreadStats::registry().sum(counters);
+  lua_createtable(L, 0, 18);
+  set_field(L, "spans_started", counters.spans_started);
+  set_field(L, "spans_finished", counters.spans_finished);
+  set_field(L, "spans_abandoned", counters.spans_abandoned);
+  set_field(L, "spans_expired", counters.spans_expired);
+  set_field(L, "live_spans", counters.live_spans);
+  set_field(L, "live_span_contexts", counters.live_span_contexts);
+  set_field(L, "live_tracers", counters.live_tracers);
+  set_field(L, "buffered_log_records", counters.buffered_log_records);
+  set_field(L, "buffered_log_bytes", counters.buffered_log_bytes);
+  set_field(L, "plugin_time_ns", counters.plugin_time_ns);
+  set_field(L, "spans_shed", counters.spans_shed);
+  set_field(L, "load_shedding_episodes", counters.load_shedding_episodes);
+  set_field(L, "log_records_streamed", counters.log_records_streamed);
+  set_field(L, "profile_samples", counters.profile_samples);
+  set_field(L, "profile_time_ns", counters.profile_time_ns);
+  set_propagation_fields(L, counters, "text_map", CarrierFormat::text_map);
+  set_propagation_fields(L, counters, "http_headers",
+                         CarrierFormat::http_headers);
+  set_propagation_fields(L, counters, "binary", CarrierFormat::binary);
+  return 1;
+}
+}  // namespace lua_bridge_tracer
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+extern "C" {
+#include <lauxlib.h>
+#include <lua.h>
+}  // extern "C"
+
+namespace lua_bridge_tracer {
+enum class CarrierFormat { text_map, http_headers, binary };
+
+const int num_carrier_formats = 3;
+
+// Counters describing what the bridge is doing, summed over every lua_State
+// in the process.
+//
+// Each thread updates its own set of counters, and the sets are summed when
+// they're read, so threads tracing at once never contend for a cache line.
+// The counters are atomics only so that they can be read from another thread;
+// a snapshot taken while other threads are busy needn't be consistent across
+// counters.
+struct Stats {
+  std::atomic<int64_t> spans_started;
+  std::atomic<int64_t> spans_finished;
+
+  // Spans garbage collected without having been finished.
+  std::atomic<int64_t> spans_abandoned;
+
+  // Tracked spans ended for being in flight longer than their tracer allows.
+  std::atomic<int64_t> spans_expired;
+
+  std::atomic<int64_t> live_spans;
+  std::atomic<int64_t> live_span_contexts;
+  std::atomic<int64_t> live_tracers;
+
+  // Log records held by unfinished spans and the bytes of data in them.
+  std::atomic<int64_t> buffered_log_records;
+  std::atomic<int64_t> buffered_log_bytes;
+
+  std::atomic<int64_t> injects[num_carrier_formats];
+  std::atomic<int64_t> inject_failures[num_carrier_formats];
+  std::atomic<int64_t> extracts[num_carrier_formats];
+  std::atomic<int64_t> extract_failures[num_carrier_formats];
+
+  // Time spent in the tracer starting and finishing spans, injecting and
+  // extracting contexts, and closing.
+  std::atomic<int64_t> plugin_time_ns;
+
+  // Spans shed under load, and the number of times shedding started.
+  std::atomic<int64_t> spans_shed;
+  std::atomic<int64_t> load_shedding_episodes;
+
+  // Log records passed to the tracer before their span finished.
+  std::atomic<int64_t> log_records_streamed;
+
+  // Stacks sampled by profilers, and the time taken sampling them.
+  std::atomic<int64_t> profile_samples;
+  std::atomic<int64_t> profile_time_ns;
+};
+
+// Returns the calling thread's counters.
+Stats& stats() noexcept;
+
+// Since only its own thread writes to a counter, it can be updated with a
+// plain load and store rather than a locked read-modify-write.
+inline void add_stat(std::atomic<int64_t>& counter, int64_t n = 1) noexcept {
+  counter.store(counter.load(std::memory_order_relaxed) + n,
+                std::memory_order_relaxed);
+}
+
+inline void subtract_stat(std::atomic<int64_t>& counter,
+                          int64_t n = 1) noexcept {
+  add_stat(counter, -n);
+}
+
+// Adds the time from its construction to its destruction to
+// Stats::plugin_time_ns.
+class PluginTimer {
+ public:
+  PluginTimer() noexcept : start_{std::chrono::steady_clock::now()} {}
+
+  PluginTimer(const PluginTimer&) = delete;
+  PluginTimer& operator=(const PluginTimer&) = delete;
+
+  ~PluginTimer() noexcept {
+    add_stat(stats().plugin_time_ns,
+             std::chrono::duration_cast<std::chrono::nanoseconds>(
+                 std::chrono::steady_clock::now() - start_)
+                 .count());
+  }
+
+ private:
+  std::chrono::steady_clock::time_point start_;
+};
+
+// Implements bridge_tracer.stats(), which returns a table of the counters.
+int push_stats(lua_State* L) noexcept;
+}  // namespace lua_bridge_tracer
@@ -0,0 +1,134 @@
+#include "tracer_handle.h"
+
+#include "background_thread.h"
+#include "dynamic_tracer.h"
+#include "native_tracer.h"
+#include "stats.h"
+
+#include <stdexcept>
+
+namespace lua_bridge_tracer {
+//------------------------------------------------------------------------------
+// close_retired_tracer
+//------------------------------------------------------------------------------
+// Closes a tracer that's been replaced and that no span refers to anymore.
+//
+// A plugin's tracer can block while it flushes its reporter, so it's closed,
+// and freed, on a thread of its own. The native tracer is closed in place,
+// since its sinks can hold references into the lua_State.
+static void close_retired_tracer(
+    std::shared_ptr<opentracing::Tracer>&& tracer) noexcept {
+  if (std::dynamic_pointer_cast<NativeTracer>(tracer) == nullptr) {
+    try {
+      auto plugin_tracer = std::move(tracer);
+      start_background_thread([plugin_tracer] {
+        PluginTimer timer;
+        plugin_tracer->Close();
+      });
+      return;
+    } catch (const std::exception&) {
+      // Fall back to closing it here.
+    }
+  }
+  PluginTimer timer;
+  tracer->Close();
+}
+
+//------------------------------------------------------------------------------
+// TracerGeneration::remove_reference
+//------------------------------------------------------------------------------
+void TracerGeneration::remove_reference() noexcept {
+  if (--reference_count_ != 0) {
+    return;
+  }
+  if (is_retired_) {
+    close_retired_tracer(std::move(tracer_));
+  }
+  delete this;
+}
+
+//------------------------------------------------------------------------------
+// constructor
+//------------------------------------------------------------------------------
+TracerHandle::TracerHandle(std::shared_ptr<opentracing::Tracer>&& tracer,
+                           std::string&& library_name)
+    : generation_{new TracerGeneration{std::move(tracer), 1}},
+      library_name_{std::move(library_name)} {}
+
+//------------------------------------------------------------------------------
+// destructor
+//------------------------------------------------------------------------------
+// The current tracer is left open, since it may be shared, as the global
+// tracer is, beyond the lua_State.
+TracerHandle::~TracerHandle() noexcept = default;
+
+//------------------------------------------------------------------------------
+// make
+//------------------------------------------------------------------------------
+TracerHandlePtr TracerHandle::make(std::shared_ptr<opentracing::Tracer> tracer,
+                                   std::string library_name) {
+  return TracerHandlePtr{
+      new TracerHandle{std::move(tracer), std::move(library_name)}};
+}
+
+//------------------------------------------------------------------------------
+// replace_tracer
+//------------------------------------------------------------------------------
+void TracerHandle::replace_tracer(std::shared_ptr<opentracing::Tracer> tracer) {
+  TracerGenerationPtr generation{
+      new TracerGeneration{std::move(tracer), generation_->number() + 1}};
+  generation_->is_retired_ = true;
+  generation_ = std::move(generation);
+}
+
+//------------------------------------------------------------------------------
+// reload_tracer
+//------------------------------------------------------------------------------
+void TracerHandle::reload_tracer(std::string config) {
+  if (library_name_.empty()) {
+    throw std::runtime_error{
+        "tracer wasn't loaded from a plugin, so it can't be reloaded"};
+  }
+  auto reload = std::make_shared<Reload>();
+  auto library_name = library_name_;
+  start_background_thread([reload, library_name, config] {
+    std::shared_ptr<opentracing::Tracer> tracer;
+    std::string error;
+    try {
+      tracer = load_tracer(library_name.c_str(), config.c_str());
+    } catch (const std::exception& e) {
+      error = e.what();
+    }
+    if (reload->is_superseded.load(std::memory_order_acquire)) {
+      // Nothing will install it, so free it here rather than leave it to
+      // whichever of the thread and the handle lets go of `reload` last.
+      tracer = nullptr;
+    }
+    reload->tracer = std::move(tracer);
+    reload->error = std::move(error);
+    reload->is_done.store(true, std::memory_order_release);
+  });
+
+  // A reload still loading is superseded; its thread frees what it loads.
+  if (reload_ != nullptr) {
+    reload_->is_superseded.store(true, std::memory_order_release);
+  }
+  reload_ = std::move(reload);
+  reload_error_.clear();
+}
+
+//------------------------------------------------------------------------------
+// finish_reload
+//------------------------------------------------------------------------------
+void TracerHandle::finish_reload() {
+  if (!reload_->is_done.load(std::memory_order_acquire)) {
+    return;
+  }
+  auto tracer = std::move(reload_->tracer);
+  reload_error_ = std::move(reload_->error);
+  reload_ = nullptr;
+  if (tracer != nullptr) {
+    replace_tracer(std::move(tracer));
+  }
+}
+}  // namespace lua_bridge_tracer
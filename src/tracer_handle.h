@@ -0,0 +1,189 @@
+#pragma once
+
+#include "tracer_state.h"
+
+#include <opentracing/tracer.h>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <utility>
+
+namespace lua_bridge_tracer {
+// Shares ownership of an object counted with a plain integer. `T` provides
+// add_reference and remove_reference, which frees it once the count reaches
+// zero. Copies must stay within the lua_State the object belongs to.
+template <class T>
+class LocalPtr {
+ public:
+  LocalPtr() noexcept = default;
+
+  explicit LocalPtr(T* ptr) noexcept : ptr_{ptr} { acquire(); }
+
+  LocalPtr(const LocalPtr& other) noexcept : ptr_{other.ptr_} { acquire(); }
+
+  LocalPtr(LocalPtr&& other) noexcept : ptr_{other.ptr_} {
+    other.ptr_ = nullptr;
+  }
+
+  ~LocalPtr() noexcept { release(); }
+
+  LocalPtr& operator=(LocalPtr other) noexcept {
+    std::swap(ptr_, other.ptr_);
+    return *this;
+  }
+
+  T* get() const noexcept { return ptr_; }
+
+  T& operator*() const noexcept { return *ptr_; }
+
+  T* operator->() const noexcept { return ptr_; }
+
+  explicit operator bool() const noexcept { return ptr_ != nullptr; }
+
+ private:
+  T* ptr_ = nullptr;
+
+  void acquire() noexcept {
+    if (ptr_ != nullptr) {
+      ptr_->add_reference();
+    }
+  }
+
+  void release() noexcept {
+    if (ptr_ != nullptr) {
+      ptr_->remove_reference();
+    }
+  }
+};
+
+// A tracer that a handle has been configured with. Spans and span contexts
+// pin the generation they were made by, so that a tracer replaced by
+// TracerHandle::replace_tracer outlives them, and is only closed once they're
+// gone.
+class TracerGeneration {
+ public:
+  TracerGeneration(const TracerGeneration&) = delete;
+  TracerGeneration& operator=(const TracerGeneration&) = delete;
+
+  const std::shared_ptr<opentracing::Tracer>& tracer() const noexcept {
+    return tracer_;
+  }
+
+  // Counts from 1 for the tracer a handle was made with.
+  uint64_t number() const noexcept { return number_; }
+
+  void add_reference() noexcept { ++reference_count_; }
+
+  void remove_reference() noexcept;
+
+ private:
+  std::shared_ptr<opentracing::Tracer> tracer_;
+  uint64_t number_;
+  size_t reference_count_ = 0;
+  bool is_retired_ = false;
+
+  TracerGeneration(std::shared_ptr<opentracing::Tracer>&& tracer,
+                   uint64_t number) noexcept
+      : tracer_{std::move(tracer)}, number_{number} {}
+
+  friend class TracerHandle;
+};
+
+using TracerGenerationPtr = LocalPtr<TracerGeneration>;
+
+class TracerHandle;
+
+using TracerHandlePtr = LocalPtr<TracerHandle>;
+
+// Pins a tracer, along with the TracerState configuring it, for the objects of
+// a single lua_State.
+//
+// Every span and span context has to keep its tracer alive. If each held an
+// std::shared_ptr, starting and freeing a span would atomically update the
+// tracer's reference count, and when lua_States on different threads share a
+// tracer (such as the global one) that count's cache line would bounce between
+// cores. A lua_State is only run by one thread at a time, so instead its
+// objects share a handle counted with a plain integer, and only the handle
+// holds an std::shared_ptr to the tracer.
+//
+// The tracer can be replaced without disturbing spans in flight: the handle
+// moves on to a new TracerGeneration, and the old one is closed once the last
+// span or span context pinning it is freed.
+class TracerHandle {
+ public:
+  TracerHandle(const TracerHandle&) = delete;
+  TracerHandle& operator=(const TracerHandle&) = delete;
+
+  ~TracerHandle() noexcept;
+
+  // `library_name` is the plugin the tracer was loaded from, if any, for
+  // reload_tracer.
+  static TracerHandlePtr make(std::shared_ptr<opentracing::Tracer> tracer,
+                              std::string library_name = {});
+
+  const std::shared_ptr<opentracing::Tracer>& tracer() const noexcept {
+    return generation_->tracer();
+  }
+
+  const TracerGenerationPtr& generation() const noexcept {
+    return generation_;
+  }
+
+  TracerState& state() noexcept { return state_; }
+
+  // Starts spans and operations after this call on `tracer`.
+  void replace_tracer(std::shared_ptr<opentracing::Tracer> tracer);
+
+  // Loads a new tracer from the handle's plugin with `config` on a
+  // background thread. It replaces the current one at the first call to
+  // update after it's loaded.
+  void reload_tracer(std::string config);
+
+  // Installs a tracer loaded by reload_tracer if it's ready. Costs a single
+  // branch when no reload is pending.
+  void update() {
+    if (reload_ != nullptr) {
+      finish_reload();
+    }
+  }
+
+  bool is_reloading() const noexcept { return reload_ != nullptr; }
+
+  // The error the last reload failed with, or an empty string.
+  const std::string& reload_error() const noexcept { return reload_error_; }
+
+  void add_reference() noexcept { ++reference_count_; }
+
+  void remove_reference() noexcept {
+    if (--reference_count_ == 0) {
+      delete this;
+    }
+  }
+
+ private:
+  // Shared with the thread loading a tracer for reload_tracer, which sets
+  // `tracer` or `error` before `is_done`. A reload that's been superseded
+  // by another drops its tracer as soon as it's loaded.
+  struct Reload {
+    std::shared_ptr<opentracing::Tracer> tracer;
+    std::string error;
+    std::atomic<bool> is_done{false};
+    std::atomic<bool> is_superseded{false};
+  };
+
+  TracerGenerationPtr generation_;
+  TracerState state_;
+  std::string library_name_;
+  std::shared_ptr<Reload> reload_;
+  std::string reload_error_;
+  size_t reference_count_ = 0;
+
+  TracerHandle(std::shared_ptr<opentracing::Tracer>&& tracer,
+               std::string&& library_name);
+
+  void finish_reload();
+};
+}  // namespace lua_bridge_tracer
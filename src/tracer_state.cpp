@@ -0,0 +1,31 @@
+#include "tracer_state.h"
+
+namespace lua_bridge_tracer {
+//------------------------------------------------------------------------------
+// set_span_filter
+//------------------------------------------------------------------------------
+void TracerState::set_span_filter(opentracing::string_view operation_name,
+                                  std::chrono::microseconds min_duration) {
+  if (min_duration.count() <= 0) {
+    span_filters_.erase(operation_name);
+    return;
+  }
+  span_filters_[operation_name] = min_duration;
+}
+
+//------------------------------------------------------------------------------
+// span_filter
+//------------------------------------------------------------------------------
+std::chrono::microseconds TracerState::span_filter(
+    opentracing::string_view operation_name) const {
+  // Avoid building a key when no filters are configured.
+  if (span_filters_.empty()) {
+    return {};
+  }
+  auto iter = span_filters_.find(operation_name);
+  if (iter == std::end(span_filters_)) {
+    return {};
+  }
+  return iter->second;
+}
+}  // namespace lua_bridge_tracer
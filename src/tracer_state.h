@@ -0,0 +1,120 @@
+#pragma once
+
+#include "load_shedder.h"
+#include "span_budget.h"
+#include "span_profiler.h"
+#include "span_registry.h"
+
+#include <opentracing/string_view.h>
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace lua_bridge_tracer {
+class LuaSpanContext;
+
+// When an unfinished span passes its buffered log records to the tracer, so
+// that a long-lived span holds only a bounded tail of its logs. A limit of
+// zero leaves that trigger unused.
+struct LogStreaming {
+  size_t max_records = 0;
+  size_t max_bytes = 0;
+
+  // The age of the oldest buffered record.
+  std::chrono::microseconds max_age{0};
+
+  bool is_enabled() const noexcept {
+    return max_records > 0 || max_bytes > 0 || max_age.count() > 0;
+  }
+};
+
+// Configuration shared by a LuaTracer, the LuaTracers obtained from its spans,
+// and the spans themselves.
+class TracerState {
+ public:
+  // Spans with the given operation name that finish in less than
+  // `min_duration` are dropped before reaching the tracer. A zero duration
+  // removes the filter.
+  void set_span_filter(opentracing::string_view operation_name,
+                       std::chrono::microseconds min_duration);
+
+  std::chrono::microseconds span_filter(
+      opentracing::string_view operation_name) const;
+
+  // Limits applied to the tags and logs of spans started afterwards.
+  void set_span_limits(const SpanLimits& span_limits) noexcept {
+    span_limits_ = span_limits;
+  }
+
+  const SpanLimits& span_limits() const noexcept { return span_limits_; }
+
+  // Whether spans started afterwards are added to the registry, and when
+  // they expire.
+  void set_span_tracking(const SpanTracking& span_tracking) noexcept {
+    span_tracking_ = span_tracking;
+  }
+
+  const SpanTracking& span_tracking() const noexcept { return span_tracking_; }
+
+  SpanRegistry& span_registry() noexcept { return span_registry_; }
+
+  // When spans stream their log records, checked as records are added.
+  void set_log_streaming(const LogStreaming& log_streaming) noexcept {
+    log_streaming_ = log_streaming;
+  }
+
+  const LogStreaming& log_streaming() const noexcept {
+    return log_streaming_;
+  }
+
+  // The profiler sampling spans started afterwards, or nullptr. Profiled
+  // spans are added to the registry.
+  void set_profiler(std::unique_ptr<SpanProfiler>&& profiler) noexcept {
+    profiler_ = std::move(profiler);
+  }
+
+  SpanProfiler* profiler() const noexcept { return profiler_.get(); }
+
+  LoadShedder& load_shedder() noexcept { return load_shedder_; }
+
+  // The span contexts handed out by the C API and not yet freed. Only these
+  // can be imported with import_c_span_context, since they're given to it by
+  // address.
+  void add_c_span_context(const LuaSpanContext* span_context) {
+    c_span_contexts_.insert(span_context);
+  }
+
+  void remove_c_span_context(const LuaSpanContext* span_context) noexcept {
+    c_span_contexts_.erase(span_context);
+  }
+
+  bool has_c_span_context(const LuaSpanContext* span_context) const noexcept {
+    return c_span_contexts_.count(span_context) != 0;
+  }
+
+  // Counts the spans passed to the tracer since it was last flushed or
+  // closed.
+  void count_finished_span() noexcept { ++num_unflushed_spans_; }
+
+  uint64_t take_unflushed_spans() noexcept {
+    auto result = num_unflushed_spans_;
+    num_unflushed_spans_ = 0;
+    return result;
+  }
+
+ private:
+  std::unordered_map<std::string, std::chrono::microseconds> span_filters_;
+  SpanLimits span_limits_;
+  SpanTracking span_tracking_;
+  SpanRegistry span_registry_;
+  LogStreaming log_streaming_;
+  std::unique_ptr<SpanProfiler> profiler_;
+  LoadShedder load_shedder_;
+  std::unordered_set<const LuaSpanContext*> c_span_contexts_;
+  uint64_t num_unflushed_spans_ = 0;
+};
+}  // namespace lua_bridge_tracer
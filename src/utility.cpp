@@ -1,5 +1,7 @@
 #include "utility.h"
 
+#include <algorithm>
+#include <cmath>
 #include <stdexcept>
 
 namespace lua_bridge_tracer {
@@ -36,30 +38,76 @@ std::chrono::system_clock::time_point convert_timestamp(lua_State* L,
 }
 
 //------------------------------------------------------------------------------
-// to_value
+// fill_start_timestamps
 //------------------------------------------------------------------------------
-static opentracing::Value to_dictionary_value(lua_State* L, int index);
+void fill_start_timestamps(opentracing::SystemTime& start_system_timestamp,
+                           opentracing::SteadyTime& start_steady_timestamp) {
+  if (start_system_timestamp == opentracing::SystemTime{} &&
+      start_steady_timestamp == opentracing::SteadyTime{}) {
+    start_system_timestamp = opentracing::SystemClock::now();
+    start_steady_timestamp = opentracing::SteadyClock::now();
+  } else if (start_steady_timestamp == opentracing::SteadyTime{}) {
+    start_steady_timestamp =
+        opentracing::convert_time_point<opentracing::SteadyClock>(
+            start_system_timestamp);
+  } else if (start_system_timestamp == opentracing::SystemTime{}) {
+    start_system_timestamp =
+        opentracing::convert_time_point<opentracing::SystemClock>(
+            start_steady_timestamp);
+  }
+}
 
-opentracing::Value to_value(lua_State* L, int index) {
+//------------------------------------------------------------------------------
+// to_absolute_index
+//------------------------------------------------------------------------------
+static int to_absolute_index(lua_State* L, int index) {
+  if (index < 0 && index > LUA_REGISTRYINDEX) {
+    return lua_gettop(L) + index + 1;
+  }
+  return index;
+}
+
+//------------------------------------------------------------------------------
+// to_scalar_value
+//------------------------------------------------------------------------------
+static bool to_scalar_value(lua_State* L, int index, SpanBudget& budget,
+                            opentracing::Value& result) {
   switch (lua_type(L, index)) {
     case LUA_TNUMBER: {
-      return static_cast<double>(lua_tonumber(L, index));
+      if (!budget.reserve(sizeof(double))) {
+        return false;
+      }
+#if LUA_VERSION_NUM >= 503
+      // Keep integers exact, which doubles can't above 2^53.
+      if (lua_isinteger(L, index)) {
+        result = static_cast<int64_t>(lua_tointeger(L, index));
+        return true;
+      }
+#endif
+      result = static_cast<double>(lua_tonumber(L, index));
+      return true;
     }
     case LUA_TSTRING: {
       size_t value_len;
       auto value_data = lua_tolstring(L, index, &value_len);
-      std::string value{value_data, value_len};
-      return std::move(value);
+      value_len = budget.string_length(value_len);
+      if (!budget.reserve(value_len)) {
+        return false;
+      }
+      result = std::string{value_data, value_len};
+      return true;
     }
     case LUA_TBOOLEAN: {
-      return static_cast<bool>(lua_toboolean(L, index));
-    }
-    case LUA_TTABLE: {
-      return to_dictionary_value(L, index);
+      if (!budget.reserve(sizeof(bool))) {
+        return false;
+      }
+      result = static_cast<bool>(lua_toboolean(L, index));
+      return true;
     }
     case LUA_TNIL:
     case LUA_TNONE: {
-      return nullptr;
+      result = nullptr;
+      return true;
     }
     default:
       throw std::runtime_error{"invalid value type"};
@@ -67,37 +115,248 @@ opentracing::Value to_value(lua_State* L, int index) {
 }
 
 //------------------------------------------------------------------------------
-// to_dictionary_value
+// TableFrame
 //------------------------------------------------------------------------------
-opentracing::Value to_dictionary_value(lua_State* L, int index) {
-  auto key_values = to_key_values(L, index);
-  opentracing::Dictionary result{std::begin(key_values), std::end(key_values)};
-  return result;
+namespace {
+// A table that's part way through being converted by to_table_value.
+struct TableFrame {
+  // Where the table is on the Lua stack.
+  int index;
+
+  // Identifies the table for cycle detection.
+  const void* table;
+
+  // The opentracing::Values or opentracing::Dictionary being filled in.
+  opentracing::Value* value;
+
+  // The table's length if it's converted as an array, or 0 if it's converted
+  // as a dictionary.
+  size_t length;
+
+  // The number of entries visited so far.
+  size_t position;
+};
+}  // namespace
+
+//------------------------------------------------------------------------------
+// is_sequence
+//------------------------------------------------------------------------------
+// Checks that the keys of the table at `index` are exactly 1..`length`: since
+// keys are distinct, it's enough that there are `length` of them and each is
+// an integer in that range. Stops at the first key that isn't.
+static bool is_sequence(lua_State* L, int index, size_t length) {
+  size_t num_keys = 0;
+  lua_pushnil(L);
+  while (lua_next(L, index)) {
+    lua_pop(L, 1);
+    auto key = lua_type(L, -1) == LUA_TNUMBER ? lua_tonumber(L, -1) : 0;
+    if (!(key >= 1 && key <= static_cast<lua_Number>(length)) ||
+        key != std::floor(key)) {
+      lua_pop(L, 1);
+      return false;
+    }
+    ++num_keys;
+  }
+  return num_keys == length;
 }
 
 //------------------------------------------------------------------------------
-// to_key_values
+// open_table
+//------------------------------------------------------------------------------
+// Sets up `value` to receive the contents of the table at `index`.
+//
+// A table is converted to opentracing::Values if it's a sequence (i.e. its
+// keys are 1..#t) and to an opentracing::Dictionary otherwise. The array is
+// sized for no more entries than `budget` lets a table have, however long the
+// sequence.
+static TableFrame open_table(lua_State* L, int index, const SpanBudget& budget,
+                             opentracing::Value& value) {
+  auto length = get_table_len(L, index);
+  if (length > 0 && !is_sequence(L, index, length)) {
+    length = 0;
+  }
+  if (length > 0) {
+    auto max_table_size = budget.limits().max_table_size;
+    value = opentracing::Values(
+        max_table_size != 0 ? std::min(length, max_table_size) : length);
+  } else {
+    value = opentracing::Dictionary{};
+    // lua_next needs a key to start from
+    lua_pushnil(L);
+  }
+  return {index, lua_topointer(L, index), &value, length, 0};
+}
+
+//------------------------------------------------------------------------------
+// can_open_table
+//------------------------------------------------------------------------------
+// Checks that the table on the top of the stack can be nested within `frames`.
+static bool can_open_table(lua_State* L, SpanBudget& budget,
+                           const std::vector<TableFrame>& frames,
+                           const void* parent) {
+  auto table = lua_topointer(L, -1);
+  if (table == parent) {
+    budget.drop();
+    return false;
+  }
+  for (auto& frame : frames) {
+    if (frame.table == table) {
+      budget.drop();
+      return false;
+    }
+  }
+  if (budget.table_depth_exceeded(frames.size() + 1)) {
+    return false;
+  }
+  // Each open table needs room for itself, a key, a value, and a copy of the
+  // key.
+  if (!lua_checkstack(L, 4)) {
+    budget.drop();
+    return false;
+  }
+  return true;
+}
+
 //------------------------------------------------------------------------------
-std::vector<std::pair<std::string, opentracing::Value>> to_key_values(
-    lua_State* L, int index) {
+// to_table_value
+//------------------------------------------------------------------------------
+// Converts the table at `index` without recursing, so that deeply nested
+// tables can't overflow the C stack. Each opentracing::Values and
+// opentracing::Dictionary is built in place inside its parent. Tables that
+// contain themselves, or `parent`, have the cyclic entries dropped.
+static bool to_table_value(lua_State* L, int index, SpanBudget& budget,
+                           const void* parent, opentracing::Value& result) {
+  index = to_absolute_index(L, index);
+  auto top = lua_gettop(L);
+  std::vector<TableFrame> frames;
   lua_pushvalue(L, index);
-  std::vector<std::pair<std::string, opentracing::Value>> result;
-  result.reserve(get_table_len(L, index));
+  if (!can_open_table(L, budget, frames, parent)) {
+    lua_settop(L, top);
+    return false;
+  }
+  frames.push_back(open_table(L, top + 1, budget, result));
+
+  while (!frames.empty()) {
+    auto& frame = frames.back();
+    opentracing::Value* slot = nullptr;
+    if (frame.length > 0) {
+      if (frame.position == frame.length ||
+          budget.table_size_exceeded(frame.position)) {
+        // Drop any slots left past the entries visited.
+        frame.value->get<opentracing::Values>().resize(frame.position);
+        lua_settop(L, frame.index - 1);
+        frames.pop_back();
+        continue;
+      }
+      slot = &frame.value->get<opentracing::Values>()[frame.position];
+      ++frame.position;
+      lua_rawgeti(L, frame.index, static_cast<lua_Integer>(frame.position));
+    } else {
+      if (!lua_next(L, frame.index)) {
+        lua_settop(L, frame.index - 1);
+        frames.pop_back();
+        continue;
+      }
+      // ignore if the key isn't a string
+      if (!lua_isstring(L, -2)) {
+        lua_pop(L, 1);
+        continue;
+      }
+      if (budget.table_size_exceeded(frame.position)) {
+        lua_settop(L, frame.index - 1);
+        frames.pop_back();
+        continue;
+      }
+      ++frame.position;
+      lua_pushvalue(L, -2);
+      size_t key_len;
+      auto key_data = lua_tolstring(L, -1, &key_len);
+      if (!budget.reserve(key_len)) {
+        lua_pop(L, 2);
+        continue;
+      }
+      auto& dictionary = frame.value->get<opentracing::Dictionary>();
+      std::string key{key_data, key_len};
+      lua_pop(L, 1);
+      if (lua_type(L, -1) != LUA_TTABLE) {
+        opentracing::Value value;
+        if (to_scalar_value(L, -1, budget, value)) {
+          dictionary.emplace(std::move(key), std::move(value));
+        }
+        lua_pop(L, 1);
+        continue;
+      }
+      if (!can_open_table(L, budget, frames, parent)) {
+        lua_pop(L, 1);
+        continue;
+      }
+      // Dictionary is node based, so the slot stays put as entries are added.
+      slot = &dictionary[std::move(key)];
+      frames.push_back(open_table(L, lua_gettop(L), budget, *slot));
+      continue;
+    }
+
+    // Arrays are sized up front, so the slot stays put as well.
+    if (lua_type(L, -1) != LUA_TTABLE) {
+      to_scalar_value(L, -1, budget, *slot);
+      lua_pop(L, 1);
+      continue;
+    }
+    if (!can_open_table(L, budget, frames, parent)) {
+      lua_pop(L, 1);
+      continue;
+    }
+    frames.push_back(open_table(L, lua_gettop(L), budget, *slot));
+  }
+  lua_settop(L, top);
+  return true;
+}
+
+//------------------------------------------------------------------------------
+// to_value
+//------------------------------------------------------------------------------
+bool to_value(lua_State* L, int index, SpanBudget& budget,
+              opentracing::Value& value) {
+  if (lua_type(L, index) == LUA_TTABLE) {
+    return to_table_value(L, index, budget, nullptr, value);
+  }
+  return to_scalar_value(L, index, budget, value);
+}
+
+//------------------------------------------------------------------------------
+// to_key_values
+//------------------------------------------------------------------------------
+void to_key_values(
+    lua_State* L, int index, SpanBudget& budget,
+    std::vector<std::pair<std::string, opentracing::Value>>& key_values) {
+  index = to_absolute_index(L, index);
+  auto table = lua_topointer(L, index);
+  size_t num_key_values = 0;
   lua_pushnil(L);
-  while (lua_next(L, -2)) {
+  while (lua_next(L, index)) {
     // ignore if the key isn't a string
     if (!lua_isstring(L, -2)) {
       lua_pop(L, 1);
       continue;
     }
+    if (budget.table_size_exceeded(num_key_values)) {
+      lua_pop(L, 2);
+      break;
+    }
+    ++num_key_values;
     lua_pushvalue(L, -2);
-    size_t key_len, value_len;
+    size_t key_len;
     auto key = lua_tolstring(L, -1, &key_len);
-    auto value = to_value(L, -2);
-    result.emplace_back(key, value);
+    opentracing::Value value;
+    if (budget.reserve(key_len)) {
+      auto was_converted = lua_type(L, -2) == LUA_TTABLE
+                               ? to_table_value(L, -2, budget, table, value)
+                               : to_scalar_value(L, -2, budget, value);
+      if (was_converted) {
+        key_values.emplace_back(std::string{key, key_len}, std::move(value));
+      }
+    }
     lua_pop(L, 2);
   }
-  lua_pop(L, 1);
-  return result;
 }
 }  // namespace lua_bridge_tracer
@@ -1,5 +1,8 @@
 #pragma once
 
+#include "span_budget.h"
+
+#include <opentracing/tracer.h>
 #include <opentracing/value.h>
 
 #include <chrono>
@@ -15,8 +18,20 @@ size_t get_table_len(lua_State* L, int index);
 std::chrono::system_clock::time_point convert_timestamp(lua_State* L,
                                                         int index);
 
-opentracing::Value to_value(lua_State* L, int index);
+// Fills in whichever of a span's start timestamps weren't given, the same way
+// tracers do.
+void fill_start_timestamps(opentracing::SystemTime& start_system_timestamp,
+                           opentracing::SteadyTime& start_steady_timestamp);
+
+// Converts the Lua value at `index`, charging its size to `budget`. Returns
+// false if the value was dropped because it didn't fit.
+bool to_value(lua_State* L, int index, SpanBudget& budget,
+              opentracing::Value& value);
 
-std::vector<std::pair<std::string, opentracing::Value>> to_key_values(
-    lua_State* L, int index);
+// Converts the string keys of the table at `index` and their values, leaving
+// out any that don't fit in `budget`. The results are appended to
+// `key_values`.
+void to_key_values(
+    lua_State* L, int index, SpanBudget& budget,
+    std::vector<std::pair<std::string, opentracing::Value>>& key_values);
 }  // namespace lua_bridge_tracer
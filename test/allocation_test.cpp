@@ -0,0 +1,152 @@
+// Checks that the bridge's core operations stay within a fixed number of heap
+// allocations.
+//
+// The operations are run against the C++ global tracer, a no-op tracer, so
+// that only the bridge's own allocations, plus the one the no-op tracer makes
+// for each span, are counted. Lua's allocations aren't included.
+#include "allocation_counter.h"
+#include "lua_harness.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <exception>
+#include <string>
+
+namespace {
+struct AllocationBudget {
+  const char* name;
+
+  // Sets up locals available to `operation`.
+  const char* setup;
+
+  // A statement performing the operation being checked.
+  const char* operation;
+
+  // The most calls to operator new the operation may make.
+  int max_allocations;
+
+  // If set, a statement whose allocations are subtracted from each
+  // operation's, for operations that need fresh state every time.
+  const char* baseline;
+};
+}  // namespace
+
+static const int num_iterations = 1000;
+
+// Allows for allocations that happen once per run, such as buffers that are
+// reused afterwards.
+static const int num_one_off_allocations = 10;
+
+static const AllocationBudget allocation_budgets[] = {
+    // The LuaSpan, the tracer's span, and the block holding the span with its
+    // aggregator slot.
+    {"start_span+finish", "", "tracer:start_span('abc'):finish()", 3,
+     nullptr},
+    // ...plus the references vector.
+    {"start_span(child_of)+finish",
+     "local options = {references = {{'child_of', "
+     "tracer:start_span('parent'):context()}}}",
+     "tracer:start_span('abc', options):finish()", 4, nullptr},
+    {"set_tag(number)", "local span = tracer:start_span('abc')",
+     "span:set_tag('key', 123)", 0, nullptr},
+    {"set_tag(boolean)", "local span = tracer:start_span('abc')",
+     "span:set_tag('key', true)", 0, nullptr},
+    // Short enough for the small string optimization.
+    {"set_tag(string)", "local span = tracer:start_span('abc')",
+     "span:set_tag('key', 'value')", 0, nullptr},
+    // The LuaSpanContext. A span's first context is the one that matters, so
+    // each is taken from a new span.
+    {"context", "", "tracer:start_span('abc'):context()", 1,
+     "tracer:start_span('abc')"},
+    // The fields vector as it grows to two entries, plus the amortized growth
+    // of the span's records.
+    {"log_kv",
+     "local span = tracer:start_span('abc')\n"
+     "local fields = {event = 'abc', value = 123}",
+     "span:log_kv(fields)", 3, nullptr},
+    {"text_map_inject",
+     "local context = tracer:start_span('abc'):context()\n"
+     "local carrier = {}",
+     "tracer:text_map_inject(context, carrier)", 0, nullptr},
+    {"http_headers_inject",
+     "local context = tracer:start_span('abc'):context()\n"
+     "local carrier = {}",
+     "tracer:http_headers_inject(context, carrier)", 0, nullptr},
+};
+
+//------------------------------------------------------------------------------
+// count_loop_allocations
+//------------------------------------------------------------------------------
+// Returns the allocations made running `statement` num_iterations times, after
+// `setup`, less those made by `setup` alone.
+static uint64_t count_loop_allocations(lua_bridge_tracer::LuaHarness& harness,
+                                       const char* setup,
+                                       const char* statement) {
+  auto L = harness.state();
+  harness.push_tracer();
+  harness.load(std::string{"local tracer, n = ...\n"} + setup +
+               "\nfor i = 1, n do\n" + statement + "\nend");
+  auto function_index = lua_gettop(L);
+
+  // warm up
+  lua_pushvalue(L, function_index);
+  lua_pushvalue(L, function_index - 1);
+  lua_pushinteger(L, num_iterations);
+  harness.call(2, 0);
+
+  // Run the setup on its own so that its allocations can be subtracted.
+  harness.load(std::string{"local tracer = ...\n"} + setup);
+  lua_pushvalue(L, function_index - 1);
+  auto num_allocations = lua_bridge_tracer::num_allocations();
+  harness.call(1, 0);
+  auto num_setup_allocations =
+      lua_bridge_tracer::num_allocations() - num_allocations;
+
+  lua_pushvalue(L, function_index);
+  lua_pushvalue(L, function_index - 1);
+  lua_pushinteger(L, num_iterations);
+  num_allocations = lua_bridge_tracer::num_allocations();
+  harness.call(2, 0);
+  num_allocations = lua_bridge_tracer::num_allocations() - num_allocations -
+                    num_setup_allocations;
+  lua_pop(L, 2);
+  return num_allocations;
+}
+
+//------------------------------------------------------------------------------
+// check_allocation_budget
+//------------------------------------------------------------------------------
+static bool check_allocation_budget(const AllocationBudget& budget) {
+  lua_bridge_tracer::LuaHarness harness;
+  auto num_allocations =
+      count_loop_allocations(harness, budget.setup, budget.operation);
+  if (budget.baseline != nullptr) {
+    auto num_baseline_allocations =
+        count_loop_allocations(harness, budget.setup, budget.baseline);
+    num_allocations = num_allocations > num_baseline_allocations
+                          ? num_allocations - num_baseline_allocations
+                          : 0;
+  }
+
+  auto allocations_per_operation =
+      static_cast<double>(num_allocations) / num_iterations;
+  auto was_successful =
+      num_allocations <= static_cast<uint64_t>(budget.max_allocations) *
+                                 num_iterations +
+                             num_one_off_allocations;
+  std::printf("%-6s %-28s %6.2f allocs/op (budget %d)\n",
+              was_successful ? "OK" : "FAILED", budget.name,
+              allocations_per_operation, budget.max_allocations);
+  return was_successful;
+}
+
+int main() try {
+  auto was_successful = true;
+  for (auto& budget : allocation_budgets) {
+    was_successful = check_allocation_budget(budget) && was_successful;
+  }
+  return was_successful ? 0 : 1;
+} catch (const std::exception& e) {
+  std::fprintf(stderr, "Error: %s\n", e.what());
+  return 1;
+}
@@ -0,0 +1,214 @@
+// Checks that span records survive encoding and a trip through a span ring,
+// including when records wrap around the end of the ring or don't fit.
+#include "span_record.h"
+#include "span_ring.h"
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <exception>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+
+using lua_bridge_tracer::SpanRecord;
+using lua_bridge_tracer::SpanRing;
+
+static bool was_successful = true;
+
+//------------------------------------------------------------------------------
+// check
+//------------------------------------------------------------------------------
+static void check(bool condition, const char* description) {
+  std::printf("%-6s %s\n", condition ? "OK" : "FAILED", description);
+  was_successful = was_successful && condition;
+}
+
+//------------------------------------------------------------------------------
+// make_ring_path
+//------------------------------------------------------------------------------
+static std::string make_ring_path() {
+  char path[] = "/tmp/span_ring_testXXXXXX";
+  auto file_descriptor = ::mkstemp(path);
+  if (file_descriptor == -1) {
+    throw std::runtime_error{"failed to create a temporary file"};
+  }
+  ::close(file_descriptor);
+  return path;
+}
+
+//------------------------------------------------------------------------------
+// test_encoding
+//------------------------------------------------------------------------------
+static void test_encoding() {
+  SpanRecord record;
+  record.trace_id_high = 1;
+  record.trace_id_low = 2;
+  record.span_id = 3;
+  record.parent_span_id = 4;
+  record.follows_from = true;
+  record.start_timestamp = 1531434895308545;
+  record.duration_ns = 1000;
+  record.operation_name = "abc";
+  record.tags.emplace_back("s", std::string{"xyz"});
+  record.tags.emplace_back("d", 1.5);
+  record.tags.emplace_back("b", true);
+  record.tags.emplace_back("v", opentracing::Values{1.0, std::string{"x"}});
+  std::vector<opentracing::LogRecord> log_records(1);
+  log_records[0].fields.emplace_back("event", std::string{"error"});
+
+  std::string buffer;
+  lua_bridge_tracer::encode_span_record(record, log_records, buffer);
+  SpanRecord decoded;
+  auto was_decoded = lua_bridge_tracer::decode_span_record(
+      buffer.data(), buffer.size(), decoded);
+  check(was_decoded, "records decode");
+  check(decoded.trace_id_high == 1 && decoded.trace_id_low == 2 &&
+            decoded.span_id == 3 && decoded.parent_span_id == 4 &&
+            decoded.follows_from,
+        "ids and references are kept");
+  check(decoded.start_timestamp == record.start_timestamp &&
+            decoded.duration_ns == 1000 && decoded.operation_name == "abc",
+        "timestamps and operation names are kept");
+  check(decoded.tags.size() == 4 && decoded.tags[0].second.is<std::string>() &&
+            decoded.tags[0].second.get<std::string>() == "xyz" &&
+            decoded.tags[1].second.is<double>() &&
+            decoded.tags[2].second.is<bool>() &&
+            decoded.tags[3].second.is<opentracing::Values>() &&
+            decoded.tags[3].second.get<opentracing::Values>().size() == 2,
+        "tags are kept");
+  check(decoded.logs.size() == 1 && decoded.logs[0].fields.size() == 1 &&
+            decoded.logs[0].fields[0].first == "event",
+        "logs are kept");
+
+  SpanRecord truncated;
+  check(!lua_bridge_tracer::decode_span_record(buffer.data(),
+                                               buffer.size() - 1, truncated),
+        "truncated records are rejected");
+
+  // More tags than are stored inline.
+  SpanRecord many_tags;
+  for (int i = 0; i < 20; ++i) {
+    many_tags.tags.emplace_back("tag" + std::to_string(i),
+                                static_cast<int64_t>(i));
+  }
+  buffer.clear();
+  lua_bridge_tracer::encode_span_record(many_tags, {}, buffer);
+  decoded = SpanRecord{};
+  was_decoded = lua_bridge_tracer::decode_span_record(buffer.data(),
+                                                      buffer.size(), decoded);
+  check(was_decoded && decoded.tags.size() == 20 &&
+            decoded.tags[19].first == "tag19" &&
+            decoded.tags[19].second.get<int64_t>() == 19,
+        "tags past the inline capacity are kept");
+}
+
+//------------------------------------------------------------------------------
+// test_ring
+//------------------------------------------------------------------------------
+static void test_ring() {
+  auto path = make_ring_path();
+  ::unlink(path.c_str());
+  auto writer = SpanRing::open(path, 4096);
+  auto reader = SpanRing::open(path, 0);
+  check(reader->capacity() == 4096, "rings are shared through their file");
+
+  // Write enough records to wrap around the ring several times.
+  auto in_order = true;
+  std::string record;
+  for (int i = 0; i < 1000; ++i) {
+    std::string data(static_cast<size_t>(1 + i % 300), static_cast<char>(i));
+    if (!writer->write(data.data(), data.size()) || !reader->read(record) ||
+        record != data) {
+      in_order = false;
+    }
+  }
+  check(in_order, "records are read in the order they're written");
+  check(!reader->read(record), "reading an empty ring returns nothing");
+  ::unlink(path.c_str());
+
+  // A record that ends 8 bytes before the end of the data area leaves a tail
+  // too short for a record header.
+  writer = SpanRing::open(path, 4096);
+  reader = SpanRing::open(path, 0);
+  std::string long_data(4096 - 16 - 8, 'a');
+  std::string short_data(16, 'b');
+  check(writer->write(long_data.data(), long_data.size()) &&
+            reader->read(record) && record == long_data &&
+            writer->write(short_data.data(), short_data.size()) &&
+            reader->read(record) && record == short_data &&
+            writer->write(long_data.data(), 1000) && reader->read(record) &&
+            record == long_data.substr(0, 1000) && !reader->read(record),
+        "records are read past a tail shorter than a record header");
+
+  std::string data(1000, 'x');
+  auto num_written = 0;
+  while (writer->write(data.data(), data.size())) {
+    ++num_written;
+  }
+  // Depending on where the ring's left off, padding may take up the space
+  // of one of the records.
+  check((num_written == 3 || num_written == 4) && writer->num_dropped() == 1,
+        "records that don't fit are dropped and counted");
+  check(reader->read(record) && record == data &&
+            writer->write(data.data(), data.size()),
+        "reading frees space for writers");
+  ::unlink(path.c_str());
+
+  std::ofstream{path} << "not a ring, but longer than a header would be "
+                      << std::string(300, ' ');
+  auto was_rejected = false;
+  try {
+    SpanRing::open(path, 0);
+  } catch (const std::exception&) {
+    was_rejected = true;
+  }
+  check(was_rejected, "files that aren't rings are rejected");
+  ::unlink(path.c_str());
+}
+
+//------------------------------------------------------------------------------
+// test_abandoned_records
+//------------------------------------------------------------------------------
+static void test_abandoned_records() {
+  auto path = make_ring_path();
+  ::unlink(path.c_str());
+  auto writer = SpanRing::open(path, 4096);
+  auto reader = SpanRing::open(path, 0);
+  std::string data(100, 'x');
+  std::string record;
+
+  // A writer that's still running is waited on until the stall timeout.
+  check(writer->reserve(data.size()) != nullptr &&
+            writer->write(data.data(), data.size()) && !reader->read(record),
+        "uncommitted records are waited on");
+  reader->set_stall_timeout(std::chrono::milliseconds{0});
+  check(reader->read(record) && record == data && reader->num_skipped() == 1,
+        "records left uncommitted past the stall timeout are skipped");
+  reader->set_stall_timeout(std::chrono::milliseconds{10000});
+
+  // A writer that's gone is skipped right away.
+  auto pid = ::fork();
+  if (pid == 0) {
+    SpanRing::open(path, 0)->reserve(data.size());
+    ::_exit(0);
+  }
+  auto status = 0;
+  ::waitpid(pid, &status, 0);
+  check(writer->write(data.data(), data.size()) && reader->read(record) &&
+            record == data && reader->num_skipped() == 2,
+        "records reserved by writers that have exited are skipped");
+  ::unlink(path.c_str());
+}
+
+int main() try {
+  test_encoding();
+  test_ring();
+  test_abandoned_records();
+  return was_successful ? 0 : 1;
+} catch (const std::exception& e) {
+  std::fprintf(stderr, "Error: %s\n", e.what());
+  return 1;
+}
@@ -118,6 +118,583 @@ describe("in bridge_tracer", function()
       local references = json[1]["references"]
 			assert.are.equal(#references, 0)
     end);
+
+    it("supports aggregating sibling spans", function()
+      local json_file = os.tmpname()
+      local tracer = new_mocktracer(json_file)
+      local parent = tracer:start_span("parent")
+      local context = parent:context()
+      for i=1,3 do
+        local span = tracer:start_span("get",
+                  {["references"] = {{"child_of", context}}, ["aggregate"] = true})
+        span:set_tag("key", "abc")
+        span:finish()
+      end
+      parent:finish()
+      tracer:close()
+			local json = read_json(json_file)
+			assert.are.equal(#json, 2)
+      assert.are.equal(json[1]["operation_name"], "get")
+      assert.are.equal(json[1]["tags"]["aggregate.count"], 3)
+      assert.are.equal(json[1]["tags"]["key"], "abc")
+      assert.are.equal(#json[1]["references"], 1)
+    end)
+
+    it("rejects children of aggregated spans", function()
+      local json_file = os.tmpname()
+      local tracer = new_mocktracer(json_file)
+      local parent = tracer:start_span("parent")
+      local span = tracer:start_span("get",
+                {["references"] = {{"child_of", parent:context()}},
+                 ["aggregate"] = true})
+      assert.has_error(function()
+        tracer:start_span("child",
+                {["references"] = {{"child_of", span:context()}}})
+      end)
+      span:finish()
+      parent:finish()
+
+      -- Aggregated spans that start after their parent finishes are emitted
+      -- on their own.
+      tracer:start_span("late",
+                {["references"] = {{"child_of", parent:context()}},
+                 ["aggregate"] = true}):finish()
+      tracer:close()
+      local json = read_json(json_file)
+      assert.are.equal(#json, 3)
+      assert.are.equal(json[3]["operation_name"], "late")
+      assert.are.equal(json[3]["tags"]["aggregate.count"], 1)
+    end)
+
+    it("supports filtering spans by duration", function()
+      local json_file = os.tmpname()
+      local tracer = new_mocktracer(json_file)
+      tracer:set_span_filter("fast", 1000)
+      local parent = tracer:start_span("parent")
+      local context = parent:context()
+      local span1 = tracer:start_span("fast",
+                  {["references"] = {{"child_of", context}}})
+      span1:finish()
+      local span2 = tracer:start_span("fast",
+                  {["references"] = {{"child_of", context}},
+                   ["start_time"] = 1531434895308545})
+      span2:finish(1531434896813719)
+      parent:finish()
+      tracer:close()
+			local json = read_json(json_file)
+			assert.are.equal(#json, 2)
+      assert.are.equal(json[1]["operation_name"], "fast")
+      assert.are.equal(json[2]["operation_name"], "parent")
+      assert.are.equal(json[2]["tags"]["filtered.count"], 1)
+    end)
+
+    it("rejects span filter durations out of range", function()
+      local tracer = bridge_tracer:new({})
+      assert.has_error(function() tracer:set_span_filter("a", -1) end)
+      assert.has_error(function() tracer:set_span_filter("a", 0 / 0) end)
+      assert.has_error(function() tracer:set_span_filter("a", 1e300) end)
+      tracer:set_span_filter("a", 0)
+    end)
+  end)
+
+  describe("active spans", function()
+    it("parent spans started in the same coroutine", function()
+      local records = {}
+      local tracer = bridge_tracer:new({["span_callback"] = function(record)
+        table.insert(records, record)
+      end})
+      assert.are.equal(tracer:active_span(), nil)
+      local parent = tracer:start_active_span("parent")
+      assert.are.equal(tracer:active_span(), parent)
+
+      local child = tracer:start_span("child")
+      local other
+      local co = coroutine.create(function()
+        assert.are.equal(tracer:active_span(), nil)
+        other = tracer:start_span("other")
+        other:finish()
+      end)
+      assert.is_true(coroutine.resume(co))
+      local root = tracer:start_span("root", {["ignore_active_span"] = true})
+      root:finish()
+      child:finish()
+      parent:finish()
+      assert.are.equal(tracer:active_span(), nil)
+
+      assert.are.equal(#records, 4)
+      local parent_record = records[4]
+      assert.are.equal(records[1].operation_name, "other")
+      assert.are.equal(records[1].parent_span_id, nil)
+      assert.are.equal(records[2].operation_name, "root")
+      assert.are.equal(records[2].parent_span_id, nil)
+      assert.are.equal(records[3].operation_name, "child")
+      assert.are.equal(records[3].parent_span_id, parent_record.span_id)
+    end)
+
+    it("skips spans finished out of order", function()
+      local tracer = bridge_tracer:new({})
+      local outer = tracer:start_active_span("outer")
+      local inner = tracer:start_active_span("inner")
+      outer:finish()
+      assert.are.equal(tracer:active_span(), inner)
+      inner:finish()
+      assert.are.equal(tracer:active_span(), nil)
+    end)
+  end)
+
+  describe("the cost option", function()
+    it("tags spans with their cost less their children's", function()
+      local records = {}
+      local tracer = bridge_tracer:new({["span_callback"] = function(record)
+        table.insert(records, record)
+      end})
+      local parent = tracer:start_span("parent", {["cost"] = true})
+      local child = tracer:start_span("child",
+                  {["references"] = {{"child_of", parent:context()}},
+                   ["cost"] = true})
+      local t = {}
+      for i=1,10000 do
+        t[i] = {i}
+      end
+      child:finish()
+      parent:finish()
+
+      assert.are.equal(#records, 2)
+      local child_tags = records[1].tags
+      local parent_tags = records[2].tags
+      assert.is_true(child_tags["cost.heap_delta_bytes"] > 0)
+      assert.are.equal(child_tags["cost.self_cpu_ns"],
+                       child_tags["cost.cpu_ns"])
+      assert.are.equal(parent_tags["cost.self_cpu_ns"],
+                       parent_tags["cost.cpu_ns"] - child_tags["cost.cpu_ns"])
+      assert.are.equal(parent_tags["cost.self_heap_delta_bytes"],
+                       parent_tags["cost.heap_delta_bytes"] -
+                       child_tags["cost.heap_delta_bytes"])
+    end)
+
+    it("isn't measured by default", function()
+      local records = {}
+      local tracer = bridge_tracer:new({["span_callback"] = function(record)
+        table.insert(records, record)
+      end})
+      tracer:start_span("abc"):finish()
+      assert.are.equal(records[1].tags["cost.cpu_ns"], nil)
+    end)
+  end)
+
+  describe("the profiler", function()
+    it("attributes samples to the innermost span", function()
+      local records = {}
+      local tracer = bridge_tracer:new({["span_callback"] = function(record)
+        table.insert(records, record)
+      end})
+      -- Compiled code doesn't run hooks.
+      if jit then jit.off() end
+      tracer:set_profiling({["instructions"] = 100})
+      local function spin()
+        local x = 0
+        for i=1,100000 do
+          x = x + i
+        end
+        return x
+      end
+      local span = tracer:start_span("busy")
+      spin()
+      span:finish()
+      local dump = tracer:dump_profile()
+      tracer:set_profiling(false)
+      if jit then jit.on() end
+
+      assert.are.equal(#records, 1)
+      local logs = records[1].logs
+      local fields = logs[#logs].fields
+      assert.are.equal(fields["event"], "profile")
+      assert.truthy(fields["profile.folded_stacks"]:find("spin@", 1, true))
+      assert.truthy(dump:find("busy;", 1, true))
+      assert.are.equal(tracer:dump_profile(), nil)
+      assert.is_true(bridge_tracer.stats().profile_samples > 0)
+    end)
+  end)
+
+  describe("the reconfigure method", function()
+    it("finishes spans in flight on the old tracer", function()
+      local old_records = {}
+      local new_records = {}
+      local tracer = bridge_tracer:new({["span_callback"] = function(record)
+        table.insert(old_records, record)
+      end})
+      local span1 = tracer:start_span("old")
+      tracer:reconfigure({["span_callback"] = function(record)
+        table.insert(new_records, record)
+      end})
+      local span2 = tracer:start_span("new")
+      span1:finish()
+      span2:finish()
+
+      assert.are.equal(tracer:reconfigure_status().generation, 2)
+      assert.are.equal(#old_records, 1)
+      assert.are.equal(old_records[1].operation_name, "old")
+      assert.are.equal(#new_records, 1)
+      assert.are.equal(new_records[1].operation_name, "new")
+    end)
+
+    it("reloads a plugin in the background", function()
+      local json_file = os.tmpname()
+      local tracer = new_mocktracer(os.tmpname())
+      tracer:reconfigure('{ "output_file":"' .. json_file .. '" }')
+      local deadline = os.clock() + 10
+      while tracer:reconfigure_status().pending and os.clock() < deadline do
+      end
+      local status = tracer:reconfigure_status()
+      assert.are.equal(status.error, nil)
+      assert.are.equal(status.generation, 2)
+
+      tracer:start_span("abc"):finish()
+      tracer:close()
+      local json = read_json(json_file)
+      assert.are.equal(#json, 1)
+      assert.are.equal(json[1]["operation_name"], "abc")
+    end)
+
+    it("can't reload a tracer that wasn't loaded from a plugin", function()
+      local tracer = bridge_tracer:new({})
+      assert.has_error(function() tracer:reconfigure("{}") end)
+    end)
+  end)
+
+  describe("the native tracer", function()
+    it("passes finished spans to a callback", function()
+      local records = {}
+      local tracer = bridge_tracer:new({["span_callback"] = function(record)
+        table.insert(records, record)
+      end})
+      local parent = tracer:start_span("parent")
+      local span = tracer:start_span("child",
+                  {["references"] = {{"child_of", parent:context()}}})
+      span:set_tag("key", "value")
+      span:log_kv({["event"] = "abc"})
+      span:finish()
+      parent:finish()
+      tracer:close()
+
+      assert.are.equal(#records, 2)
+      assert.are.equal(records[1].operation_name, "child")
+      assert.are.equal(records[1].tags["key"], "value")
+      assert.are.equal(records[1].logs[1].fields["event"], "abc")
+      assert.are.equal(records[1].reference_type, "child_of")
+      assert.are.equal(records[1].parent_span_id, records[2].span_id)
+      assert.are.equal(records[1].trace_id, records[2].trace_id)
+      assert.are.equal(#records[2].trace_id, 32)
+      assert.are.equal(records[2].parent_span_id, nil)
+    end)
+
+    it("writes spans to a file", function()
+      local path = os.tmpname()
+      local tracer = bridge_tracer:new({["span_file"] = path})
+      tracer:start_span("abc"):finish()
+      tracer:close()
+
+      local file = io.open(path)
+      local line = file:read("*l")
+      file:close()
+      os.remove(path)
+      assert.truthy(line:find('"operation_name":"abc"', 1, true))
+    end)
+
+    it("flushes and closes in the background", function()
+      local path = os.tmpname()
+      local tracer = bridge_tracer:new({["span_file"] = path})
+      for i=1,3 do
+        tracer:start_span("abc"):finish()
+      end
+      local drain = tracer:flush(1000)
+      assert.is_true(drain:wait())
+      assert.is_true(drain:done())
+      assert.are.equal(drain:result().spans_flushed, 3)
+      assert.are.equal(drain:result().spans_dropped, 0)
+
+      tracer:start_span("abc"):finish()
+      drain = tracer:close_async()
+      assert.is_true(drain:wait())
+      assert.are.equal(drain:result().spans_flushed, 1)
+
+      local num_lines = 0
+      for _ in io.lines(path) do
+        num_lines = num_lines + 1
+      end
+      os.remove(path)
+      assert.are.equal(num_lines, 4)
+    end)
+
+    it("leaves a plugin's drain counts unknown", function()
+      local json_file = os.tmpname()
+      local tracer = new_mocktracer(json_file)
+      tracer:start_span("abc"):finish()
+      local drain = tracer:close_async()
+      assert.is_true(drain:wait())
+      assert.is_nil(drain:result().spans_flushed)
+      assert.is_nil(drain:result().spans_dropped)
+      os.remove(json_file)
+    end)
+
+    it("rejects drain timeouts out of range", function()
+      local tracer = bridge_tracer:new({})
+      assert.has_error(function() tracer:flush(0 / 0) end)
+      assert.has_error(function() tracer:flush(2 ^ 63) end)
+      local drain = tracer:close_async(-1)
+      assert.is_true(drain:wait())
+      assert.has_error(function() drain:wait(0 / 0) end)
+      assert.has_error(function() drain:wait(1e300) end)
+      assert.is_true(drain:wait(-1))
+    end)
+
+    it("sets integer tags exactly", function()
+      local records = {}
+      local tracer = bridge_tracer:new({["span_callback"] = function(record)
+        table.insert(records, record)
+      end})
+      local span = tracer:start_span("abc")
+      span:set_tag("status", 200)
+      span:set_tag_int("i", -5)
+      span:set_tag_uint("u", 7)
+      assert.has_error(function() span:set_tag_int("x", 1.5) end)
+      assert.has_error(function() span:set_tag_uint("x", -1.0) end)
+      if math.type ~= nil then
+        span:set_tag_int("id", math.maxinteger)
+      end
+      span:finish()
+      tracer:close()
+
+      local tags = records[1].tags
+      assert.are.equal(tags["status"], 200)
+      assert.are.equal(tags["i"], -5)
+      assert.are.equal(tags["u"], 7)
+      assert.are.equal(tags["x"], nil)
+      if math.type ~= nil then
+        assert.are.equal(math.type(tags["status"]), "integer")
+        assert.are.equal(tags["id"], math.maxinteger)
+      end
+    end)
+
+    it("streams the logs of long-lived spans", function()
+      local records = {}
+      local tracer = bridge_tracer:new({["span_callback"] = function(record)
+        table.insert(records, record)
+      end})
+      tracer:set_log_streaming({max_records = 2})
+      local before = bridge_tracer.stats()
+      local span = tracer:start_span("connection")
+      for i=1,5 do
+        span:log_kv({["message"] = i})
+      end
+      span:finish()
+      tracer:close()
+
+      local after = bridge_tracer.stats()
+      assert.are.equal(
+          after.log_records_streamed - before.log_records_streamed, 4)
+      assert.are.equal(#records, 3)
+      assert.are.equal(records[1].operation_name, "log_stream")
+      assert.are.equal(records[1].parent_span_id, records[3].span_id)
+      assert.are.equal(#records[1].logs, 2)
+      assert.are.equal(records[2].logs[1].fields["message"], 3)
+      assert.are.equal(records[3].operation_name, "connection")
+      assert.are.equal(#records[3].logs, 1)
+      assert.are.equal(records[3].logs[1].fields["message"], 5)
+      assert.are.equal(records[3].tags["bridge.log_streams"], 2)
+    end)
+
+    it("rejects log streaming ages out of range", function()
+      local tracer = bridge_tracer:new({})
+      for _, max_age in ipairs({-1, 0 / 0, 2 ^ 63}) do
+        assert.has_error(function()
+          tracer:set_log_streaming({max_age_us = max_age})
+        end)
+      end
+    end)
+
+    it("sheds root spans while the tracer is behind", function()
+      local records = {}
+      local tracer = bridge_tracer:new({["span_callback"] = function(record)
+        table.insert(records, record)
+      end})
+      tracer:set_load_shedding({max_open_spans = 2, probe_interval = 1000})
+      local before = bridge_tracer.stats()
+      local open = {}
+      for i=1,3 do
+        table.insert(open, tracer:start_span("open"))
+      end
+      local shed = tracer:start_span("shed")
+      local child = tracer:start_span("child",
+                  {["references"] = {{"child_of", shed:context()}}})
+      local carrier = {}
+      tracer:text_map_inject(shed:context(), carrier)
+      assert.are.same(carrier, {})
+      child:finish()
+      shed:finish()
+      local traced = tracer:start_span("traced",
+                  {["references"] = {{"child_of", open[1]:context()}}})
+      traced:finish()
+      local after = bridge_tracer.stats()
+      assert.are.equal(after.spans_shed - before.spans_shed, 2)
+      assert.are.equal(
+          after.load_shedding_episodes - before.load_shedding_episodes, 1)
+
+      for _, span in ipairs(open) do
+        span:finish()
+      end
+      tracer:start_span("recovered"):finish()
+      tracer:close()
+      assert.are.equal(#records, 5)
+      assert.are.equal(records[1].operation_name, "traced")
+      assert.are.equal(records[5].operation_name, "recovered")
+    end)
+
+    it("rejects load shedding options out of range", function()
+      local tracer = bridge_tracer:new({})
+      for _, value in ipairs({-1, 0 / 0, 2 ^ 64}) do
+        assert.has_error(function()
+          tracer:set_load_shedding({max_finish_latency_us = value})
+        end)
+        assert.has_error(function()
+          tracer:set_load_shedding({probe_interval = value})
+        end)
+      end
+      assert.has_error(function()
+        tracer:set_load_shedding({max_finish_latency_us = 2 ^ 63})
+      end)
+    end)
+
+    it("exports spans to a span ring and propagates contexts", function()
+      local tracer = bridge_tracer:new({["span_ring"] = os.tmpname()})
+      local parent = tracer:start_span("parent")
+      parent:set_baggage_item("abc", "123")
+      local span = tracer:start_span("child",
+                  {["references"] = {{"child_of", parent:context()}}})
+      span:set_tag("key", "value")
+      span:log_kv({["event"] = "abc"})
+
+      local carrier1 = {}
+      tracer:http_headers_inject(span:context(), carrier1)
+      assert.are_not_equals(carrier1["traceparent"], nil)
+      assert.are.equal(carrier1["ot-baggage-abc"], "123")
+      local context1 = tracer:http_headers_extract(carrier1)
+      assert.are_not_equals(context1, nil)
+
+      local carrier2 = tracer:binary_inject(span:context())
+      local context2 = tracer:binary_extract(carrier2)
+      assert.are_not_equals(context2, nil)
+
+      span:finish()
+      parent:finish()
+      tracer:close()
+    end)
+  end)
+
+  describe("the ffi wrapper", function()
+    -- Outside of LuaJIT this is the module itself.
+    local ffi_bridge_tracer = require 'opentracing_bridge_tracer_ffi'
+
+    it("implements the same span operations", function()
+      local records = {}
+      local tracer = ffi_bridge_tracer:new({["span_callback"] = function(record)
+        table.insert(records, record)
+      end})
+      local parent = tracer:start_span("parent", {["tags"] = {["a"] = 1}})
+      parent:set_baggage_item("abc", "123")
+      assert.are.equal(parent:get_baggage_item("abc"), "123")
+      assert.are.equal(parent:tracer(), tracer)
+      local span = tracer:start_span("child",
+                  {["references"] = {{"follows_from", parent:context()}}})
+      span:set_operation_name("renamed")
+      span:set_tag("s", "value")
+      span:set_tag("n", 2)
+      span:set_tag("b", true)
+      span:log_kv({["event"] = "abc", ["count"] = 3})
+
+      local carrier = {}
+      tracer:text_map_inject(span:context(), carrier)
+      local context = tracer:text_map_extract(carrier)
+      assert.are_not_equals(context, nil)
+      local binary_context =
+          tracer:binary_extract(tracer:binary_inject(span:context()))
+      assert.are_not_equals(binary_context, nil)
+      local aggregated = tracer:start_span("aggregated",
+                  {["references"] = {{"child_of", parent:context()}},
+                   ["aggregate"] = true})
+      aggregated:finish()
+
+      span:finish()
+      parent:finish()
+      tracer:close()
+
+      local by_name = {}
+      for _, record in ipairs(records) do
+        by_name[record.operation_name] = record
+      end
+      assert.are.equal(#records, 3)
+      assert.are.equal(by_name["renamed"].reference_type, "follows_from")
+      assert.are.equal(by_name["renamed"].tags["s"], "value")
+      assert.are.equal(by_name["renamed"].tags["n"], 2)
+      assert.are.equal(by_name["renamed"].tags["b"], true)
+      assert.are.equal(by_name["renamed"].logs[1].fields["count"], 3)
+      assert.are.equal(by_name["parent"].tags["a"], 1)
+      assert.are.equal(by_name["aggregated"].tags["aggregate.count"], 1)
+    end)
+
+    it("parents spans on the active span of the same tracer", function()
+      local records = {}
+      local callback = function(record)
+        records[record.operation_name] = record
+      end
+      local tracer = ffi_bridge_tracer:new({["span_callback"] = callback})
+      local other = ffi_bridge_tracer:new({["span_callback"] = callback})
+      local active = tracer:start_active_span("active")
+      tracer:start_span("child"):finish()
+      tracer:start_span("ignored", {["ignore_active_span"] = true}):finish()
+      other:start_span("other"):finish()
+      active:finish()
+      assert.are.equal(records["child"].parent_span_id,
+                       records["active"].span_id)
+      assert.are.equal(records["ignored"].parent_span_id, nil)
+      assert.are.equal(records["other"].parent_span_id, nil)
+    end)
+
+    it("sets tags from a template", function()
+      local records = {}
+      local tracer = ffi_bridge_tracer:new({["span_callback"] = function(record)
+        table.insert(records, record)
+      end})
+      local template = tracer:tag_template({"s", "i", "b", ["c"] = "abc"})
+      local span = tracer:start_span("abc")
+      span:set_tags_with(template, "xyz", 123)
+      assert.has_error(function() span:set_tags_with(template, 1, 2, 3, 4) end)
+      span:finish()
+      tracer:close()
+      assert.are.equal(records[1].tags["c"], "abc")
+      assert.are.equal(records[1].tags["s"], "xyz")
+      assert.are.equal(records[1].tags["i"], 123)
+      assert.are.equal(records[1].tags["b"], nil)
+    end)
+
+    it("only imports contexts handed out by the C API", function()
+      local tracer = bridge_tracer:new({})
+      assert.has_error(function() tracer:import_c_span_context(12345) end)
+      assert.has_error(function() tracer:import_c_span_context(-1) end)
+    end)
+
+    it("frees C API handles with their userdata", function()
+      local tracer = bridge_tracer:new({})
+      collectgarbage()
+      local before = bridge_tracer.stats()
+      local c_tracer = tracer:c_tracer()
+      assert.are.equal(type(c_tracer), "userdata")
+      assert.are.equal(bridge_tracer.stats().live_tracers - before.live_tracers,
+                       1)
+      c_tracer = nil
+      collectgarbage()
+      assert.are.equal(bridge_tracer.stats().live_tracers, before.live_tracers)
+    end)
   end)
 
   describe("a tracer", function()
@@ -136,6 +713,66 @@ describe("in bridge_tracer", function()
       local context3 = tracer:binary_extract("")
       assert.are.equal(context3, nil)
     end)
+
+    it("starts and finishes spans in batches", function()
+      local json_file = os.tmpname()
+      local tracer = new_mocktracer(json_file)
+      local parent = tracer:start_span("parent")
+      local spans = tracer:start_spans(
+          {"a", {["operation_name"] = "b", ["tags"] = {["extra"] = 1}}},
+          {["references"] = {{"child_of", parent:context()}},
+           ["tags"] = {["shared"] = "abc"}})
+      assert.are.equal(#spans, 2)
+      tracer:finish_spans(spans)
+      local children = tracer:start_spans({"c"}, parent:context())
+      tracer:finish_spans(children, {(os.time() + 1) * 1000000})
+      parent:finish()
+      tracer:close()
+
+      local json = read_json(json_file)
+      assert.are.equal(#json, 4)
+      assert.are.equal(json[1]["operation_name"], "a")
+      assert.are.equal(json[1]["tags"]["shared"], "abc")
+      assert.are.equal(json[1]["tags"]["extra"], nil)
+      assert.are.equal(#json[1]["references"], 1)
+      assert.are.equal(json[2]["operation_name"], "b")
+      assert.are.equal(json[2]["tags"]["shared"], "abc")
+      assert.are.equal(json[2]["tags"]["extra"], 1)
+      assert.are.equal(json[3]["operation_name"], "c")
+      assert.are.equal(#json[3]["references"], 1)
+    end)
+
+    it("extracts from a batch of carriers", function()
+      local json_file = os.tmpname()
+      local tracer = new_mocktracer(json_file)
+      local span = tracer:start_span("abc")
+      span:finish()
+
+      -- text map
+      local carrier1 = {}
+      tracer:text_map_inject(span:context(), carrier1)
+      local contexts1, errors1 =
+          tracer:text_map_extract_many({carrier1, {}, carrier1})
+      assert.are_not_equals(contexts1[1], nil)
+      assert.are.equal(contexts1[2], nil)
+      assert.are_not_equals(contexts1[3], nil)
+      assert.are.equal(errors1, nil)
+
+      -- http headers
+      local carrier2 = {}
+      tracer:http_headers_inject(span:context(), carrier2)
+      local contexts2, errors2 =
+          tracer:http_headers_extract_many({carrier2, "abc"})
+      assert.are_not_equals(contexts2[1], nil)
+      assert.are.equal(contexts2[2], nil)
+      assert.are_not_equals(errors2[2], nil)
+
+      -- binary
+      local carrier3 = tracer:binary_inject(span:context())
+      local contexts3 = tracer:binary_extract_many({"", carrier3})
+      assert.are.equal(contexts3[1], nil)
+      assert.are_not_equals(contexts3[2], nil)
+    end)
   end)
 
   describe("a span", function()
@@ -219,6 +856,30 @@ describe("in bridge_tracer", function()
 			assert.are.equal(json[1]["tags"]["i"], 123)
     end)
 
+    it("supports attaching tags from a template", function()
+      local json_file = os.tmpname()
+      local tracer = new_mocktracer(json_file)
+      local template = tracer:tag_template({"s", "i", "b", ["c"] = "abc"})
+      local span = tracer:start_span("abc")
+      span:set_tags_with(template, "xyz", 123)
+      span:finish()
+      tracer:start_span("xyz", {["tag_template"] = template,
+                                ["tag_values"] = {"xyz", 7, true}}):finish()
+      assert.has_error(function()
+        tracer:start_span("abc"):set_tags_with(template, 1, 2, 3, 4)
+      end)
+      tracer:close()
+      local json = read_json(json_file)
+      assert.are.equal(#json, 2)
+      assert.are.equal(json[1]["tags"]["c"], "abc")
+      assert.are.equal(json[1]["tags"]["s"], "xyz")
+      assert.are.equal(json[1]["tags"]["i"], 123)
+      assert.are.equal(json[1]["tags"]["b"], nil)
+      assert.are.equal(json[2]["tags"]["c"], "abc")
+      assert.are.equal(json[2]["tags"]["i"], 7)
+      assert.are.equal(json[2]["tags"]["b"], true)
+    end)
+
     it("supports logging", function()
       local json_file = os.tmpname()
       local tracer = new_mocktracer(json_file)
@@ -236,6 +897,153 @@ describe("in bridge_tracer", function()
       assert.are.equal(records[1]["value"], 123)
     end)
 
+    it("doesn't share log records between spans", function()
+      local json_file = os.tmpname()
+      local tracer = new_mocktracer(json_file)
+      local span1 = tracer:start_span("abc")
+      span1:log_kv({["x"] = 1})
+      span1:log_kv({["x"] = 2})
+      span1:finish()
+      local span2 = tracer:start_span("xyz")
+      span2:log_kv({["y"] = 3})
+      span2:finish()
+      tracer:close()
+			local json = read_json(json_file)
+			assert.are.equal(#json, 2)
+      assert.are.equal(#json[1]["logs"], 2)
+      assert.are.equal(#json[2]["logs"], 1)
+      assert.are.equal(json[2]["logs"][1]["fields"][1]["key"], "y")
+    end)
+
+    it("converts tables with non-sequence keys to dictionaries", function()
+      local records = {}
+      local tracer = bridge_tracer:new({["span_callback"] = function(record)
+        table.insert(records, record)
+      end})
+      -- Built key by key so that every key is in the table's hash part, in no
+      -- particular traversal order.
+      local value = {}
+      value["x"] = "y"
+      for i=1,8 do
+        value[i] = i
+      end
+      value["z"] = "w"
+      local span = tracer:start_span("abc")
+      span:set_tag("t", value)
+      span:set_tag("a", {1, 2, 3})
+      span:finish()
+      tracer:close()
+      local tags = records[1].tags
+      assert.are.equal(tags["t"]["x"], "y")
+      assert.are.equal(tags["t"]["z"], "w")
+      assert.are.same(tags["a"], {1, 2, 3})
+    end)
+
+    it("supports logging nested and self-referencing tables", function()
+      local json_file = os.tmpname()
+      local tracer = new_mocktracer(json_file)
+      local span = tracer:start_span("abc")
+      local fields = {["list"] = {1, 2, 3}, ["nested"] = {["x"] = 123}}
+      fields["self"] = fields
+      fields["nested"]["parent"] = fields
+      span:log_kv(fields)
+      span:finish()
+      tracer:close()
+			local json = read_json(json_file)
+			assert.are.equal(#json, 1)
+      local records = json[1]["logs"][1]["fields"]
+      assert.are.equal(#records, 2)
+      for _, record in ipairs(records) do
+        if record["key"] == "list" then
+          assert.are.same(record["value"], {1, 2, 3})
+        else
+          assert.are.equal(record["key"], "nested")
+          assert.are.same(record["value"], {["x"] = 123})
+        end
+      end
+			assert.are.equal(json[1]["tags"]["bridge.dropped"], 2)
+    end)
+
+    it("enforces the tracer's limits on tags and logs", function()
+      local json_file = os.tmpname()
+      local tracer = new_mocktracer(json_file)
+      tracer:set_limits({["max_string_length"] = 3, ["max_log_records"] = 1})
+      local span = tracer:start_span("abc")
+      span:set_tag("s", "abcdef")
+      span:log_kv({["x"] = 1})
+      span:log_kv({["x"] = 2})
+      span:finish()
+      tracer:close()
+			local json = read_json(json_file)
+			assert.are.equal(#json, 1)
+			assert.are.equal(json[1]["tags"]["s"], "abc")
+			assert.are.equal(json[1]["tags"]["bridge.truncated"], true)
+			assert.are.equal(json[1]["tags"]["bridge.dropped"], 1)
+      assert.are.equal(#json[1]["logs"], 1)
+    end)
+
+    it("cuts long array tags to the table size limit", function()
+      local json_file = os.tmpname()
+      local tracer = new_mocktracer(json_file)
+      tracer:set_limits({["max_table_size"] = 2})
+      local values = {}
+      for i=1,1000 do
+        values[i] = i
+      end
+      local span = tracer:start_span("abc")
+      span:set_tag("a", values)
+      span:finish()
+      tracer:close()
+      local json = read_json(json_file)
+      assert.are.equal(#json[1]["tags"]["a"], 2)
+      assert.are.equal(json[1]["tags"]["a"][2], 2)
+      assert.are.equal(json[1]["tags"]["bridge.dropped"], 1)
+    end)
+
+    it("rejects limits out of range", function()
+      local tracer = bridge_tracer:new({})
+      assert.has_error(function() tracer:set_limits({["max_bytes"] = -1}) end)
+      assert.has_error(function() tracer:set_limits({["max_bytes"] = 0 / 0}) end)
+      assert.has_error(function()
+        tracer:set_limits({["max_bytes"] = 2 ^ 64})
+      end)
+      tracer:set_limits({["max_bytes"] = 2 ^ 63})
+    end)
+
+    it("rejects span tracking ages out of range", function()
+      local tracer = bridge_tracer:new({})
+      for _, max_age in ipairs({-1, 0 / 0, 2 ^ 63}) do
+        assert.has_error(function()
+          tracer:set_span_tracking({["max_age_us"] = max_age})
+        end)
+      end
+    end)
+
+    it("can be tracked and expired while in flight", function()
+      local json_file = os.tmpname()
+      local tracer = new_mocktracer(json_file)
+      tracer:set_span_tracking({["max_age_us"] = 1000})
+      local leaked = tracer:start_span("leaked")
+      leaked:set_tag("x", 1)
+      local spans = tracer:in_flight_spans(5)
+      assert.are.equal(#spans, 1)
+      assert.are.equal(spans[1]["operation_name"], "leaked")
+      assert.are.equal(spans[1]["num_tags"], 1)
+
+      local start = os.clock()
+      while os.clock() - start < 0.01 do end
+      local span = tracer:start_span("abc")
+      span:finish()
+      leaked:finish()
+      assert.are.equal(#tracer:in_flight_spans(), 0)
+      tracer:close()
+			local json = read_json(json_file)
+			assert.are.equal(#json, 2)
+      assert.are.equal(json[1]["operation_name"], "leaked")
+			assert.are.equal(json[1]["tags"]["bridge.expired"], true)
+      assert.are.equal(json[2]["operation_name"], "abc")
+    end)
+
     it("supports attaching and querying baggage", function()
       local json_file = os.tmpname()
       local tracer = new_mocktracer(json_file)
@@ -245,4 +1053,37 @@ describe("in bridge_tracer", function()
     end)
 
   end)
+
+  describe("the stats function", function()
+    it("counts spans, log records, and propagation", function()
+      collectgarbage()
+      local before = bridge_tracer.stats()
+      local json_file = os.tmpname()
+      local tracer = new_mocktracer(json_file)
+      local span = tracer:start_span("abc")
+      span:log_kv({["x"] = 123})
+      local during = bridge_tracer.stats()
+      assert.are.equal(during.spans_started - before.spans_started, 1)
+      assert.are.equal(during.live_spans - before.live_spans, 1)
+      assert.are.equal(
+          during.buffered_log_records - before.buffered_log_records, 1)
+      assert.is_true(during.buffered_log_bytes > before.buffered_log_bytes)
+
+      span:finish()
+      local carrier = {}
+      tracer:text_map_inject(span:context(), carrier)
+      tracer:text_map_extract(carrier)
+      tracer:start_span("xyz")
+      collectgarbage()
+      local after = bridge_tracer.stats()
+      assert.are.equal(after.spans_finished - before.spans_finished, 1)
+      assert.are.equal(after.spans_abandoned - before.spans_abandoned, 1)
+      assert.are.equal(after.buffered_log_records, before.buffered_log_records)
+      assert.are.equal(after.buffered_log_bytes, before.buffered_log_bytes)
+      assert.are.equal(
+          after.text_map.injects - before.text_map.injects, 1)
+      assert.are.equal(
+          after.text_map.extracts - before.text_map.extracts, 1)
+    end)
+  end)
 end)
@@ -0,0 +1,75 @@
+// Reads the spans exported to a span ring and prints them as JSON, one span
+// per line. It's a reference for the reader side of the ring and a way to see
+// what the bridge is exporting.
+//
+// Usage: bridge_ring_dump [--follow] <path>
+//
+// Reading consumes the spans, so don't run it alongside the process that
+// forwards them. With --follow it keeps waiting for new spans; otherwise it
+// exits once the ring is empty.
+#include "span_json.h"
+#include "span_record.h"
+#include "span_ring.h"
+
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <exception>
+#include <string>
+#include <thread>
+
+using lua_bridge_tracer::SpanRecord;
+using lua_bridge_tracer::SpanRing;
+
+int main(int argc, char* argv[]) try {
+  auto follow = false;
+  const char* path = nullptr;
+  for (int i = 1; i < argc; ++i) {
+    if (std::strcmp(argv[i], "--follow") == 0) {
+      follow = true;
+    } else if (path == nullptr) {
+      path = argv[i];
+    } else {
+      path = nullptr;
+      break;
+    }
+  }
+  if (path == nullptr) {
+    std::fprintf(stderr, "Usage: %s [--follow] <path>\n", argv[0]);
+    return 1;
+  }
+
+  auto ring = SpanRing::open(path, 0);
+  std::string record;
+  std::string out;
+  uint64_t num_invalid = 0;
+  while (true) {
+    if (!ring->read(record)) {
+      if (!follow) {
+        break;
+      }
+      std::fflush(stdout);
+      std::this_thread::sleep_for(std::chrono::milliseconds{10});
+      continue;
+    }
+    SpanRecord span_record;
+    if (!lua_bridge_tracer::decode_span_record(record.data(), record.size(),
+                                               span_record)) {
+      ++num_invalid;
+      continue;
+    }
+    out.clear();
+    lua_bridge_tracer::write_span_json(span_record, {}, out);
+    out.push_back('\n');
+    std::fwrite(out.data(), 1, out.size(), stdout);
+  }
+  std::fprintf(stderr,
+               "%" PRIu64 " spans dropped by writers, %" PRIu64
+               " abandoned by writers, %" PRIu64 " invalid\n",
+               ring->num_dropped(), ring->num_skipped(), num_invalid);
+  return 0;
+} catch (const std::exception& e) {
+  std::fprintf(stderr, "Error: %s\n", e.what());
+  return 1;
+}